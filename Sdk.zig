@@ -1,7 +1,7 @@
 const std = @import("std");
 const logger = std.log.scoped(.dunstblick_sdk);
 const tvg = @import("vendor/tvg/src/lib/tinyvg.zig");
-const qoi = @import("vendor/qoi/src/qoi.zig");
+const bitmap = @import("src/dunstblick-protocol/bitmap.zig");
 const zigimg = @import("./vendor/zero-graphics/vendor/zigimg/zigimg.zig");
 
 const Pkg = std.build.Pkg;
@@ -40,6 +40,7 @@ pub fn getAppPackage(sdk: *const Sdk, name: []const u8) Pkg {
         .dependencies = &[_]std.build.Pkg{
             pkgs.network,
             pkgs.dunstblick_protocol,
+            pkgs.dunstblick_compiler,
         },
     });
 }
@@ -177,7 +178,7 @@ pub const CompileImageStep = struct {
         var src_image = try zigimg.Image.fromFilePath(allocator, src_path);
         defer src_image.deinit();
 
-        const linear_rgba8 = try allocator.alloc(qoi.Color, src_image.width * src_image.height);
+        const linear_rgba8 = try allocator.alloc(bitmap.Color, src_image.width * src_image.height);
         defer allocator.free(linear_rgba8);
 
         {
@@ -187,7 +188,7 @@ pub const CompileImageStep = struct {
                 std.debug.assert(idx < linear_rgba8.len);
 
                 const rgba8 = pixel.toIntegerColor8();
-                linear_rgba8[idx] = qoi.Color{
+                linear_rgba8[idx] = bitmap.Color{
                     .r = rgba8.R,
                     .g = rgba8.G,
                     .b = rgba8.B,
@@ -197,12 +198,12 @@ pub const CompileImageStep = struct {
             }
         }
 
-        const qoi_data = try qoi.encodeBuffer(allocator, qoi.ConstImage{
-            .colorspace = .sRGB,
+        // Emit restart points so the display client can decode large bitmaps in parallel
+        const qoi_data = try bitmap.encode(allocator, bitmap.ConstImage{
             .width = std.math.cast(u16, src_image.width) orelse return error.ImageTooLarge,
             .height = std.math.cast(u16, src_image.height) orelse return error.ImageTooLarge,
             .pixels = linear_rgba8,
-        });
+        }, .{});
         defer allocator.free(qoi_data);
 
         var cache = CacheBuilder.init(self.sdk.builder, "dunstblick");
@@ -618,6 +619,14 @@ const pkgs = struct {
         },
     };
 
+    const dunstblick_compiler = std.build.Pkg{
+        .name = "dunstblick-compiler",
+        .source = FileSource{ .path = sdkRoot() ++ "/src/dunstblick-compiler/package.zig" },
+        .dependencies = &[_]std.build.Pkg{
+            dunstblick_protocol,
+        },
+    };
+
     const args = std.build.Pkg{
         .name = "args",
         .source = FileSource{ .path = sdkRoot() ++ "/vendor/zig-args/args.zig" },
@@ -65,11 +65,20 @@ const pkgs = struct {
         },
     };
 
+    const dunstblick_compiler = std.build.Pkg{
+        .name = "dunstblick-compiler",
+        .source = .{ .path = "./src/dunstblick-compiler/package.zig" },
+        .dependencies = &[_]std.build.Pkg{
+            dunstblick_protocol,
+        },
+    };
+
     const dunstblick_app = std.build.Pkg{
         .name = "dunstblick-app",
         .source = .{ .path = "./src/dunstblick-app/dunstblick.zig" },
         .dependencies = &[_]std.build.Pkg{
             dunstblick_protocol,
+            dunstblick_compiler,
             network,
         },
     };
@@ -126,6 +135,12 @@ const pkgs = struct {
         .source = .{ .path = "src/dunst-environment/main.zig" },
         .dependencies = &.{known_folders},
     };
+
+    const dunst_rpc_server = std.build.Pkg{
+        .name = "dunst-rpc-server",
+        .source = .{ .path = "src/dunst-rpc-server/main.zig" },
+        .dependencies = &.{network},
+    };
 };
 
 pub fn build(b: *Builder) !void {
@@ -167,6 +182,7 @@ pub fn build(b: *Builder) !void {
     dunstinit.addPackage(pkgs.network);
     dunstinit.addPackage(pkgs.antiphony);
     dunstinit.addPackage(pkgs.dunst_environment);
+    dunstinit.addPackage(pkgs.dunst_rpc_server);
     dunstinit.setTarget(target);
     dunstinit.setBuildMode(mode);
     dunstinit.install();
@@ -220,6 +236,7 @@ pub fn build(b: *Builder) !void {
     dunstfs_daemon.addPackage(pkgs.network);
     dunstfs_daemon.addPackage(pkgs.antiphony);
     dunstfs_daemon.addPackage(pkgs.dunst_environment);
+    dunstfs_daemon.addPackage(pkgs.dunst_rpc_server);
     dunstfs_daemon.addIncludeDir("./vendor/zig-sqlite/c");
     dunstfs_daemon.linkLibrary(libsqlite3);
     dunstfs_daemon.linkLibrary(libpcre2);
@@ -414,7 +431,6 @@ pub fn build(b: *Builder) !void {
     dunstblick_desktop.addPackage(pkgs.network);
     dunstblick_desktop.addPackage(pkgs.tvg);
     dunstblick_desktop.addPackage(pkgs.known_folders);
-    dunstblick_desktop.addPackage(pkgs.qoi);
     dunstblick_desktop.setBuildMode(mode);
 
     const desktop_app = dunstblick_desktop.compileFor(.{ .desktop = target });
@@ -486,7 +502,15 @@ pub fn build(b: *Builder) !void {
         dunstblick_protocol_test.addPackage(pkgs.charm);
     }
 
+    const dunstblick_app_test = b.addTest(pkgs.dunstblick_app.source.path);
+    {
+        for (pkgs.dunstblick_app.dependencies.?) |dep| {
+            dunstblick_app_test.addPackage(dep);
+        }
+    }
+
     const widget_tester = b.addExecutable("widget-tester", "src/test/widget-tester/main.zig");
+    const headless = b.addExecutable("dunstblick-headless", "src/dunstblick-desktop/headless.zig");
     {
         widget_tester.setBuildMode(mode);
         widget_tester.setTarget(.{}); // compile native
@@ -510,15 +534,71 @@ pub fn build(b: *Builder) !void {
             resources.addProperty("input-group");
 
             widget_tester.addPackage(resources.getPackage("app-data"));
+            headless.addPackage(resources.getPackage("app-data"));
         }
     }
 
+    // The headless benchmark is an executable of its own instead of a mode of widget-tester or
+    // dunstblick-desktop: widget-tester only serves its layout and has no renderer, and the window
+    // and GL context of the desktop are created by zero-graphics before our code runs. So it
+    // combines the resources of widget-tester with the user interface code of the desktop.
+    {
+        headless.setBuildMode(mode);
+        headless.setTarget(target);
+        headless.addPackage(pkgs.dunstblick_protocol);
+        headless.addPackage(pkgs.zerog);
+        headless.addPackage(pkgs.tvg);
+        headless.addPackage(pkgs.args);
+        headless.linkLibC();
+        headless.install();
+
+        dunstblick_step.dependOn(&headless.install_step.?.step);
+
+        const headless_run = headless.run();
+        if (b.args) |args| {
+            headless_run.addArgs(args);
+        }
+
+        const bench_ui_step = b.step("bench-ui", "Renders the widget tester without a GPU and reports per-frame timings");
+        bench_ui_step.dependOn(&headless_run.step);
+    }
+
     const widget_doc_render = b.addExecutable("render-widget-docs", "src/tools/render-widget-docs.zig");
     widget_doc_render.addPackage(pkgs.dunstblick_protocol);
     widget_doc_render.setBuildMode(mode);
     widget_doc_render.setTarget(target);
     widget_doc_render.install();
 
+    const bench_qoi = b.addExecutable("bench-qoi", "src/tools/bench-qoi.zig");
+    bench_qoi.addPackage(pkgs.dunstblick_protocol);
+    bench_qoi.addPackage(pkgs.qoi);
+    bench_qoi.setBuildMode(mode);
+    bench_qoi.setTarget(target);
+
+    const bench_qoi_run = bench_qoi.run();
+    if (b.args) |args| {
+        bench_qoi_run.addArgs(args);
+    }
+
+    const bench_qoi_step = b.step("bench-qoi", "Compares the bitmap decoder of the display client against the vendored QOI decoder");
+    bench_qoi_step.dependOn(&bench_qoi_run.step);
+
+    const bench_blake3 = b.addExecutable("bench-blake3", "src/tools/bench-blake3.zig");
+    bench_blake3.addPackage(.{
+        .name = "dunstfs-blake3",
+        .source = .{ .path = "./src/dunstfs/blake3.zig" },
+    });
+    bench_blake3.setBuildMode(mode);
+    bench_blake3.setTarget(target);
+
+    const bench_blake3_run = bench_blake3.run();
+    if (b.args) |args| {
+        bench_blake3_run.addArgs(args);
+    }
+
+    const bench_blake3_step = b.step("bench-blake3", "Compares the streaming and the multi-threaded BLAKE3 hash of dfs-daemon");
+    bench_blake3_step.dependOn(&bench_blake3_run.step);
+
     const install2_step = b.step("build-experimental", "Builds the highly experimental software parts");
     install2_step.dependOn(&dunstnetz_daemon.step);
 
@@ -537,6 +617,7 @@ pub fn build(b: *Builder) !void {
     test_step.dependOn(&dunstnetz_test.step);
     test_step.dependOn(&dunstnetz_daemon_test.step);
     test_step.dependOn(&dunstblick_protocol_test.step);
+    test_step.dependOn(&dunstblick_app_test.step);
 }
 
 const libmagic_sources = [_][]const u8{
@@ -0,0 +1,538 @@
+//! Serves the RPC connections of a Dunstwolke service with a fixed pool of worker threads.
+//!
+//! A dispatcher thread accepts connections and waits for them with a `network.SocketSet`
+//! (epoll on Linux). A connection is queued for a worker only when the client sent a request.
+//! The worker serves the requests that are available and hands the connection back to the
+//! dispatcher as soon as the client has nothing more to say, so workers are only busy while
+//! requests are served and idle connections never occupy a worker.
+//!
+//! The end points read their requests from a `Stream`. While a worker serves a connection,
+//! a read at the start of the next request fails with `error.WouldBlock` if the client didn't
+//! send anything yet. The session returns the error, and the same session continues with the
+//! next request on whichever worker gets the connection next. The start of a request is
+//! detected by the direction of the traffic: the first read after a response was written.
+//! So sessions must never wait for data from the client after they wrote something, except
+//! for the next request. The RPC host end points only ever answer requests, so this holds.
+//!
+//! Connections over `Options.max_connections` are closed right after they were accepted.
+//! Connections that stay silent for `Options.idle_timeout`, either between two requests or
+//! in the middle of one, are closed as well, so stalled or forgotten clients can't keep a
+//! worker or a connection slot forever.
+
+const std = @import("std");
+const builtin = @import("builtin");
+const network = @import("network");
+
+const logger = std.log.scoped(.rpc_server);
+
+pub const Options = struct {
+    /// Number of requests that are served at the same time. Uses the number of CPUs if `null`.
+    worker_count: ?usize = null,
+
+    /// Maximum number of open connections, including idle and queued ones.
+    max_connections: usize = 256,
+
+    /// Time a client may stay silent before its connection is closed. `null` disables the timeout.
+    idle_timeout: ?u64 = 30 * std.time.ns_per_s,
+
+    /// Period in which the metrics are logged. `null` disables the logging.
+    metrics_period: ?u64 = 60 * std.time.ns_per_s,
+};
+
+/// Counters that show how well the workers keep up with the clients.
+pub const Metrics = struct {
+    /// Total number of accepted connections.
+    accepted: u64 = 0,
+    /// Connections closed because `Options.max_connections` was reached.
+    rejected: u64 = 0,
+    /// Connections that were closed by the client or failed while they waited for a request.
+    dropped: u64 = 0,
+    /// Number of times a worker served the pending requests of a connection.
+    served: u64 = 0,
+    /// Connections that were closed after `Options.idle_timeout`.
+    timed_out: u64 = 0,
+
+    /// Connections that wait for their next request.
+    idle: usize = 0,
+    /// Connections with a pending request that wait for a worker.
+    queued: usize = 0,
+    /// Connections that are currently served.
+    active: usize = 0,
+
+    /// Highest number of queued connections.
+    peak_queued: usize = 0,
+    /// Total and longest time a request waited for a worker.
+    total_queue_time: u64 = 0,
+    max_queue_time: u64 = 0,
+
+    pub fn format(metrics: Metrics, comptime fmt: []const u8, options: std.fmt.FormatOptions, writer: anytype) !void {
+        _ = fmt;
+        _ = options;
+        const avg_queue_time = if (metrics.served > 0) metrics.total_queue_time / metrics.served else 0;
+        try writer.print("{} accepted, {} rejected, {} dropped, {} served, {} timed out, {} idle, {} queued (peak {}), {} active, queue time avg {} max {}", .{
+            metrics.accepted,
+            metrics.rejected,
+            metrics.dropped,
+            metrics.served,
+            metrics.timed_out,
+            metrics.idle,
+            metrics.queued,
+            metrics.peak_queued,
+            metrics.active,
+            std.fmt.fmtDuration(avg_queue_time),
+            std.fmt.fmtDuration(metrics.max_queue_time),
+        });
+    }
+};
+
+/// The connection of a session, see the file documentation.
+pub const Stream = struct {
+    socket: network.Socket,
+
+    /// Set by the server while a worker serves the connection. Only then reads may yield.
+    serving: bool = false,
+    /// `true` when the next read starts a new request: at the start of `serve()` and after
+    /// a response was written.
+    at_request: bool = false,
+
+    pub const ReadError = network.Socket.Reader.Error || error{WouldBlock};
+    pub const WriteError = network.Socket.Writer.Error;
+
+    pub const Reader = std.io.Reader(*Stream, ReadError, read);
+    pub const Writer = std.io.Writer(*Stream, WriteError, write);
+
+    pub fn reader(self: *Stream) Reader {
+        return Reader{ .context = self };
+    }
+
+    pub fn writer(self: *Stream) Writer {
+        return Writer{ .context = self };
+    }
+
+    fn read(self: *Stream, buffer: []u8) ReadError!usize {
+        if (self.serving and self.at_request and !(try self.hasPendingData()))
+            return error.WouldBlock;
+        const len = try self.socket.receive(buffer);
+        self.at_request = false;
+        return len;
+    }
+
+    fn write(self: *Stream, bytes: []const u8) WriteError!usize {
+        const len = try self.socket.send(bytes);
+        self.at_request = true;
+        return len;
+    }
+
+    /// Returns `true` if the client sent data that wasn't read yet, or closed the connection.
+    fn hasPendingData(self: *Stream) ReadError!bool {
+        var fds = [1]std.os.pollfd{.{
+            .fd = self.socket.internal,
+            .events = std.os.POLL.IN,
+            .revents = 0,
+        }};
+        const count = std.os.poll(&fds, 0) catch return error.WouldBlock;
+        return (count > 0);
+    }
+};
+
+/// Creates a server that serves each connection with a `Session`, which must provide:
+///
+/// - `fn init(session: *Session, context: Context, allocator: std.mem.Allocator, stream: *Stream) !void`
+///   reads the handshake when the first request arrived. The session is initialized in place and
+///   must not be moved, as the end points keep pointers.
+/// - `fn serve(session: *Session) !void` serves requests until reading the next one fails with
+///   `error.WouldBlock`, which must be returned. Returning without an error closes the connection,
+///   `error.EndOfStream` closes it quietly.
+/// - `fn deinit(session: *Session) void`
+///
+/// A session is used by one worker at a time, but by different workers over its lifetime.
+/// `allocator` belongs to the connection: it serves allocations from a scratch buffer of
+/// `session_scratch_size` bytes first, memory that is freed in reverse order of allocation
+/// (like the arena of an RPC call) is reused by the next call without a heap allocation.
+pub fn Server(comptime Context: type, comptime Session: type) type {
+    return struct {
+        const Self = @This();
+
+        const session_scratch_size = 16 << 10;
+
+        const Connection = struct {
+            stream: Stream,
+            scratch: std.heap.StackFallbackAllocator(session_scratch_size),
+            allocator: std.mem.Allocator,
+            /// Initialized by the worker that serves the first request.
+            session: ?Session = null,
+            /// When the connection was accepted, queued or handed back.
+            timestamp: i128,
+        };
+
+        allocator: std.mem.Allocator,
+        context: Context,
+        options: Options,
+
+        /// The dispatcher receives a datagram on this socket when connections were handed back.
+        wake_socket: network.Socket,
+        wake_end_point: network.EndPoint,
+
+        /// Protects all fields below.
+        mutex: std.Thread.Mutex = .{},
+        queue_changed: std.Thread.Condition = .{},
+        queue: std.fifo.LinearFifo(*Connection, .Dynamic),
+        /// Connections that were handed back by the workers, but aren't watched by the dispatcher yet.
+        returned: std.ArrayListUnmanaged(*Connection) = .{},
+        shutdown: bool = false,
+        metrics: Metrics = .{},
+
+        pub fn init(allocator: std.mem.Allocator, context: Context, options: Options) !Self {
+            var wake_socket = try network.Socket.create(.ipv4, .udp);
+            errdefer wake_socket.close();
+
+            try wake_socket.bind(network.EndPoint{
+                .address = network.Address{ .ipv4 = network.Address.IPv4.init(127, 0, 0, 1) },
+                .port = 0,
+            });
+
+            return Self{
+                .allocator = allocator,
+                .context = context,
+                .options = options,
+                .wake_socket = wake_socket,
+                .wake_end_point = try wake_socket.getLocalEndPoint(),
+                .queue = std.fifo.LinearFifo(*Connection, .Dynamic).init(allocator),
+            };
+        }
+
+        pub fn deinit(self: *Self) void {
+            while (self.queue.readItem()) |connection| {
+                self.destroyConnection(connection);
+            }
+            self.queue.deinit();
+            for (self.returned.items) |connection| {
+                self.destroyConnection(connection);
+            }
+            self.returned.deinit(self.allocator);
+            self.wake_socket.close();
+            self.* = undefined;
+        }
+
+        /// Returns a snapshot of the metrics.
+        pub fn getMetrics(self: *Self) Metrics {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+            return self.metrics;
+        }
+
+        /// Accepts connections on `listener` and serves them. Only returns on errors.
+        pub fn run(self: *Self, listener: network.Socket) !void {
+            const worker_count = self.options.worker_count orelse (std.Thread.getCpuCount() catch 1);
+
+            const workers = try self.allocator.alloc(std.Thread, std.math.max(1, worker_count));
+            defer self.allocator.free(workers);
+
+            var spawned: usize = 0;
+            defer {
+                self.mutex.lock();
+                self.shutdown = true;
+                self.queue_changed.broadcast();
+                self.mutex.unlock();
+
+                for (workers[0..spawned]) |worker| {
+                    worker.join();
+                }
+            }
+
+            while (spawned < workers.len) : (spawned += 1) {
+                workers[spawned] = try std.Thread.spawn(.{}, workerMain, .{self});
+            }
+
+            try self.dispatch(listener);
+        }
+
+        /// Accepts new connections and queues the ones with a pending request for the workers.
+        fn dispatch(self: *Self, listener: network.Socket) !void {
+            var socket_set = try network.SocketSet.init(self.allocator);
+            defer socket_set.deinit();
+
+            var idle = std.ArrayList(*Connection).init(self.allocator);
+            defer {
+                for (idle.items) |connection| {
+                    self.destroyConnection(connection);
+                }
+                idle.deinit();
+            }
+
+            var last_report = std.time.nanoTimestamp();
+
+            while (true) {
+                socket_set.clear();
+                try socket_set.add(listener, .{ .read = true, .write = false });
+                try socket_set.add(self.wake_socket, .{ .read = true, .write = false });
+                for (idle.items) |connection| {
+                    try socket_set.add(connection.stream.socket, .{ .read = true, .write = false });
+                }
+
+                _ = try network.waitForSocketEvent(&socket_set, self.getWaitTimeout());
+
+                const now = std.time.nanoTimestamp();
+
+                // pass on connections with a request, close the ones that failed or timed out
+                var i: usize = 0;
+                while (i < idle.items.len) {
+                    const connection = idle.items[i];
+                    const socket = connection.stream.socket;
+                    if (socket_set.isFaulted(socket)) {
+                        _ = idle.swapRemove(i);
+                        self.destroyConnection(connection);
+
+                        self.mutex.lock();
+                        defer self.mutex.unlock();
+                        self.metrics.dropped += 1;
+                        self.metrics.idle -= 1;
+                    } else if (socket_set.isReadyRead(socket)) {
+                        _ = idle.swapRemove(i);
+                        connection.timestamp = now;
+                        self.enqueue(connection);
+                    } else if (self.options.idle_timeout != null and now - connection.timestamp >= self.options.idle_timeout.?) {
+                        _ = idle.swapRemove(i);
+                        self.destroyConnection(connection);
+
+                        self.mutex.lock();
+                        defer self.mutex.unlock();
+                        self.metrics.timed_out += 1;
+                        self.metrics.idle -= 1;
+                    } else {
+                        i += 1;
+                    }
+                }
+
+                if (socket_set.isReadyRead(self.wake_socket)) {
+                    var dummy: [8]u8 = undefined;
+                    _ = try self.wake_socket.receive(&dummy);
+                }
+
+                // watch the connections the workers handed back, they are checked in the next round
+                {
+                    self.mutex.lock();
+                    defer self.mutex.unlock();
+
+                    try idle.appendSlice(self.returned.items);
+                    self.returned.shrinkRetainingCapacity(0);
+                }
+
+                if (socket_set.isReadyRead(listener)) {
+                    self.accept(listener, &idle, now);
+                }
+
+                if (self.options.metrics_period) |period| {
+                    if (now - last_report >= period) {
+                        last_report = now;
+                        logger.info("{}", .{self.getMetrics()});
+                    }
+                }
+            }
+        }
+
+        /// Returns how long the dispatcher may sleep, so idle connections time out and
+        /// the metrics are logged in time.
+        fn getWaitTimeout(self: Self) ?u64 {
+            const idle_timeout = self.options.idle_timeout orelse return self.options.metrics_period;
+            const metrics_period = self.options.metrics_period orelse return idle_timeout;
+            return std.math.min(idle_timeout, metrics_period);
+        }
+
+        fn accept(self: *Self, listener: network.Socket, idle: *std.ArrayList(*Connection), now: i128) void {
+            // running out of file descriptors must not stop the server
+            var socket = listener.accept() catch |err| {
+                logger.err("failed to accept connection: {s}", .{@errorName(err)});
+                return;
+            };
+
+            self.mutex.lock();
+            defer self.mutex.unlock();
+
+            self.metrics.accepted += 1;
+
+            const open = self.metrics.idle + self.metrics.queued + self.metrics.active;
+            if (open >= self.options.max_connections) {
+                socket.close();
+                self.metrics.rejected += 1;
+                logger.warn("connection limit reached, rejecting connection: {}", .{self.metrics});
+                return;
+            }
+
+            const connection = self.createConnection(socket, now) catch {
+                socket.close();
+                self.metrics.dropped += 1;
+                return;
+            };
+            idle.append(connection) catch {
+                self.destroyConnection(connection);
+                self.metrics.dropped += 1;
+                return;
+            };
+            self.metrics.idle += 1;
+        }
+
+        fn createConnection(self: *Self, socket: network.Socket, now: i128) !*Connection {
+            const connection = try self.allocator.create(Connection);
+            connection.* = Connection{
+                .stream = Stream{ .socket = socket },
+                .scratch = std.heap.stackFallback(session_scratch_size, self.allocator),
+                .allocator = undefined,
+                .timestamp = now,
+            };
+            // `get()` resets the scratch buffer, so it's only called once
+            connection.allocator = connection.scratch.get();
+
+            if (self.options.idle_timeout) |timeout| {
+                // the socket options take microseconds, zero would disable the timeout
+                const micros = std.math.max(1, std.math.cast(u32, timeout / std.time.ns_per_us) orelse std.math.maxInt(u32));
+                socket.setReadTimeout(micros) catch |err| logger.warn("failed to set read timeout: {s}", .{@errorName(err)});
+                socket.setWriteTimeout(micros) catch |err| logger.warn("failed to set write timeout: {s}", .{@errorName(err)});
+            }
+
+            return connection;
+        }
+
+        /// Closes the connection and frees its session.
+        fn destroyConnection(self: *Self, connection: *Connection) void {
+            if (connection.session) |*session| {
+                session.deinit();
+            }
+            connection.stream.socket.close();
+            self.allocator.destroy(connection);
+        }
+
+        fn enqueue(self: *Self, connection: *Connection) void {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+
+            self.metrics.idle -= 1;
+
+            self.queue.writeItem(connection) catch |err| {
+                logger.err("failed to queue connection: {s}", .{@errorName(err)});
+                self.destroyConnection(connection);
+                self.metrics.dropped += 1;
+                return;
+            };
+
+            self.metrics.queued += 1;
+            self.metrics.peak_queued = std.math.max(self.metrics.peak_queued, self.metrics.queued);
+            self.queue_changed.signal();
+        }
+
+        /// Waits for a queued connection. Returns `null` when the server shuts down.
+        fn dequeue(self: *Self) ?*Connection {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+
+            while (true) {
+                if (self.shutdown)
+                    return null;
+                if (self.queue.readItem()) |connection| {
+                    const queue_time = @intCast(u64, std.math.max(0, std.time.nanoTimestamp() - connection.timestamp));
+
+                    self.metrics.queued -= 1;
+                    self.metrics.active += 1;
+                    self.metrics.total_queue_time += queue_time;
+                    self.metrics.max_queue_time = std.math.max(self.metrics.max_queue_time, queue_time);
+
+                    return connection;
+                }
+                self.queue_changed.wait(&self.mutex);
+            }
+        }
+
+        /// Passes a served connection back to the dispatcher, which waits for its next request.
+        fn handBack(self: *Self, connection: *Connection) void {
+            connection.timestamp = std.time.nanoTimestamp();
+
+            const wake = blk: {
+                self.mutex.lock();
+                defer self.mutex.unlock();
+
+                self.metrics.active -= 1;
+                self.metrics.served += 1;
+
+                self.returned.append(self.allocator, connection) catch {
+                    self.destroyConnection(connection);
+                    self.metrics.dropped += 1;
+                    return;
+                };
+                self.metrics.idle += 1;
+
+                // the dispatcher takes all returned connections at once
+                break :blk (self.returned.items.len == 1);
+            };
+
+            if (wake) {
+                _ = self.wake_socket.sendTo(self.wake_end_point, "!") catch |err| {
+                    logger.warn("failed to wake up the dispatcher: {s}", .{@errorName(err)});
+                };
+            }
+        }
+
+        fn close(self: *Self, connection: *Connection, timed_out: bool) void {
+            self.destroyConnection(connection);
+
+            self.mutex.lock();
+            defer self.mutex.unlock();
+            self.metrics.active -= 1;
+            self.metrics.served += 1;
+            if (timed_out)
+                self.metrics.timed_out += 1;
+        }
+
+        fn workerMain(self: *Self) void {
+            while (self.dequeue()) |connection| {
+                self.serve(connection);
+            }
+        }
+
+        /// Serves the pending requests of `connection`, then hands it back or closes it.
+        fn serve(self: *Self, connection: *Connection) void {
+            const session = if (connection.session) |*session| session else blk: {
+                connection.session = @as(Session, undefined);
+                Session.init(&connection.session.?, self.context, connection.allocator, &connection.stream) catch |err| {
+                    connection.session = null;
+                    return self.fail(connection, err);
+                };
+                break :blk &connection.session.?;
+            };
+
+            connection.stream.serving = true;
+            connection.stream.at_request = true;
+            const result = session.serve();
+            // reset before the connection is handed to another thread
+            connection.stream.serving = false;
+
+            result catch |err| {
+                if (@as(anyerror, err) == error.WouldBlock and connection.stream.at_request) {
+                    // the client didn't send the next request yet
+                    return self.handBack(connection);
+                }
+                return self.fail(connection, err);
+            };
+
+            self.close(connection, false);
+        }
+
+        fn fail(self: *Self, connection: *Connection, err: anyerror) void {
+            switch (err) {
+                error.EndOfStream => {}, // this is just a safe disconnect
+                error.WouldBlock => {
+                    logger.info("closing stalled connection", .{});
+                    return self.close(connection, true);
+                },
+                else => {
+                    logger.err("connection failed: {s}", .{@errorName(err)});
+                    if (builtin.mode == .Debug and builtin.os.tag != .windows) {
+                        if (@errorReturnTrace()) |trace| {
+                            std.debug.dumpStackTrace(trace.*);
+                        }
+                    }
+                },
+            }
+            self.close(connection, false);
+        }
+    };
+}
@@ -0,0 +1,117 @@
+//! Watches layout source files and recompiles them when they change.
+//! The compiled layouts are added to the application with `Application.addResource`,
+//! which uploads them to all connected display clients. The display clients rebuild
+//! their view in place, so the objects and the widget state stay as they are.
+//!
+//! This is meant for development: call `poll()` in the event loop of the application
+//! and changes to the layout files are visible right after they are saved.
+
+const std = @import("std");
+const layout_compiler = @import("dunstblick-compiler");
+
+const Application = @import("dunstblick.zig").Application;
+const ResourceID = @import("dunstblick.zig").ResourceID;
+
+const log = std.log.scoped(.layout_watcher);
+
+const Self = @This();
+
+const Layout = struct {
+    resource: ResourceID,
+    path: []const u8, // owned
+
+    /// Modification time and size of the last compiled version.
+    mtime: i128,
+    size: u64,
+};
+
+allocator: std.mem.Allocator,
+application: *Application,
+database: *layout_compiler.Database,
+
+layouts: std.ArrayListUnmanaged(Layout),
+
+/// Creates a new watcher. `database` resolves the identifiers in the layout files
+/// and must be the one the application was built with.
+pub fn init(allocator: std.mem.Allocator, application: *Application, database: *layout_compiler.Database) Self {
+    return Self{
+        .allocator = allocator,
+        .application = application,
+        .database = database,
+        .layouts = .{},
+    };
+}
+
+pub fn deinit(self: *Self) void {
+    for (self.layouts.items) |layout| {
+        self.allocator.free(layout.path);
+    }
+    self.layouts.deinit(self.allocator);
+    self.* = undefined;
+}
+
+/// Starts watching the layout file at `path`, which is compiled into `resource`.
+/// The file is compiled and added to the application right away.
+pub fn watch(self: *Self, resource: ResourceID, path: []const u8) !void {
+    const layout = try self.layouts.addOne(self.allocator);
+    errdefer _ = self.layouts.pop();
+
+    layout.* = Layout{
+        .resource = resource,
+        .path = try self.allocator.dupe(u8, path),
+        .mtime = 0,
+        .size = 0,
+    };
+    errdefer self.allocator.free(layout.path);
+
+    _ = try self.reload(layout);
+}
+
+/// Recompiles all layout files that changed since the last call and uploads them.
+/// Layout files with compile errors are reported and keep their previous version.
+/// Returns the number of layouts that were uploaded.
+pub fn poll(self: *Self) !usize {
+    var count: usize = 0;
+    for (self.layouts.items) |*layout| {
+        if (try self.reload(layout))
+            count += 1;
+    }
+    return count;
+}
+
+/// Compiles `layout` if its file changed. Returns `true` if the resource was updated.
+fn reload(self: *Self, layout: *Layout) !bool {
+    var file = std.fs.cwd().openFile(layout.path, .{}) catch |err| switch (err) {
+        // editors may replace the file when saving, try again in the next poll
+        error.FileNotFound => return false,
+        else => |e| return e,
+    };
+    defer file.close();
+
+    const stat = try file.stat();
+    if (stat.mtime == layout.mtime and stat.size == layout.size)
+        return false;
+    layout.mtime = stat.mtime;
+    layout.size = stat.size;
+
+    var compiler = layout_compiler.Compiler.init(self.allocator, self.database);
+    defer compiler.deinit();
+
+    var data = std.ArrayList(u8).init(self.allocator);
+    defer data.deinit();
+
+    const result = compiler.compile(file.reader(), data.writer());
+
+    const errors = compiler.getErrors();
+    for (errors) |err| {
+        log.err("{s}: {s}", .{ layout.path, err });
+    }
+    if (errors.len > 0)
+        return false;
+    try result;
+
+    try self.application.addResource(layout.resource, .layout, data.items);
+
+    log.info("reloaded {s}", .{layout.path});
+    return true;
+}
@@ -23,6 +23,8 @@ pub const Margins = protocol.Margins;
 pub const Color = protocol.Color;
 pub const Point = protocol.Point;
 
+pub const LayoutWatcher = @import("LayoutWatcher.zig");
+
 pub const DunstblickError = error{
     OutOfMemory,
     NetworkError,
@@ -198,6 +200,123 @@ pub const Event = union(enum) {
     property_changed: PropertyChangedEvent,
 };
 
+/// Keeps the last messages sent in a session, so they can be sent again when the
+/// display client resumes the session after the connection was lost.
+const ReplayLog = struct {
+    /// Upper bound for the size of all logged messages. The oldest messages are
+    /// discarded when a new one doesn't fit anymore.
+    const max_size = 256 * 1024;
+
+    messages: std.fifo.LinearFifo([]u8, .Dynamic),
+
+    /// Sequence number of the first message in `messages`.
+    first_sequence: u64 = 0,
+
+    /// Total size of all messages in bytes.
+    size: usize = 0,
+
+    fn init(allocator: std.mem.Allocator) ReplayLog {
+        return ReplayLog{
+            .messages = std.fifo.LinearFifo([]u8, .Dynamic).init(allocator),
+        };
+    }
+
+    fn deinit(self: *ReplayLog, allocator: std.mem.Allocator) void {
+        self.clear(allocator);
+        self.messages.deinit();
+    }
+
+    fn nextSequence(self: ReplayLog) u64 {
+        return self.first_sequence + self.messages.count;
+    }
+
+    fn append(self: *ReplayLog, allocator: std.mem.Allocator, message: []const u8) void {
+        if (message.len <= max_size) {
+            while (self.size + message.len > max_size) {
+                self.dropOldest(allocator);
+            }
+            if (allocator.dupe(u8, message)) |copy| {
+                if (self.messages.writeItem(copy)) {
+                    self.size += copy.len;
+                    return;
+                } else |_| {
+                    allocator.free(copy);
+                }
+            } else |_| {}
+        }
+
+        // The message can't be logged, so the session can only be resumed after it.
+        self.clear(allocator);
+        self.first_sequence += 1;
+    }
+
+    fn dropOldest(self: *ReplayLog, allocator: std.mem.Allocator) void {
+        const message = self.messages.readItem().?;
+        self.size -= message.len;
+        self.first_sequence += 1;
+        allocator.free(message);
+    }
+
+    fn clear(self: *ReplayLog, allocator: std.mem.Allocator) void {
+        while (self.messages.count > 0) {
+            self.dropOldest(allocator);
+        }
+    }
+
+    /// Returns `true` if all messages starting at `sequence` are still available.
+    fn canReplayFrom(self: ReplayLog, sequence: u64) bool {
+        return (sequence >= self.first_sequence) and (sequence <= self.nextSequence());
+    }
+
+    fn get(self: ReplayLog, sequence: u64) ?[]const u8 {
+        if (sequence < self.first_sequence or sequence >= self.nextSequence())
+            return null;
+        return self.messages.peekItem(@intCast(usize, sequence - self.first_sequence));
+    }
+};
+
+test "ReplayLog" {
+    const allocator = std.testing.allocator;
+
+    var log = ReplayLog.init(allocator);
+    defer log.deinit(allocator);
+
+    try std.testing.expect(log.canReplayFrom(0));
+    try std.testing.expectEqual(@as(?[]const u8, null), log.get(0));
+
+    log.append(allocator, "first");
+    log.append(allocator, "second");
+    try std.testing.expectEqual(@as(u64, 2), log.nextSequence());
+    try std.testing.expectEqualStrings("first", log.get(0).?);
+    try std.testing.expectEqualStrings("second", log.get(1).?);
+    try std.testing.expectEqual(@as(?[]const u8, null), log.get(2));
+    try std.testing.expect(log.canReplayFrom(0));
+    try std.testing.expect(log.canReplayFrom(2));
+    try std.testing.expect(!log.canReplayFrom(3));
+
+    // the oldest messages are dropped when the log is full
+    const big = try allocator.alloc(u8, ReplayLog.max_size - "second".len);
+    defer allocator.free(big);
+    std.mem.set(u8, big, 0xAA);
+
+    log.append(allocator, big);
+    try std.testing.expectEqual(@as(u64, 1), log.first_sequence);
+    try std.testing.expect(!log.canReplayFrom(0));
+    try std.testing.expectEqualStrings("second", log.get(1).?);
+    try std.testing.expectEqual(big.len, log.get(2).?.len);
+    try std.testing.expectEqual(@as(usize, ReplayLog.max_size), log.size);
+
+    // a message larger than the log can't be replayed, so nothing before it can be either
+    const huge = try allocator.alloc(u8, ReplayLog.max_size + 1);
+    defer allocator.free(huge);
+
+    log.append(allocator, huge);
+    try std.testing.expectEqual(@as(u64, 4), log.nextSequence());
+    try std.testing.expect(!log.canReplayFrom(3));
+    try std.testing.expect(log.canReplayFrom(4));
+    try std.testing.expectEqual(@as(usize, 0), log.size);
+}
+
 /// A connection that was established by a display client.
 /// Use these to interact with your clients.
 pub const Connection = struct {
@@ -205,6 +324,15 @@ pub const Connection = struct {
 
     const PacketQueue = std.atomic.Queue([]const u8);
 
+    /// How long a lost connection with a session waits for the display client to resume it
+    /// before the `disconnected` event is emitted.
+    const session_grace_period = 15 * std.time.ns_per_s;
+
+    const Suspension = struct {
+        since: i128,
+        reason: DisconnectReason,
+    };
+
     mutex: std.Thread.Mutex,
 
     sock: xnet.Socket,
@@ -212,6 +340,19 @@ pub const Connection = struct {
 
     disconnect_reason: ?DisconnectReason = null,
 
+    /// The resumable session issued to the display client, if it asked for one.
+    session: ?protocol.tcp.Session = null,
+
+    /// Messages sent in the session, replayed when the session is resumed.
+    replay_log: ReplayLog,
+
+    /// Set while the display client is gone, but may still resume the session.
+    /// Messages are only logged in that time.
+    suspension: ?Suspension = null,
+
+    /// The socket and protocol state were handed over to a resumed connection.
+    moved: bool = false,
+
     client_capabilities: std.EnumSet(ClientCapabilities),
     screen_resolution: Size,
 
@@ -232,13 +373,19 @@ pub const Connection = struct {
             .screen_resolution = undefined,
             .user_data_pointer = null,
             .server = protocol.tcp.ServerStateMachine(xnet.Socket.Writer).init(provider.allocator, sock.writer()),
+            .replay_log = ReplayLog.init(provider.allocator),
         };
     }
 
     fn deinit(self: *Self) void {
+        self.replay_log.deinit(self.provider.allocator);
+        if (self.moved)
+            return; // socket and protocol state belong to the resumed connection now
+
         log.debug("connection lost to {}", .{self.remote});
         self.server.deinit();
-        self.sock.close();
+        if (self.suspension == null)
+            self.sock.close();
     }
 
     fn drop(self: *Self, reason: DisconnectReason) void {
@@ -248,6 +395,76 @@ pub const Connection = struct {
         log.debug("dropped connection to {}: {}", .{ self.remote, reason });
     }
 
+    /// Returns `true` if the display client may still resume the session of this connection.
+    fn isResumable(self: Self) bool {
+        if (self.session == null)
+            return false;
+        const reason = self.disconnect_reason orelse return true;
+        return (self.suspension == null) and (reason == .quit or reason == .network_error);
+    }
+
+    /// Keeps the connection after the display client lost it, so the session can be resumed.
+    fn suspendSession(self: *Self) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        log.debug("connection to {} suspended, waiting for the session to be resumed", .{self.remote});
+
+        self.sock.close();
+        self.suspension = Suspension{
+            .since = std.time.nanoTimestamp(),
+            .reason = self.disconnect_reason.?,
+        };
+        self.disconnect_reason = null;
+    }
+
+    /// Hands the socket of this pending connection over to the connection with the requested
+    /// session and sends the messages the display client missed. Returns the resumed connection
+    /// or `null` if the session can't be resumed.
+    fn resumeSession(self: *Self, session_id: [16]u8, sequence: u64) !?*Self {
+        const target = self.provider.findSession(session_id) orelse return null;
+
+        target.mutex.lock();
+        defer target.mutex.unlock();
+
+        if (!target.replay_log.canReplayFrom(sequence))
+            return null;
+        if (self.server.setKeyAndVerify(target.session.?.key) != .success)
+            return null;
+
+        try self.server.sendAuthenticationResult(.success, false);
+
+        if (target.suspension == null) {
+            // the display client noticed the loss before we did
+            target.sock.close();
+        }
+        target.server.deinit();
+        target.sock = self.sock;
+        target.remote = self.remote;
+        target.server = self.server;
+        target.suspension = null;
+        target.disconnect_reason = null;
+
+        self.server = undefined;
+        self.moved = true;
+        self.disconnect_reason = .quit;
+
+        log.debug("resumed session of {}, replaying {} messages", .{
+            target.remote,
+            target.replay_log.nextSequence() - sequence,
+        });
+
+        var current = sequence;
+        while (target.replay_log.get(current)) |message| : (current += 1) {
+            target.server.sendMessage(message) catch {
+                target.drop(.network_error);
+                break;
+            };
+        }
+
+        return target;
+    }
+
     /// Shoves data from the display server into the connection.
     fn pushData(self: *Self, blob: []const u8) !void {
         errdefer self.drop(DisconnectReason.invalid_data);
@@ -266,10 +483,26 @@ pub const Connection = struct {
                             .rejects_password = info.has_password, // reject both username and password if present
                         });
 
-                        if (auth_action != .send_auth_result)
-                            return error.ProtocolViolation;
+                        switch (auth_action) {
+                            .send_auth_result => if (info.wants_session) {
+                                self.session = try self.server.sendAuthenticationResultWithSession(false);
+                            } else {
+                                try self.server.sendAuthenticationResult(.success, false);
+                            },
+                            .expect_resume => {},
+                            else => return error.ProtocolViolation,
+                        }
+                    },
+
+                    .resume_request => |info| {
+                        if (try self.resumeSession(info.session_id, info.sequence)) |target| {
+                            // everything after the request belongs to the resumed connection
+                            return target.pushData(blob[offset..]);
+                        }
 
-                        try self.server.sendAuthenticationResult(.success, false);
+                        log.debug("{} tried to resume an unknown session", .{self.remote});
+                        try self.server.sendAuthenticationResult(.unknown_session, false);
+                        return self.drop(.quit);
                     },
 
                     .authenticate_info => |info| {
@@ -334,6 +567,12 @@ pub const Connection = struct {
         self.mutex.lock();
         defer self.mutex.unlock();
 
+        if (self.session != null)
+            self.replay_log.append(self.provider.allocator, packet);
+
+        if (self.suspension != null)
+            return; // sent when the display client resumes the session
+
         self.server.sendMessage(packet) catch |err| return mapSendError(err);
     }
 
@@ -509,6 +748,73 @@ pub const Connection = struct {
         try self.send(stream.getWritten());
     }
 
+    /// Uploads a resource that was added or changed after the connection was established.
+    fn uploadResource(self: *Self, id: ResourceID, kind: ResourceKind, data: []const u8) DunstblickError!void {
+        var packet = std.ArrayList(u8).init(self.provider.allocator);
+        defer packet.deinit();
+
+        var buffer = try protocol.beginDisplayCommandEncoding(packet.writer(), .uploadResource);
+
+        try buffer.writeID(@enumToInt(id));
+        try buffer.writeEnum(@enumToInt(kind));
+        try buffer.writeRaw(data);
+
+        try self.send(packet.items);
+    }
+
+    /// Sets a property with a statically known type, see `protocol.TypedProperty`.
+    /// The value is encoded directly, without converting it to a `Value`.
+    pub fn setTypedProperty(self: *Self, object: ObjectID, property: anytype, value: @TypeOf(property).Type) DunstblickError!void {
+        var backing_buf: [4096]u8 = undefined;
+        var stream = std.io.fixedBufferStream(&backing_buf);
+
+        var buffer = try protocol.beginDisplayCommandEncoding(stream.writer(), .setProperty);
+
+        try buffer.writeID(@enumToInt(object));
+        try buffer.writeID(@enumToInt(property.name));
+        try buffer.writeEnum(@enumToInt(@TypeOf(property).value_type));
+        try @TypeOf(property).encode(&buffer, value);
+
+        try self.send(stream.getWritten());
+    }
+
+    /// Sets a property to a value that is already encoded in the wire format.
+    /// `data` must contain a single value of type `value_type`, without the type tag.
+    pub fn setEncodedProperty(self: *Self, object: ObjectID, name: PropertyName, value_type: Type, data: []const u8) DunstblickError!void {
+        var backing_buf: [4096]u8 = undefined;
+        var stream = std.io.fixedBufferStream(&backing_buf);
+
+        var buffer = try protocol.beginDisplayCommandEncoding(stream.writer(), .setProperty);
+
+        try buffer.writeID(@enumToInt(object));
+        try buffer.writeID(@enumToInt(name));
+        try buffer.writeEnum(@enumToInt(value_type));
+        try buffer.writeRaw(data);
+
+        try self.send(stream.getWritten());
+    }
+
+    /// Animates a property of an object from its current value to `value` in `duration` milliseconds.
+    /// The display client interpolates the value every frame, so this replaces sending
+    /// `setProperty` many times per second. Only integer, number, color, size and point
+    /// properties are animated, other types are changed immediately.
+    /// When `notify` is set, a property changed event with `value` is sent when the animation has finished.
+    pub fn animateProperty(self: *Self, object: ObjectID, name: PropertyName, value: Value, duration: u32, easing: protocol.Easing, notify: bool) DunstblickError!void {
+        var backing_buf: [4096]u8 = undefined;
+        var stream = std.io.fixedBufferStream(&backing_buf);
+
+        var buffer = try protocol.beginDisplayCommandEncoding(stream.writer(), .animateProperty);
+
+        try buffer.writeID(@enumToInt(object));
+        try buffer.writeID(@enumToInt(name));
+        try value.serialize(&buffer, true);
+        try buffer.writeVarUInt(duration);
+        try buffer.writeByte(@enumToInt(easing));
+        try buffer.writeByte(@boolToInt(notify));
+
+        try self.send(stream.getWritten());
+    }
+
     /// Clears a list property of an object.
     /// This action will remove all object references from an objectlist property.
     pub fn clear(self: *Self, object: ObjectID, name: PropertyName) DunstblickError!void {
@@ -591,6 +897,9 @@ pub const Application = struct {
     app_description: ?[]const u8, // owned
     app_icon: ?[]const u8, // owned
 
+    description_hash: protocol.udp.ContentHash,
+    icon_hash: protocol.udp.ContentHash,
+
     tcp_listener_ep: xnet.EndPoint,
 
     resource_lock: std.Thread.Mutex,
@@ -626,10 +935,8 @@ pub const Application = struct {
         /// Optional TVG icon, limited to 512 byte.
         app_icon: ?[]const u8,
     ) !Self {
-        if (app_description != null and app_description.?.len > protocol.udp.DiscoverResponse.ShortDescription.max_length)
-            return error.DescriptionTooLong;
-        if (app_icon != null and app_icon.?.len > protocol.udp.DiscoverResponse.IconDescription.max_length)
-            return error.IconTooLong;
+        try validateDiscoveryInfo(discovery_name, app_description, app_icon);
+
         var provider = Self{
             .mutex = .{},
             .resource_lock = .{},
@@ -651,6 +958,8 @@ pub const Application = struct {
             .discovery_name = undefined,
             .app_description = null,
             .app_icon = null,
+            .description_hash = undefined,
+            .icon_hash = undefined,
 
             .tcp_sock = undefined,
             .multicast_sock = undefined,
@@ -668,6 +977,8 @@ pub const Application = struct {
         provider.app_icon = if (app_icon) |data| if (data.len > 0) try allocator.dupe(u8, data) else null else null;
         errdefer if (provider.app_icon) |ptr| allocator.free(ptr);
 
+        provider.updateContentHashes();
+
         // Initialize TCP socket:
         provider.tcp_sock = try xnet.Socket.create(.ipv4, .tcp);
         errdefer provider.tcp_sock.close();
@@ -697,11 +1008,46 @@ pub const Application = struct {
 
         log.debug("provider ready at {}", .{try provider.tcp_sock.getLocalEndPoint()});
 
+        // let the display clients know about us without waiting for their next scan
+        provider.sendAnnouncement(multicast_end_point);
+
         return provider;
     }
 
+    const multicast_end_point = xnet.EndPoint{
+        .address = .{
+            .ipv4 = xnet.Address.IPv4.init(
+                protocol.udp.multicast_group_v4[0],
+                protocol.udp.multicast_group_v4[1],
+                protocol.udp.multicast_group_v4[2],
+                protocol.udp.multicast_group_v4[3],
+            ),
+        },
+        .port = protocol.udp.port,
+    };
+
+    fn validateDiscoveryInfo(discovery_name: []const u8, app_description: ?[]const u8, app_icon: ?[]const u8) !void {
+        if (discovery_name.len > protocol.udp.max_name_length)
+            return error.NameTooLong;
+        if (app_description != null and app_description.?.len > protocol.udp.DiscoverResponse.ShortDescription.max_length)
+            return error.DescriptionTooLong;
+        if (app_icon != null and app_icon.?.len > protocol.udp.DiscoverResponse.IconDescription.max_length)
+            return error.IconTooLong;
+    }
+
+    fn updateContentHashes(self: *Self) void {
+        self.description_hash = protocol.udp.computeContentHash(self.app_description orelse "");
+        self.icon_hash = protocol.udp.computeContentHash(self.app_icon orelse "");
+    }
+
     /// Closes the application and all connections.
     pub fn close(self: *Self) void {
+        {
+            var withdraw = protocol.udp.Withdraw{ .tcp_port = self.tcp_listener_ep.port };
+            _ = self.multicast_sock.sendTo(multicast_end_point, std.mem.asBytes(&withdraw)) catch |err| {
+                log.warn("failed to send udp withdrawal: {}", .{err});
+            };
+        }
         {
             var iter = self.established_connections.first;
             while (iter) |item| {
@@ -764,6 +1110,8 @@ pub const Application = struct {
         {
             var iter = self.established_connections.first;
             while (iter) |node| : (iter = node.next) {
+                if (node.data.suspension != null)
+                    continue;
                 try self.socket_set.add(node.data.sock, .{ .read = true, .write = false });
             }
         }
@@ -780,6 +1128,8 @@ pub const Application = struct {
         {
             var iter = self.established_connections.first;
             while (iter) |item| : (iter = item.next) {
+                if (item.data.suspension != null)
+                    continue;
                 if (self.socket_set.isFaulted(item.data.sock))
                     item.data.drop(.network_error);
             }
@@ -818,7 +1168,7 @@ pub const Application = struct {
         {
             var iter = self.established_connections.first;
             while (iter) |item| : (iter = item.next) {
-                if (item.data.disconnect_reason != null)
+                if (item.data.disconnect_reason != null or item.data.suspension != null)
                     continue;
                 if (self.socket_set.isReadyRead(item.data.sock)) {
                     try item.data.receiveData();
@@ -836,51 +1186,24 @@ pub const Application = struct {
                     if (std.mem.eql(u8, &message.header.magic, &protocol.udp.magic)) {
                         switch (message.header.type) {
                             .discover => {
-                                if (msg.numberOfBytes >= @sizeOf(protocol.udp.Discover)) {
-                                    var buffer: [protocol.udp.DiscoverResponse.buffer_size]u8 align(@alignOf(protocol.udp.DiscoverResponse)) = undefined;
-                                    const response = @ptrCast(*protocol.udp.DiscoverResponse, &buffer);
-                                    response.* = .{
-                                        .features = .{
-                                            .has_description = (self.app_description != null),
-                                            .has_icon = (self.app_icon != null),
-                                            .requires_auth = false,
-                                            .wants_username = false,
-                                            .wants_password = false,
-                                            .is_encrypted = false,
-                                        },
-                                        .tcp_port = self.tcp_listener_ep.port,
-                                        .display_name = undefined,
-                                    };
-                                    response.setName(self.discovery_name) catch @panic("Application name too long!");
-
-                                    if (response.getDescriptionPtr()) |ptr| {
-                                        ptr.set(self.app_description.?) catch @panic("Application description too long!");
-                                    }
-                                    if (response.getIconPtr()) |ptr| {
-                                        ptr.set(self.app_icon.?) catch @panic("Application icon too long!");
-                                    }
-
-                                    // log.debug("response to {}", .{msg.sender});
-
-                                    const length = response.getTotalPacketLength();
-                                    // log.debug("sendTo({}, '{}')", .{
-                                    //     msg.sender,
-                                    //     std.fmt.fmtSliceHexLower(buffer[0..length]),
-                                    // });
-                                    if (self.multicast_sock.sendTo(msg.sender, buffer[0..length])) |sendlen| {
-                                        if (sendlen < length) {
-                                            log.err("expected to send {} bytes, got {}", .{
-                                                length,
-                                                sendlen,
-                                            });
-                                        }
-                                    } else |err| {
-                                        log.err("failed to send udp response: {}", .{err});
-                                    }
+                                if (msg.numberOfBytes >= @sizeOf(protocol.udp.DiscoverV2) and message.discover_v2.version >= 2) {
+                                    self.sendAnnouncement(msg.sender);
+                                } else if (msg.numberOfBytes >= @sizeOf(protocol.udp.Discover)) {
+                                    self.sendDiscoverResponse(msg.sender);
                                 } else {
                                     log.err("expected {} bytes, got {}", .{ @sizeOf(protocol.udp.Discover), msg.numberOfBytes });
                                 }
                             },
+                            .query_content => {
+                                if (msg.numberOfBytes >= @sizeOf(protocol.udp.ContentQuery)) {
+                                    self.sendContent(msg.sender, message.content_query);
+                                } else {
+                                    log.err("expected {} bytes, got {}", .{ @sizeOf(protocol.udp.ContentQuery), msg.numberOfBytes });
+                                }
+                            },
+                            .announce, .respond_content, .withdraw => {
+                                // messages of other providers, meant for the display clients
+                            },
                             .respond_discover => {
                                 if (msg.numberOfBytes >= @sizeOf(protocol.udp.DiscoverResponse)) {
                                     log.debug("got udp response", .{});
@@ -967,13 +1290,28 @@ pub const Application = struct {
             }
         }
 
-        // Close all established connections that were dropped
+        // Close all established connections that were dropped. Connections with a session
+        // are suspended first and only closed when the session isn't resumed in time.
         {
+            const now = std.time.nanoTimestamp();
+
             var iter = self.established_connections.first;
             while (iter) |item| {
                 const next = item.next;
                 defer iter = next;
 
+                if (item.data.disconnect_reason != null and item.data.isResumable()) {
+                    item.data.suspendSession();
+                    continue;
+                }
+
+                if (item.data.suspension) |suspension| {
+                    if (item.data.disconnect_reason == null and now - suspension.since >= Connection.session_grace_period) {
+                        log.debug("session of {} was not resumed in time", .{item.data.remote});
+                        item.data.disconnect_reason = suspension.reason;
+                    }
+                }
+
                 if (item.data.disconnect_reason != null) {
                     const event = try self.createEvent();
                     errdefer self.freeEvent(event);
@@ -996,6 +1334,99 @@ pub const Application = struct {
         }
     }
 
+    /// Returns the connection that may resume the session with `session_id`.
+    fn findSession(self: *Self, session_id: [16]u8) ?*Connection {
+        var iter = self.established_connections.first;
+        while (iter) |item| : (iter = item.next) {
+            const session = item.data.session orelse continue;
+            if (std.mem.eql(u8, &session.id, &session_id) and item.data.isResumable())
+                return &item.data;
+        }
+        return null;
+    }
+
+    fn sendUdp(self: *Self, target: xnet.EndPoint, packet: []const u8) void {
+        if (self.multicast_sock.sendTo(target, packet)) |sendlen| {
+            if (sendlen < packet.len) {
+                log.err("expected to send {} bytes, got {}", .{
+                    packet.len,
+                    sendlen,
+                });
+            }
+        } else |err| {
+            log.err("failed to send udp response: {}", .{err});
+        }
+    }
+
+    /// Responds to a discovery request of a client that only understands version 1.
+    fn sendDiscoverResponse(self: *Self, target: xnet.EndPoint) void {
+        var buffer: [protocol.udp.DiscoverResponse.buffer_size]u8 align(@alignOf(protocol.udp.DiscoverResponse)) = undefined;
+        const response = @ptrCast(*protocol.udp.DiscoverResponse, &buffer);
+        response.* = .{
+            .features = self.getDiscoveryFeatures(),
+            .tcp_port = self.tcp_listener_ep.port,
+            .display_name = undefined,
+        };
+        response.setName(self.discovery_name) catch unreachable; // validated before
+
+        if (response.getDescriptionPtr()) |ptr| {
+            ptr.set(self.app_description.?) catch unreachable;
+        }
+        if (response.getIconPtr()) |ptr| {
+            ptr.set(self.app_icon.?) catch unreachable;
+        }
+
+        self.sendUdp(target, buffer[0..response.getTotalPacketLength()]);
+    }
+
+    /// Sends the compact discovery response. `target` is either the client that
+    /// sent a discovery request or the multicast group.
+    fn sendAnnouncement(self: *Self, target: xnet.EndPoint) void {
+        var announcement = protocol.udp.Announcement{
+            .features = self.getDiscoveryFeatures(),
+            .tcp_port = self.tcp_listener_ep.port,
+            .display_name = undefined,
+            .description_hash = self.description_hash,
+            .icon_hash = self.icon_hash,
+        };
+        announcement.setName(self.discovery_name) catch unreachable; // validated before
+
+        self.sendUdp(target, std.mem.asBytes(&announcement));
+    }
+
+    fn sendContent(self: *Self, target: xnet.EndPoint, query: protocol.udp.ContentQuery) void {
+        const content = switch (query.kind) {
+            .description => if (std.mem.eql(u8, &query.hash, &self.description_hash)) self.app_description else null,
+            .icon => if (std.mem.eql(u8, &query.hash, &self.icon_hash)) self.app_icon else null,
+            _ => null,
+        } orelse {
+            // the content was changed in the meantime, the client will receive
+            // the new hash with our announcement
+            return;
+        };
+
+        var response = protocol.udp.ContentResponse{
+            .kind = query.kind,
+            .hash = query.hash,
+            .size = undefined,
+            .data = undefined,
+        };
+        response.set(content) catch unreachable; // validated before
+
+        self.sendUdp(target, std.mem.asBytes(&response)[0..response.getTotalPacketLength()]);
+    }
+
+    fn getDiscoveryFeatures(self: Self) protocol.udp.DiscoverResponse.Features {
+        return .{
+            .has_description = (self.app_description != null),
+            .has_icon = (self.app_icon != null),
+            .requires_auth = false,
+            .wants_username = false,
+            .wants_password = false,
+            .is_encrypted = false,
+        };
+    }
+
     /// Allocates a new event and returns it. Initializes the arena, but not the event pointer.
     fn createEvent(self: *Self) !*AppEvent {
         const node = if (self.event_stash.pop()) |node|
@@ -1071,33 +1502,83 @@ pub const Application = struct {
 
     // Public API
 
+    /// Changes the information shown to the discovering clients. The change is
+    /// announced to all clients in the network immediately.
+    pub fn setDiscoveryInfo(
+        self: *Self,
+        /// The name that is shown to the discovering clients.
+        discovery_name: []const u8,
+        /// Optional description of the application, utf-8 encoded, limited to 256 byte.
+        app_description: ?[]const u8,
+        /// Optional TVG icon, limited to 512 byte.
+        app_icon: ?[]const u8,
+    ) !void {
+        try validateDiscoveryInfo(discovery_name, app_description, app_icon);
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        const new_name = try self.allocator.dupe(u8, discovery_name);
+        errdefer self.allocator.free(new_name);
+
+        const new_description = if (app_description) |text| try self.allocator.dupe(u8, text) else null;
+        errdefer if (new_description) |ptr| self.allocator.free(ptr);
+
+        const new_icon = if (app_icon) |data| if (data.len > 0) try self.allocator.dupe(u8, data) else null else null;
+
+        self.allocator.free(self.discovery_name);
+        if (self.app_description) |text| self.allocator.free(text);
+        if (self.app_icon) |data| self.allocator.free(data);
+
+        self.discovery_name = new_name;
+        self.app_description = new_description;
+        self.app_icon = new_icon;
+        self.updateContentHashes();
+
+        self.sendAnnouncement(multicast_end_point);
+    }
+
     /// Adds a resource to the UI system.
     /// The resource will be hashed and stored until the provider is shut down
     /// or the the resource is removed again.
     /// Resources in the storage will be uploaded to a display client on connection
     /// and newly added resources will also be sent to all currently connected display
-    /// clients.
+    /// clients. Display clients rebuild their view when a layout is replaced.
     pub fn addResource(self: *Self, id: protocol.ResourceID, kind: protocol.ResourceKind, data: []const u8) DunstblickError!void {
-        self.mutex.lock();
-        defer self.mutex.unlock();
+        {
+            self.resource_lock.lock();
+            defer self.resource_lock.unlock();
 
-        var cloned_data = try self.allocator.dupe(u8, data);
-        errdefer self.allocator.free(cloned_data);
+            var cloned_data = try self.allocator.dupe(u8, data);
+            errdefer self.allocator.free(cloned_data);
 
-        const result = try self.resources.getOrPut(id);
+            const result = try self.resources.getOrPut(id);
 
-        std.debug.assert(result.key_ptr.* == id);
-        if (result.found_existing) {
-            std.debug.assert(result.value_ptr.id == id);
-            self.allocator.free(result.value_ptr.data);
-        } else {
-            result.value_ptr.id = id;
+            std.debug.assert(result.key_ptr.* == id);
+            if (result.found_existing) {
+                std.debug.assert(result.value_ptr.id == id);
+                if (std.mem.eql(u8, result.value_ptr.data, data) and result.value_ptr.type == kind) {
+                    // the display clients already have this resource
+                    self.allocator.free(cloned_data);
+                    return;
+                }
+                self.allocator.free(result.value_ptr.data);
+            } else {
+                result.value_ptr.id = id;
+            }
+            result.value_ptr.type = @intToEnum(protocol.ResourceKind, @enumToInt(kind));
+            result.value_ptr.data = cloned_data;
+            result.value_ptr.updateHash();
         }
-        result.value_ptr.type = @intToEnum(protocol.ResourceKind, @enumToInt(kind));
-        result.value_ptr.data = cloned_data;
-        result.value_ptr.updateHash();
 
-        // TODO: Forward the result to all connected clients.
+        var iter = self.established_connections.first;
+        while (iter) |node| : (iter = node.next) {
+            if (node.data.disconnect_reason != null)
+                continue;
+            node.data.uploadResource(id, kind, data) catch |err| {
+                log.warn("failed to upload resource {} to {}: {s}", .{ @enumToInt(id), node.data.remote, @errorName(err) });
+            };
+        }
     }
 
     /// Deletes a resource from the UI system.
@@ -1105,8 +1586,8 @@ pub const Application = struct {
     /// used again, but newly connected display clients will not receive the
     /// resource anymore.
     pub fn removeResource(self: *Self, id: protocol.ResourceID) DunstblickError!void {
-        self.mutex.lock();
-        defer self.mutex.unlock();
+        self.resource_lock.lock();
+        defer self.resource_lock.unlock();
 
         if (self.resources.fetchRemove(id)) |item| {
             self.allocator.free(item.value.data);
@@ -1147,6 +1628,25 @@ pub const Object = struct {
         try value.serialize(&enc, false);
     }
 
+    /// Sets a property with a statically known type, see `protocol.TypedProperty`.
+    pub fn setTypedProperty(self: *Self, property: anytype, value: @TypeOf(property).Type) DunstblickError!void {
+        var enc = protocol.makeEncoder(self.commandbuffer.writer());
+
+        try enc.writeEnum(@enumToInt(@TypeOf(property).value_type));
+        try enc.writeID(@enumToInt(property.name));
+        try @TypeOf(property).encode(&enc, value);
+    }
+
+    /// Sets a property to a value that is already encoded in the wire format.
+    /// `data` must contain a single value of type `value_type`, without the type tag.
+    pub fn setEncodedProperty(self: *Self, name: protocol.PropertyName, value_type: Type, data: []const u8) DunstblickError!void {
+        var enc = protocol.makeEncoder(self.commandbuffer.writer());
+
+        try enc.writeEnum(@enumToInt(value_type));
+        try enc.writeID(@enumToInt(name));
+        try enc.writeRaw(data);
+    }
+
     /// The object will either be added to the list of objects
     /// or, if an object with the same ID already exists, will replace that object.
     /// The new object will only have the properties set in this transaction,
@@ -0,0 +1,372 @@
+//! Compiles many layout files in a single invocation.
+//!
+//! All inputs share one `Database`, so the config file is only read and written once.
+//! The inputs are distributed over worker threads, each compiling with its own `Compiler`.
+//! With a build cache `Manifest`, an input is skipped when its content and the database
+//! generation are the same as when it was compiled the last time.
+//!
+//! When the database may add new IDs, the workers only give new names provisional IDs.
+//! The final IDs are assigned in the order of the names afterwards, and the layouts that
+//! used provisional IDs are compiled again, so the IDs don't depend on the thread timing.
+
+const std = @import("std");
+
+const Compiler = @import("Compiler.zig");
+const Database = @import("Database.zig");
+const Optimizer = @import("Optimizer.zig");
+
+const Self = @This();
+
+pub const FileType = enum { binary, header };
+
+pub const Options = struct {
+    file_type: FileType = .binary,
+    /// Runs the `Optimizer` on the compiled layouts.
+    optimize: bool = false,
+};
+
+pub const Result = enum {
+    pending,
+    /// The layout was compiled and written to the output file.
+    compiled,
+    /// The output file is still valid and was kept.
+    up_to_date,
+    /// The layout has errors, see `Job.compiler`.
+    failed,
+};
+
+pub const Job = struct {
+    input: []const u8,
+    output: []const u8,
+
+    result: Result = .pending,
+    /// Hash of the input file and the options that affect the output.
+    hash: u64 = 0,
+    /// Contains the errors of the layout after a compilation.
+    compiler: ?Compiler = null,
+    /// Set when the layout was compiled with `Options.optimize`.
+    statistics: ?Optimizer.Statistics = null,
+    /// Set when the input couldn't be read or the output couldn't be written.
+    io_error: ?anyerror = null,
+
+    pub fn deinit(self: *Job) void {
+        if (self.compiler) |*compiler| {
+            compiler.deinit();
+        }
+        self.* = undefined;
+    }
+};
+
+allocator: std.mem.Allocator,
+database: *Database,
+options: Options,
+manifest: ?*Manifest,
+
+jobs: []Job,
+/// Index of the next job a worker will take.
+next_job: usize = 0,
+/// The database generation the manifest entries are checked against.
+generation: u64 = 0,
+
+pub fn init(allocator: std.mem.Allocator, database: *Database, options: Options, manifest: ?*Manifest, jobs: []Job) Self {
+    return Self{
+        .allocator = allocator,
+        .database = database,
+        .options = options,
+        .manifest = manifest,
+        .jobs = jobs,
+    };
+}
+
+/// Compiles all jobs on `thread_count` threads and updates the manifest.
+/// Returns `true` when all layouts were compiled successfully.
+pub fn run(self: *Self, thread_count: usize) !bool {
+    self.generation = self.database.computeGeneration();
+
+    self.database.defer_new_items = self.database.allow_new_items;
+    self.runJobs(thread_count);
+
+    if (try self.database.assignNewItems()) {
+        // the layouts that weren't skipped might contain provisional IDs
+        for (self.jobs) |*job| {
+            if (job.result == .up_to_date)
+                continue;
+            const input = job.input;
+            const output = job.output;
+            job.deinit();
+            job.* = Job{ .input = input, .output = output };
+        }
+        self.runJobs(thread_count);
+    }
+
+    // Layouts stay valid when new IDs were added, so all successful jobs are recorded
+    // with the final generation of the database.
+    const final_generation = self.database.computeGeneration();
+
+    var success = true;
+    for (self.jobs) |job| {
+        switch (job.result) {
+            .pending => unreachable,
+            .compiled, .up_to_date => if (self.manifest) |manifest| {
+                try manifest.put(job.input, .{ .hash = job.hash, .generation = final_generation });
+            },
+            .failed => {
+                success = false;
+                if (self.manifest) |manifest| {
+                    manifest.remove(job.input);
+                }
+            },
+        }
+    }
+    return success;
+}
+
+/// Runs all jobs that are still pending on `thread_count` threads.
+fn runJobs(self: *Self, thread_count: usize) void {
+    self.next_job = 0;
+
+    var threads_buffer: [64]std.Thread = undefined;
+    const worker_count = std.math.clamp(thread_count, 1, std.math.min(threads_buffer.len, self.jobs.len));
+
+    // The calling thread works as well, all others are spawned.
+    var spawned: usize = 0;
+    while (spawned + 1 < worker_count) {
+        threads_buffer[spawned] = std.Thread.spawn(.{}, worker, .{self}) catch break;
+        spawned += 1;
+    }
+
+    worker(self);
+
+    for (threads_buffer[0..spawned]) |thread| {
+        thread.join();
+    }
+}
+
+fn worker(self: *Self) void {
+    while (true) {
+        const index = @atomicRmw(usize, &self.next_job, .Add, 1, .SeqCst);
+        if (index >= self.jobs.len)
+            return;
+        const job = &self.jobs[index];
+        if (job.result != .pending)
+            continue;
+        self.processJob(job) catch |err| {
+            job.io_error = err;
+            job.result = .failed;
+        };
+    }
+}
+
+fn processJob(self: *Self, job: *Job) !void {
+    const source = try std.fs.cwd().readFileAlloc(self.allocator, job.input, 4 << 20);
+    defer self.allocator.free(source);
+
+    job.hash = computeInputHash(source, self.options);
+
+    if (self.manifest) |manifest| {
+        if (manifest.isUpToDate(job.input, job.hash, self.generation) and outputExists(job.output)) {
+            job.result = .up_to_date;
+            return;
+        }
+    }
+
+    job.compiler = Compiler.init(self.allocator, self.database);
+    const compiler = &job.compiler.?;
+
+    var data = std.ArrayList(u8).init(self.allocator);
+    defer data.deinit();
+
+    var stream = std.io.fixedBufferStream(source);
+    compiler.compile(stream.reader(), data.writer()) catch {
+        job.result = .failed;
+        return;
+    };
+    if (compiler.getErrors().len > 0) {
+        job.result = .failed;
+        return;
+    }
+
+    if (self.options.optimize) {
+        var optimized = std.ArrayList(u8).init(self.allocator);
+        errdefer optimized.deinit();
+
+        job.statistics = try Optimizer.optimize(self.allocator, data.items, optimized.writer());
+
+        data.deinit();
+        data = optimized;
+    }
+
+    var file = try std.fs.cwd().createFile(job.output, .{ .exclusive = false, .read = false });
+    defer file.close();
+
+    var buffered = std.io.bufferedWriter(file.writer());
+    try writeOutput(buffered.writer(), data.items, self.options.file_type);
+    try buffered.flush();
+
+    job.result = .compiled;
+}
+
+fn outputExists(path: []const u8) bool {
+    std.fs.cwd().access(path, .{}) catch return false;
+    return true;
+}
+
+fn computeInputHash(source: []const u8, options: Options) u64 {
+    var hasher = std.hash.Wyhash.init(0);
+    hasher.update(&[_]u8{ @enumToInt(options.file_type), @boolToInt(options.optimize) });
+    hasher.update(source);
+    return hasher.final();
+}
+
+/// Writes the compiled layout `data` in the format `file_type`.
+pub fn writeOutput(stream: anytype, data: []const u8, file_type: FileType) !void {
+    switch (file_type) {
+        .binary => try stream.writeAll(data),
+
+        .header => {
+            for (data) |c| {
+                try stream.print("0x{X}, ", .{c});
+            }
+        },
+    }
+}
+
+/// The build cache. Remembers the input hash and database generation of every layout
+/// that was compiled successfully.
+///
+/// The manifest is a text file with a line `<hash> <generation> <input path>` per input,
+/// both numbers are hexadecimal.
+pub const Manifest = struct {
+    pub const Entry = struct {
+        hash: u64,
+        generation: u64,
+    };
+
+    arena: std.heap.ArenaAllocator,
+    entries: std.StringArrayHashMapUnmanaged(Entry) = .{},
+
+    pub fn init(allocator: std.mem.Allocator) Manifest {
+        return Manifest{
+            .arena = std.heap.ArenaAllocator.init(allocator),
+        };
+    }
+
+    /// Loads a manifest. Malformed lines are ignored, the inputs are compiled again then.
+    pub fn parse(allocator: std.mem.Allocator, text: []const u8) !Manifest {
+        var manifest = init(allocator);
+        errdefer manifest.deinit();
+
+        var lines = std.mem.tokenize(u8, text, "\r\n");
+        while (lines.next()) |line| {
+            var parts = std.mem.split(u8, line, " ");
+            const hash = std.fmt.parseInt(u64, parts.next() orelse continue, 16) catch continue;
+            const generation = std.fmt.parseInt(u64, parts.next() orelse continue, 16) catch continue;
+            const path = parts.rest();
+            if (path.len == 0)
+                continue;
+            try manifest.put(path, .{ .hash = hash, .generation = generation });
+        }
+
+        return manifest;
+    }
+
+    pub fn deinit(self: *Manifest) void {
+        self.entries.deinit(self.arena.child_allocator);
+        self.arena.deinit();
+        self.* = undefined;
+    }
+
+    pub fn isUpToDate(self: Manifest, path: []const u8, hash: u64, generation: u64) bool {
+        const entry = self.entries.get(path) orelse return false;
+        return (entry.hash == hash) and (entry.generation == generation);
+    }
+
+    pub fn put(self: *Manifest, path: []const u8, entry: Entry) !void {
+        const gop = try self.entries.getOrPut(self.arena.child_allocator, path);
+        if (!gop.found_existing) {
+            gop.key_ptr.* = try self.arena.allocator().dupe(u8, path);
+        }
+        gop.value_ptr.* = entry;
+    }
+
+    pub fn remove(self: *Manifest, path: []const u8) void {
+        _ = self.entries.orderedRemove(path);
+    }
+
+    pub fn write(self: Manifest, writer: anytype) !void {
+        var iter = self.entries.iterator();
+        while (iter.next()) |item| {
+            try writer.print("{x:0>16} {x:0>16} {s}\n", .{
+                item.value_ptr.hash,
+                item.value_ptr.generation,
+                item.key_ptr.*,
+            });
+        }
+    }
+};
+
+test "manifest round trip" {
+    var manifest = Manifest.init(std.testing.allocator);
+    defer manifest.deinit();
+
+    try manifest.put("layouts/main.ui", .{ .hash = 0x1234, .generation = 0xABCD });
+    try manifest.put("layouts/list item.ui", .{ .hash = 0x5678, .generation = 0xABCD });
+
+    var buffer = std.ArrayList(u8).init(std.testing.allocator);
+    defer buffer.deinit();
+    try manifest.write(buffer.writer());
+
+    var loaded = try Manifest.parse(std.testing.allocator, buffer.items);
+    defer loaded.deinit();
+
+    try std.testing.expect(loaded.isUpToDate("layouts/main.ui", 0x1234, 0xABCD));
+    try std.testing.expect(loaded.isUpToDate("layouts/list item.ui", 0x5678, 0xABCD));
+    try std.testing.expect(!loaded.isUpToDate("layouts/main.ui", 0x1234, 0xABCE));
+    try std.testing.expect(!loaded.isUpToDate("layouts/other.ui", 0x1234, 0xABCD));
+}
+
+test "database generation ignores insertion order" {
+    var a = Database.init(std.testing.allocator, true);
+    defer a.deinit();
+    var b = Database.init(std.testing.allocator, true);
+    defer b.deinit();
+
+    _ = try a.get(.property, "first");
+    _ = try a.get(.object, "second");
+
+    try b.properties.put("first", 1);
+    try b.objects.put("second", 1);
+
+    try std.testing.expectEqual(a.computeGeneration(), b.computeGeneration());
+
+    _ = try a.get(.property, "third");
+    try std.testing.expect(a.computeGeneration() != b.computeGeneration());
+}
+
+test "deferred IDs are assigned in the order of the names" {
+    var a = Database.init(std.testing.allocator, true);
+    defer a.deinit();
+    var b = Database.init(std.testing.allocator, true);
+    defer b.deinit();
+
+    _ = try a.get(.property, "existing");
+    _ = try b.get(.property, "existing");
+
+    a.defer_new_items = true;
+    b.defer_new_items = true;
+
+    const provisional = (try a.get(.property, "second")).?;
+    _ = try a.get(.property, "first");
+    try std.testing.expectEqual(provisional, (try a.get(.property, "second")).?);
+
+    _ = try b.get(.property, "first");
+    _ = try b.get(.property, "second");
+
+    try std.testing.expect(try a.assignNewItems());
+    try std.testing.expect(try b.assignNewItems());
+    try std.testing.expect(!try a.assignNewItems());
+
+    try std.testing.expectEqual(@as(?u32, 2), try a.get(.property, "first"));
+    try std.testing.expectEqual(@as(?u32, 3), try a.get(.property, "second"));
+    try std.testing.expectEqual(a.computeGeneration(), b.computeGeneration());
+}
@@ -0,0 +1,281 @@
+//! Read-only view of a database in the binary format.
+//!
+//! The format is designed to be used straight from a memory mapped file. Lookups do a binary
+//! search and don't need any allocation. All integers are little endian `u32`:
+//!
+//! - Header: magic `DBID`, `version`, offset and length of the string pool
+//! - One section header per `Database.Entry`: offset of the entries, entry count, next free ID
+//! - The entries of each section, sorted by name: name offset into the string pool, name length, ID
+//! - The string pool with all names, back-to-back
+
+const std = @import("std");
+
+const Database = @import("Database.zig");
+const Entry = Database.Entry;
+
+const Self = @This();
+
+pub const magic = "DBID";
+pub const version = 1;
+
+const kinds = std.enums.values(Entry);
+
+const header_size = 16;
+const section_header_size = 12;
+const entry_size = 12;
+
+pub const Item = struct {
+    name: []const u8,
+    /// Offset of `name` in the string pool.
+    name_offset: u32,
+    id: u32,
+};
+
+pub const Section = struct {
+    entries: []const u8,
+    strings: []const u8,
+    count: u32,
+    next_id: u32,
+
+    pub fn getItem(self: Section, index: usize) Item {
+        const entry = self.entries[entry_size * index ..][0..entry_size];
+        const name_offset = readU32(entry, 0);
+        const name_length = readU32(entry, 4);
+        return Item{
+            .name = self.strings[name_offset..][0..name_length],
+            .name_offset = name_offset,
+            .id = readU32(entry, 8),
+        };
+    }
+
+    /// Returns the ID of `name` or `null` if it's not in the section.
+    pub fn find(self: Section, name: []const u8) ?u32 {
+        var left: usize = 0;
+        var right: usize = self.count;
+        while (left < right) {
+            const mid = left + (right - left) / 2;
+            const item = self.getItem(mid);
+            switch (std.mem.order(u8, item.name, name)) {
+                .eq => return item.id,
+                .lt => left = mid + 1,
+                .gt => right = mid,
+            }
+        }
+        return null;
+    }
+
+    pub fn iterator(self: Section) Iterator {
+        return Iterator{ .section = self };
+    }
+
+    pub const Iterator = struct {
+        section: Section,
+        index: usize = 0,
+
+        pub fn next(self: *Iterator) ?Item {
+            if (self.index >= self.section.count)
+                return null;
+            const item = self.section.getItem(self.index);
+            self.index += 1;
+            return item;
+        }
+    };
+};
+
+data: []const u8,
+strings: []const u8,
+
+pub fn isBinary(data: []const u8) bool {
+    return std.mem.startsWith(u8, data, magic);
+}
+
+/// Validates `data` and creates a view of it. The view references `data`.
+/// Lookups go by name, so the IDs are only checked for uniqueness when the view is loaded
+/// into a `Database`, which rejects an ID used by two names with `error.IdConflict`.
+pub fn init(data: []const u8) !Self {
+    if (data.len < header_size + kinds.len * section_header_size)
+        return error.InvalidDatabase;
+    if (!isBinary(data))
+        return error.InvalidDatabase;
+    if (readU32(data, 4) != version)
+        return error.UnsupportedVersion;
+
+    const self = Self{
+        .data = data,
+        .strings = try slice(data, readU32(data, 8), readU32(data, 12)),
+    };
+
+    for (kinds) |kind| {
+        const header = data[header_size + section_header_size * @enumToInt(kind) ..][0..section_header_size];
+        const count = readU32(header, 4);
+        _ = try slice(data, readU32(header, 0), std.math.mul(u32, count, entry_size) catch return error.InvalidDatabase);
+
+        const section = self.getSection(kind);
+
+        var previous: ?[]const u8 = null;
+        var i: usize = 0;
+        while (i < count) : (i += 1) {
+            const entry = section.entries[entry_size * i ..][0..entry_size];
+            const name = try slice(self.strings, readU32(entry, 0), readU32(entry, 4));
+            const id = readU32(entry, 8);
+            if (id == 0 or id >= section.next_id)
+                return error.InvalidDatabase;
+
+            // Lookups require the names to be sorted and unique.
+            if (previous) |prev| {
+                if (std.mem.order(u8, prev, name) != .lt)
+                    return error.InvalidDatabase;
+            }
+            previous = name;
+        }
+    }
+
+    return self;
+}
+
+pub fn getSection(self: Self, kind: Entry) Section {
+    const header = self.data[header_size + section_header_size * @enumToInt(kind) ..][0..section_header_size];
+    const count = readU32(header, 4);
+    return Section{
+        .entries = self.data[readU32(header, 0)..][0 .. entry_size * count],
+        .strings = self.strings,
+        .count = count,
+        .next_id = readU32(header, 8),
+    };
+}
+
+/// Returns the ID of `name` or `null` if the database doesn't contain it.
+pub fn get(self: Self, kind: Entry, name: []const u8) ?u32 {
+    return self.getSection(kind).find(name);
+}
+
+/// Writes `database` in the binary format. `allocator` is used for temporary allocations.
+pub fn write(allocator: std.mem.Allocator, database: *Database, writer: anytype) !void {
+    var sorted: [kinds.len][]Item = undefined;
+    for (sorted) |*items| {
+        items.* = &[_]Item{};
+    }
+    defer for (sorted) |items| {
+        allocator.free(items);
+    };
+
+    var entry_count: usize = 0;
+    var string_size: usize = 0;
+    for (kinds) |kind, k| {
+        const map = database.getMap(kind);
+        const items = try allocator.alloc(Item, map.count());
+        sorted[k] = items;
+
+        var iter = map.iterator();
+        for (items) |*item| {
+            const kv = iter.next().?;
+            item.* = Item{
+                .name = kv.key_ptr.*,
+                .name_offset = undefined,
+                .id = kv.value_ptr.*,
+            };
+        }
+        std.sort.sort(Item, items, {}, struct {
+            fn lessThan(_: void, lhs: Item, rhs: Item) bool {
+                return std.mem.lessThan(u8, lhs.name, rhs.name);
+            }
+        }.lessThan);
+
+        for (items) |*item| {
+            item.name_offset = std.math.cast(u32, string_size) orelse return error.DatabaseTooLarge;
+            string_size += item.name.len;
+        }
+        entry_count += items.len;
+    }
+
+    const entries_offset = header_size + kinds.len * section_header_size;
+    const strings_offset = entries_offset + entry_size * entry_count;
+    if (strings_offset + string_size > std.math.maxInt(u32))
+        return error.DatabaseTooLarge;
+
+    try writer.writeAll(magic);
+    try writer.writeIntLittle(u32, version);
+    try writer.writeIntLittle(u32, @intCast(u32, strings_offset));
+    try writer.writeIntLittle(u32, @intCast(u32, string_size));
+
+    var offset: usize = entries_offset;
+    for (kinds) |kind, k| {
+        try writer.writeIntLittle(u32, @intCast(u32, offset));
+        try writer.writeIntLittle(u32, @intCast(u32, sorted[k].len));
+        try writer.writeIntLittle(u32, database.next_ids.get(kind));
+        offset += entry_size * sorted[k].len;
+    }
+
+    for (sorted) |items| {
+        for (items) |item| {
+            try writer.writeIntLittle(u32, item.name_offset);
+            try writer.writeIntLittle(u32, @intCast(u32, item.name.len));
+            try writer.writeIntLittle(u32, item.id);
+        }
+    }
+
+    for (sorted) |items| {
+        for (items) |item| {
+            try writer.writeAll(item.name);
+        }
+    }
+}
+
+fn readU32(data: []const u8, offset: usize) u32 {
+    return std.mem.readIntLittle(u32, data[offset..][0..4]);
+}
+
+fn slice(data: []const u8, offset: u32, length: u32) ![]const u8 {
+    if (@as(u64, offset) + length > data.len)
+        return error.InvalidDatabase;
+    return data[offset..][0..length];
+}
+
+test "binary database round trip" {
+    var database = Database.init(std.testing.allocator, true);
+    defer database.deinit();
+
+    try database.importText(
+        \\property text
+        \\property visibility
+        \\object root 10
+        \\widget button 3
+        \\# comment
+        \\property enabled
+    );
+
+    var buffer = std.ArrayList(u8).init(std.testing.allocator);
+    defer buffer.deinit();
+    try database.toBinary(buffer.writer());
+
+    const view = try Self.init(buffer.items);
+    try std.testing.expectEqual(@as(?u32, 1), view.get(.property, "text"));
+    try std.testing.expectEqual(@as(?u32, 2), view.get(.property, "visibility"));
+    try std.testing.expectEqual(@as(?u32, 3), view.get(.property, "enabled"));
+    try std.testing.expectEqual(@as(?u32, 10), view.get(.object, "root"));
+    try std.testing.expectEqual(@as(?u32, 3), view.get(.widget, "button"));
+    try std.testing.expectEqual(@as(?u32, null), view.get(.property, "root"));
+    try std.testing.expectEqual(@as(?u32, null), view.get(.event, "text"));
+
+    var loaded = try Database.load(std.testing.allocator, true, buffer.items);
+    defer loaded.deinit();
+
+    try std.testing.expectEqual(database.computeGeneration(), loaded.computeGeneration());
+    try std.testing.expectEqual(@as(?u32, 11), try loaded.get(.object, "other"));
+    try std.testing.expectEqual(@as(?u32, 4), try loaded.get(.property, "other"));
+}
+
+test "invalid binary databases are rejected" {
+    try std.testing.expectError(error.InvalidDatabase, Self.init("DBID"));
+
+    var database = Database.init(std.testing.allocator, true);
+    defer database.deinit();
+    _ = try database.get(.resource, "image");
+
+    var buffer = std.ArrayList(u8).init(std.testing.allocator);
+    defer buffer.deinit();
+    try database.toBinary(buffer.writer());
+
+    // Cut off the string pool
+    try std.testing.expectError(error.InvalidDatabase, Self.init(buffer.items[0 .. buffer.items.len - 1]));
+}
@@ -0,0 +1,422 @@
+//! Generates Zig and C bindings for the identifiers in a `Database`.
+//!
+//! All IDs get a typed constant. Properties that are bound in a layout with `bind(…)` also get
+//! the type of the widget property they are bound to, so the bindings can encode their values
+//! directly into the wire format instead of going through a type-tagged value.
+
+const std = @import("std");
+const protocol = @import("dunstblick-protocol");
+
+const Database = @import("Database.zig");
+
+/// Maps a property ID to the type of the widget properties it is bound to.
+/// Filled by the `Parser` when it's passed one.
+pub const PropertyTypes = std.AutoHashMap(u32, protocol.Type);
+
+const Item = struct {
+    name: []const u8,
+    id: u32,
+};
+
+/// Returns all items of `kind` sorted by ID, so the generated files are stable.
+fn getSortedItems(allocator: std.mem.Allocator, database: *Database, kind: Database.Entry) ![]Item {
+    const map = database.getMap(kind);
+
+    const items = try allocator.alloc(Item, map.count());
+    errdefer allocator.free(items);
+
+    var iter = map.iterator();
+    for (items) |*item| {
+        const kv = iter.next().?;
+        item.* = Item{ .name = kv.key_ptr.*, .id = kv.value_ptr.* };
+    }
+
+    std.sort.sort(Item, items, {}, struct {
+        fn lessThan(_: void, lhs: Item, rhs: Item) bool {
+            return lhs.id < rhs.id;
+        }
+    }.lessThan);
+
+    return items;
+}
+
+const zig_namespaces = [_]struct { kind: Database.Entry, namespace: []const u8, id_type: []const u8 }{
+    .{ .kind = .resource, .namespace = "resources", .id_type = "ResourceID" },
+    .{ .kind = .event, .namespace = "events", .id_type = "EventID" },
+    .{ .kind = .object, .namespace = "objects", .id_type = "ObjectID" },
+    .{ .kind = .widget, .namespace = "widgets", .id_type = "WidgetName" },
+    .{ .kind = .property, .namespace = "properties", .id_type = "PropertyName" },
+};
+
+/// Writes a Zig file that declares a namespace per ID kind. Typed properties are
+/// declared as `protocol.TypedProperty`, which can be passed to `Object.setTypedProperty`.
+pub fn writeZig(allocator: std.mem.Allocator, database: *Database, types: *const PropertyTypes, writer: anytype) !void {
+    try writer.writeAll(
+        \\//! Generated by dunstblick-compiler --bindgen, do not edit!
+        \\
+        \\const protocol = @import("dunstblick-protocol");
+        \\
+    );
+
+    for (zig_namespaces) |ns| {
+        const items = try getSortedItems(allocator, database, ns.kind);
+        defer allocator.free(items);
+
+        try writer.print("\npub const {s} = struct {{\n", .{ns.namespace});
+        for (items) |item| {
+            const property_type = if (ns.kind == .property) types.get(item.id) else null;
+            if (property_type) |t| {
+                try writer.print("    pub const {} = protocol.TypedProperty(.{s}).init({d});\n", .{
+                    std.zig.fmtId(item.name),
+                    @tagName(t),
+                    item.id,
+                });
+            } else {
+                try writer.print("    pub const {} = @intToEnum(protocol.{s}, {d});\n", .{
+                    std.zig.fmtId(item.name),
+                    ns.id_type,
+                    item.id,
+                });
+            }
+        }
+        try writer.writeAll("};\n");
+    }
+}
+
+/// Formats `name` as a C identifier by replacing all invalid characters with `_`.
+fn fmtCName(name: []const u8, case: std.fmt.Case) std.fmt.Formatter(formatCName) {
+    return .{ .data = CName{ .name = name, .case = case } };
+}
+
+const CName = struct {
+    name: []const u8,
+    case: std.fmt.Case,
+};
+
+fn formatCName(data: CName, comptime fmt: []const u8, options: std.fmt.FormatOptions, writer: anytype) !void {
+    _ = fmt;
+    _ = options;
+    if (data.name.len == 0 or std.ascii.isDigit(data.name[0]))
+        try writer.writeByte('_');
+    for (data.name) |c| {
+        if (std.ascii.isAlNum(c)) {
+            try writer.writeByte(switch (data.case) {
+                .upper => std.ascii.toUpper(c),
+                .lower => std.ascii.toLower(c),
+            });
+        } else {
+            try writer.writeByte('_');
+        }
+    }
+}
+
+/// Returns the C type of a property value or `null` if the type is not supported by the C bindings.
+fn getCType(value_type: protocol.Type) ?[]const u8 {
+    return switch (value_type) {
+        .integer => "int32_t",
+        .number => "float",
+        .string => "char const *",
+        .enumeration => "uint8_t",
+        .margins => "struct dunstblick_Margins",
+        .color => "struct dunstblick_Color",
+        .size => "struct dunstblick_Size",
+        .point => "struct dunstblick_Point",
+        .resource => "dunstblick_ResourceID",
+        .boolean => "bool",
+        .object => "dunstblick_ObjectID",
+        .event => "dunstblick_EventID",
+        .widget => "dunstblick_WidgetName",
+        .sizelist, .objectlist => null,
+    };
+}
+
+/// Writes the C statements that encode `value` into `buffer` and advance `length`.
+fn writeCEncoder(writer: anytype, value_type: protocol.Type) !void {
+    switch (value_type) {
+        .integer => try writer.writeAll("    length += dunstblick_bindgen_put_varsint(buffer + length, value);\n"),
+        .number => try writer.writeAll("    memcpy(buffer + length, &value, 4);\n    length += 4;\n"),
+        .string => try writer.writeAll(
+            \\    length += dunstblick_bindgen_put_varuint(buffer + length, (uint32_t)string_length);
+            \\    memcpy(buffer + length, value, string_length);
+            \\    length += string_length;
+            \\
+        ),
+        .enumeration => try writer.writeAll("    buffer[length++] = value;\n"),
+        .boolean => try writer.writeAll("    buffer[length++] = value ? 1 : 0;\n"),
+        .margins => try writer.writeAll(
+            \\    length += dunstblick_bindgen_put_varuint(buffer + length, value.left);
+            \\    length += dunstblick_bindgen_put_varuint(buffer + length, value.top);
+            \\    length += dunstblick_bindgen_put_varuint(buffer + length, value.right);
+            \\    length += dunstblick_bindgen_put_varuint(buffer + length, value.bottom);
+            \\
+        ),
+        .color => try writer.writeAll(
+            \\    buffer[length++] = value.red;
+            \\    buffer[length++] = value.green;
+            \\    buffer[length++] = value.blue;
+            \\    buffer[length++] = value.alpha;
+            \\
+        ),
+        .size => try writer.writeAll(
+            \\    length += dunstblick_bindgen_put_varuint(buffer + length, value.width);
+            \\    length += dunstblick_bindgen_put_varuint(buffer + length, value.height);
+            \\
+        ),
+        .point => try writer.writeAll(
+            \\    length += dunstblick_bindgen_put_varsint(buffer + length, value.x);
+            \\    length += dunstblick_bindgen_put_varsint(buffer + length, value.y);
+            \\
+        ),
+        .resource, .object, .event, .widget => try writer.writeAll("    length += dunstblick_bindgen_put_varuint(buffer + length, value);\n"),
+        .sizelist, .objectlist => unreachable,
+    }
+}
+
+/// Writes the body of a setter function. `call` is the call to the raw encoded API without
+/// its last four arguments, which are the property, the type and the encoded value.
+fn writeCSetterBody(writer: anytype, value_type: protocol.Type, call: []const u8, property: std.fmt.Formatter(formatCName)) !void {
+    if (value_type == .string) {
+        // Short strings are encoded on the stack, long ones need a heap buffer.
+        try writer.writeAll(
+            \\    size_t const string_length = strlen(value);
+            \\    uint8_t stack_buffer[64];
+            \\    uint8_t *const buffer = (string_length + 5 <= sizeof stack_buffer) ? stack_buffer : (uint8_t *)malloc(string_length + 5);
+            \\    if (buffer == NULL)
+            \\        return DUNSTBLICK_ERROR_OUT_OF_MEMORY;
+            \\    size_t length = 0;
+            \\
+        );
+        try writeCEncoder(writer, value_type);
+        try writer.print(
+            \\    enum dunstblick_Error const result = {s}, PROPERTY_{}, {d}, buffer, length);
+            \\    if (buffer != stack_buffer)
+            \\        free(buffer);
+            \\    return result;
+            \\
+        , .{ call, property, @enumToInt(value_type) });
+    } else {
+        try writer.writeAll(
+            \\    uint8_t buffer[20];
+            \\    size_t length = 0;
+            \\
+        );
+        try writeCEncoder(writer, value_type);
+        try writer.print("    return {s}, PROPERTY_{}, {d}, buffer, length);\n", .{ call, property, @enumToInt(value_type) });
+    }
+}
+
+const c_prefixes = [_]struct { kind: Database.Entry, prefix: []const u8 }{
+    .{ .kind = .resource, .prefix = "RESOURCE" },
+    .{ .kind = .event, .prefix = "EVENT" },
+    .{ .kind = .object, .prefix = "OBJECT" },
+    .{ .kind = .widget, .prefix = "WIDGET" },
+    .{ .kind = .property, .prefix = "PROPERTY" },
+};
+
+/// Two names of the same kind that are sanitized to the same C identifier,
+/// for example `item-count` and `item_count`.
+pub const CNameCollision = struct {
+    kind: Database.Entry,
+    first: []const u8,
+    second: []const u8,
+
+    pub fn format(self: CNameCollision, comptime fmt: []const u8, options: std.fmt.FormatOptions, writer: anytype) !void {
+        _ = fmt;
+        _ = options;
+        const prefix = for (c_prefixes) |kind| {
+            if (kind.kind == self.kind)
+                break kind.prefix;
+        } else unreachable;
+        try writer.print("{s} names '{s}' and '{s}' both map to the C identifier {s}_{}", .{
+            @tagName(self.kind),
+            self.first,
+            self.second,
+            prefix,
+            fmtCName(self.first, .upper),
+        });
+    }
+};
+
+/// Returns the first pair of names that would get the same C identifier, or `null` if all are unique.
+/// The setters of the properties use the same name in lower case, so checking the defines is enough.
+pub fn findCNameCollision(allocator: std.mem.Allocator, database: *Database) !?CNameCollision {
+    var arena = std.heap.ArenaAllocator.init(allocator);
+    defer arena.deinit();
+
+    for (c_prefixes) |kind| {
+        const items = try getSortedItems(arena.allocator(), database, kind.kind);
+
+        var names = std.StringHashMap([]const u8).init(arena.allocator());
+        for (items) |item| {
+            const c_name = try std.fmt.allocPrint(arena.allocator(), "{}", .{fmtCName(item.name, .upper)});
+            const gop = try names.getOrPut(c_name);
+            if (gop.found_existing) {
+                return CNameCollision{ .kind = kind.kind, .first = gop.value_ptr.*, .second = item.name };
+            }
+            gop.value_ptr.* = item.name;
+        }
+    }
+    return null;
+}
+
+/// Writes a C header that defines all IDs as `<KIND>_<NAME>` and a pair of setters for each typed property:
+/// `set_<name>(connection, object_id, value)` and `set_object_<name>(object, value)`.
+/// Size lists and object lists have no setters, they must be set with a `dunstblick_Value`.
+/// Fails with `error.NameCollision` if two names map to the same C identifier, see `findCNameCollision()`.
+pub fn writeC(allocator: std.mem.Allocator, database: *Database, types: *const PropertyTypes, writer: anytype) !void {
+    if ((try findCNameCollision(allocator, database)) != null)
+        return error.NameCollision;
+
+    try writer.writeAll(
+        \\// Generated by dunstblick-compiler --bindgen, do not edit!
+        \\
+        \\#pragma once
+        \\
+        \\#include <dunstblick.h>
+        \\
+        \\#include <stdlib.h>
+        \\#include <string.h>
+        \\
+        \\static inline size_t dunstblick_bindgen_put_varuint(uint8_t *out, uint32_t value) {
+        \\    size_t len = 1;
+        \\    while (len < 5 && (value >> (7 * len)) != 0)
+        \\        len++;
+        \\    for (size_t i = 0; i < len; i++) {
+        \\        uint8_t chr = (value >> (7 * (len - i - 1))) & 0x7F;
+        \\        out[i] = (i + 1 < len) ? (chr | 0x80) : chr;
+        \\    }
+        \\    return len;
+        \\}
+        \\
+        \\static inline size_t dunstblick_bindgen_put_varsint(uint8_t *out, int32_t value) {
+        \\    return dunstblick_bindgen_put_varuint(out, ((uint32_t)value << 1) ^ (value < 0 ? 0xFFFFFFFFu : 0u));
+        \\}
+        \\
+    );
+
+    for (c_prefixes) |kind| {
+        const items = try getSortedItems(allocator, database, kind.kind);
+        defer allocator.free(items);
+
+        try writer.writeByte('\n');
+        for (items) |item| {
+            try writer.print("#define {s}_{} {d}\n", .{ kind.prefix, fmtCName(item.name, .upper), item.id });
+        }
+    }
+
+    const properties = try getSortedItems(allocator, database, .property);
+    defer allocator.free(properties);
+
+    for (properties) |item| {
+        const value_type = types.get(item.id) orelse continue;
+        const c_type = getCType(value_type) orelse continue;
+
+        const name = fmtCName(item.name, .lower);
+        const define = fmtCName(item.name, .upper);
+
+        try writer.print("\nstatic inline enum dunstblick_Error set_{}(struct dunstblick_Connection *connection, dunstblick_ObjectID object, {s} value) {{\n", .{ name, c_type });
+        try writeCSetterBody(writer, value_type, "dunstblick_SetEncodedProperty(connection, object", define);
+        try writer.writeAll("}\n");
+
+        try writer.print("\nstatic inline enum dunstblick_Error set_object_{}(struct dunstblick_Object *object, {s} value) {{\n", .{ name, c_type });
+        try writeCSetterBody(writer, value_type, "dunstblick_SetEncodedObjectProperty(object", define);
+        try writer.writeAll("}\n");
+    }
+}
+
+fn expectContains(haystack: []const u8, needle: []const u8) !void {
+    if (std.mem.indexOf(u8, haystack, needle) == null) {
+        std.debug.print("'{s}' not found in:\n{s}\n", .{ needle, haystack });
+        return error.TestExpectedContains;
+    }
+}
+
+test "zig bindings" {
+    var database = Database.init(std.testing.allocator, true);
+    defer database.deinit();
+    try database.importText(
+        \\property text
+        \\property count
+        \\property unbound
+        \\object root
+        \\event click-me
+    );
+
+    var types = PropertyTypes.init(std.testing.allocator);
+    defer types.deinit();
+    try types.put(1, .string);
+    try types.put(2, .integer);
+
+    var output = std.ArrayList(u8).init(std.testing.allocator);
+    defer output.deinit();
+    try writeZig(std.testing.allocator, &database, &types, output.writer());
+
+    try expectContains(output.items, "pub const text = protocol.TypedProperty(.string).init(1);\n");
+    try expectContains(output.items, "pub const count = protocol.TypedProperty(.integer).init(2);\n");
+    try expectContains(output.items, "pub const unbound = @intToEnum(protocol.PropertyName, 3);\n");
+    try expectContains(output.items, "pub const root = @intToEnum(protocol.ObjectID, 1);\n");
+    try expectContains(output.items, "pub const @\"click-me\" = @intToEnum(protocol.EventID, 1);\n");
+}
+
+test "c bindings" {
+    var database = Database.init(std.testing.allocator, true);
+    defer database.deinit();
+    try database.importText(
+        \\property text
+        \\property item-count
+        \\property children
+        \\event click-me
+    );
+
+    var types = PropertyTypes.init(std.testing.allocator);
+    defer types.deinit();
+    try types.put(1, .string);
+    try types.put(2, .integer);
+    try types.put(3, .objectlist);
+
+    var output = std.ArrayList(u8).init(std.testing.allocator);
+    defer output.deinit();
+    try writeC(std.testing.allocator, &database, &types, output.writer());
+
+    try expectContains(output.items, "#define EVENT_CLICK_ME 1\n");
+    try expectContains(output.items, "#define PROPERTY_ITEM_COUNT 2\n");
+    try expectContains(output.items, "set_text(struct dunstblick_Connection *connection, dunstblick_ObjectID object, char const * value)");
+    try expectContains(output.items, "set_object_item_count(struct dunstblick_Object *object, int32_t value)");
+    try expectContains(output.items, "dunstblick_SetEncodedProperty(connection, object, PROPERTY_ITEM_COUNT, 1, buffer, length)");
+    try std.testing.expect(std.mem.indexOf(u8, output.items, "set_children") == null);
+}
+
+test "c names must be unique" {
+    var database = Database.init(std.testing.allocator, true);
+    defer database.deinit();
+    try database.importText(
+        \\property item-count
+        \\property item_count
+        \\event click
+    );
+
+    var types = PropertyTypes.init(std.testing.allocator);
+    defer types.deinit();
+
+    const collision = (try findCNameCollision(std.testing.allocator, &database)).?;
+    try std.testing.expectEqual(Database.Entry.property, collision.kind);
+    try std.testing.expectEqualStrings("item-count", collision.first);
+    try std.testing.expectEqualStrings("item_count", collision.second);
+
+    var message = std.ArrayList(u8).init(std.testing.allocator);
+    defer message.deinit();
+    try message.writer().print("{}", .{collision});
+    try std.testing.expectEqualStrings("property names 'item-count' and 'item_count' both map to the C identifier PROPERTY_ITEM_COUNT", message.items);
+
+    try std.testing.expectError(error.NameCollision, writeC(std.testing.allocator, &database, &types, std.io.null_writer));
+
+    // names that only differ in case collide as well
+    var other = Database.init(std.testing.allocator, true);
+    defer other.deinit();
+    try other.importText(
+        \\widget Title
+        \\widget title
+        \\object title
+    );
+    try std.testing.expectEqual(Database.Entry.widget, (try findCNameCollision(std.testing.allocator, &other)).?.kind);
+}
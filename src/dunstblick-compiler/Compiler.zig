@@ -7,12 +7,16 @@ pub const Tokenizer = @import("Tokenizer.zig");
 pub const Database = @import("Database.zig");
 pub const Parser = @import("Parser.zig");
 pub const ErrorCollection = @import("ErrorCollection.zig");
+pub const Bindgen = @import("Bindgen.zig");
 
 allocator: std.mem.Allocator,
 database: *Database,
 
 errors: ErrorCollection,
 
+/// When set, the types of all bound properties are recorded, see `Bindgen`.
+property_types: ?*Bindgen.PropertyTypes = null,
+
 pub fn init(allocator: std.mem.Allocator, database: *Database) Self {
     return Self{
         .allocator = allocator,
@@ -39,6 +43,7 @@ pub fn compile(self: *Self, reader: anytype, writer: anytype) !void {
 
         .errors = &self.errors,
         .tokens = &tokenIterator,
+        .property_types = self.property_types,
     };
 
     parser.parseFile(writer) catch |err| {
@@ -1,5 +1,7 @@
 const std = @import("std");
 
+const BinaryDatabase = @import("BinaryDatabase.zig");
+
 const Self = @This();
 const IDMap = std.StringHashMap(u32);
 
@@ -11,15 +13,35 @@ pub const Entry = enum {
     widget,
 };
 
+pub const Format = enum { json, binary };
+
 arena: std.heap.ArenaAllocator,
 allow_new_items: bool,
 
+/// Serializes `get()`, so several compilers can share the database.
+mutex: std.Thread.Mutex = .{},
+
 resources: IDMap,
 events: IDMap,
 properties: IDMap,
 objects: IDMap,
 widgets: IDMap,
 
+/// The ID the next new item of each kind receives. Always larger than all IDs of that kind.
+next_ids: std.EnumArray(Entry, u32) = std.EnumArray(Entry, u32).initFill(1),
+
+/// The name of every assigned ID, so `insert()` can reject an ID that is used by another name.
+names_by_id: std.EnumArray(Entry, std.AutoHashMapUnmanaged(u32, []const u8)) = std.EnumArray(Entry, std.AutoHashMapUnmanaged(u32, []const u8)).initFill(.{}),
+
+/// While set, `get()` gives new items a provisional ID from the top of the ID range, and
+/// `assignNewItems()` assigns the final IDs. Compilers running in parallel find new items
+/// in any order, this keeps the IDs independent of it.
+defer_new_items: bool = false,
+/// The items that received a provisional ID, see `defer_new_items`.
+deferred_items: std.EnumArray(Entry, std.ArrayListUnmanaged([]const u8)) = std.EnumArray(Entry, std.ArrayListUnmanaged([]const u8)).initFill(.{}),
+/// The provisional ID the next deferred item receives.
+next_provisional_id: u32 = std.math.maxInt(u32),
+
 /// Initializes a new database.
 /// - `allocator` will be used to do Database-local allocations.
 /// - `allow_new_items` declares that the database is allowed to insert new IDs on a call to `get` instead of returning `null`.
@@ -38,6 +60,10 @@ pub fn init(allocator: std.mem.Allocator, allow_new_items: bool) Self {
 }
 
 pub fn deinit(self: *Self) void {
+    for (std.enums.values(Entry)) |kind| {
+        self.deferred_items.getPtr(kind).deinit(self.arena.child_allocator);
+        self.names_by_id.getPtr(kind).deinit(self.arena.child_allocator);
+    }
     self.resources.deinit();
     self.events.deinit();
     self.properties.deinit();
@@ -46,7 +72,7 @@ pub fn deinit(self: *Self) void {
     self.arena.deinit();
 }
 
-fn getMap(self: *Self, kind: Entry) *IDMap {
+pub fn getMap(self: *Self, kind: Entry) *IDMap {
     return switch (kind) {
         .resource => &self.resources,
         .event => &self.events,
@@ -57,25 +83,32 @@ fn getMap(self: *Self, kind: Entry) *IDMap {
 }
 
 pub fn get(self: *Self, kind: Entry, name: []const u8) !?u32 {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+
     const map = self.getMap(kind);
     if (self.allow_new_items) {
         const gop = try map.getOrPut(name);
         if (!gop.found_existing) {
             errdefer _ = map.remove(name);
 
+            const next_id = self.next_ids.getPtr(kind);
+            if (next_id.* == std.math.maxInt(u32))
+                return error.OutOfIds;
+
             // Insert into memory
             gop.key_ptr.* = try self.dupe(name);
-
-            // As we will find ourselves in the map as well,
-            // we will increment that zero to 1
-            gop.value_ptr.* = 0;
-            var iter = map.iterator();
-            while (iter.next()) |item| {
-                if (gop.value_ptr.* < item.value_ptr.*) {
-                    gop.value_ptr.* = item.value_ptr.*;
-                }
+            if (self.defer_new_items) {
+                if (self.next_provisional_id <= next_id.*)
+                    return error.OutOfIds;
+                try self.deferred_items.getPtr(kind).append(self.arena.child_allocator, gop.key_ptr.*);
+                gop.value_ptr.* = self.next_provisional_id;
+                self.next_provisional_id -= 1;
+            } else {
+                try self.names_by_id.getPtr(kind).putNoClobber(self.arena.child_allocator, next_id.*, gop.key_ptr.*);
+                gop.value_ptr.* = next_id.*;
+                next_id.* += 1;
             }
-            gop.value_ptr.* += 1;
             std.debug.assert(gop.value_ptr.* >= 1);
         }
         return gop.value_ptr.*;
@@ -84,11 +117,273 @@ pub fn get(self: *Self, kind: Entry, name: []const u8) !?u32 {
     }
 }
 
+/// Replaces the provisional IDs of the items added while `defer_new_items` was set. The items
+/// of each kind get the next free IDs in the order of their names. Clears `defer_new_items`
+/// and returns `true` if any item was added.
+pub fn assignNewItems(self: *Self) !bool {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+
+    self.defer_new_items = false;
+    self.next_provisional_id = std.math.maxInt(u32);
+
+    var any_added = false;
+    for (std.enums.values(Entry)) |kind| {
+        const names = self.deferred_items.getPtr(kind);
+        defer names.clearRetainingCapacity();
+
+        std.sort.sort([]const u8, names.items, {}, struct {
+            fn lessThan(_: void, lhs: []const u8, rhs: []const u8) bool {
+                return std.mem.lessThan(u8, lhs, rhs);
+            }
+        }.lessThan);
+
+        const map = self.getMap(kind);
+        const next_id = self.next_ids.getPtr(kind);
+        try self.names_by_id.getPtr(kind).ensureUnusedCapacity(self.arena.child_allocator, @intCast(u32, names.items.len));
+        for (names.items) |name| {
+            if (next_id.* == std.math.maxInt(u32))
+                return error.OutOfIds;
+            map.getPtr(name).?.* = next_id.*;
+            self.names_by_id.getPtr(kind).putAssumeCapacityNoClobber(next_id.*, name);
+            next_id.* += 1;
+        }
+        any_added = any_added or (names.items.len > 0);
+    }
+    return any_added;
+}
+
+/// Computes a hash of all IDs in the database. Compiled layouts are valid as long as
+/// the generation doesn't change. Adding IDs changes the generation as well, but doesn't
+/// invalidate layouts that were compiled before, as existing IDs are never changed.
+pub fn computeGeneration(self: *Self) u64 {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+
+    // Entries are combined order independent, so the generation doesn't depend
+    // on the order the database was loaded in.
+    var generation: u64 = 0;
+    for (std.enums.values(Entry)) |kind| {
+        var iter = self.getMap(kind).iterator();
+        while (iter.next()) |item| {
+            var hasher = std.hash.Wyhash.init(@enumToInt(kind));
+            hasher.update(item.key_ptr.*);
+            hasher.update(std.mem.asBytes(item.value_ptr));
+            generation +%= hasher.final();
+        }
+    }
+    return generation;
+}
+
+/// Inserts `name` with a fixed `id`, independent of `allow_new_items`. Returns `error.IdConflict`
+/// when `name` already has another ID, or `id` belongs to another name.
+/// The memory of `name` must outlive the database.
+fn insert(self: *Self, kind: Entry, name: []const u8, id: u32) !void {
+    const names = self.names_by_id.getPtr(kind);
+    const name_gop = try names.getOrPut(self.arena.child_allocator, id);
+    if (name_gop.found_existing and !std.mem.eql(u8, name_gop.value_ptr.*, name))
+        return error.IdConflict;
+    errdefer if (!name_gop.found_existing) names.removeByPtr(name_gop.key_ptr);
+
+    const gop = try self.getMap(kind).getOrPut(name);
+    if (gop.found_existing) {
+        if (gop.value_ptr.* != id)
+            return error.IdConflict;
+        return;
+    }
+    gop.key_ptr.* = name;
+    gop.value_ptr.* = id;
+    name_gop.value_ptr.* = name;
+
+    const next_id = self.next_ids.getPtr(kind);
+    if (id >= next_id.*) {
+        next_id.* = id +| 1;
+    }
+}
+
 pub fn iterator(self: *Self, kind: Entry) IDMap.Iterator {
     const map = self.getMap(kind);
     return map.iterator();
 }
 
+/// Returns the format of a stored database. Binary databases start with a magic number,
+/// everything else is expected to be JSON.
+pub fn detectFormat(data: []const u8) Format {
+    return if (BinaryDatabase.isBinary(data)) .binary else .json;
+}
+
+/// Loads a database stored in any of the supported formats.
+pub fn load(allocator: std.mem.Allocator, allow_new_items: bool, data: []const u8) !Self {
+    return switch (detectFormat(data)) {
+        .json => try fromJson(allocator, allow_new_items, data),
+        .binary => try fromBinary(allocator, allow_new_items, data),
+    };
+}
+
+pub fn save(self: *Self, writer: anytype, format: Format) !void {
+    switch (format) {
+        .json => try self.toJson(writer),
+        .binary => try self.toBinary(writer),
+    }
+}
+
+/// Loads a database from the binary format, see `BinaryDatabase`.
+/// - `allocator` will be used to do both function local as well as Database-local allocations.
+/// - `allow_new_items` is the same as in `init()`
+/// - `data` is the binary database. It isn't referenced after the call, so it can be unmapped.
+pub fn fromBinary(allocator: std.mem.Allocator, allow_new_items: bool, data: []const u8) !Self {
+    const view = try BinaryDatabase.init(data);
+
+    var db = init(allocator, allow_new_items);
+    errdefer db.deinit();
+
+    // The names are stored back-to-back in the file, so a single copy of the string pool
+    // holds all of them.
+    const strings = try db.arena.allocator().dupe(u8, view.strings);
+
+    for (std.enums.values(Entry)) |kind| {
+        const section = view.getSection(kind);
+        try db.getMap(kind).ensureTotalCapacity(section.count);
+
+        var iter = section.iterator();
+        while (iter.next()) |item| {
+            try db.insert(kind, strings[item.name_offset..][0..item.name.len], item.id);
+        }
+        db.next_ids.set(kind, std.math.max(db.next_ids.get(kind), section.next_id));
+    }
+
+    return db;
+}
+
+/// Writes the database in the binary format, see `BinaryDatabase`.
+pub fn toBinary(self: *Self, writer: anytype) !void {
+    try BinaryDatabase.write(self.arena.child_allocator, self, writer);
+}
+
+/// Adds items from a text file to the database. Each line has the form `kind name` or
+/// `kind name id`, where `kind` is one of the `Entry` names. Items without an explicit ID
+/// get the next free one. Empty lines and lines starting with `#` are ignored.
+/// Names with whitespace or quotes are written in double quotes, see `writeName()`.
+pub fn importText(self: *Self, text: []const u8) !void {
+    var name_buffer = std.ArrayList(u8).init(self.arena.child_allocator);
+    defer name_buffer.deinit();
+
+    var lines = std.mem.tokenize(u8, text, "\r\n");
+    while (lines.next()) |line| {
+        var parts = std.mem.tokenize(u8, line, " \t");
+        const kind_name = parts.next() orelse continue;
+        if (kind_name[0] == '#')
+            continue;
+
+        const kind = std.meta.stringToEnum(Entry, kind_name) orelse return error.InvalidKind;
+
+        const rest = parts.rest();
+        const name = if (std.mem.startsWith(u8, rest, "\"")) blk: {
+            name_buffer.shrinkRetainingCapacity(0);
+            const length = try parseQuotedName(rest, &name_buffer);
+            if (length < rest.len and rest[length] != ' ' and rest[length] != '\t')
+                return error.InvalidLine;
+            parts.index = (@ptrToInt(rest.ptr) - @ptrToInt(line.ptr)) + length;
+            break :blk name_buffer.items;
+        } else parts.next() orelse return error.MissingName;
+
+        if (parts.next()) |id_text| {
+            const id = std.fmt.parseInt(u32, id_text, 10) catch return error.InvalidId;
+            if (id == 0)
+                return error.InvalidId;
+            if (self.getMap(kind).get(name)) |existing| {
+                if (existing != id)
+                    return error.IdConflict;
+            } else {
+                try self.insert(kind, try self.dupe(name), id);
+            }
+        } else {
+            const allow_new_items = self.allow_new_items;
+            self.allow_new_items = true;
+            defer self.allow_new_items = allow_new_items;
+
+            _ = try self.get(kind, name);
+        }
+
+        if (parts.next() != null)
+            return error.InvalidLine;
+    }
+}
+
+/// Writes all items in the format accepted by `importText`, sorted by kind and ID.
+pub fn exportText(self: *Self, writer: anytype) !void {
+    var items = std.ArrayList(IDMap.Entry).init(self.arena.child_allocator);
+    defer items.deinit();
+
+    for (std.enums.values(Entry)) |kind| {
+        items.shrinkRetainingCapacity(0);
+
+        var iter = self.getMap(kind).iterator();
+        while (iter.next()) |item| {
+            try items.append(item);
+        }
+
+        std.sort.sort(IDMap.Entry, items.items, {}, struct {
+            fn lessThan(_: void, lhs: IDMap.Entry, rhs: IDMap.Entry) bool {
+                return lhs.value_ptr.* < rhs.value_ptr.*;
+            }
+        }.lessThan);
+
+        for (items.items) |item| {
+            try writer.print("{s} ", .{@tagName(kind)});
+            try writeName(writer, item.key_ptr.*);
+            try writer.print(" {d}\n", .{item.value_ptr.*});
+        }
+    }
+}
+
+/// Writes `name` for `importText()`. Names that aren't a single word are put in double
+/// quotes, where `\\`, `\"`, `\n`, `\r` and `\t` escape the special characters.
+fn writeName(writer: anytype, name: []const u8) !void {
+    if (name.len > 0 and std.mem.indexOfAny(u8, name, " \t\r\n\"\\") == null)
+        return writer.writeAll(name);
+
+    try writer.writeByte('"');
+    for (name) |c| {
+        switch (c) {
+            '"' => try writer.writeAll("\\\""),
+            '\\' => try writer.writeAll("\\\\"),
+            '\n' => try writer.writeAll("\\n"),
+            '\r' => try writer.writeAll("\\r"),
+            '\t' => try writer.writeAll("\\t"),
+            else => try writer.writeByte(c),
+        }
+    }
+    try writer.writeByte('"');
+}
+
+/// Decodes a name written by `writeName()` at the start of `text` into `name`.
+/// Returns the number of bytes of `text` that were consumed.
+fn parseQuotedName(text: []const u8, name: *std.ArrayList(u8)) !usize {
+    std.debug.assert(text[0] == '"');
+
+    var i: usize = 1;
+    while (i < text.len) : (i += 1) {
+        switch (text[i]) {
+            '"' => return i + 1,
+            '\\' => {
+                i += 1;
+                if (i >= text.len)
+                    return error.InvalidName;
+                try name.append(switch (text[i]) {
+                    '"', '\\' => text[i],
+                    'n' => '\n',
+                    'r' => '\r',
+                    't' => '\t',
+                    else => return error.InvalidName,
+                });
+            },
+            else => |c| try name.append(c),
+        }
+    }
+    return error.InvalidName;
+}
+
 /// Loads a new database from a json file.
 /// - `allocator` will be used to do both function local as well as Database-local allocations.
 /// - `allow_new_items` is the same as in `init()`
@@ -109,11 +404,11 @@ pub fn fromJson(allocator: std.mem.Allocator, allow_new_items: bool, json: []con
     var db = init(allocator, allow_new_items);
     errdefer db.deinit();
 
-    try db.loadIdMap(config, "resources", &db.resources);
-    try db.loadIdMap(config, "callbacks", &db.events);
-    try db.loadIdMap(config, "properties", &db.properties);
-    try db.loadIdMap(config, "objects", &db.objects);
-    try db.loadIdMap(config, "widgets", &db.widgets);
+    try db.loadIdMap(config, "resources", .resource);
+    try db.loadIdMap(config, "callbacks", .event);
+    try db.loadIdMap(config, "properties", .property);
+    try db.loadIdMap(config, "objects", .object);
+    try db.loadIdMap(config, "widgets", .widget);
 
     return db;
 }
@@ -122,11 +417,13 @@ fn dupe(self: *Self, str: []const u8) ![]u8 {
     return self.arena.allocator().dupe(u8, str);
 }
 
-fn loadIdMap(self: *Self, config: std.json.ValueTree, key: []const u8, map: *IDMap) !void {
+fn loadIdMap(self: *Self, config: std.json.ValueTree, key: []const u8, kind: Entry) !void {
     if (config.root.Object.get(key)) |value| {
+        try self.getMap(kind).ensureTotalCapacity(value.Object.count());
+
         var items = value.Object.iterator();
         while (items.next()) |kv| {
-            try map.put(try self.dupe(kv.key_ptr.*), @intCast(u32, kv.value_ptr.Integer));
+            try self.insert(kind, try self.dupe(kv.key_ptr.*), @intCast(u32, kv.value_ptr.Integer));
         }
     }
 }
@@ -138,6 +435,9 @@ fn validateObjectMap(list: std.json.Value) !void {
     while (iter.next()) |kv| {
         if (kv.value_ptr.* != .Integer)
             return error.InvalidConfig;
+        // same range as in `importText()`, 0 is never a valid ID
+        if (kv.value_ptr.Integer < 1 or kv.value_ptr.Integer > std.math.maxInt(u32))
+            return error.InvalidConfig;
     }
 }
 
@@ -200,3 +500,61 @@ pub fn toJson(self: Self, writer: anytype) !void {
     any = (try writeJsonMap(any, "widgets", self.widgets, writer)) or any;
     try writer.writeAll("\n}\n");
 }
+
+test "an ID can't be used by two names" {
+    var database = init(std.testing.allocator, false);
+    defer database.deinit();
+
+    try database.importText("property text 3");
+    try std.testing.expectError(error.IdConflict, database.importText("property title 3"));
+    try std.testing.expectError(error.IdConflict, database.importText("property text 4"));
+    try database.importText("property text 3\nobject text 3");
+
+    try std.testing.expectEqual(@as(?u32, null), try database.get(.property, "title"));
+
+    // new items never reuse an ID
+    try database.importText("property title");
+    try std.testing.expectEqual(@as(?u32, 4), try database.get(.property, "title"));
+    try std.testing.expectError(error.IdConflict, database.importText("property other 4"));
+}
+
+test "json IDs must be in range" {
+    for ([_][]const u8{
+        "{ \"properties\": { \"text\": 0 } }",
+        "{ \"properties\": { \"text\": -1 } }",
+        "{ \"objects\": { \"text\": 4294967296 } }",
+    }) |json| {
+        try std.testing.expectError(error.InvalidJsonDocument, fromJson(std.testing.allocator, false, json));
+    }
+
+    var database = try fromJson(std.testing.allocator, false, "{ \"properties\": { \"text\": 7 } }");
+    defer database.deinit();
+    try std.testing.expectEqual(@as(?u32, 7), try database.get(.property, "text"));
+}
+
+test "text export round trip" {
+    var database = init(std.testing.allocator, true);
+    defer database.deinit();
+
+    try database.importText(
+        \\property text
+        \\property "item count" 5
+        \\event "say \"hi\"\t\\"
+        \\object #hash
+    );
+    try std.testing.expectEqual(@as(?u32, 5), try database.get(.property, "item count"));
+    try std.testing.expectEqual(@as(?u32, 1), try database.get(.event, "say \"hi\"\t\\"));
+
+    var buffer = std.ArrayList(u8).init(std.testing.allocator);
+    defer buffer.deinit();
+    try database.exportText(buffer.writer());
+
+    var loaded = init(std.testing.allocator, false);
+    defer loaded.deinit();
+    try loaded.importText(buffer.items);
+
+    try std.testing.expectEqual(database.computeGeneration(), loaded.computeGeneration());
+
+    try std.testing.expectError(error.InvalidName, loaded.importText("property \"unterminated"));
+    try std.testing.expectError(error.InvalidLine, loaded.importText("property \"a\"b"));
+}
@@ -0,0 +1,477 @@
+//! Shrinks compiled layouts without changing the widget tree the client creates from them.
+//!
+//! - Properties that have the default value of their widget, that are set again later or
+//!   that don't exist on their widget are dropped.
+//! - The remaining properties are sorted by property and value kind, so equal widgets are
+//!   encoded the same way, no matter in which order their properties were written.
+//! - Subtrees that are identical to a subtree written before are replaced by a reference
+//!   to that subtree (see `layout_format.subtree_reference_tag`), as long as the reference
+//!   is smaller than the subtree.
+
+const std = @import("std");
+
+const protocol = @import("dunstblick-protocol");
+const layout_format = protocol.layout_format;
+
+const WidgetType = protocol.WidgetType;
+const Property = protocol.Property;
+const Enum = protocol.Enum;
+
+pub const Statistics = struct {
+    input_size: usize = 0,
+    output_size: usize = 0,
+    /// Properties that were removed from the layout.
+    dropped_properties: usize = 0,
+    /// Subtrees that were replaced by a reference.
+    shared_subtrees: usize = 0,
+
+    pub fn format(self: Statistics, comptime fmt: []const u8, options: std.fmt.FormatOptions, writer: anytype) !void {
+        _ = fmt;
+        _ = options;
+
+        const saved = if (self.input_size > 0)
+            100.0 * @intToFloat(f32, self.input_size - self.output_size) / @intToFloat(f32, self.input_size)
+        else
+            0.0;
+
+        try writer.print("{d} -> {d} bytes ({d:.1}% saved), {d} properties dropped, {d} subtrees shared", .{
+            self.input_size,
+            self.output_size,
+            saved,
+            self.dropped_properties,
+            self.shared_subtrees,
+        });
+    }
+};
+
+pub const OptimizeError = error{
+    OutOfMemory,
+    EndOfStream,
+    InvalidLayout,
+};
+
+/// How a property gets its value. A property can have a value and either a binding or an
+/// expression, which computes the value in the display client.
+const ValueKind = enum(u8) { value, binding, expression };
+
+const PropertyEntry = struct {
+    property: Property,
+    kind: ValueKind,
+    /// The encoded property, including the tag.
+    data: []const u8,
+
+    fn lessThan(_: void, lhs: PropertyEntry, rhs: PropertyEntry) bool {
+        if (lhs.property != rhs.property)
+            return @enumToInt(lhs.property) < @enumToInt(rhs.property);
+        return @enumToInt(lhs.kind) < @enumToInt(rhs.kind);
+    }
+};
+
+const Node = struct {
+    widget_type: WidgetType,
+    properties: []const PropertyEntry,
+    children: []const Node,
+    /// The optimized encoding of the subtree, without any references.
+    /// Identical subtrees have identical encodings.
+    encoded: []const u8,
+};
+
+/// Optimizes the compiled `layout` and writes the result into `writer`.
+pub fn optimize(allocator: std.mem.Allocator, layout: []const u8, writer: anytype) !Statistics {
+    var arena = std.heap.ArenaAllocator.init(allocator);
+    defer arena.deinit();
+
+    var stats = Statistics{ .input_size = layout.len };
+
+    var decoder = protocol.Decoder.init(layout);
+    const root_type = std.meta.intToEnum(WidgetType, try decoder.readByte()) catch return error.InvalidLayout;
+    const root = try parseWidget(arena.allocator(), &decoder, root_type, &stats);
+    if (decoder.offset != layout.len)
+        return error.InvalidLayout;
+
+    var output = std.ArrayList(u8).init(arena.allocator());
+    var shared = std.StringHashMap(u32).init(arena.allocator());
+
+    try emitWidget(&output, &shared, root, &stats);
+
+    try writer.writeAll(output.items);
+    stats.output_size = output.items.len;
+
+    return stats;
+}
+
+fn parseWidget(allocator: std.mem.Allocator, decoder: *protocol.Decoder, widget_type: WidgetType, stats: *Statistics) OptimizeError!Node {
+    var properties = std.ArrayList(PropertyEntry).init(allocator);
+    while (true) {
+        const start = decoder.offset;
+        const tag = try decoder.readByte();
+        if (tag == 0)
+            break;
+
+        const property = std.meta.intToEnum(Property, tag & 0x7F) catch return error.InvalidLayout;
+
+        var kind = ValueKind.value;
+        if ((tag & 0x80) != 0) {
+            kind = .binding;
+            if ((try decoder.readVarUInt()) == 0) {
+                kind = .expression;
+                _ = protocol.expression.read(decoder) catch |err| switch (err) {
+                    error.EndOfStream => return error.EndOfStream,
+                    else => return error.InvalidLayout,
+                };
+            }
+        } else {
+            var value = protocol.Value.deserialize(allocator, getTypeOfProperty(property), decoder) catch |err| switch (err) {
+                error.OutOfMemory => return error.OutOfMemory,
+                error.EndOfStream => return error.EndOfStream,
+                else => return error.InvalidLayout,
+            };
+            value.deinit();
+        }
+
+        try properties.append(PropertyEntry{
+            .property = property,
+            .kind = kind,
+            .data = decoder.source[start..decoder.offset],
+        });
+    }
+
+    var children = std.ArrayList(Node).init(allocator);
+    while (true) {
+        const tag = try decoder.readByte();
+        if (tag == 0)
+            break;
+        const child_type = std.meta.intToEnum(WidgetType, tag) catch return error.InvalidLayout;
+        try children.append(try parseWidget(allocator, decoder, child_type, stats));
+    }
+
+    const optimized_properties = try optimizeProperties(allocator, widget_type, properties.items, stats);
+
+    var encoded = std.ArrayList(u8).init(allocator);
+    try encoded.append(@enumToInt(widget_type));
+    for (optimized_properties) |entry| {
+        try encoded.appendSlice(entry.data);
+    }
+    try encoded.append(0);
+    for (children.items) |child| {
+        try encoded.appendSlice(child.encoded);
+    }
+    try encoded.append(0);
+
+    return Node{
+        .widget_type = widget_type,
+        .properties = optimized_properties,
+        .children = children.items,
+        .encoded = encoded.items,
+    };
+}
+
+fn optimizeProperties(allocator: std.mem.Allocator, widget_type: WidgetType, properties: []const PropertyEntry, stats: *Statistics) ![]PropertyEntry {
+    var result = std.ArrayList(PropertyEntry).init(allocator);
+    for (properties) |entry, i| {
+        // the display client rejects bound properties that have an expression as well
+        if (entry.kind == .binding) {
+            for (properties) |other| {
+                if (other.property == entry.property and other.kind == .expression)
+                    return error.InvalidLayout;
+            }
+        }
+
+        // The client applies the properties in order, so a later one of the same kind wins.
+        const overridden = for (properties[i + 1 ..]) |later| {
+            if (later.property == entry.property and later.kind == entry.kind)
+                break true;
+        } else false;
+
+        const unused = overridden or
+            !hasProperty(widget_type, entry.property) or
+            (entry.kind == .value and isDefaultValue(widget_type, entry));
+
+        if (unused) {
+            stats.dropped_properties += 1;
+        } else {
+            try result.append(entry);
+        }
+    }
+
+    // No two entries are equal anymore, so an unstable sort is fine.
+    std.sort.sort(PropertyEntry, result.items, {}, PropertyEntry.lessThan);
+
+    return result.items;
+}
+
+fn emitWidget(output: *std.ArrayList(u8), shared: *std.StringHashMap(u32), node: Node, stats: *Statistics) OptimizeError!void {
+    const offset = std.math.cast(u32, output.items.len) orelse return error.InvalidLayout;
+
+    if (shared.get(node.encoded)) |shared_offset| {
+        if (1 + varUIntSize(shared_offset) < node.encoded.len) {
+            var encoder = protocol.makeEncoder(output.writer());
+            try encoder.writeByte(layout_format.subtree_reference_tag);
+            try encoder.writeVarUInt(shared_offset);
+            stats.shared_subtrees += 1;
+            return;
+        }
+    } else {
+        try shared.put(node.encoded, offset);
+    }
+
+    try output.append(@enumToInt(node.widget_type));
+    for (node.properties) |entry| {
+        try output.appendSlice(entry.data);
+    }
+    try output.append(0);
+    for (node.children) |child| {
+        try emitWidget(output, shared, child, stats);
+    }
+    try output.append(0);
+}
+
+fn varUIntSize(value: u32) usize {
+    var size: usize = 1;
+    var rest = value >> 7;
+    while (rest != 0) : (rest >>= 7) {
+        size += 1;
+    }
+    return size;
+}
+
+fn getTypeOfProperty(property: Property) protocol.Type {
+    for (layout_format.properties) |desc| {
+        if (desc.value == property)
+            return desc.type;
+    }
+    unreachable;
+}
+
+fn hasProperty(widget_type: WidgetType, property: Property) bool {
+    for (layout_format.widget_types) |desc| {
+        if (desc.type == widget_type)
+            return std.mem.indexOfScalar(Property, desc.properties, property) != null;
+    }
+    unreachable;
+}
+
+fn isDefaultValue(widget_type: WidgetType, entry: PropertyEntry) bool {
+    const default = getDefaultValue(widget_type, entry.property) orelse return false;
+    return std.mem.eql(u8, entry.data[1..], default);
+}
+
+const DefaultValue = struct {
+    property: Property,
+    value: []const u8,
+};
+
+const WidgetDefaultValue = struct {
+    widget: WidgetType,
+    property: Property,
+    value: []const u8,
+};
+
+/// Returns the encoded default value of `property` on a widget of type `widget_type`.
+fn getDefaultValue(widget_type: WidgetType, property: Property) ?[]const u8 {
+    for (widget_defaults) |default| {
+        if (default.widget == widget_type and default.property == property)
+            return default.value;
+    }
+    for (common_defaults) |default| {
+        if (default.property == property)
+            return default.value;
+    }
+    return null;
+}
+
+fn enumeration(comptime value: Enum) []const u8 {
+    return &[_]u8{@enumToInt(value)};
+}
+
+fn margins(comptime value: u7) []const u8 {
+    return &[_]u8{ value, value, value, value };
+}
+
+fn number(comptime value: f32) []const u8 {
+    const bytes = comptime std.mem.toBytes(value);
+    return &bytes;
+}
+
+const zero = &[_]u8{0};
+const yes = &[_]u8{1};
+const no = &[_]u8{0};
+
+// The default values must match `Widget.init()` and the `setUp()` functions of the controls
+// in the desktop client. Values that can't be encoded unambiguously are left out.
+
+const common_defaults = [_]DefaultValue{
+    .{ .property = .horizontal_alignment, .value = enumeration(.stretch) },
+    .{ .property = .vertical_alignment, .value = enumeration(.stretch) },
+    .{ .property = .margins, .value = margins(0) },
+    .{ .property = .paddings, .value = margins(0) },
+    .{ .property = .dock_site, .value = enumeration(.left) },
+    .{ .property = .visibility, .value = enumeration(.visible) },
+    .{ .property = .enabled, .value = yes },
+    .{ .property = .hit_test_visible, .value = yes },
+    .{ .property = .binding_context, .value = zero },
+    .{ .property = .child_template, .value = zero },
+    .{ .property = .widget_name, .value = zero },
+    .{ .property = .tab_title, .value = zero },
+    .{ .property = .size_hint, .value = &[_]u8{ 0, 0 } },
+    .{ .property = .left, .value = zero },
+    .{ .property = .top, .value = zero },
+};
+
+const widget_defaults = [_]WidgetDefaultValue{
+    .{ .widget = .button, .property = .on_click, .value = zero },
+    .{ .widget = .button, .property = .margins, .value = margins(8) },
+    .{ .widget = .button, .property = .paddings, .value = margins(8) },
+
+    .{ .widget = .label, .property = .text, .value = zero },
+    .{ .widget = .label, .property = .font_family, .value = enumeration(.sans) },
+    .{ .widget = .label, .property = .margins, .value = margins(8) },
+    .{ .widget = .label, .property = .horizontal_alignment, .value = enumeration(.center) },
+    .{ .widget = .label, .property = .vertical_alignment, .value = enumeration(.middle) },
+    .{ .widget = .label, .property = .hit_test_visible, .value = no },
+
+    .{ .widget = .textbox, .property = .text, .value = zero },
+    .{ .widget = .textbox, .property = .margins, .value = margins(8) },
+    .{ .widget = .textbox, .property = .horizontal_alignment, .value = enumeration(.center) },
+    .{ .widget = .textbox, .property = .vertical_alignment, .value = enumeration(.middle) },
+    .{ .widget = .textbox, .property = .hit_test_visible, .value = no },
+
+    .{ .widget = .picture, .property = .image, .value = zero },
+    .{ .widget = .picture, .property = .image_scaling, .value = enumeration(.stretch) },
+    .{ .widget = .picture, .property = .hit_test_visible, .value = no },
+
+    .{ .widget = .checkbox, .property = .is_checked, .value = no },
+    .{ .widget = .checkbox, .property = .horizontal_alignment, .value = enumeration(.left) },
+    .{ .widget = .checkbox, .property = .vertical_alignment, .value = enumeration(.middle) },
+    .{ .widget = .checkbox, .property = .margins, .value = margins(8) },
+    .{ .widget = .checkbox, .property = .paddings, .value = margins(8) },
+
+    // The default group is -1, but negative integers don't survive a round trip yet.
+    .{ .widget = .radiobutton, .property = .selected_index, .value = zero },
+    .{ .widget = .radiobutton, .property = .horizontal_alignment, .value = enumeration(.left) },
+    .{ .widget = .radiobutton, .property = .vertical_alignment, .value = enumeration(.middle) },
+    .{ .widget = .radiobutton, .property = .margins, .value = margins(8) },
+    .{ .widget = .radiobutton, .property = .paddings, .value = margins(8) },
+
+    .{ .widget = .scrollbar, .property = .minimum, .value = number(0.0) },
+    .{ .widget = .scrollbar, .property = .maximum, .value = number(100.0) },
+    .{ .widget = .scrollbar, .property = .value, .value = number(25.0) },
+    .{ .widget = .scrollbar, .property = .orientation, .value = enumeration(.horizontal) },
+
+    .{ .widget = .slider, .property = .minimum, .value = number(0.0) },
+    .{ .widget = .slider, .property = .maximum, .value = number(100.0) },
+    .{ .widget = .slider, .property = .value, .value = number(0.0) },
+    .{ .widget = .slider, .property = .orientation, .value = enumeration(.horizontal) },
+
+    .{ .widget = .progressbar, .property = .minimum, .value = number(0.0) },
+    .{ .widget = .progressbar, .property = .maximum, .value = number(100.0) },
+    .{ .widget = .progressbar, .property = .value, .value = number(0.0) },
+    .{ .widget = .progressbar, .property = .orientation, .value = enumeration(.horizontal) },
+    .{ .widget = .progressbar, .property = .display_progress_style, .value = enumeration(.percent) },
+
+    .{ .widget = .spacer, .property = .hit_test_visible, .value = no },
+
+    .{ .widget = .tab_layout, .property = .selected_index, .value = zero },
+    .{ .widget = .grid_layout, .property = .rows, .value = zero },
+    .{ .widget = .grid_layout, .property = .columns, .value = zero },
+    .{ .widget = .stack_layout, .property = .orientation, .value = enumeration(.vertical) },
+};
+
+fn compileForTest(database: anytype, source: []const u8) ![]u8 {
+    const Compiler = @import("Compiler.zig");
+
+    var compiler = Compiler.init(std.testing.allocator, database);
+    defer compiler.deinit();
+
+    var data = std.ArrayList(u8).init(std.testing.allocator);
+    errdefer data.deinit();
+
+    var stream = std.io.fixedBufferStream(source);
+    try compiler.compile(stream.reader(), data.writer());
+    try std.testing.expectEqual(@as(usize, 0), compiler.getErrors().len);
+
+    return data.toOwnedSlice();
+}
+
+test "default and overridden properties are dropped" {
+    var database = @import("Database.zig").init(std.testing.allocator, true);
+    defer database.deinit();
+
+    const layout = try compileForTest(&database,
+        \\Label {
+        \\  text: "a";
+        \\  font-family: sans;
+        \\  margins: 2;
+        \\  text: "b";
+        \\  orientation: vertical;
+        \\}
+    );
+    defer std.testing.allocator.free(layout);
+
+    var output = std.ArrayList(u8).init(std.testing.allocator);
+    defer output.deinit();
+
+    const stats = try optimize(std.testing.allocator, layout, output.writer());
+
+    try std.testing.expectEqual(@as(usize, 3), stats.dropped_properties);
+    try std.testing.expectEqual(output.items.len, stats.output_size);
+    try std.testing.expectEqualSlices(u8, &[_]u8{
+        @enumToInt(WidgetType.label),
+        @enumToInt(Property.margins),
+        2,
+        2,
+        2,
+        2,
+        @enumToInt(Property.text),
+        1,
+        'b',
+        0, // end of properties
+        0, // end of children
+    }, output.items);
+}
+
+test "identical subtrees are shared" {
+    var database = @import("Database.zig").init(std.testing.allocator, true);
+    defer database.deinit();
+
+    const layout = try compileForTest(&database,
+        \\StackLayout {
+        \\  margins: 4;
+        \\  Label { text: "Hello, World!"; font-family: sans; }
+        \\  Label { text: "Hello, World!"; }
+        \\  Label { text: "Hi"; }
+        \\}
+    );
+    defer std.testing.allocator.free(layout);
+
+    var output = std.ArrayList(u8).init(std.testing.allocator);
+    defer output.deinit();
+
+    const stats = try optimize(std.testing.allocator, layout, output.writer());
+
+    try std.testing.expectEqual(@as(usize, 1), stats.shared_subtrees);
+    try std.testing.expect(stats.output_size < stats.input_size);
+
+    // The first label starts right after the properties of the stack layout.
+    const first_label = 1 + 5 + 1;
+    try std.testing.expectEqual(@enumToInt(WidgetType.label), output.items[first_label]);
+
+    const reference = first_label + 1 + 15 + 1 + 1;
+    try std.testing.expectEqualSlices(u8, &[_]u8{ layout_format.subtree_reference_tag, first_label }, output.items[reference..][0..2]);
+}
+
+test "bound properties with an expression are rejected" {
+    const text = @enumToInt(Property.text) | 0x80;
+    const layout = [_]u8{
+        @enumToInt(WidgetType.label),
+        text, 1, // bound to property 1
+        text, 0, @enumToInt(protocol.expression.Opcode.property), 1, @enumToInt(protocol.expression.Opcode.end),
+        0, // end of properties
+        0, // end of children
+    };
+
+    var output = std.ArrayList(u8).init(std.testing.allocator);
+    defer output.deinit();
+
+    try std.testing.expectError(error.InvalidLayout, optimize(std.testing.allocator, &layout, output.writer()));
+}
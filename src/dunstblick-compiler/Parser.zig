@@ -2,10 +2,12 @@ const std = @import("std");
 
 const string_luts = @import("dunstblick-protocol").layout_format;
 const enums = @import("dunstblick-protocol");
+const expression = @import("dunstblick-protocol").expression;
 
 const Tokenizer = @import("Tokenizer.zig");
 const ErrorCollection = @import("ErrorCollection.zig");
 const Database = @import("Database.zig");
+const Bindgen = @import("Bindgen.zig");
 const Token = Tokenizer.Token;
 
 const Parser = @This();
@@ -15,6 +17,9 @@ database: *Database,
 errors: *ErrorCollection,
 tokens: *Tokenizer,
 
+/// When set, the type of every property binding is recorded here.
+property_types: ?*Bindgen.PropertyTypes = null,
+
 fn widgetFromName(name: []const u8) ?enums.WidgetType {
     for (string_luts.widget_types) |tup| {
         if (std.mem.eql(u8, tup.widget, name))
@@ -128,11 +133,34 @@ fn convertString(parser: Parser, input: []const u8) ![]const u8 {
     return output[0..outptr];
 }
 
-fn parseID(parser: Parser, writer: anytype, functionName: []const u8, entry: Database.Entry) !void {
+/// Parses the argument of an ID function like `resource(…)`, which is either
+/// the numeric ID or an alias from the database.
+fn parseIDValue(parser: Parser, functionName: []const u8, entry: Database.Entry) !u32 {
+    var value = try parser.tokens.expectOneOf(.{ .integer, .string });
+    return switch (value.type) {
+        .integer => try tokenToUnsignedInteger(value),
+        .string => blk: {
+            const name = try convertString(parser, value.text);
+            defer parser.allocator.free(name);
+
+            const id_or_null = try parser.database.get(entry, name);
+            if (id_or_null) |val| {
+                break :blk val;
+            } else {
+                try parser.errors.add(parser.tokens.location, "Unkown {s} alias '{s}'", .{ functionName, name });
+                break :blk @as(u32, 0);
+            }
+        },
+        else => unreachable,
+    };
+}
+
+/// Parses `functionName(id);` and writes the ID. Returns `null` when the syntax was invalid.
+fn parseID(parser: Parser, writer: anytype, functionName: []const u8, entry: Database.Entry) !?u32 {
     var resource = parser.tokens.expect(.identifier) catch {
         try parser.errors.add(parser.tokens.location, "Expected identifier.", .{});
         try parser.tokens.readUntil(.{.semiColon});
-        return;
+        return null;
     };
     if (!std.mem.eql(u8, resource.text, functionName)) {
         try parser.errors.add(
@@ -141,47 +169,35 @@ fn parseID(parser: Parser, writer: anytype, functionName: []const u8, entry: Dat
             .{ functionName, resource.text },
         );
         try parser.tokens.readUntil(.{.semiColon});
-        return;
+        return null;
     }
     _ = parser.tokens.expect(.openParens) catch {
         try parser.errors.add(parser.tokens.location, "Expected opening parens.", .{});
         try parser.tokens.readUntil(.{.semiColon});
-        return;
+        return null;
     };
 
-    var value = try parser.tokens.expectOneOf(.{ .integer, .string });
-    const rid = switch (value.type) {
-        .integer => try tokenToUnsignedInteger(value),
-        .string => blk: {
-            const name = try convertString(parser, value.text);
-            defer parser.allocator.free(name);
-
-            const id_or_null = try parser.database.get(entry, name);
-            if (id_or_null) |val| {
-                break :blk val;
-            } else {
-                try parser.errors.add(parser.tokens.location, "Unkown {s} alias '{s}'", .{ functionName, name });
-                break :blk @as(u32, 0);
-            }
-        },
-        else => unreachable,
-    };
+    const rid = try parseIDValue(parser, functionName, entry);
     _ = parser.tokens.expect(.closeParens) catch {
         try parser.errors.add(parser.tokens.location, "Expected closing parens.", .{});
         try parser.tokens.readUntil(.{.semiColon});
-        return;
+        return null;
     };
 
     _ = parser.tokens.expect(.semiColon) catch {
         try parser.errors.add(parser.tokens.location, "Expected semicolon.", .{});
         try parser.tokens.readUntil(.{.semiColon});
-        return;
+        return null;
     };
 
     try writeVarUInt(writer, rid);
+    return rid;
 }
 
-fn parseProperty(parser: Parser, writer: anytype, property: enums.Property, propertyType: enums.Type) !void {
+/// How the value of a property is provided.
+const PropertyKind = enum { value, binding, expression };
+
+fn parseProperty(parser: Parser, writer: anytype, property: enums.Property, propertyType: enums.Type) !PropertyKind {
     if (try parser.tokens.peekNextWhitespace()) |tok| {
         if (tok.type == .identifier) {
             if (std.mem.eql(u8, tok.text, "bind")) {
@@ -189,9 +205,35 @@ fn parseProperty(parser: Parser, writer: anytype, property: enums.Property, prop
                 // this is a bindingx
                 try writer.writeByte(@as(u8, @enumToInt(property)) | 0x80);
 
-                try parseID(parser, writer, "bind", .property);
+                const name = (try parseID(parser, writer, "bind", .property)) orelse return .binding;
+                if (parser.property_types) |property_types| {
+                    // 0 is returned for unknown aliases, which were already reported
+                    if (name != 0) {
+                        const entry = try property_types.getOrPut(name);
+                        if (entry.found_existing and entry.value_ptr.* != propertyType) {
+                            try parser.errors.add(parser.tokens.location, "Property {d} is bound as {s} here, but as {s} in another place.", .{
+                                name,
+                                @tagName(propertyType),
+                                @tagName(entry.value_ptr.*),
+                            });
+                        } else {
+                            entry.value_ptr.* = propertyType;
+                        }
+                    }
+                }
 
-                return;
+                return .binding;
+            }
+            if (std.mem.eql(u8, tok.text, "expr")) {
+
+                // this is a binding expression, encoded as a binding to the
+                // invalid property, followed by the byte code
+                try writer.writeByte(@as(u8, @enumToInt(property)) | 0x80);
+                try writeVarUInt(writer, 0);
+
+                try parseExpression(parser, writer);
+
+                return .expression;
             }
         }
     }
@@ -302,7 +344,7 @@ fn parseProperty(parser: Parser, writer: anytype, property: enums.Property, prop
             try writeVarSInt(writer, height);
         },
 
-        .resource => try parseID(parser, writer, "resource", .resource),
+        .resource => _ = try parseID(parser, writer, "resource", .resource),
 
         // true|false|yes|no;
         .boolean => {
@@ -395,15 +437,233 @@ fn parseProperty(parser: Parser, writer: anytype, property: enums.Property, prop
             }
         },
 
-        .object => try parseID(parser, writer, "object", .object),
+        .object => _ = try parseID(parser, writer, "object", .object),
 
         .objectlist => {
             unreachable;
         },
 
-        .event => try parseID(parser, writer, "callback", .event),
+        .event => _ = try parseID(parser, writer, "callback", .event),
+
+        .widget => _ = try parseID(parser, writer, "widget", .widget),
+    }
+    return .value;
+}
+
+/// Parses `expr(…);` and writes the byte code of the expression.
+fn parseExpression(parser: Parser, writer: anytype) !void {
+    _ = try parser.tokens.expect(.identifier);
+    _ = try parser.tokens.expect(.openParens);
+
+    var code = std.ArrayList(u8).init(parser.allocator);
+    defer code.deinit();
+
+    try parseConditional(parser, code.writer());
+    try code.append(@enumToInt(expression.Opcode.end));
+
+    _ = try parser.tokens.expect(.closeParens);
+    _ = try parser.tokens.expect(.semiColon);
+
+    var decoder = enums.Decoder.init(code.items);
+    _ = expression.read(&decoder) catch |err| switch (err) {
+        error.ExpressionTooComplex => try parser.errors.add(parser.tokens.location, "Expression is too complex, it needs more than {} stack slots.", .{
+            expression.max_stack_depth,
+        }),
+        // the code generator produced byte code the display client can't read
+        error.EndOfStream, error.InvalidEnumTag, error.InvalidExpression => try parser.errors.add(parser.tokens.location, "Failed to compile the expression: {s}.", .{
+            @errorName(err),
+        }),
+    };
+
+    try writer.writeAll(code.items);
+}
+
+fn writeOpcode(code: anytype, opcode: expression.Opcode) !void {
+    try code.writeByte(@enumToInt(opcode));
+}
+
+/// Consumes the next token if it is one of `types` and returns it.
+fn acceptOneOf(parser: Parser, comptime types: anytype) !?Token {
+    const tok = (try parser.tokens.peekNextWhitespace()) orelse return null;
+    inline for (types) |t| {
+        if (tok.type == t)
+            return try parser.tokens.expect(t);
+    }
+    return null;
+}
 
-        .widget => try parseID(parser, writer, "widget", .widget),
+// expression grammar, from lowest to highest precedence:
+// conditional := or [ "?" conditional ":" conditional ]
+// or          := and { "||" and }
+// and         := equality { "&&" equality }
+// equality    := relation { ("==" | "!=") relation }
+// relation    := sum { ("<" | "<=" | ">" | ">=") sum }
+// sum         := product { ("+" | "-") product }
+// product     := unary { ("*" | "/") unary }
+// unary       := ("-" | "!") unary | primary
+// primary     := integer | number | string | "(" conditional ")"
+//              | true | false | yes | no | <enumeration>
+//              | bind(id) | format(string { "," conditional })
+
+fn parseConditional(parser: Parser, code: anytype) ParseWidgetError!void {
+    try parseBinary(parser, code, 0);
+    if ((try acceptOneOf(parser, .{.questionMark})) != null) {
+        try parseConditional(parser, code);
+        _ = try parser.tokens.expect(.colon);
+        try parseConditional(parser, code);
+        try writeOpcode(code, .select);
+    }
+}
+
+const BinaryOperator = struct {
+    token: Tokenizer.TokenType,
+    opcode: expression.Opcode,
+};
+
+/// Binary operators grouped by precedence, from lowest to highest.
+const binary_operators = [_][]const BinaryOperator{
+    &.{.{ .token = .@"or", .opcode = .@"or" }},
+    &.{.{ .token = .@"and", .opcode = .@"and" }},
+    &.{
+        .{ .token = .equal, .opcode = .equal },
+        .{ .token = .notEqual, .opcode = .not_equal },
+    },
+    &.{
+        .{ .token = .less, .opcode = .less },
+        .{ .token = .lessEqual, .opcode = .less_equal },
+        .{ .token = .greater, .opcode = .greater },
+        .{ .token = .greaterEqual, .opcode = .greater_equal },
+    },
+    &.{
+        .{ .token = .plus, .opcode = .add },
+        .{ .token = .minus, .opcode = .subtract },
+    },
+    &.{
+        .{ .token = .asterisk, .opcode = .multiply },
+        .{ .token = .slash, .opcode = .divide },
+    },
+};
+
+fn parseBinary(parser: Parser, code: anytype, precedence: usize) ParseWidgetError!void {
+    if (precedence >= binary_operators.len)
+        return try parseUnary(parser, code);
+
+    try parseBinary(parser, code, precedence + 1);
+    outer: while (try parser.tokens.peekNextWhitespace()) |tok| {
+        for (binary_operators[precedence]) |op| {
+            if (tok.type == op.token) {
+                _ = try parser.tokens.expect(op.token);
+                try parseBinary(parser, code, precedence + 1);
+                try writeOpcode(code, op.opcode);
+                continue :outer;
+            }
+        }
+        break;
+    }
+}
+
+fn parseUnary(parser: Parser, code: anytype) ParseWidgetError!void {
+    if (try acceptOneOf(parser, .{ .minus, .exclamationMark })) |tok| {
+        try parseUnary(parser, code);
+        try writeOpcode(code, if (tok.type == .minus) .negate else .not);
+    } else {
+        try parsePrimary(parser, code);
+    }
+}
+
+fn parsePrimary(parser: Parser, code: anytype) ParseWidgetError!void {
+    const tok = try parser.tokens.expectOneOf(.{ .integer, .number, .string, .openParens, .identifier });
+    switch (tok.type) {
+        .integer => {
+            try writeOpcode(code, .integer);
+            try writeVarSInt(code, try tokenToInteger(tok));
+        },
+        .number => {
+            var f = try tokenToNumber(tok);
+            try writeOpcode(code, .number);
+            try code.writeAll(std.mem.asBytes(&f));
+        },
+        .string => {
+            var string = try convertString(parser, tok.text);
+            defer parser.allocator.free(string);
+
+            try writeOpcode(code, .string);
+            try writeVarUInt(code, @intCast(u32, string.len));
+            try code.writeAll(string);
+        },
+        .openParens => {
+            try parseConditional(parser, code);
+            _ = try parser.tokens.expect(.closeParens);
+        },
+        .identifier => {
+            const booleans = .{
+                .{ .text = "true", .value = true },
+                .{ .text = "yes", .value = true },
+                .{ .text = "false", .value = false },
+                .{ .text = "no", .value = false },
+            };
+            inline for (booleans) |b| {
+                if (std.mem.eql(u8, b.text, tok.text)) {
+                    try writeOpcode(code, .boolean);
+                    try code.writeByte(@boolToInt(b.value));
+                    return;
+                }
+            }
+
+            if (std.mem.eql(u8, tok.text, "bind")) {
+                _ = try parser.tokens.expect(.openParens);
+                const name = try parseIDValue(parser, "bind", .property);
+                _ = try parser.tokens.expect(.closeParens);
+
+                try writeOpcode(code, .property);
+                try writeVarUInt(code, name);
+                return;
+            }
+
+            if (std.mem.eql(u8, tok.text, "format")) {
+                _ = try parser.tokens.expect(.openParens);
+
+                const fmt_token = try parser.tokens.expect(.string);
+                const fmt = try convertString(parser, fmt_token.text);
+                defer parser.allocator.free(fmt);
+
+                try writeOpcode(code, .string);
+                try writeVarUInt(code, @intCast(u32, fmt.len));
+                try code.writeAll(fmt);
+
+                var count: u32 = 0;
+                while ((try parser.tokens.expectOneOf(.{ .comma, .closeParens })).type == .comma) {
+                    try parseConditional(parser, code);
+                    count += 1;
+                }
+
+                if (count != expression.countPlaceholders(fmt)) {
+                    try parser.errors.add(parser.tokens.location, "The format string has {} placeholders, but {} arguments were given.", .{
+                        expression.countPlaceholders(fmt),
+                        count,
+                    });
+                }
+
+                try writeOpcode(code, .format);
+                try writeVarUInt(code, count);
+                return;
+            }
+
+            for (string_luts.enumerations) |e| {
+                if (std.mem.eql(u8, e.enumeration, tok.text)) {
+                    try writeOpcode(code, .enumeration);
+                    try code.writeByte(@enumToInt(e.value));
+                    return;
+                }
+            }
+
+            try parser.errors.add(parser.tokens.location, "Unknown identifier '{s}' in expression.", .{tok.text});
+
+            // keep the byte code valid, so we can report more errors
+            try writeOpcode(code, .boolean);
+            try code.writeByte(0);
+        },
+        else => unreachable,
     }
 }
 
@@ -430,6 +690,9 @@ fn parseWidget(parser: Parser, writer: anytype, widgetTypeName: []const u8) Pars
 
     _ = try parser.tokens.expect(.openBrace);
 
+    // the display client evaluates either a binding or an expression for a property
+    var dynamic_properties = std.EnumSet(enums.Property){};
+
     var isReadingChildren = false;
     while (true) {
         var id_or_closing = try parser.tokens.expectOneOf(.{ .identifier, .closeBrace });
@@ -472,7 +735,15 @@ fn parseWidget(parser: Parser, writer: anytype, widgetTypeName: []const u8) Pars
 
                         const propertyType = getTypeOfProperty(prop);
 
-                        try parseProperty(parser, writer, prop, propertyType);
+                        const kind = try parseProperty(parser, writer, prop, propertyType);
+                        if (kind != .value) {
+                            if (dynamic_properties.contains(prop)) {
+                                try parser.errors.add(parser.tokens.location, "Property '{s}' can only have a single binding or expression.", .{
+                                    id_or_closing.text,
+                                });
+                            }
+                            dynamic_properties.insert(prop);
+                        }
                     },
                 }
             },
@@ -518,3 +789,78 @@ const ZigZagInt = struct {
         return (n << 1) ^ (n >> 31);
     }
 };
+
+test "binding expressions" {
+    var database = Database.init(std.testing.allocator, true);
+    defer database.deinit();
+
+    var errors = ErrorCollection.init(std.testing.allocator);
+    defer errors.deinit();
+
+    var tokens = Tokenizer.init(
+        \\Label { text: expr(format("{} of {}", bind("done") + 1, bind("total"))); visibility: expr(bind("total") > 0 ? visible : collapsed); }
+    );
+
+    var output = std.ArrayList(u8).init(std.testing.allocator);
+    defer output.deinit();
+
+    const parser = Parser{
+        .allocator = std.testing.allocator,
+        .database = &database,
+        .errors = &errors,
+        .tokens = &tokens,
+    };
+    try parser.parseFile(output.writer());
+
+    try std.testing.expectEqual(@as(usize, 0), errors.list.items.len);
+
+    const op = struct {
+        fn f(o: expression.Opcode) u8 {
+            return @enumToInt(o);
+        }
+    }.f;
+
+    const text = @enumToInt(enums.Property.text) | 0x80;
+    const visibility = @enumToInt(enums.Property.visibility) | 0x80;
+    const visible = @enumToInt(enums.Enum.visible);
+    const collapsed = @enumToInt(enums.Enum.collapsed);
+
+    // "done" is property 1, "total" is property 2
+    try std.testing.expectEqualSlices(u8, &[_]u8{@enumToInt(enums.WidgetType.label)} ++
+        [_]u8{ text, 0, op(.string), 8 } ++ "{} of {}" ++
+        [_]u8{ op(.property), 1, op(.integer), 2, op(.add), op(.property), 2, op(.format), 2, op(.end) } ++
+        [_]u8{ visibility, 0, op(.property), 2, op(.integer), 0, op(.greater) } ++
+        [_]u8{ op(.enumeration), visible, op(.enumeration), collapsed, op(.select), op(.end) } ++
+        [_]u8{ 0, 0 }, output.items);
+}
+
+test "a property can't be bound and computed" {
+    const layouts = [_][]const u8{
+        \\Label { text: bind("name"); text: expr(bind("name")); }
+        ,
+        \\Label { text: expr(bind("name")); text: expr(bind("name")); }
+        ,
+    };
+    for (layouts) |layout| {
+        var database = Database.init(std.testing.allocator, true);
+        defer database.deinit();
+
+        var errors = ErrorCollection.init(std.testing.allocator);
+        defer errors.deinit();
+
+        var tokens = Tokenizer.init(layout);
+
+        var output = std.ArrayList(u8).init(std.testing.allocator);
+        defer output.deinit();
+
+        const parser = Parser{
+            .allocator = std.testing.allocator,
+            .database = &database,
+            .errors = &errors,
+            .tokens = &tokens,
+        };
+        try parser.parseFile(output.writer());
+
+        try std.testing.expectEqual(@as(usize, 1), errors.list.items.len);
+    }
+}
@@ -16,6 +16,22 @@ pub const TokenType = enum {
     openParens,
     closeParens,
     whitespace,
+
+    // operators, only used in expressions
+    plus,
+    minus,
+    asterisk,
+    slash,
+    questionMark,
+    exclamationMark,
+    equal,
+    notEqual,
+    less,
+    lessEqual,
+    greater,
+    greaterEqual,
+    @"and",
+    @"or",
 };
 
 pub const Token = struct {
@@ -71,6 +87,19 @@ fn initSingle(text: []const u8, kind: TokenType) Token {
     };
 }
 
+/// Returns `double` if the character after the first one is `second`, otherwise `single`.
+/// `single` may be `null` if the first character is not a token on its own.
+fn initSingleOrDouble(text: []const u8, second: u8, single: ?TokenType, double: TokenType) !Token {
+    if (text.len > 1 and text[1] == second) {
+        return Token{
+            .type = double,
+            .text = text[0..2],
+            .location = undefined,
+        };
+    }
+    return initSingle(text, single orelse return error.UnrecognizedChar);
+}
+
 pub fn readUntil(self: *Self, types: anytype) !void {
     while (true) {
         var token_or_null = try self.nextSkipWhitespace();
@@ -145,6 +174,18 @@ fn next(self: *Self) !?Token {
         ':' => initSingle(self.data, .colon),
         ';' => initSingle(self.data, .semiColon),
         ',' => initSingle(self.data, .comma),
+        '+' => initSingle(self.data, .plus),
+        '-' => initSingle(self.data, .minus),
+        '*' => initSingle(self.data, .asterisk),
+        '?' => initSingle(self.data, .questionMark),
+
+        // Operators that may consist of two characters
+        '!' => try initSingleOrDouble(self.data, '=', .exclamationMark, .notEqual),
+        '=' => try initSingleOrDouble(self.data, '=', null, .equal),
+        '<' => try initSingleOrDouble(self.data, '=', .less, .lessEqual),
+        '>' => try initSingleOrDouble(self.data, '=', .greater, .greaterEqual),
+        '&' => try initSingleOrDouble(self.data, '&', null, .@"and"),
+        '|' => try initSingleOrDouble(self.data, '|', null, .@"or"),
 
         // Identifier
         'a'...'z', 'A'...'Z' => blk: {
@@ -211,12 +252,10 @@ fn next(self: *Self) !?Token {
 
         ' ', '\n', '\r', '\t' => initSingle(self.data, .whitespace),
 
-        // comment
-        '/' => blk: {
+        // comment or division
+        '/' => if (self.data.len < 2 or self.data[1] != '*') initSingle(self.data, .slash) else blk: {
             if (self.data.len < 4)
                 return error.UnexpectedEndOfStream;
-            if (self.data[1] != '*')
-                return error.UnexpectedToken;
 
             var offset: usize = 3;
             while (offset < self.data.len and self.data[offset - 1] != '*' and self.data[offset] != '/') {
@@ -265,6 +304,14 @@ test "Tokenizer single chars" {
         .{ ":heajsdkj", .colon },
         .{ ";heajsdkj", .semiColon },
         .{ ",heajsdkj", .comma },
+        .{ "+", .plus },
+        .{ "-", .minus },
+        .{ "*", .asterisk },
+        .{ "/", .slash },
+        .{ "?", .questionMark },
+        .{ "!", .exclamationMark },
+        .{ "<", .less },
+        .{ ">", .greater },
     };
 
     inline for (tests) |t| {
@@ -279,6 +326,31 @@ test "Tokenizer single chars" {
     }
 }
 
+test "Tokenizer operators" {
+    const tests = .{
+        .{ "==", .equal },
+        .{ "!=", .notEqual },
+        .{ "<=", .lessEqual },
+        .{ ">=", .greaterEqual },
+        .{ "&&", .@"and" },
+        .{ "||", .@"or" },
+    };
+
+    inline for (tests) |t| {
+        const text = t.@"0";
+        const result = t.@"1";
+
+        try std.testing.expectEqual(Token{
+            .type = result,
+            .text = text,
+            .location = Location{ .line = 1, .column = 1 },
+        }, (try Self.init(text).next()).?);
+    }
+
+    try std.testing.expectError(error.UnrecognizedChar, Self.init("=").next());
+    try std.testing.expectError(error.UnrecognizedChar, Self.init("&").next());
+}
+
 test "Tokenizer identifier" {
     const tests_good = .{
         "a",
@@ -3,20 +3,40 @@ const args_parser = @import("args");
 
 const Compiler = @import("Compiler.zig");
 const Database = @import("Database.zig");
+const Batch = @import("Batch.zig");
+const Optimizer = @import("Optimizer.zig");
+const Bindgen = @import("Bindgen.zig");
 
-const FileType = enum { binary, header };
+const FileType = Batch.FileType;
 
 fn usage(stream: anytype, exe_name: []const u8) !void {
     const name = std.fs.path.basename(exe_name);
 
     try stream.print("usage: {s} layoutfile\n", .{name});
+    try stream.print("       {s} -d [dir] layoutfile...\n", .{name});
+    try stream.print("       {s} -c [file] --import [file]\n", .{name});
+    try stream.print("       {s} -c [file] --bindgen [file] layoutfile...\n", .{name});
     try stream.writeAll(
         \\Compiles a dunstblick layout file into the binary representation.
         \\  -h, --help              Shows this text.
         \\  -o, --output [file]     Renders the output into [file].
-        \\  -c, --config [file]     Uses [file] as the json config file.
+        \\  -d, --output-dir [dir]  Compiles all layout files into [dir], keeping their file names.
+        \\  -j, --jobs [count]      Compiles up to [count] layout files in parallel. Defaults to the number of CPUs.
+        \\      --cache [file]      Uses [file] as the build cache. Layout files that didn't change since the
+        \\                          last compilation are skipped.
+        \\  -c, --config [file]     Uses [file] as the config file. Both JSON and binary configs are accepted.
         \\  -u, --update-config     Updates the config file when a unknown identifier is found
+        \\      --config-format [f] Writes the config file as 'json' or 'binary'. Defaults to the format of
+        \\                          the existing config file, or 'json' for new files.
+        \\      --import [file]     Adds the identifiers in [file] to the config file. Each line has the form
+        \\                          'kind name' or 'kind name id', kind is one of resource, event, property,
+        \\                          object or widget.
+        \\      --export [file]     Writes all identifiers of the config file into [file] in the import format.
         \\  -f, --file-type [type]  Sets the file type to 'binary' or 'header'. 
+        \\  -O, --optimize          Optimizes the compiled layouts and prints the size savings.
+        \\      --bindgen [file]    Generates bindings for all identifiers in the config file. Properties that
+        \\                          are bound in the given layout files get typed setters. Writes a C header
+        \\                          if [file] ends in '.h', Zig code otherwise.
         \\
     );
 }
@@ -30,9 +50,17 @@ pub fn main() !u8 {
     const args = args_parser.parseForCurrentProcess(struct {
         // This declares long options for double hyphen
         output: ?[]const u8 = null,
+        @"output-dir": ?[]const u8 = null,
+        jobs: ?usize = null,
+        cache: ?[]const u8 = null,
         config: ?[]const u8 = null,
+        @"config-format": ?Database.Format = null,
+        import: ?[]const u8 = null,
+        @"export": ?[]const u8 = null,
+        bindgen: ?[]const u8 = null,
         @"file-type": FileType = .binary,
         @"update-config": bool = false,
+        optimize: bool = false,
         help: bool = false,
 
         // This declares short-hand options for single hyphen
@@ -41,6 +69,9 @@ pub fn main() !u8 {
             .f = "file-type",
             .c = "config",
             .o = "output",
+            .d = "output-dir",
+            .j = "jobs",
+            .O = "optimize",
             .h = "help",
         };
     }, allocator, .print) catch return 1;
@@ -51,14 +82,24 @@ pub fn main() !u8 {
         return 0;
     }
 
-    if (args.positionals.len != 1) {
+    const batch_mode = (args.options.@"output-dir" != null);
+    const bindgen_mode = (args.options.bindgen != null);
+    const tool_mode = (args.options.import != null) or (args.options.@"export" != null) or bindgen_mode;
+    if ((args.positionals.len == 0 and !tool_mode) or (!batch_mode and !bindgen_mode and args.positionals.len > 1)) {
         try usage(std.io.getStdErr().writer(), args.executable_name orelse return 1);
         return 1;
     }
 
+    if (args.options.import != null and args.options.config == null) {
+        try std.io.getStdErr().writer().writeAll("--import requires a config file!\n");
+        return 1;
+    }
+
+    var config_format: Database.Format = args.options.@"config-format" orelse .json;
+
     var database: Database = if (args.options.config) |cfgfile| blk: {
-        var buffer = std.fs.cwd().readFileAlloc(allocator, cfgfile, 1 << 20) catch |err| switch (err) { // 1 MB
-            error.FileNotFound => |e| if (args.options.@"update-config")
+        var buffer = std.fs.cwd().readFileAlloc(allocator, cfgfile, 256 << 20) catch |err| switch (err) { // 256 MB
+            error.FileNotFound => |e| if (args.options.@"update-config" or args.options.import != null)
                 break :blk Database.init(allocator, true)
             else
                 return e,
@@ -66,10 +107,47 @@ pub fn main() !u8 {
         };
         defer allocator.free(buffer);
 
-        break :blk try Database.fromJson(allocator, args.options.@"update-config", buffer);
+        if (args.options.@"config-format" == null) {
+            config_format = Database.detectFormat(buffer);
+        }
+
+        break :blk try Database.load(allocator, args.options.@"update-config", buffer);
     } else Database.init(allocator, args.options.@"update-config");
     defer database.deinit();
 
+    if (args.options.import) |import_file| {
+        const text = try std.fs.cwd().readFileAlloc(allocator, import_file, 256 << 20);
+        defer allocator.free(text);
+
+        database.importText(text) catch |err| {
+            std.debug.print("{s}: error: {s}\n", .{ import_file, @errorName(err) });
+            return 1;
+        };
+
+        try saveConfig(&database, args.options.config.?, config_format);
+    }
+
+    if (args.options.@"export") |export_file| {
+        var file = try std.fs.cwd().createFile(export_file, .{ .exclusive = false, .read = false });
+        defer file.close();
+
+        var buffered = std.io.bufferedWriter(file.writer());
+        try database.exportText(buffered.writer());
+        try buffered.flush();
+    }
+
+    if (args.options.bindgen) |bindgen_file| {
+        return try generateBindings(allocator, &database, args.options, config_format, bindgen_file, args.positionals);
+    }
+
+    if (args.positionals.len == 0) {
+        return 0;
+    }
+
+    if (batch_mode) {
+        return try compileBatch(allocator, &database, args.options, config_format, args.positionals);
+    }
+
     const inputFile = args.positionals[0];
 
     const outfile_path = if (args.options.output) |outfile| outfile else {
@@ -104,6 +182,9 @@ pub fn main() !u8 {
     defer if (layout_data) |data|
         allocator.free(data);
 
+    var optimized_data = std.ArrayList(u8).init(allocator);
+    defer optimized_data.deinit();
+
     const errors = compiler.getErrors();
     if (errors.len > 0) {
         for (errors) |err| {
@@ -112,37 +193,173 @@ pub fn main() !u8 {
         return 1;
     }
 
-    if (layout_data) |data| {
+    if (layout_data) |compiled_data| {
+        var data = compiled_data;
+        if (args.options.optimize) {
+            const stats = try Optimizer.optimize(allocator, data, optimized_data.writer());
+            try std.io.getStdOut().writer().print("{s}: {}\n", .{ inputFile, stats });
+            data = optimized_data.items;
+        }
+
         {
             var file = try std.fs.cwd().createFile(outfile_path, .{ .exclusive = false, .read = false });
             defer file.close();
 
-            var stream = file.writer();
+            try Batch.writeOutput(file.writer(), data, args.options.@"file-type");
+        }
+
+        try writeConfig(&database, args.options, config_format);
+
+        return 0;
+    } else {
+        return 1;
+    }
+}
+
+fn saveConfig(database: *Database, config_file: []const u8, format: Database.Format) !void {
+    var file = try std.fs.cwd().createFile(config_file, .{ .exclusive = false, .read = false });
+    defer file.close();
+
+    var buffered = std.io.bufferedWriter(file.writer());
+    try database.save(buffered.writer(), format);
+    try buffered.flush();
+}
+
+fn writeConfig(database: *Database, options: anytype, format: Database.Format) !void {
+    if (options.@"update-config") {
+        if (options.config) |config_file| {
+            try saveConfig(database, config_file, format);
+        }
+    }
+}
+
+fn compileBatch(allocator: std.mem.Allocator, database: *Database, options: anytype, config_format: Database.Format, inputs: []const []const u8) !u8 {
+    const output_dir = options.@"output-dir".?;
 
-            switch (args.options.@"file-type") {
-                .binary => try stream.writeAll(data),
+    var arena = std.heap.ArenaAllocator.init(allocator);
+    defer arena.deinit();
 
-                .header => {
-                    for (data) |c| {
-                        try stream.print("0x{X}, ", .{c});
-                    }
-                },
+    const jobs = try arena.allocator().alloc(Batch.Job, inputs.len);
+    for (jobs) |*job, i| {
+        const name = std.fs.path.basename(inputs[i]);
+        for (jobs[0..i]) |other| {
+            if (std.mem.eql(u8, std.fs.path.basename(other.input), name)) {
+                std.debug.print("error: {s} and {s} would both be compiled to {s}\n", .{ other.input, inputs[i], name });
+                return 1;
             }
         }
+        job.* = Batch.Job{
+            .input = inputs[i],
+            .output = try std.fs.path.join(arena.allocator(), &[_][]const u8{ output_dir, name }),
+        };
+    }
+    defer for (jobs) |*job| {
+        job.deinit();
+    };
+
+    try std.fs.cwd().makePath(output_dir);
+
+    var manifest: ?Batch.Manifest = if (options.cache) |cache_file| blk: {
+        const text = std.fs.cwd().readFileAlloc(allocator, cache_file, 16 << 20) catch |err| switch (err) {
+            error.FileNotFound => break :blk Batch.Manifest.init(allocator),
+            else => |e| return e,
+        };
+        defer allocator.free(text);
+
+        break :blk try Batch.Manifest.parse(allocator, text);
+    } else null;
+    defer if (manifest) |*m| m.deinit();
+
+    const thread_count = options.jobs orelse (std.Thread.getCpuCount() catch 1);
 
-        if (args.options.@"update-config") {
-            if (args.options.config) |config_file| {
-                var file = try std.fs.cwd().createFile(config_file, .{ .exclusive = false, .read = false });
-                defer file.close();
+    const batch_options = Batch.Options{
+        .file_type = options.@"file-type",
+        .optimize = options.optimize,
+    };
+
+    var batch = Batch.init(allocator, database, batch_options, if (manifest) |*m| m else null, jobs);
+    const success = try batch.run(thread_count);
 
-                try database.toJson(file.writer());
+    for (jobs) |job| {
+        if (job.io_error) |err| {
+            std.debug.print("{s}: error: {s}\n", .{ job.input, @errorName(err) });
+        }
+        if (job.compiler) |compiler| {
+            for (compiler.getErrors()) |err| {
+                std.debug.print("{s}: error: {s}\n", .{ job.input, err });
             }
         }
+        if (job.statistics) |stats| {
+            try std.io.getStdOut().writer().print("{s}: {}\n", .{ job.input, stats });
+        }
+    }
 
-        return 0;
-    } else {
+    if (manifest) |m| {
+        var file = try std.fs.cwd().createFile(options.cache.?, .{ .exclusive = false, .read = false });
+        defer file.close();
+
+        var buffered = std.io.bufferedWriter(file.writer());
+        try m.write(buffered.writer());
+        try buffered.flush();
+    }
+
+    try writeConfig(database, options, config_format);
+
+    return if (success) 0 else 1;
+}
+
+/// Compiles all `inputs` to collect the types of the bound properties, then writes the bindings.
+fn generateBindings(allocator: std.mem.Allocator, database: *Database, options: anytype, config_format: Database.Format, output_file: []const u8, inputs: []const []const u8) !u8 {
+    var property_types = Bindgen.PropertyTypes.init(allocator);
+    defer property_types.deinit();
+
+    var success = true;
+    for (inputs) |input| {
+        var compiler = Compiler.init(allocator, database);
+        defer compiler.deinit();
+        compiler.property_types = &property_types;
+
+        var src_file = std.fs.cwd().openFile(input, .{}) catch |err| {
+            std.debug.print("{s}: error: {s}\n", .{ input, @errorName(err) });
+            success = false;
+            continue;
+        };
+        defer src_file.close();
+
+        compiler.compile(src_file.reader(), std.io.null_writer) catch {};
+
+        for (compiler.getErrors()) |err| {
+            std.debug.print("{s}: error: {s}\n", .{ input, err });
+            success = false;
+        }
+    }
+    if (!success)
         return 1;
+
+    const is_c_header = std.mem.eql(u8, std.fs.path.extension(output_file), ".h");
+    if (is_c_header) {
+        if (try Bindgen.findCNameCollision(allocator, database)) |collision| {
+            std.debug.print("{s}: error: {}\n", .{ output_file, collision });
+            return 1;
+        }
     }
+
+    {
+        var file = try std.fs.cwd().createFile(output_file, .{ .exclusive = false, .read = false });
+        defer file.close();
+
+        var buffered = std.io.bufferedWriter(file.writer());
+        if (is_c_header) {
+            try Bindgen.writeC(allocator, database, &property_types, buffered.writer());
+        } else {
+            try Bindgen.writeZig(allocator, database, &property_types, buffered.writer());
+        }
+        try buffered.flush();
+    }
+
+    try writeConfig(database, options, config_format);
+
+    return 0;
 }
 
 test {
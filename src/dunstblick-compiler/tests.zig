@@ -1,7 +1,11 @@
 test {
+    _ = @import("Batch.zig");
+    _ = @import("Bindgen.zig");
+    _ = @import("BinaryDatabase.zig");
     _ = @import("Compiler.zig");
     _ = @import("Database.zig");
     _ = @import("Location.zig");
+    _ = @import("Optimizer.zig");
     _ = @import("ErrorCollection.zig");
     _ = @import("Parser.zig");
     _ = @import("Tokenizer.zig");
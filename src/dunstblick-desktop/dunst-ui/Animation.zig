@@ -0,0 +1,125 @@
+//! A property animation that runs on the display client. The application only sends the
+//! target value, and the property is interpolated from its current value every frame.
+
+const std = @import("std");
+const protocol = @import("dunstblick-protocol");
+
+const types = @import("types.zig");
+
+const Value = types.Value;
+
+const Animation = @This();
+
+oid: protocol.ObjectID,
+name: protocol.PropertyName,
+
+/// The value of the property when the animation was started.
+start: Value,
+target: Value,
+
+/// Duration of the animation in seconds.
+duration: f32,
+/// Time passed since the animation was started, in seconds.
+elapsed: f32 = 0,
+
+easing: protocol.Easing,
+
+/// Report the target value to the application when the animation has finished.
+notify: bool,
+
+/// Returns `true` if values of the type of `value` can be interpolated.
+/// Only those don't own memory, so animations never have to free their values.
+pub fn isAnimatable(value: Value) bool {
+    return switch (value) {
+        .integer, .number, .color, .size, .point => true,
+        else => false,
+    };
+}
+
+/// Advances the animation by `dt` seconds and returns the current value of the property.
+pub fn advance(self: *Animation, dt: f32) Value {
+    self.elapsed = std.math.min(self.elapsed + dt, self.duration);
+    return interpolate(self.start, self.target, ease(self.easing, self.elapsed / self.duration));
+}
+
+pub fn isFinished(self: Animation) bool {
+    return (self.elapsed >= self.duration);
+}
+
+fn ease(easing: protocol.Easing, t: f32) f32 {
+    return switch (easing) {
+        .linear => t,
+        .ease_in => t * t * t,
+        .ease_out => 1 - (1 - t) * (1 - t) * (1 - t),
+        .ease_in_out => if (t < 0.5)
+            4 * t * t * t
+        else
+            1 - 4 * (1 - t) * (1 - t) * (1 - t),
+        _ => t,
+    };
+}
+
+fn interpolate(start: Value, target: Value, t: f32) Value {
+    std.debug.assert(std.meta.activeTag(start) == std.meta.activeTag(target));
+    return switch (target) {
+        .integer => |value| Value{ .integer = lerpInt(i32, start.integer, value, t) },
+        .number => |value| Value{ .number = start.number + (value - start.number) * t },
+        .color => |value| Value{ .color = .{
+            .red = lerpInt(u8, start.color.red, value.red, t),
+            .green = lerpInt(u8, start.color.green, value.green, t),
+            .blue = lerpInt(u8, start.color.blue, value.blue, t),
+            .alpha = lerpInt(u8, start.color.alpha, value.alpha, t),
+        } },
+        .size => |value| Value{ .size = .{
+            .width = lerpInt(u32, start.size.width, value.width, t),
+            .height = lerpInt(u32, start.size.height, value.height, t),
+        } },
+        .point => |value| Value{ .point = .{
+            .x = lerpInt(i32, start.point.x, value.x, t),
+            .y = lerpInt(i32, start.point.y, value.y, t),
+        } },
+        else => unreachable,
+    };
+}
+
+fn lerpInt(comptime T: type, a: T, b: T, t: f32) T {
+    const fa = @intToFloat(f64, a);
+    const fb = @intToFloat(f64, b);
+    return @floatToInt(T, @round(fa + (fb - fa) * t));
+}
+
+test "animations interpolate towards the target" {
+    var anim = Animation{
+        .oid = protocol.ObjectID.init(1),
+        .name = protocol.PropertyName.init(1),
+        .start = Value{ .integer = 0 },
+        .target = Value{ .integer = 100 },
+        .duration = 1.0,
+        .easing = .linear,
+        .notify = false,
+    };
+
+    try std.testing.expectEqual(@as(i32, 25), anim.advance(0.25).integer);
+    try std.testing.expect(!anim.isFinished());
+
+    try std.testing.expectEqual(@as(i32, 100), anim.advance(2.0).integer);
+    try std.testing.expect(anim.isFinished());
+}
+
+test "easing functions start at 0 and end at 1" {
+    inline for (.{ .linear, .ease_in, .ease_out, .ease_in_out }) |easing| {
+        try std.testing.expectApproxEqAbs(@as(f32, 0), ease(easing, 0), 0.0001);
+        try std.testing.expectApproxEqAbs(@as(f32, 1), ease(easing, 1), 0.0001);
+    }
+    try std.testing.expect(ease(.ease_in, 0.5) < 0.5);
+    try std.testing.expect(ease(.ease_out, 0.5) > 0.5);
+}
+
+test "colors are interpolated per channel" {
+    const value = interpolate(
+        Value{ .color = .{ .red = 0, .green = 255, .blue = 10, .alpha = 255 } },
+        Value{ .color = .{ .red = 200, .green = 55, .blue = 10, .alpha = 255 } },
+        0.5,
+    );
+    try std.testing.expectEqual(protocol.Color{ .red = 100, .green = 155, .blue = 10, .alpha = 255 }, value.color);
+}
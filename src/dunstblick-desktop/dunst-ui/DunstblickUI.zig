@@ -8,6 +8,10 @@ const logger = std.log.scoped(.dunstblick_ui);
 pub usingnamespace @import("types.zig");
 
 const types = @import("types.zig");
+const Animation = @import("Animation.zig");
+
+const MemoryBudget = @import("../gui/MemoryBudget.zig");
+const profiler = @import("../profiler.zig");
 
 const DunstblickUI = @This();
 
@@ -30,24 +34,53 @@ pub const FeedbackInterface = struct {
     }
 };
 
+/// Renders `drawing` resources into textures. Provided by the host, so the rasterization
+/// can be shared between all applications and run in the background.
+pub const DrawingRasterizer = struct {
+    pub const ErasedSelf = opaque {};
+
+    erased_self: *ErasedSelf,
+    get_texture: fn (self: *ErasedSelf, data: []const u8, size: zero_graphics.Size) error{OutOfMemory}!?*ResourceManager.Texture,
+
+    /// Returns the texture for the drawing `data` rendered at `size`, or `null` if it isn't ready yet.
+    pub fn getTexture(self: @This(), data: []const u8, size: zero_graphics.Size) error{OutOfMemory}!?*ResourceManager.Texture {
+        return self.get_texture(self.erased_self, data, size);
+    }
+};
+
 allocator: std.mem.Allocator,
 
 objects: std.AutoArrayHashMapUnmanaged(protocol.ObjectID, types.Object),
 resources: std.AutoArrayHashMapUnmanaged(protocol.ResourceID, Resource),
 
 current_view: ?WidgetTree,
+/// The layout resource `current_view` was created from.
+current_view_id: ?protocol.ResourceID,
 root_object: ?protocol.ObjectID,
 
+/// Property animations that are currently running, advanced by `updateAnimations()`.
+animations: std.ArrayListUnmanaged(Animation),
+
 interface: FeedbackInterface,
 
-pub fn init(allocator: std.mem.Allocator, interface: FeedbackInterface) DunstblickUI {
+/// Renders all `drawing` resources.
+rasterizer: DrawingRasterizer,
+
+/// Counts the processed frames. Resources remember the frame they were displayed
+/// the last time, so `trimMemory()` can evict the least recently used ones.
+frame: u64 = 0,
+
+pub fn init(allocator: std.mem.Allocator, rasterizer: DrawingRasterizer, interface: FeedbackInterface) DunstblickUI {
     return DunstblickUI{
         .allocator = allocator,
         .objects = .{},
         .resources = .{},
+        .rasterizer = rasterizer,
 
         .current_view = null,
+        .current_view_id = null,
         .root_object = null,
+        .animations = .{},
 
         .interface = interface,
     };
@@ -57,7 +90,7 @@ pub fn deinit(self: *DunstblickUI) void {
     {
         var it = self.resources.iterator();
         while (it.next()) |entry| {
-            entry.value_ptr.data.deinit(self.allocator);
+            entry.value_ptr.deinit(self.allocator);
         }
     }
     self.resources.deinit(self.allocator);
@@ -70,21 +103,39 @@ pub fn deinit(self: *DunstblickUI) void {
     }
     self.objects.deinit(self.allocator);
 
+    self.animations.deinit(self.allocator);
+
     self.* = undefined;
 }
 
 pub fn processUserInterface(self: *DunstblickUI, rectangle: zero_graphics.Rectangle, ui: zero_graphics.UserInterface.Builder) !void {
+    self.frame += 1;
     if (self.current_view) |*view| {
         const root_object = if (self.root_object) |obj_id|
             self.objects.getPtr(obj_id)
         else
             null;
 
-        try view.updateBindings(root_object);
-        try view.updateWantedSize(ui.ui.renderer.?.resources, ui.ui);
-        view.layout(rectangle);
-
-        try view.processUserInterface(ui.ui.renderer.?.resources, ui);
+        {
+            const zone = profiler.begin(.update_bindings, null);
+            defer zone.end();
+            try view.updateBindings(root_object);
+        }
+        {
+            const zone = profiler.begin(.update_wanted_size, null);
+            defer zone.end();
+            try view.updateWantedSize(ui.ui.renderer.?.resources, ui.ui);
+        }
+        {
+            const zone = profiler.begin(.layout, null);
+            defer zone.end();
+            view.layout(rectangle);
+        }
+        {
+            const zone = profiler.begin(.process_user_interface, null);
+            defer zone.end();
+            try view.processUserInterface(ui.ui.renderer.?.resources, ui);
+        }
     }
 }
 
@@ -97,10 +148,74 @@ pub fn addOrReplaceResource(self: *DunstblickUI, id: protocol.ResourceID, kind:
         };
     }
 
+    gop.value_ptr.invalidateCache();
     gop.value_ptr.kind = kind;
 
     try gop.value_ptr.data.resize(self.allocator, data.len);
     std.mem.copy(u8, gop.value_ptr.data.items, data);
+
+    if (kind == .layout)
+        self.reloadView();
+}
+
+/// Same as `addOrReplaceResource`, but takes ownership of `data` instead of copying it.
+/// `data` must be allocated with the allocator of the user interface.
+pub fn addOrReplaceResourceOwned(self: *DunstblickUI, id: protocol.ResourceID, kind: protocol.ResourceKind, data: []u8) !void {
+    const gop = self.resources.getOrPut(self.allocator, id) catch |err| {
+        self.allocator.free(data);
+        return err;
+    };
+    if (gop.found_existing) {
+        gop.value_ptr.deinit(self.allocator);
+    }
+
+    gop.value_ptr.* = .{
+        .kind = kind,
+        .data = std.ArrayListUnmanaged(u8).fromOwnedSlice(data),
+    };
+
+    if (kind == .layout)
+        self.reloadView();
+}
+
+/// CPU side pixels of a bitmap texture.
+pub const BitmapPixels = struct {
+    width: u15,
+    height: u15,
+    pixels: []const zero_graphics.Color,
+};
+
+/// Returns the pixels of `texture` if it belongs to one of the bitmap resources. The pixels are
+/// decoded on first use and kept with the resource, as the GPU holds the only copy otherwise.
+/// Required for software rendering.
+pub fn getBitmapPixels(self: *DunstblickUI, texture: *const ResourceManager.Texture) ?BitmapPixels {
+    for (self.resources.values()) |*resource| {
+        if (resource.cache_data != .bitmap)
+            continue;
+        const cache = &resource.cache_data.bitmap;
+        const bitmap_texture = cache.texture orelse continue;
+        if (bitmap_texture != texture)
+            continue;
+
+        if (cache.pixels == null) {
+            var image = protocol.bitmap.decode(cache.resource_manager.allocator, resource.data.items, .{}) catch |err| {
+                logger.warn("Could not decode bitmap for software rendering: {s}", .{@errorName(err)});
+                return null;
+            };
+            if (image.width != texture.width or image.height != texture.height) {
+                image.deinit(cache.resource_manager.allocator);
+                return null;
+            }
+            cache.pixels = image.pixels;
+        }
+
+        return BitmapPixels{
+            .width = texture.width,
+            .height = texture.height,
+            .pixels = std.mem.bytesAsSlice(zero_graphics.Color, std.mem.sliceAsBytes(cache.pixels.?)),
+        };
+    }
+    return null;
 }
 
 pub fn addOrUpdateObject(self: *DunstblickUI, obj: types.Object) !void {
@@ -131,6 +246,29 @@ pub fn setView(self: *DunstblickUI, id: protocol.ResourceID) !void {
     }
 
     self.current_view = tree;
+    self.current_view_id = id;
+}
+
+/// Rebuilds the current view after a layout changed, either the view itself or one
+/// of the templates it uses. The objects stay untouched and the widgets keep the
+/// state the user changed, see `WidgetTree.transferState`. When the new layout
+/// is invalid, the old view is kept.
+fn reloadView(self: *DunstblickUI) void {
+    const id = self.current_view_id orelse return;
+    const view = if (self.current_view) |*view| view else return;
+
+    const resource = self.resources.get(id) orelse return;
+
+    var decoder = protocol.Decoder.init(resource.data.items);
+    var tree = WidgetTree.deserialize(self, self.allocator, &decoder) catch |err| {
+        logger.err("failed to reload the view from layout {}: {s}", .{ @enumToInt(id), @errorName(err) });
+        return;
+    };
+
+    tree.transferState(view);
+
+    view.deinit();
+    self.current_view = tree;
 }
 
 pub fn setRoot(self: *DunstblickUI, object: protocol.ObjectID) !void {
@@ -140,6 +278,160 @@ pub fn setRoot(self: *DunstblickUI, object: protocol.ObjectID) !void {
         null;
 }
 
+/// Animates the property `name` of `oid` from its current value to `target` over `duration`
+/// seconds. A running animation of the same property continues from its current value.
+/// Properties that don't exist yet, have another type or can't be interpolated are set immediately.
+pub fn animateProperty(
+    self: *DunstblickUI,
+    oid: protocol.ObjectID,
+    name: protocol.PropertyName,
+    target: types.Value,
+    duration: f32,
+    easing: protocol.Easing,
+    notify: bool,
+) !void {
+    var value = target;
+
+    const object = self.getObject(oid) orelse {
+        value.deinit();
+        return error.ObjectNotFound;
+    };
+
+    self.cancelAnimation(oid, name);
+
+    const current = object.getProperty(name);
+    const animate = (duration > 0) and
+        Animation.isAnimatable(value) and
+        (current != null) and
+        (std.meta.activeTag(current.?.*) == std.meta.activeTag(value));
+
+    if (!animate) {
+        object.setProperty(name, value) catch |err| {
+            value.deinit();
+            return err;
+        };
+        if (notify) {
+            try self.triggerPropertyChanged(oid, name, target);
+        }
+        return;
+    }
+
+    try self.animations.append(self.allocator, Animation{
+        .oid = oid,
+        .name = name,
+        .start = current.?.*,
+        .target = value,
+        .duration = duration,
+        .easing = easing,
+        .notify = notify,
+    });
+}
+
+/// Stops the animation of a property, which keeps its current value. Called when the
+/// property is changed by the application or the user.
+pub fn cancelAnimation(self: *DunstblickUI, oid: protocol.ObjectID, name: protocol.PropertyName) void {
+    for (self.animations.items) |anim, i| {
+        if (anim.oid == oid and anim.name == name) {
+            _ = self.animations.swapRemove(i);
+            return;
+        }
+    }
+}
+
+pub fn isAnimating(self: DunstblickUI) bool {
+    return (self.animations.items.len > 0);
+}
+
+/// Advances all running animations by `dt` seconds and writes the interpolated values into
+/// the objects. Finished animations report their target value when requested.
+pub fn updateAnimations(self: *DunstblickUI, dt: f32) !void {
+    var i: usize = 0;
+    while (i < self.animations.items.len) {
+        const anim = &self.animations.items[i];
+
+        const object = self.getObject(anim.oid) orelse {
+            // the object was removed meanwhile
+            _ = self.animations.swapRemove(i);
+            continue;
+        };
+
+        try object.setProperty(anim.name, anim.advance(dt));
+
+        if (anim.isFinished()) {
+            const finished = self.animations.swapRemove(i);
+            if (finished.notify) {
+                try self.triggerPropertyChanged(finished.oid, finished.name, finished.target);
+            }
+        } else {
+            i += 1;
+        }
+    }
+}
+
+/// Returns the resource `id` and marks it as displayed in the current frame.
+fn useResource(self: *DunstblickUI, id: protocol.ResourceID) ?*Resource {
+    const resource = self.resources.getPtr(id) orelse return null;
+    resource.last_used = self.frame;
+    return resource;
+}
+
+/// Computes the memory currently used by the user interface.
+pub fn getMemoryUsage(self: DunstblickUI) MemoryBudget.Usage {
+    var usage = MemoryBudget.Usage{};
+
+    for (self.resources.values()) |resource| {
+        usage.resources += resource.data.capacity;
+        usage.textures += resource.getCacheSize();
+    }
+
+    for (self.objects.values()) |object| {
+        usage.objects += object.getMemoryUsage();
+    }
+
+    if (self.current_view) |view| {
+        usage.widgets = view.getMemoryUsage();
+    }
+
+    return usage;
+}
+
+/// Evicts decoded resources, least recently used first, until they use at most `cache_budget`
+/// bytes. Evicted resources are decoded again from their raw data when they are displayed
+/// the next time. While `is_visible` is set, the resources of the last processed frame are
+/// still on screen and kept. `frame` doesn't advance for hidden user interfaces, so they pass
+/// `false` to make every resource a candidate.
+/// The raw resource data is never evicted, see `MemoryBudget`.
+pub fn trimMemory(self: *DunstblickUI, cache_budget: usize, is_visible: bool) !void {
+    var cache_size: usize = 0;
+    for (self.resources.values()) |resource| {
+        cache_size += resource.getCacheSize();
+    }
+    if (cache_size <= cache_budget)
+        return;
+
+    var candidates = std.ArrayList(*Resource).init(self.allocator);
+    defer candidates.deinit();
+
+    for (self.resources.values()) |*resource| {
+        if ((!is_visible or resource.last_used < self.frame) and resource.getCacheSize() > 0) {
+            try candidates.append(resource);
+        }
+    }
+
+    std.sort.sort(*Resource, candidates.items, {}, Resource.lessRecentlyUsed);
+
+    for (candidates.items) |resource| {
+        if (cache_size <= cache_budget)
+            break;
+        cache_size -= resource.getCacheSize();
+        resource.invalidateCache();
+    }
+
+    if (cache_size > cache_budget) {
+        logger.debug("displayed resources use {} bytes, which exceeds the budget of {} bytes", .{ cache_size, cache_budget });
+    }
+}
+
 pub fn getObject(self: *DunstblickUI, id: protocol.ObjectID) ?*types.Object {
     return if (self.objects.getEntry(id)) |entry|
         entry.value_ptr
@@ -155,6 +447,7 @@ fn triggerEvent(self: *DunstblickUI, event: protocol.EventID, widget: protocol.W
 }
 
 fn triggerPropertyChanged(self: *DunstblickUI, oid: protocol.ObjectID, name: protocol.PropertyName, value: types.Value) zero_graphics.UserInterface.Builder.Error!void {
+    self.cancelAnimation(oid, name);
     self.interface.triggerPropertyChanged(oid, name, value) catch |err| switch (err) {
         error.IoError => logger.err("{} while property {}.{} was changed to {}", .{ err, oid, name, value }),
         else => |e| return e,
@@ -167,18 +460,150 @@ pub const Resource = struct {
 
     cache_data: Cache = .none,
 
+    /// The frame in which the resource was displayed the last time, see `DunstblickUI.frame`.
+    last_used: u64 = 0,
+
     const Cache = union(enum) {
         none,
         layout,
         bitmap: BitmapCache,
-        drawing,
+        drawing: DrawingCache,
     };
 
     const BitmapCache = struct {
         resource_manager: *ResourceManager,
         texture: ?*ResourceManager.Texture,
+        /// Decoded on demand for software rendering, see `getBitmapPixels()`.
+        pixels: ?[]protocol.bitmap.Color = null,
     };
 
+    /// Returns the number of bytes used by the data derived from `data`.
+    fn getCacheSize(self: Resource) usize {
+        return switch (self.cache_data) {
+            .bitmap => |cache| blk: {
+                var size: usize = 0;
+                if (cache.texture) |texture| {
+                    size += 4 * @as(usize, texture.width) * @as(usize, texture.height);
+                }
+                if (cache.pixels) |pixels| {
+                    size += std.mem.sliceAsBytes(pixels).len;
+                }
+                break :blk size;
+            },
+            .none, .layout, .drawing => 0,
+        };
+    }
+
+    fn lessRecentlyUsed(_: void, lhs: *Resource, rhs: *Resource) bool {
+        return lhs.last_used < rhs.last_used;
+    }
+
+    const DrawingCache = struct {
+        natural_size: ?zero_graphics.Size,
+    };
+
+    fn deinit(self: *Resource, allocator: std.mem.Allocator) void {
+        self.invalidateCache();
+        self.data.deinit(allocator);
+        self.* = undefined;
+    }
+
+    /// Drops all data derived from `data`. Must be called when the resource changes.
+    fn invalidateCache(self: *Resource) void {
+        switch (self.cache_data) {
+            .bitmap => |cache| {
+                if (cache.texture) |texture| {
+                    cache.resource_manager.destroyTexture(texture);
+                }
+                if (cache.pixels) |pixels| {
+                    cache.resource_manager.allocator.free(pixels);
+                }
+            },
+            .none, .layout, .drawing => {},
+        }
+        self.cache_data = .none;
+    }
+
+    /// Returns the size the image resource wants to be displayed in.
+    fn getImageSize(self: *Resource, resource_manager: *zero_graphics.ResourceManager, ui: *zero_graphics.UserInterface) ?zero_graphics.Size {
+        return switch (self.kind) {
+            .bitmap => if (self.getBitmap(resource_manager, ui)) |bmp|
+                zero_graphics.Size{ .width = bmp.width, .height = bmp.height }
+            else
+                null,
+            .drawing => self.getDrawingCache().natural_size,
+            .layout => null,
+        };
+    }
+
+    /// Returns a texture for the image resource that should be displayed in `target` (virtual units).
+    /// Drawings are rasterized asynchronously and return `null` until they are ready.
+    fn getImage(self: *Resource, dunstblick_ui: *DunstblickUI, resource_manager: *zero_graphics.ResourceManager, ui: *zero_graphics.UserInterface, target: zero_graphics.Size) !?*ResourceManager.Texture {
+        switch (self.kind) {
+            .bitmap => return self.getBitmap(resource_manager, ui),
+            .drawing => {
+                const natural_size = self.getDrawingCache().natural_size orelse return null;
+
+                // Rasterize with the aspect of the drawing, large enough to cover `target` in physical pixels,
+                // so the scaling modes of the picture behave the same as for bitmaps.
+                const ratio = ui.renderer.?.unit_to_pixel_ratio;
+                const scale = ratio * std.math.max(
+                    @intToFloat(f32, target.width) / @intToFloat(f32, std.math.max(1, natural_size.width)),
+                    @intToFloat(f32, target.height) / @intToFloat(f32, std.math.max(1, natural_size.height)),
+                );
+                const raster_size = zero_graphics.Size{
+                    .width = @floatToInt(u15, std.math.clamp(scale * @intToFloat(f32, natural_size.width), 1, 4096)),
+                    .height = @floatToInt(u15, std.math.clamp(scale * @intToFloat(f32, natural_size.height), 1, 4096)),
+                };
+
+                return try dunstblick_ui.rasterizer.getTexture(self.data.items, raster_size);
+            },
+            .layout => return null,
+        }
+    }
+
+    fn getDrawingCache(self: *Resource) DrawingCache {
+        std.debug.assert(self.kind == .drawing);
+        if (self.cache_data == .none) {
+            self.cache_data = .{ .drawing = DrawingCache{
+                .natural_size = getDrawingSize(self.data.items),
+            } };
+        }
+        return self.cache_data.drawing;
+    }
+
+    /// Returns the size the TinyVG graphic was designed for, or `null` if the data isn't a valid graphic.
+    fn getDrawingSize(data: []const u8) ?zero_graphics.Size {
+        if (data.len < 4)
+            return null;
+        if (data[0] != 0x72 or data[1] != 0x56 or data[2] != 1)
+            return null;
+
+        // bits 6..7 of the format byte select the encoding of the coordinates
+        const coordinate_range = data[3] >> 6;
+        const dimensions = data[4..];
+        const width_height: [2]u32 = switch (coordinate_range) {
+            0 => if (dimensions.len >= 4)
+                .{ std.mem.readIntLittle(u16, dimensions[0..2]), std.mem.readIntLittle(u16, dimensions[2..4]) }
+            else
+                return null,
+            1 => if (dimensions.len >= 2)
+                .{ dimensions[0], dimensions[1] }
+            else
+                return null,
+            2 => if (dimensions.len >= 8)
+                .{ std.mem.readIntLittle(u32, dimensions[0..4]), std.mem.readIntLittle(u32, dimensions[4..8]) }
+            else
+                return null,
+            else => return null,
+        };
+
+        return zero_graphics.Size{
+            .width = std.math.cast(u15, width_height[0]) orelse return null,
+            .height = std.math.cast(u15, width_height[1]) orelse return null,
+        };
+    }
+
     fn getBitmap(self: *Resource, resource_manager: *zero_graphics.ResourceManager, ui: *zero_graphics.UserInterface) ?*ResourceManager.Texture {
         // TODO: Overhaul caching logic
         if (ui.renderer == null)
@@ -200,13 +625,11 @@ pub const Resource = struct {
     }
 
     pub const DecodeQoi = struct {
-        const qoi = @import("qoi");
-
         data: []const u8,
         flip_y: bool = false,
 
         pub fn create(self: @This(), rm: *ResourceManager) ResourceManager.CreateResourceDataError!ResourceManager.TextureData {
-            var image = qoi.decodeBuffer(rm.allocator, self.data) catch |err| switch (err) {
+            var image = protocol.bitmap.decode(rm.allocator, self.data, .{ .flip_y = self.flip_y }) catch |err| switch (err) {
                 error.OutOfMemory => return error.OutOfMemory,
                 else => return error.InvalidFormat,
             };
@@ -245,6 +668,8 @@ pub fn Property(comptime T: type) type {
 
         value: T,
         binding: ?protocol.PropertyName = null,
+        /// When set, `value` is computed from the binding source in `WidgetTree.updateBindings`.
+        expression: ?BindingExpression = null,
 
         pub fn setUnderlying(self: *Self, value: T) void {
             std.debug.assert(self.binding == null);
@@ -265,11 +690,50 @@ pub fn Property(comptime T: type) type {
                 // trivial cases can be made with this
                 else => {},
             }
+            if (self.expression) |*expression| {
+                expression.deinit();
+            }
             self.* = undefined;
         }
     };
 }
 
+/// The byte code of a binding expression, see `protocol.expression`.
+pub const BindingExpression = struct {
+    allocator: std.mem.Allocator,
+    code: []const u8,
+
+    pub fn init(allocator: std.mem.Allocator, code: []const u8) !BindingExpression {
+        return BindingExpression{
+            .allocator = allocator,
+            .code = try allocator.dupe(u8, code),
+        };
+    }
+
+    pub fn deinit(self: *BindingExpression) void {
+        self.allocator.free(self.code);
+        self.* = undefined;
+    }
+
+    /// Evaluates the expression with the properties of `source` and converts the result to `T`.
+    pub fn evaluate(self: BindingExpression, comptime T: type, source: *types.Object) !T {
+        var result = try protocol.expression.evaluate(self.allocator, self.code, source);
+
+        const value = result.convertTo(T, self.allocator) catch |err| {
+            result.deinit();
+            return err;
+        };
+
+        // `convertTo` returns the string of `result` itself when a string is requested,
+        // every other result has to be released.
+        if (T != types.String or result != .string) {
+            result.deinit();
+        }
+
+        return value;
+    }
+};
+
 fn deinitAllProperties(comptime T: type, container: *T) void {
     inline for (std.meta.fields(T)) |fld| {
         if (comptime isProperty(fld.field_type)) {
@@ -285,8 +749,18 @@ pub const WidgetTree = struct {
     root: Widget,
     ui: *DunstblickUI,
 
+    /// Number of widgets and current nesting depth, only used by `deserialize()`.
+    widget_count: usize = 0,
+    depth: usize = 0,
+
     const scroll_bar_size = 32;
 
+    /// A layout can reference a subtree several times, and the subtree can contain references
+    /// as well, so a small layout can expand into exponentially many widgets. Layouts that
+    /// exceed these limits are rejected with `error.LayoutTooComplex`.
+    pub const max_widgets = 1 << 16;
+    pub const max_depth = 128;
+
     pub fn deserialize(ui: *DunstblickUI, allocator: std.mem.Allocator, decoder: *protocol.Decoder) !WidgetTree {
         var tree = WidgetTree{
             .allocator = allocator,
@@ -310,25 +784,44 @@ pub const WidgetTree = struct {
         Overflow,
         InvalidValue,
         InvalidProperty,
+        LayoutTooComplex,
     };
 
     const ValueFromStream = union(enum) {
         value: types.Value,
         binding: protocol.PropertyName,
+        expression: BindingExpression,
+
+        fn deinit(self: *ValueFromStream) void {
+            switch (self.*) {
+                .value => |*value| value.deinit(),
+                .binding => {},
+                .expression => |*expression| expression.deinit(),
+            }
+        }
     };
 
+    /// Takes ownership of `value_from_stream` on success. A property can either be bound to a
+    /// property or computed by a single expression, layouts that mix them are rejected.
     fn setValue(property: anytype, value_from_stream: ValueFromStream) !bool {
         switch (value_from_stream) {
             .value => |untyped_value| {
-                const typed_value = try untyped_value.get(@TypeOf(property.*).Type);
+                if (property.binding != null)
+                    return error.InvalidValue;
 
-                // this is used in the widget deserializer, so we have no binding
-                // by guarantee
+                const typed_value = try untyped_value.get(@TypeOf(property.*).Type);
                 property.setUnderlying(typed_value);
             },
             .binding => |id| {
+                if (property.expression != null)
+                    return error.InvalidValue;
                 property.binding = id;
             },
+            .expression => |expression| {
+                if (property.binding != null or property.expression != null)
+                    return error.InvalidValue;
+                property.expression = expression;
+            },
         }
         return true;
     }
@@ -361,6 +854,12 @@ pub const WidgetTree = struct {
     }
 
     fn deserializeChildWidget(self: *WidgetTree, widget: *Widget, decoder: *protocol.Decoder, widget_type: protocol.WidgetType) DeserializeWidgetError!void {
+        self.widget_count += 1;
+        self.depth += 1;
+        defer self.depth -= 1;
+        if (self.widget_count > max_widgets or self.depth > max_depth)
+            return error.LayoutTooComplex;
+
         widget.* = Widget.init(self.ui, self.allocator, widget_type);
         errdefer widget.deinit();
 
@@ -379,6 +878,15 @@ pub const WidgetTree = struct {
 
                 // logger.debug("property {} is bound to {}", .{ property_id, property_name });
 
+                // a binding to the invalid property is followed by a binding expression
+                if (property_name == .invalid) {
+                    const code = protocol.expression.read(decoder) catch |err| switch (err) {
+                        error.EndOfStream => return error.EndOfStream,
+                        else => return error.InvalidValue,
+                    };
+                    break :blk ValueFromStream{ .expression = try BindingExpression.init(self.allocator, code) };
+                }
+
                 break :blk ValueFromStream{ .binding = property_name };
             } else blk: {
                 const property_type = for (protocol.layout_format.properties) |desc| {
@@ -394,10 +902,7 @@ pub const WidgetTree = struct {
 
             // find the proper property
 
-            errdefer switch (from_stream) {
-                .value => |*value| value.deinit(),
-                .binding => {},
-            };
+            errdefer from_stream.deinit();
 
             var found_property = try setPropertyValue(Widget, widget, property_id, from_stream);
             if (!found_property) {
@@ -405,10 +910,7 @@ pub const WidgetTree = struct {
             }
             if (!found_property) {
                 logger.warn("property {} does not exist on widget {}", .{ property_id, widget_type });
-                switch (from_stream) {
-                    .value => |*value| value.deinit(),
-                    .binding => {},
-                }
+                from_stream.deinit();
                 // TODO : Think about this:
                 // Is it required that a layout format is properly compiled?
                 // Related: format versions, future properties, …
@@ -423,6 +925,27 @@ pub const WidgetTree = struct {
             const widget_type_tag = try decoder.readByte();
             if (widget_type_tag == 0)
                 break;
+
+            if (widget_type_tag == protocol.layout_format.subtree_reference_tag) {
+                const reference_offset = decoder.offset - 1;
+                const subtree_offset = try decoder.readVarUInt();
+                if (subtree_offset >= reference_offset)
+                    return error.InvalidValue;
+
+                // The subtree is decoded only from the data in front of the reference,
+                // so a reference can never include itself.
+                var subtree_decoder = protocol.Decoder{
+                    .source = decoder.source[0..reference_offset],
+                    .offset = subtree_offset,
+                };
+
+                const child = try widget.children.addOne();
+                errdefer _ = widget.children.pop();
+
+                try self.deserializeWidget(child, &subtree_decoder);
+                continue;
+            }
+
             const child_type = try std.meta.intToEnum(protocol.WidgetType, widget_type_tag);
 
             const child = try widget.children.addOne();
@@ -437,6 +960,68 @@ pub const WidgetTree = struct {
         self.* = undefined;
     }
 
+    /// Properties the widgets change themselves when the user interacts with them.
+    const interactive_properties = .{
+        .{ .control = protocol.WidgetType.checkbox, .property = "is_checked" },
+        .{ .control = protocol.WidgetType.radiobutton, .property = "group" },
+        .{ .control = protocol.WidgetType.textbox, .property = "text" },
+        .{ .control = protocol.WidgetType.scrollbar, .property = "value" },
+        .{ .control = protocol.WidgetType.slider, .property = "value" },
+        .{ .control = protocol.WidgetType.tab_layout, .property = "selected_index" },
+    };
+
+    /// Copies the interactive state of the widgets in `old` into the widgets at the same
+    /// place in this tree, so a reloaded layout doesn't reset the UI the user sees.
+    /// Only widgets of the same type and properties without a binding are considered,
+    /// bound values are kept in the objects anyways.
+    pub fn transferState(self: *WidgetTree, old: *const WidgetTree) void {
+        transferWidgetState(&self.root, &old.root);
+    }
+
+    fn transferWidgetState(widget: *Widget, old: *const Widget) void {
+        if (std.meta.activeTag(widget.control) != std.meta.activeTag(old.control))
+            return;
+
+        inline for (interactive_properties) |item| {
+            if (widget.control == item.control) {
+                const property = &@field(@field(widget.control, @tagName(item.control)), item.property);
+                const old_property = &@field(@field(old.control, @tagName(item.control)), item.property);
+
+                const is_unbound = (property.binding == null and property.expression == null and
+                    old_property.binding == null and old_property.expression == null);
+                if (is_unbound) {
+                    if (@TypeOf(property.value) == types.String) {
+                        property.value.set(old_property.value.get()) catch {};
+                    } else {
+                        property.value = old_property.value;
+                    }
+                }
+            }
+        }
+
+        // Children instantiated from templates are recreated by `updateBindings`.
+        const count = std.math.min(widget.children.items.len, old.children.items.len);
+        for (widget.children.items[0..count]) |*child, i| {
+            const old_child = &old.children.items[i];
+            if (child.template_id == null and old_child.template_id == null) {
+                transferWidgetState(child, old_child);
+            }
+        }
+    }
+
+    /// Estimates the memory used by the widgets of the tree.
+    pub fn getMemoryUsage(self: WidgetTree) usize {
+        return @sizeOf(Widget) + getChildMemoryUsage(&self.root);
+    }
+
+    fn getChildMemoryUsage(widget: *const Widget) usize {
+        var size = widget.children.capacity * @sizeOf(Widget);
+        for (widget.children.items) |*child| {
+            size += getChildMemoryUsage(child);
+        }
+        return size;
+    }
+
     pub fn updateBindings(self: *WidgetTree, root_object: ?*types.Object) !void {
         return self.updateBindingsForWidget(&self.root, root_object);
     }
@@ -479,6 +1064,18 @@ pub const WidgetTree = struct {
                 parent_binding_source;
         }
 
+        // STAGE 1.5: Compute the properties that are bound to expressions.
+        // Without a binding source they keep their last value.
+
+        if (widget.binding_source) |binding_source| {
+            updateExpressions(Widget, widget, binding_source);
+            inline for (std.meta.fields(Control)) |control_fld| {
+                if (widget.control == @field(protocol.WidgetType, control_fld.name)) {
+                    updateExpressions(control_fld.field_type, &@field(widget.control, control_fld.name), binding_source);
+                }
+            }
+        }
+
         // STAGE 2: Update child widgets.
 
         const child_template_id = widget.get(.child_template);
@@ -541,6 +1138,24 @@ pub const WidgetTree = struct {
         }
     }
 
+    fn updateExpressions(comptime T: type, container: *T, binding_source: *types.Object) void {
+        inline for (std.meta.fields(T)) |fld| {
+            if (comptime isProperty(fld.field_type)) {
+                const property = &@field(container, fld.name);
+                if (property.expression) |expression| {
+                    if (expression.evaluate(@TypeOf(property.*).Type, binding_source)) |value| {
+                        property.setUnderlying(value);
+                    } else |err| {
+                        logger.warn("binding error: evaluating the expression of {s} failed: {s}", .{
+                            fld.name,
+                            @errorName(err),
+                        });
+                    }
+                }
+            }
+        }
+    }
+
     pub fn updateWantedSize(self: *WidgetTree, resource_manager: *ResourceManager, ui: *zero_graphics.UserInterface) ComputeWantedSizeError!void {
         try self.updateWantedSizeForWidget(&self.root, resource_manager, ui);
     }
@@ -633,12 +1248,9 @@ pub const WidgetTree = struct {
             .picture => |*picture| blk: {
                 const resource_id = picture.get(.image);
 
-                if (self.ui.resources.getPtr(resource_id)) |resource| {
-                    if (resource.getBitmap(resource_manager, ui)) |bmp| {
-                        break :blk zero_graphics.Size{
-                            .width = bmp.width,
-                            .height = bmp.height,
-                        };
+                if (self.ui.useResource(resource_id)) |resource| {
+                    if (resource.getImageSize(resource_manager, ui)) |size| {
+                        break :blk size;
                     }
                 }
 
@@ -1228,8 +1840,8 @@ pub const WidgetTree = struct {
             .picture => |*picture| {
                 const resource_id = picture.get(.image);
 
-                if (self.ui.resources.getPtr(resource_id)) |resource| {
-                    if (resource.getBitmap(resource_manager, ui.ui)) |bmp| {
+                if (self.ui.useResource(resource_id)) |resource| {
+                    if (try resource.getImage(self.ui, resource_manager, ui.ui, rect.size())) |bmp| {
                         const bitmap: *ResourceManager.Texture = bmp;
                         const image_scaling: protocol.enums.ImageScaling = picture.get(.image_scaling);
 
@@ -51,6 +51,23 @@ pub fn setProperty(self: *Object, name: protocol.PropertyName, value: Value) !vo
     gop.value_ptr.* = value;
 }
 
+/// Estimates the memory used by the object and its property values.
+pub fn getMemoryUsage(self: Object) usize {
+    var size = @sizeOf(Object) + self.properties.capacity() * (@sizeOf(protocol.PropertyName) + @sizeOf(Value));
+    for (self.properties.values()) |value| {
+        size += switch (value) {
+            .string => |str| switch (str) {
+                .constant => 0,
+                .dynamic => |list| list.capacity,
+            },
+            .objectlist => |list| list.capacity * @sizeOf(protocol.ObjectID),
+            .sizelist => |list| list.capacity * @sizeOf(protocol.ColumnSizeDefinition),
+            else => 0,
+        };
+    }
+    return size;
+}
+
 pub fn getProperty(self: *Object, name: protocol.PropertyName) ?*Value {
     if (self.properties.getEntry(name)) |entry| {
         return entry.value_ptr;
@@ -0,0 +1,187 @@
+//! Distributes the frame time of the desktop between the running applications.
+//!
+//! Every application gets a `Slot` that tracks when it was updated the last time and how
+//! much CPU time it used. Each frame, the home screen asks a `Frame` whether an application
+//! may update, in order of its `Priority`:
+//!
+//! - The focused application is always updated and may use all of the remaining budget.
+//! - Visible applications share `frame_budget`. When it is exhausted, the remaining ones
+//!   are deferred to the next frame. Applications that regularly exceed their share are
+//!   only updated every few frames, but never less often than `max_deferred_frames`.
+//! - Background applications (on other workspaces or covered by a menu) are only updated
+//!   every `background_period` and never force a redraw, as they can't be seen anyways.
+
+const std = @import("std");
+
+pub const Priority = enum {
+    /// The application the user interacted with last.
+    focused,
+    /// Visible on the current workspace.
+    visible,
+    /// On another workspace or fully covered by a menu.
+    background,
+};
+
+/// Time all applications together may spend in `update()` per frame.
+pub const frame_budget = 8 * std.time.ns_per_ms;
+
+/// The smallest share an application gets, regardless of how many are running.
+pub const min_app_budget = 1 * std.time.ns_per_ms;
+
+/// Background applications are updated with this period.
+pub const background_period = 250 * std.time.ns_per_ms;
+
+/// A visible application is updated at least every this many frames.
+pub const max_deferred_frames = 8;
+
+pub const Slot = struct {
+    priority: Priority = .visible,
+
+    /// Time passed since the last update, in seconds. Passed to the next update.
+    pending_dt: f32 = 0,
+    /// Timestamp of the last update.
+    last_update: i128 = 0,
+    /// Number of frames the application was skipped in a row.
+    deferred_frames: u32 = 0,
+
+    /// Update time granted in the last frame the application was updated.
+    budget: u64 = min_app_budget,
+    /// Exponential moving average of the time spent in `update()`.
+    average_update_time: f64 = 0,
+
+    /// CPU time (update, user interface and rendering) spent in the current frame.
+    current_cpu_time: u64 = 0,
+    /// Exponential moving average of the CPU time per frame.
+    average_cpu_time: f64 = 0,
+
+    /// Finishes the CPU time accounting of the previous frame.
+    pub fn beginFrame(self: *Slot) void {
+        self.average_cpu_time = ema(self.average_cpu_time, self.current_cpu_time);
+        self.current_cpu_time = 0;
+    }
+
+    pub fn addCpuTime(self: *Slot, duration: u64) void {
+        self.current_cpu_time += duration;
+    }
+
+    /// Returns `true` when changes of the application can be seen and must be drawn.
+    pub fn isVisible(self: Slot) bool {
+        return (self.priority != .background);
+    }
+
+    /// Returns `true` when the application regularly needs more than `budget` and
+    /// should sit out this frame.
+    fn isThrottled(self: Slot, budget: u64) bool {
+        const ratio = self.average_update_time / @intToFloat(f64, budget);
+        if (ratio <= 1.0)
+            return false;
+        const period = std.math.min(@floatToInt(u32, @ceil(ratio)), max_deferred_frames);
+        return (self.deferred_frames + 1 < period);
+    }
+
+    /// Returns `true` when the application used more than its share on average.
+    pub fn isOverBudget(self: Slot) bool {
+        return self.average_update_time > @intToFloat(f64, self.budget);
+    }
+};
+
+/// Scheduling state of a single frame.
+pub const Frame = struct {
+    now: i128,
+    /// Share of the frame budget for each application.
+    app_budget: u64,
+    /// Update time used so far in this frame.
+    used: u64 = 0,
+
+    pub fn init(app_count: usize) Frame {
+        return Frame{
+            .now = std.time.nanoTimestamp(),
+            .app_budget = std.math.max(min_app_budget, frame_budget / std.math.max(1, app_count)),
+        };
+    }
+
+    /// Returns `true` if the application of `slot` should be updated in this frame.
+    /// `dt` is accumulated for skipped applications, so their next update catches up.
+    pub fn shouldUpdate(self: *Frame, slot: *Slot, dt: f32) bool {
+        slot.pending_dt += dt;
+
+        const has_budget = (self.used < frame_budget);
+        const run = switch (slot.priority) {
+            .focused => true,
+            .visible => (slot.deferred_frames >= max_deferred_frames) or
+                (has_budget and !slot.isThrottled(self.app_budget)),
+            .background => (self.now - slot.last_update >= background_period) and
+                (has_budget or self.now - slot.last_update >= 4 * background_period),
+        };
+
+        if (!run) {
+            slot.deferred_frames += 1;
+            return false;
+        }
+
+        slot.budget = if (slot.priority == .focused)
+            std.math.max(self.app_budget, frame_budget -| self.used)
+        else
+            self.app_budget;
+        return true;
+    }
+
+    /// Accounts the update of `slot` that took `duration` nanoseconds.
+    pub fn finishUpdate(self: *Frame, slot: *Slot, duration: u64) void {
+        self.used += duration;
+
+        slot.addCpuTime(duration);
+        slot.average_update_time = ema(slot.average_update_time, duration);
+        slot.pending_dt = 0;
+        slot.last_update = self.now;
+        slot.deferred_frames = 0;
+    }
+};
+
+/// Orders slots by priority, then the ones waiting longest first.
+pub fn lessThan(_: void, lhs: *const Slot, rhs: *const Slot) bool {
+    if (lhs.priority != rhs.priority)
+        return @enumToInt(lhs.priority) < @enumToInt(rhs.priority);
+    return lhs.deferred_frames > rhs.deferred_frames;
+}
+
+fn ema(average: f64, sample: u64) f64 {
+    return if (average == 0)
+        @intToFloat(f64, sample)
+    else
+        0.9 * average + 0.1 * @intToFloat(f64, sample);
+}
+
+test "visible applications are deferred when the frame budget is exhausted" {
+    var slots = [_]Slot{ .{}, .{}, .{} };
+
+    var frame = Frame.init(slots.len);
+    try std.testing.expect(frame.shouldUpdate(&slots[0], 0.016));
+    frame.finishUpdate(&slots[0], frame_budget);
+
+    try std.testing.expect(!frame.shouldUpdate(&slots[1], 0.016));
+    try std.testing.expectEqual(@as(u32, 1), slots[1].deferred_frames);
+
+    slots[2].priority = .focused;
+    try std.testing.expect(frame.shouldUpdate(&slots[2], 0.016));
+
+    // the deferred application catches up eventually
+    slots[1].deferred_frames = max_deferred_frames;
+    try std.testing.expect(frame.shouldUpdate(&slots[1], 0.016));
+    try std.testing.expectApproxEqAbs(@as(f32, 0.032), slots[1].pending_dt, 0.0001);
+}
+
+test "background applications are updated with a reduced rate" {
+    var slot = Slot{ .priority = .background };
+
+    var frame = Frame.init(1);
+    try std.testing.expect(frame.shouldUpdate(&slot, 0.016));
+    frame.finishUpdate(&slot, 0);
+    try std.testing.expect(!slot.isVisible());
+
+    var next = Frame{ .now = frame.now + 1, .app_budget = min_app_budget };
+    try std.testing.expect(!next.shouldUpdate(&slot, 0.016));
+
+    var later = Frame{ .now = frame.now + background_period, .app_budget = min_app_budget };
+    try std.testing.expect(later.shouldUpdate(&slot, 0.016));
+}
@@ -4,6 +4,7 @@ const zerog = @import("zero-graphics");
 
 const Self = @This();
 const ApplicationDescription = @import("ApplicationDescription.zig");
+const MemoryBudget = @import("MemoryBudget.zig");
 
 const Size = zerog.Size;
 
@@ -52,6 +53,35 @@ description: ApplicationDescription,
 vtable: *const Interface,
 status: Status = Status{ .starting = "Starting..." },
 
+/// When set, the application is animated and the desktop will redraw every frame.
+/// Otherwise, the desktop only redraws on input or when the application was invalidated.
+continuous_redraw: bool = false,
+
+/// Set by `invalidate()`, cleared by the desktop when the next frame is drawn.
+needs_redraw: bool = true,
+
+/// The time in nanoseconds the application may spend in the next `update()`.
+/// Assigned by the desktop, which shares the frame time between all applications.
+/// Work that doesn't fit should be deferred to the next frames.
+update_budget: u64 = 4 * std.time.ns_per_ms,
+
+/// Memory currently used by the application, reported by the application in `update()`.
+memory_usage: MemoryBudget.Usage = .{},
+
+/// The number of bytes of decoded data the application may keep in memory.
+/// Assigned by the desktop, which shares the memory between all applications.
+/// Decoded data that exceeds the budget should be released, least recently used first.
+cache_budget: usize = MemoryBudget.min_cache_budget,
+
+/// Assigned by the desktop. Cleared while the application isn't drawn, e.g. on another
+/// workspace, so none of its decoded data is in use and all of it may be released.
+is_visible: bool = true,
+
+/// Notifies the desktop that the application has changed and must be drawn again.
+pub fn invalidate(self: *Self) void {
+    self.needs_redraw = true;
+}
+
 pub fn update(self: *Self, dt: f32) !void {
     std.debug.assert(self.status == .starting or self.status == .running);
     if (self.vtable.update) |fun| {
@@ -0,0 +1,74 @@
+//! Fonts shared by the desktop and its components.
+//!
+//! Every `Renderer2D.Font` parses the TrueType data and keeps its own glyph textures, so
+//! creating the same font twice costs startup time and video memory. The cache creates
+//! each combination of face and pixel size once, when it's requested the first time.
+//! The glyphs of a font are rasterized by the renderer when they are drawn the first time.
+//!
+//! Must only be used from the render thread.
+
+const std = @import("std");
+const zerog = @import("zero-graphics");
+
+const logger = std.log.scoped(.font_cache);
+
+const Renderer2D = zerog.Renderer2D;
+const Font = Renderer2D.Font;
+
+const Self = @This();
+
+pub const Face = enum {
+    sans,
+
+    fn getData(face: Face) []const u8 {
+        return switch (face) {
+            .sans => @embedFile("fonts/firasans-regular.ttf"),
+        };
+    }
+};
+
+const Entry = struct {
+    face: Face,
+    size: u15,
+    font: *const Font,
+};
+
+allocator: std.mem.Allocator,
+renderer: *Renderer2D,
+
+/// Only a handful of fonts exist, so a linear search is the fastest lookup.
+fonts: std.ArrayListUnmanaged(Entry) = .{},
+
+pub fn init(allocator: std.mem.Allocator, renderer: *Renderer2D) Self {
+    return Self{
+        .allocator = allocator,
+        .renderer = renderer,
+    };
+}
+
+pub fn deinit(self: *Self) void {
+    for (self.fonts.items) |entry| {
+        self.renderer.destroyFont(entry.font);
+    }
+    self.fonts.deinit(self.allocator);
+    self.* = undefined;
+}
+
+/// Returns the font `face` with a height of `size` pixels and creates it on first use.
+pub fn get(self: *Self, face: Face, size: u15) !*const Font {
+    for (self.fonts.items) |entry| {
+        if (entry.face == face and entry.size == size)
+            return entry.font;
+    }
+
+    try self.fonts.ensureUnusedCapacity(self.allocator, 1);
+
+    logger.debug("creating font {s} with size {}", .{ @tagName(face), size });
+    const font = try self.renderer.createFont(face.getData(), size);
+    self.fonts.appendAssumeCapacity(Entry{
+        .face = face,
+        .size = size,
+        .font = font,
+    });
+    return font;
+}
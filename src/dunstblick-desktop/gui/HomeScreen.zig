@@ -1,6 +1,5 @@
 const std = @import("std");
 const painterz = @import("painterz");
-const tvg = @import("tvg");
 
 const zerog = @import("zero-graphics");
 
@@ -20,6 +19,11 @@ const Color = zerog.Color;
 
 const ApplicationInstance = @import("ApplicationInstance.zig");
 const ApplicationDescription = @import("ApplicationDescription.zig");
+const RasterCache = @import("RasterCache.zig");
+const AppScheduler = @import("AppScheduler.zig");
+const MemoryBudget = @import("MemoryBudget.zig");
+const FontCache = @import("FontCache.zig");
+const profiler = @import("../profiler.zig");
 
 const ButtonTheme = struct {
     const Style = struct {
@@ -86,6 +90,10 @@ pub const Config = struct {
 
     const WorkspaceConfig = struct {
         app_icon_size: u15,
+        /// Shows the average CPU time per frame in the corner of each application.
+        show_cpu_time: bool,
+        /// Shows the memory used by each application in the opposite corner.
+        show_memory_usage: bool,
         // active_app_border: Color,
         // background_color: Color,
         // insert_highlight_color: Color,
@@ -135,6 +143,8 @@ pub const Config = struct {
 
     workspace: WorkspaceConfig = WorkspaceConfig{
         .app_icon_size = 96,
+        .show_cpu_time = true,
+        .show_memory_usage = true,
         // .background_color = default_colors.tinted_gray,
         // .active_app_border = rgb("255853"),
         // .insert_highlight_color = rgb("FF00FF"),
@@ -382,100 +392,6 @@ const RectangleSide = enum {
     }
 };
 
-const IconCache = struct {
-    const SizedIcons = std.AutoHashMapUnmanaged(u30, *ResourceManager.Texture);
-    const Map = std.StringHashMapUnmanaged(SizedIcons);
-
-    allocator: std.mem.Allocator,
-    resource_manager: ?*ResourceManager,
-    icon_map: Map,
-    arena: std.heap.ArenaAllocator,
-
-    pub fn get(self: *IconCache, icon: []const u8, size: Size) !*ResourceManager.Texture {
-        const resource_manager = self.resource_manager orelse @panic("usage error");
-
-        const gop1 = try self.icon_map.getOrPut(self.allocator, icon);
-        if (!gop1.found_existing) {
-            gop1.value_ptr.* = SizedIcons{};
-        }
-
-        const size_key = (@as(u30, size.width) << 15) | size.width;
-
-        const gop2 = try gop1.value_ptr.getOrPut(self.allocator, size_key);
-        if (!gop2.found_existing) {
-            var arena = std.heap.ArenaAllocator.init(self.allocator);
-            defer arena.deinit();
-
-            const swidth = @as(usize, size.width);
-            const sheight = @as(usize, size.height);
-
-            const pixels = try self.arena.allocator().alloc(Color, swidth * sheight);
-            errdefer self.arena.allocator().free(pixels);
-
-            std.mem.set(Color, pixels, Color.transparent);
-
-            const TvgCanvas = struct {
-                buffer: [*]Color,
-
-                width: usize,
-                height: usize,
-
-                pub fn setPixel(section: @This(), x: isize, y: isize, color: tvg.Color) void {
-                    const bits = color.toRgba8();
-
-                    const px = std.math.cast(usize, x) orelse return;
-                    const py = std.math.cast(usize, y) orelse return;
-
-                    if (px >= section.width or py >= section.height)
-                        return;
-                    const buf = &section.buffer[section.width * py + px];
-                    const dst = buf.*;
-                    const src = Color{
-                        .r = bits[0],
-                        .g = bits[1],
-                        .b = bits[2],
-                        .a = bits[3],
-                    };
-
-                    buf.* = Color.alphaBlend(dst, src, src.a);
-                }
-            };
-
-            tvg.render(
-                arena.allocator(),
-                TvgCanvas{
-                    .buffer = pixels.ptr,
-                    .width = swidth,
-                    .height = sheight,
-                },
-                icon,
-            ) catch {};
-
-            gop2.value_ptr.* = resource_manager.createTexture(.ui, ResourceManager.RawRgbaTexture{
-                .width = size.width,
-                .height = size.height,
-                .pixels = std.mem.sliceAsBytes(pixels),
-            }) catch return error.OutOfMemory;
-        }
-        return gop2.value_ptr.*;
-    }
-
-    pub fn deinit(self: *IconCache) void {
-        var outer_it = self.icon_map.iterator();
-        while (outer_it.next()) |list| {
-            var inner_it = list.value_ptr.iterator();
-            while (inner_it.next()) |item| {
-                self.resource_manager.destroyTexture(item.value_ptr.*);
-            }
-            list.value_ptr.deinit(self.allocator);
-        }
-        self.icon_map.clearRetainingCapacity();
-        self.icon_map.deinit(self.allocator);
-        self.arena.deinit();
-        self.* = undefined;
-    }
-};
-
 const MouseDownData = struct {
     button: zerog.Input.MouseButton,
 
@@ -514,17 +430,26 @@ resource_manager: *ResourceManager,
 renderer: *Renderer2D,
 
 ui: UserInterface,
+/// The font created by `UserInterface.init()`. The user interface draws with the cached
+/// font of the same size instead, which it shares with the applications and the debug HUD.
+ui_own_font: *const Renderer2D.Font,
 input_processor: ?UserInterface.InputProcessor = null,
 
 app_title_font: *const Renderer2D.Font,
 app_status_font: *const Renderer2D.Font,
 app_button_font: *const Renderer2D.Font,
 
-icon_cache: IconCache,
+raster_cache: *RasterCache,
 
 context_menu: ?ContextMenu = null,
 
-pub fn init(allocator: std.mem.Allocator, resource_manager: *ResourceManager, renderer: *Renderer2D, config: *const Config) !Self {
+/// The application that was clicked last. It gets the largest share of the frame time.
+focused_application: ?*ApplicationInstance = null,
+
+/// All applications in the order they are updated in the current frame.
+schedule_queue: std.ArrayList(*WindowTree.Node),
+
+pub fn init(allocator: std.mem.Allocator, resource_manager: *ResourceManager, renderer: *Renderer2D, raster_cache: *RasterCache, font_cache: *FontCache, config: *const Config) !Self {
     var self = Self{
         .allocator = allocator,
         .size = Size{ .width = 0, .height = 0 },
@@ -538,30 +463,27 @@ pub fn init(allocator: std.mem.Allocator, resource_manager: *ResourceManager, re
         .app_status_font = undefined,
         .app_button_font = undefined,
         .ui = undefined,
+        .ui_own_font = undefined,
         .resource_manager = resource_manager,
         .renderer = renderer,
-        .icon_cache = .{
-            .resource_manager = resource_manager,
-            .allocator = allocator,
-            .icon_map = .{},
-            .arena = std.heap.ArenaAllocator.init(allocator),
-        },
+        .raster_cache = raster_cache,
+        .schedule_queue = std.ArrayList(*WindowTree.Node).init(allocator),
     };
 
-    const ttf_font_data = @embedFile("fonts/firasans-regular.ttf");
-
-    self.app_title_font = try renderer.createFont(ttf_font_data, 30);
-    errdefer renderer.destroyFont(self.app_title_font);
-
-    self.app_status_font = try renderer.createFont(ttf_font_data, 20);
-    errdefer renderer.destroyFont(self.app_status_font);
-
-    self.app_button_font = try renderer.createFont(ttf_font_data, 12);
-    errdefer renderer.destroyFont(self.app_button_font);
+    // the fonts are owned by the cache
+    self.app_title_font = try font_cache.get(.sans, 30);
+    self.app_status_font = try font_cache.get(.sans, 20);
+    self.app_button_font = try font_cache.get(.sans, 12);
 
     self.ui = try UserInterface.init(self.allocator, renderer);
     errdefer self.ui.deinit();
 
+    // glyphs are rasterized when they are drawn, so the unused font of the user interface
+    // never allocates textures
+    self.ui_own_font = self.ui.default_font;
+    self.ui.default_font = try font_cache.get(.sans, @intCast(u15, self.ui_own_font.font_size));
+    errdefer self.ui.default_font = self.ui_own_font;
+
     self.ui.theme = &ui_theme;
 
     // std.json.stringify(self.config, .{
@@ -588,6 +510,7 @@ pub fn deinit(self: *Self) void {
     }
     self.menu_items.deinit();
     self.available_apps.deinit();
+    self.schedule_queue.deinit();
     self.* = undefined;
 }
 
@@ -843,11 +766,45 @@ fn doContextMenu(self: Self, builder: UserInterface.Builder, focus_point: Point,
     return .none;
 }
 
-pub fn update(self: *Self, dt: f32) !void {
+/// Returns `true` when the home screen has to be redrawn even without any input,
+/// because an animation is running or an application was changed.
+/// Clears the redraw request of all applications.
+pub fn needsRedraw(self: *Self) bool {
+    // long click indicator and drag&drop are animated
+    var redraw = (self.mouse_down_data != null) or (self.mode != .default);
+
+    for (self.menu_items.items) |*menu_item| {
+        if (menu_item.* != .button)
+            continue;
+        if (menu_item.button.data != .workspace)
+            continue;
+
+        var leaf_iterator = menu_item.button.data.workspace.window_tree.leafIterator();
+        while (leaf_iterator.next()) |leaf| {
+            switch (leaf.*) {
+                .starting, .connected => |*app| {
+                    // hidden applications are drawn again when they become visible
+                    if (app.schedule.isVisible() and (app.application.continuous_redraw or app.application.needs_redraw)) {
+                        redraw = true;
+                    }
+                    app.application.needs_redraw = false;
+                },
+                .exited, .empty, .group => {},
+            }
+        }
+    }
+
+    return redraw;
+}
 
-    // Update all running applications
+/// Updates all running applications, in the order of their priority. This also happens
+/// in frames without a redraw, so timers and animations of the applications keep running.
+/// Returns `true` when an application changed its state and the home screen has to be rebuilt.
+pub fn updateApplications(self: *Self, dt: f32) !bool {
+    var changed = false;
     {
-        for (self.menu_items.items) |*menu_item| {
+        self.schedule_queue.shrinkRetainingCapacity(0);
+        for (self.menu_items.items) |*menu_item, button_index| {
             if (menu_item.* != .button)
                 continue;
             if (menu_item.button.data != .workspace)
@@ -860,18 +817,55 @@ pub fn update(self: *Self, dt: f32) !void {
 
             while (leaf_iterator.next()) |leaf| {
                 // logger.info("  available node: {}", .{leaf});
-                switch (leaf.*) {
-                    .starting, .connected, .exited => {
-                        try updateAppInstance(leaf, dt);
-                    },
-                    .empty, .group => {
-                        // those have no update logic, but .group might be animated in the future which would go here
-                    },
-                }
+                // .empty and .group have no update logic, but .group might be animated in the future which would go here
+                const app = getAppInstance(leaf) orelse continue;
+
+                app.schedule.beginFrame();
+                app.schedule.priority = self.getAppPriority(app, button_index == self.current_workspace);
+                try self.schedule_queue.append(leaf);
+            }
+        }
+
+        std.sort.sort(*WindowTree.Node, self.schedule_queue.items, {}, scheduleLessThan);
+
+        var memory = MemoryBudget.Distribution{};
+        for (self.schedule_queue.items) |leaf| {
+            const app = getAppInstance(leaf).?;
+            memory.add(app.application.memory_usage, app.schedule.priority);
+        }
+        for (self.schedule_queue.items) |leaf| {
+            const app = getAppInstance(leaf).?;
+            app.application.cache_budget = memory.cacheBudget(app.schedule.priority);
+            app.application.is_visible = (app.schedule.priority != .background);
+        }
+
+        var frame = AppScheduler.Frame.init(self.schedule_queue.items.len);
+        for (self.schedule_queue.items) |leaf| {
+            const app = getAppInstance(leaf).?;
+            if (!frame.shouldUpdate(&app.schedule, dt))
+                continue;
+
+            app.application.update_budget = app.schedule.budget;
+
+            const zone = profiler.begin(.app_update, app.application.description.display_name);
+            defer zone.end();
+
+            const start = std.time.nanoTimestamp();
+            const previous_state = std.meta.activeTag(leaf.*);
+            try updateAppInstance(leaf, app.schedule.pending_dt);
+            if (std.meta.activeTag(leaf.*) != previous_state) {
+                changed = true;
             }
+
+            // the node might have been re-tagged, so fetch the instance again
+            frame.finishUpdate(&getAppInstance(leaf).?.schedule, @intCast(u64, std.time.nanoTimestamp() - start));
         }
     }
+    return changed;
+}
 
+/// Rebuilds the user interface of the home screen.
+pub fn update(self: *Self) !void {
     var builder = self.ui.construct(self.size);
     defer builder.finish();
 
@@ -938,7 +932,7 @@ pub fn update(self: *Self, dt: f32) !void {
                     },
                 };
 
-                const texture = try self.icon_cache.get(icon, self.getPhysicalSize(Size{ .width = 48, .height = 48 }));
+                const texture = try self.raster_cache.get(icon, self.getPhysicalSize(Size{ .width = 48, .height = 48 }));
 
                 const style = if (button.data == .workspace and button_index == self.current_workspace)
                     ui_workspace_bar_current_button_theme
@@ -960,7 +954,7 @@ pub fn update(self: *Self, dt: f32) !void {
 
         if (dragged_app_index) |_| {
             const button_rect = self.getMenuButtonRectangle(self.menu_items.items.len);
-            const texture = try self.icon_cache.get(&icons.workspace_add, self.getPhysicalSize(Size{ .width = 48, .height = 48 }));
+            const texture = try self.raster_cache.get(&icons.workspace_add, self.getPhysicalSize(Size{ .width = 48, .height = 48 }));
             const style = if (button_rect.contains(self.mouse_pos))
                 ui_workspace_bar_current_button_theme
             else
@@ -1201,6 +1195,7 @@ fn processAppNodeEvent(custom: UserInterface.CustomWidget, event: UserInterface.
         },
         .pointer_press => |data| {
             app.mouse_press_location = data;
+            self.focused_application = app.application;
         },
         .pointer_release => |data| {
             if (app.mouse_press_location) |loc| {
@@ -1230,6 +1225,45 @@ fn renderAppNode(custom: UserInterface.CustomWidget, area: Rectangle, renderer:
         .running => try self.renderRunningAppNode(app, area, renderer),
         .exited => try self.renderExitedAppNode(app, area, renderer),
     }
+
+    if (self.config.workspace.show_cpu_time and app.application.status != .exited) {
+        var buffer: [32]u8 = undefined;
+        const text = std.fmt.bufPrint(&buffer, "{d:.1} ms", .{app.schedule.average_cpu_time / std.time.ns_per_ms}) catch unreachable;
+
+        const size = renderer.measureString(self.app_button_font, text);
+        if (size.width + 4 <= area.width and size.height + 4 <= area.height) {
+            try renderer.drawString(
+                self.app_button_font,
+                text,
+                area.x + area.width - size.width - 4,
+                area.y + area.height - size.height - 4,
+                if (app.schedule.isOverBudget())
+                    Color{ .r = 0xFF, .g = 0x40, .b = 0x40 } // TODO: Replace by theme config
+                else
+                    Color{ .r = 0xA0, .g = 0xA0, .b = 0xA0 },
+            );
+        }
+    }
+
+    if (self.config.workspace.show_memory_usage and app.application.status != .exited) {
+        var buffer: [32]u8 = undefined;
+        const usage = app.application.memory_usage;
+        const text = MemoryBudget.formatSize(&buffer, usage.total());
+
+        const size = renderer.measureString(self.app_button_font, text);
+        if (size.width + 4 <= area.width and size.height + 4 <= area.height) {
+            try renderer.drawString(
+                self.app_button_font,
+                text,
+                area.x + 4,
+                area.y + area.height - size.height - 4,
+                if (usage.textures > app.application.cache_budget)
+                    Color{ .r = 0xFF, .g = 0x40, .b = 0x40 } // TODO: Replace by theme config
+                else
+                    Color{ .r = 0xA0, .g = 0xA0, .b = 0xA0 },
+            );
+        }
+    }
 }
 
 fn renderStartingAppNode(self: *Self, app: *AppInstance, area: Rectangle, renderer: *Renderer2D) Renderer2D.DrawError!void {
@@ -1276,6 +1310,13 @@ fn renderStartingAppNode(self: *Self, app: *AppInstance, area: Rectangle, render
 fn renderRunningAppNode(self: *Self, app: *AppInstance, area: Rectangle, renderer: *Renderer2D) Renderer2D.DrawError!void {
     _ = self;
     _ = renderer;
+
+    const zone = profiler.begin(.app_render, app.application.description.display_name);
+    defer zone.end();
+
+    const start = std.time.nanoTimestamp();
+    defer app.schedule.addCpuTime(@intCast(u64, std.time.nanoTimestamp() - start));
+
     app.application.render(area, renderer) catch |err| logger.err("failed to render application '{s}': {s}", .{
         app.application.description.display_name,
         @errorName(err),
@@ -1322,7 +1363,15 @@ fn updateTreeNode(self: *Self, builder: UserInterface.Builder, area: Rectangle,
                 .process_event = processAppNodeEvent,
             });
 
+            app.area = area.shrink(1);
+
             if (node.* == .connected and app.application.status == .running) {
+                const zone = profiler.begin(.app_ui, app.application.description.display_name);
+                defer zone.end();
+
+                const start = std.time.nanoTimestamp();
+                defer app.schedule.addCpuTime(@intCast(u64, std.time.nanoTimestamp() - start));
+
                 try app.application.processUserInterface(area.shrink(1), builder);
             }
         },
@@ -1494,7 +1543,8 @@ fn getPhysicalSize(self: Self, virtual_size: Size) Size {
 fn drawIcon(self: *Self, target: Rectangle, icon: []const u8, tint: Color) !void {
     const physical_size = self.getPhysicalSize(target.size());
 
-    const texture = try self.icon_cache.get(icon, physical_size);
+    // the icon is rasterized untinted, so all tints share the same texture
+    const texture = (try self.raster_cache.get(icon, physical_size)) orelse return;
 
     try self.renderer.drawTexture(
         target,
@@ -1893,6 +1943,40 @@ fn performAppTransition(leaf: *WindowTree.Node) !void {
     }
 }
 
+fn getAppInstance(node: *WindowTree.Node) ?*AppInstance {
+    return switch (node.*) {
+        .starting, .connected, .exited => |*app| app,
+        .empty, .group => null,
+    };
+}
+
+fn scheduleLessThan(context: void, lhs: *WindowTree.Node, rhs: *WindowTree.Node) bool {
+    return AppScheduler.lessThan(context, &getAppInstance(lhs).?.schedule, &getAppInstance(rhs).?.schedule);
+}
+
+/// Determines how urgent updates of `app` are. Applications on other workspaces
+/// and the ones hidden by the app menu are updated in the background.
+fn getAppPriority(self: Self, app: *const AppInstance, on_current_workspace: bool) AppScheduler.Priority {
+    if (!on_current_workspace)
+        return .background;
+    if (self.focused_application == app.application)
+        return .focused;
+    if (self.mode.isAppMenuVisible()) {
+        if (app.area) |area| {
+            if (containsRectangle(self.getAppMenuRectangle(), area))
+                return .background;
+        }
+    }
+    return .visible;
+}
+
+fn containsRectangle(outer: Rectangle, inner: Rectangle) bool {
+    return inner.x >= outer.x and
+        inner.y >= outer.y and
+        inner.x + inner.width <= outer.x + outer.width and
+        inner.y + inner.height <= outer.y + outer.height;
+}
+
 fn updateAppInstance(node: *WindowTree.Node, dt: f32) !void {
     try performAppTransition(node);
     switch (node.*) {
@@ -1915,9 +1999,16 @@ const AppInstance = struct {
 
     mouse_press_location: ?Point = null,
 
+    /// The area the application was laid out to in the last frame.
+    area: ?Rectangle = null,
+
+    schedule: AppScheduler.Slot = .{},
+
     pub fn deinit(self: *AppInstance, screen: *Self) void {
         if (screen.context_menu != null and screen.context_menu.?.data == .app_instance and screen.context_menu.?.data.app_instance == self)
             screen.closeContextMenu();
+        if (screen.focused_application == self.application)
+            screen.focused_application = null;
         self.application.deinit();
         self.* = undefined;
     }
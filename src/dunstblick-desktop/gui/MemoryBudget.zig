@@ -0,0 +1,123 @@
+//! Shares the memory of the desktop between the running applications.
+//!
+//! Every application reports its `Usage`. Each frame, the home screen collects the usage
+//! of all applications in a `Distribution` and assigns each application a cache budget:
+//!
+//! - Memory that can't be released (raw resource data, objects and widgets) is subtracted
+//!   from `global_budget` first.
+//! - The rest is shared between the applications, weighted by their scheduling priority,
+//!   so the focused application keeps more decoded data than the ones in the background.
+//! - Applications evict decoded data exceeding their budget, least recently used first,
+//!   and decode it again from the raw resource data when it's displayed again.
+//!
+//! Only decoded data is bounded. The raw resource data stays in memory for as long as the
+//! application runs, as the protocol only lets the desktop request resources during the
+//! handshake, so evicted data couldn't be fetched again. Applications that upload many
+//! large resources can therefore exceed `global_budget`.
+
+const std = @import("std");
+
+const AppScheduler = @import("AppScheduler.zig");
+const Priority = AppScheduler.Priority;
+
+/// Memory all applications together should use.
+pub const global_budget = 256 << 20;
+
+/// The smallest cache budget an application gets, regardless of the memory
+/// used by the other applications.
+pub const min_cache_budget = 4 << 20;
+
+/// Memory used by a single application, in bytes.
+pub const Usage = struct {
+    /// Raw data of the resources, kept to decode them again on demand.
+    resources: usize = 0,
+    /// Decoded resources, for example bitmaps uploaded as textures. Can be evicted.
+    textures: usize = 0,
+    /// Objects and their property values.
+    objects: usize = 0,
+    /// Widgets of the current view.
+    widgets: usize = 0,
+
+    pub fn total(self: Usage) usize {
+        return self.fixed() + self.textures;
+    }
+
+    /// Returns the memory that can't be released by evicting decoded data.
+    pub fn fixed(self: Usage) usize {
+        return self.resources + self.objects + self.widgets;
+    }
+};
+
+fn weight(priority: Priority) usize {
+    return switch (priority) {
+        .focused => 4,
+        .visible => 2,
+        .background => 1,
+    };
+}
+
+/// Memory accounting of all applications in a single frame.
+pub const Distribution = struct {
+    /// Memory used by all applications that can't be released.
+    fixed: usize = 0,
+    /// Total memory used by all applications.
+    used: usize = 0,
+    total_weight: usize = 0,
+
+    pub fn add(self: *Distribution, usage: Usage, priority: Priority) void {
+        self.fixed += usage.fixed();
+        self.used += usage.total();
+        self.total_weight += weight(priority);
+    }
+
+    /// Returns how many bytes of decoded data an application with `priority` may keep.
+    pub fn cacheBudget(self: Distribution, priority: Priority) usize {
+        const available = global_budget -| self.fixed;
+        return std.math.max(min_cache_budget, available / std.math.max(1, self.total_weight) * weight(priority));
+    }
+};
+
+/// Formats `bytes` as a short human readable size like `12.3 MiB`.
+pub fn formatSize(buffer: []u8, bytes: usize) []const u8 {
+    const units = [_][]const u8{ "B", "KiB", "MiB", "GiB" };
+
+    var value = @intToFloat(f64, bytes);
+    var unit: usize = 0;
+    while (value >= 1024 and unit + 1 < units.len) : (unit += 1) {
+        value /= 1024;
+    }
+
+    return if (unit == 0)
+        std.fmt.bufPrint(buffer, "{d} {s}", .{ bytes, units[unit] }) catch buffer
+    else
+        std.fmt.bufPrint(buffer, "{d:.1} {s}", .{ value, units[unit] }) catch buffer;
+}
+
+test "the cache budget is weighted by priority" {
+    var distribution = Distribution{};
+    distribution.add(.{ .resources = 16 << 20, .textures = 64 << 20 }, .focused);
+    distribution.add(.{ .resources = 16 << 20, .textures = 64 << 20 }, .visible);
+    distribution.add(.{ .objects = 32 << 20 }, .background);
+
+    try std.testing.expectEqual(@as(usize, 64 << 20), distribution.fixed);
+    try std.testing.expectEqual(@as(usize, 192 << 20), distribution.used);
+
+    const available = global_budget - (64 << 20);
+    try std.testing.expectEqual(@as(usize, available / 7 * 4), distribution.cacheBudget(.focused));
+    try std.testing.expectEqual(@as(usize, available / 7 * 2), distribution.cacheBudget(.visible));
+    try std.testing.expectEqual(@as(usize, available / 7), distribution.cacheBudget(.background));
+}
+
+test "applications always get a minimal cache budget" {
+    var distribution = Distribution{};
+    distribution.add(.{ .resources = global_budget }, .visible);
+
+    try std.testing.expectEqual(@as(usize, min_cache_budget), distribution.cacheBudget(.visible));
+}
+
+test "sizes are formatted with binary units" {
+    var buffer: [32]u8 = undefined;
+    try std.testing.expectEqualStrings("512 B", formatSize(&buffer, 512));
+    try std.testing.expectEqualStrings("1.5 KiB", formatSize(&buffer, 1536));
+    try std.testing.expectEqualStrings("12.0 MiB", formatSize(&buffer, 12 << 20));
+}
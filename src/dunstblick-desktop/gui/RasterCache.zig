@@ -0,0 +1,519 @@
+//! Shared rasterization service for TinyVG graphics.
+//!
+//! Both the home screen icons and the `drawing` resources of the applications are rendered
+//! through this cache. Rasterization happens on a worker thread, so `get()` returns `null`
+//! until the texture is ready, usually one or two frames later. Finished textures are kept
+//! in a LRU list bounded by `Options.memory_budget` and can optionally be persisted to disk,
+//! so a restart of the desktop doesn't have to render the same vectors again.
+//!
+//! All functions except the worker must be called from the render thread, as the
+//! `ResourceManager` isn't thread safe.
+
+const std = @import("std");
+const builtin = @import("builtin");
+const tvg = @import("tvg");
+const zerog = @import("zero-graphics");
+
+const SoftwareRenderer = @import("SoftwareRenderer.zig");
+const DunstblickUI = @import("../dunst-ui/DunstblickUI.zig");
+
+const logger = std.log.scoped(.raster_cache);
+
+const ResourceManager = zerog.ResourceManager;
+const Size = zerog.Size;
+const Color = zerog.Color;
+
+const Self = @This();
+
+pub const Options = struct {
+    /// Maximum number of bytes used by the pixel data of all cached textures.
+    /// Textures that were used in the last built frame are never evicted, so this can
+    /// be exceeded temporarily.
+    memory_budget: usize = 32 * 1024 * 1024,
+
+    /// If not `null`, rasterized graphics are stored in this folder and loaded from there
+    /// instead of rendering them again.
+    disk_cache_path: ?[]const u8 = null,
+};
+
+pub const Key = struct {
+    /// BLAKE3 hash of the TinyVG data. Entries and disk cache files are identified by the
+    /// hash alone, so it must be collision resistant.
+    hash: [32]u8,
+    width: u15,
+    height: u15,
+};
+
+/// Number of frames after which a failed graphic is rendered again.
+/// Failures are usually caused by a lack of memory or a broken disk cache.
+const retry_delay = 120;
+
+const State = union(enum) {
+    pending,
+    ready: *ResourceManager.Texture,
+    /// The frame in which rendering failed.
+    failed: u64,
+};
+
+const Entry = struct {
+    key: Key,
+    state: State,
+    /// The frame this entry was requested the last time.
+    last_used: u64,
+    /// Storage for the texture loader, must be kept alive as long as the texture exists.
+    pixels: []Color,
+};
+
+const LruList = std.TailQueue(Entry);
+
+const Job = struct {
+    key: Key,
+    /// Copy of the TinyVG data, owned by the job.
+    data: []const u8,
+    result: ?[]Color = null,
+};
+
+const JobList = std.TailQueue(Job);
+
+allocator: std.mem.Allocator,
+resource_manager: *ResourceManager,
+options: Options,
+
+/// Least recently used entries are at the front of the list.
+lru: LruList = .{},
+entries: std.AutoHashMapUnmanaged(Key, *LruList.Node) = .{},
+/// Maps the ready textures back to their entries, so the software renderer can find the pixels.
+textures: std.AutoHashMapUnmanaged(*const ResourceManager.Texture, *LruList.Node) = .{},
+memory_usage: usize = 0,
+frame: u64 = 0,
+
+cache_dir: ?std.fs.Dir = null,
+
+worker: ?std.Thread = null,
+mutex: std.Thread.Mutex = .{},
+condition: std.Thread.Condition = .{},
+pending_jobs: JobList = .{},
+finished_jobs: JobList = .{},
+shutdown_requested: bool = false,
+
+/// Initializes the cache in-place, as the worker thread keeps a pointer to it.
+pub fn init(self: *Self, allocator: std.mem.Allocator, resource_manager: *ResourceManager, options: Options) !void {
+    self.* = Self{
+        .allocator = allocator,
+        .resource_manager = resource_manager,
+        .options = options,
+    };
+
+    if (options.disk_cache_path) |path| {
+        self.cache_dir = std.fs.cwd().makeOpenPath(path, .{ .iterate = true }) catch |err| blk: {
+            logger.warn("could not open disk cache at {s}: {s}", .{ path, @errorName(err) });
+            break :blk null;
+        };
+        if (self.cache_dir) |dir| {
+            removeIncompleteFiles(dir) catch |err| {
+                logger.warn("could not clean up the disk cache: {s}", .{@errorName(err)});
+            };
+        }
+    }
+    errdefer if (self.cache_dir) |*dir| dir.close();
+
+    if (!builtin.single_threaded) {
+        self.worker = std.Thread.spawn(.{}, workerMain, .{self}) catch |err| blk: {
+            logger.warn("could not spawn raster worker, falling back to synchronous rendering: {s}", .{@errorName(err)});
+            break :blk null;
+        };
+    }
+}
+
+pub fn deinit(self: *Self) void {
+    if (self.worker) |worker| {
+        {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+            self.shutdown_requested = true;
+        }
+        self.condition.signal();
+        worker.join();
+    }
+
+    while (self.pending_jobs.popFirst()) |node| {
+        self.destroyJob(node);
+    }
+    while (self.finished_jobs.popFirst()) |node| {
+        self.destroyJob(node);
+    }
+
+    while (self.lru.first) |node| {
+        self.destroyEntry(node);
+    }
+    self.entries.deinit(self.allocator);
+    self.textures.deinit(self.allocator);
+
+    if (self.cache_dir) |*dir| dir.close();
+
+    self.* = undefined;
+}
+
+/// Returns the texture for the graphic `data` rendered at `size`, or `null` if it isn't
+/// rendered yet. Rendering is queued on the first request. Tint the texture when drawing it.
+pub fn get(self: *Self, data: []const u8, size: Size) error{OutOfMemory}!?*ResourceManager.Texture {
+    if (size.width == 0 or size.height == 0)
+        return null;
+
+    var key = Key{
+        .hash = undefined,
+        .width = size.width,
+        .height = size.height,
+    };
+    std.crypto.hash.Blake3.hash(data, &key.hash, .{});
+
+    const gop = try self.entries.getOrPut(self.allocator, key);
+    if (gop.found_existing) {
+        const node = gop.value_ptr.*;
+
+        // move to the back of the LRU list
+        self.lru.remove(node);
+        self.lru.append(node);
+        node.data.last_used = self.frame;
+
+        switch (node.data.state) {
+            .ready => |texture| return texture,
+            .pending => return null,
+            .failed => |frame| {
+                if (self.frame < frame + retry_delay)
+                    return null;
+                node.data.state = .pending;
+                errdefer node.data.state = .{ .failed = frame };
+                return try self.queueJob(node, data);
+            },
+        }
+    }
+    errdefer _ = self.entries.remove(key);
+
+    const node = try self.allocator.create(LruList.Node);
+    errdefer self.allocator.destroy(node);
+
+    node.* = .{ .data = Entry{
+        .key = key,
+        .state = .pending,
+        .last_used = self.frame,
+        .pixels = &[_]Color{},
+    } };
+    self.lru.append(node);
+    errdefer self.lru.remove(node);
+    gop.value_ptr.* = node;
+
+    return try self.queueJob(node, data);
+}
+
+/// Returns the interface that renders the `drawing` resources of the applications with this cache.
+pub fn drawingRasterizer(self: *Self) DunstblickUI.DrawingRasterizer {
+    return DunstblickUI.DrawingRasterizer{
+        .erased_self = @ptrCast(*DunstblickUI.DrawingRasterizer.ErasedSelf, self),
+        .get_texture = getErased,
+    };
+}
+
+fn getErased(erased_self: *DunstblickUI.DrawingRasterizer.ErasedSelf, data: []const u8, size: Size) error{OutOfMemory}!?*ResourceManager.Texture {
+    const self = @ptrCast(*Self, @alignCast(@alignOf(Self), erased_self));
+    return self.get(data, size);
+}
+
+/// Renders `data` for the pending entry `node`, either on the worker or right away.
+fn queueJob(self: *Self, node: *LruList.Node, data: []const u8) error{OutOfMemory}!?*ResourceManager.Texture {
+    std.debug.assert(node.data.state == .pending);
+
+    const job_node = try self.allocator.create(JobList.Node);
+    errdefer self.allocator.destroy(job_node);
+
+    job_node.* = .{ .data = Job{
+        .key = node.data.key,
+        .data = try self.allocator.dupe(u8, data),
+    } };
+
+    if (self.worker != null) {
+        {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+            self.pending_jobs.append(job_node);
+        }
+        self.condition.signal();
+        return null;
+    } else {
+        self.executeJob(&job_node.data);
+        self.finishJob(job_node);
+        return switch (node.data.state) {
+            .ready => |texture| texture,
+            .pending, .failed => null,
+        };
+    }
+}
+
+/// Uploads finished rasterizations. Call this once per frame.
+/// Returns `true` when new textures are available.
+pub fn update(self: *Self) bool {
+    var finished = blk: {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        const list = self.finished_jobs;
+        self.finished_jobs = .{};
+        break :blk list;
+    };
+    const has_changes = (finished.first != null);
+    while (finished.popFirst()) |job_node| {
+        self.finishJob(job_node);
+    }
+
+    return has_changes;
+}
+
+/// Evicts unused textures. Call this before the user interface is built again,
+/// as textures used in the last built frame are never evicted.
+pub fn beginFrame(self: *Self) void {
+    self.frame += 1;
+    self.evict();
+}
+
+/// Returns `true` when there is still work queued on the worker thread.
+pub fn isBusy(self: *Self) bool {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+    return (self.pending_jobs.first != null) or (self.finished_jobs.first != null);
+}
+
+/// Returns a texture source that resolves the textures of this cache to their pixels.
+pub fn textureSource(self: *Self) SoftwareRenderer.TextureSource {
+    return SoftwareRenderer.TextureSource{
+        .erased_self = @ptrCast(*SoftwareRenderer.TextureSource.ErasedSelf, self),
+        .lookup_fn = lookupTexture,
+    };
+}
+
+fn lookupTexture(erased_self: *SoftwareRenderer.TextureSource.ErasedSelf, texture: *const ResourceManager.Texture) ?SoftwareRenderer.Image {
+    const self = @ptrCast(*Self, @alignCast(@alignOf(Self), erased_self));
+
+    const node = self.textures.get(texture) orelse return null;
+    return SoftwareRenderer.Image{
+        .width = node.data.key.width,
+        .height = node.data.key.height,
+        .pixels = .{ .rgba = node.data.pixels },
+    };
+}
+
+fn finishJob(self: *Self, job_node: *JobList.Node) void {
+    defer self.destroyJob(job_node);
+
+    // the entry might have been evicted while it was pending
+    const node = self.entries.get(job_node.data.key) orelse return;
+    std.debug.assert(node.data.state == .pending);
+
+    const pixels = job_node.data.result orelse {
+        node.data.state = .{ .failed = self.frame };
+        return;
+    };
+    job_node.data.result = null;
+
+    const texture = self.resource_manager.createTexture(.ui, ResourceManager.RawRgbaTexture{
+        .width = node.data.key.width,
+        .height = node.data.key.height,
+        .pixels = std.mem.sliceAsBytes(pixels),
+    }) catch |err| {
+        logger.err("failed to create texture: {s}", .{@errorName(err)});
+        self.allocator.free(pixels);
+        node.data.state = .{ .failed = self.frame };
+        return;
+    };
+
+    node.data.pixels = pixels;
+    node.data.state = .{ .ready = texture };
+    self.memory_usage += std.mem.sliceAsBytes(pixels).len;
+
+    // Only required for software rendering, which falls back to an untextured quad
+    self.textures.put(self.allocator, texture, node) catch {};
+}
+
+fn destroyJob(self: *Self, job_node: *JobList.Node) void {
+    if (job_node.data.result) |pixels| {
+        self.allocator.free(pixels);
+    }
+    self.allocator.free(job_node.data.data);
+    self.allocator.destroy(job_node);
+}
+
+fn destroyEntry(self: *Self, node: *LruList.Node) void {
+    switch (node.data.state) {
+        .ready => |texture| {
+            _ = self.textures.remove(texture);
+            self.resource_manager.destroyTexture(texture);
+        },
+        .pending, .failed => {},
+    }
+    self.memory_usage -= std.mem.sliceAsBytes(node.data.pixels).len;
+    self.allocator.free(node.data.pixels);
+
+    _ = self.entries.remove(node.data.key);
+    self.lru.remove(node);
+    self.allocator.destroy(node);
+}
+
+fn evict(self: *Self) void {
+    var it = self.lru.first;
+    while (it) |node| {
+        if (self.memory_usage <= self.options.memory_budget)
+            break;
+        it = node.next;
+
+        // textures from the last frame might still be referenced by the renderer
+        if (node.data.last_used + 1 >= self.frame)
+            continue;
+        if (node.data.state == .pending)
+            continue;
+
+        self.destroyEntry(node);
+    }
+}
+
+fn workerMain(self: *Self) void {
+    while (true) {
+        const job_node = blk: {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+
+            while (self.pending_jobs.first == null and !self.shutdown_requested) {
+                self.condition.wait(&self.mutex);
+            }
+            if (self.shutdown_requested)
+                return;
+
+            break :blk self.pending_jobs.popFirst().?;
+        };
+
+        self.executeJob(&job_node.data);
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.finished_jobs.append(job_node);
+    }
+}
+
+/// Renders the graphic of `job` or loads it from the disk cache. Can be called from any thread.
+fn executeJob(self: *Self, job: *Job) void {
+    const pixel_count = @as(usize, job.key.width) * @as(usize, job.key.height);
+
+    const pixels = self.allocator.alloc(Color, pixel_count) catch {
+        logger.err("out of memory while rasterizing {}×{} graphic", .{ job.key.width, job.key.height });
+        return;
+    };
+
+    var file_name_buffer: [96]u8 = undefined;
+    const file_name = std.fmt.bufPrint(&file_name_buffer, "{s}-{d}x{d}.rgba", .{
+        std.fmt.fmtSliceHexLower(&job.key.hash),
+        job.key.width,
+        job.key.height,
+    }) catch unreachable;
+
+    if (self.cache_dir) |dir| {
+        if (loadFromDisk(dir, file_name, pixels)) {
+            job.result = pixels;
+            return;
+        }
+    }
+
+    rasterize(self.allocator, job.data, job.key, pixels) catch |err| {
+        logger.err("failed to rasterize graphic: {s}", .{@errorName(err)});
+        self.allocator.free(pixels);
+        return;
+    };
+
+    if (self.cache_dir) |dir| {
+        storeOnDisk(dir, file_name, pixels) catch |err| {
+            logger.warn("could not write {s} to the disk cache: {s}", .{ file_name, @errorName(err) });
+        };
+    }
+
+    job.result = pixels;
+}
+
+/// Writes the pixels to a temporary file first, so a crash never leaves a truncated entry.
+fn storeOnDisk(dir: std.fs.Dir, file_name: []const u8, pixels: []const Color) !void {
+    var random: [8]u8 = undefined;
+    std.crypto.random.bytes(&random);
+
+    var temp_name_buffer: [128]u8 = undefined;
+    const temp_name = std.fmt.bufPrint(&temp_name_buffer, "{s}.{s}.tmp", .{ file_name, std.fmt.fmtSliceHexLower(&random) }) catch unreachable;
+
+    {
+        var file = try dir.createFile(temp_name, .{ .exclusive = true });
+        defer file.close();
+        errdefer dir.deleteFile(temp_name) catch {};
+
+        try file.writeAll(std.mem.sliceAsBytes(pixels));
+    }
+    errdefer dir.deleteFile(temp_name) catch {};
+
+    try dir.rename(temp_name, file_name);
+}
+
+/// Deletes the temporary files of writes that were interrupted by a crash.
+fn removeIncompleteFiles(dir: std.fs.Dir) !void {
+    var iter = dir.iterate();
+    while (try iter.next()) |entry| {
+        if (entry.kind == .File and std.mem.endsWith(u8, entry.name, ".tmp")) {
+            try dir.deleteFile(entry.name);
+        }
+    }
+}
+
+fn loadFromDisk(dir: std.fs.Dir, file_name: []const u8, pixels: []Color) bool {
+    var file = dir.openFile(file_name, .{}) catch return false;
+    defer file.close();
+
+    const bytes = std.mem.sliceAsBytes(pixels);
+    const len = file.readAll(bytes) catch return false;
+    return (len == bytes.len);
+}
+
+fn rasterize(allocator: std.mem.Allocator, data: []const u8, key: Key, pixels: []Color) !void {
+    var arena = std.heap.ArenaAllocator.init(allocator);
+    defer arena.deinit();
+
+    std.mem.set(Color, pixels, Color.transparent);
+
+    const TvgCanvas = struct {
+        buffer: [*]Color,
+
+        width: usize,
+        height: usize,
+
+        pub fn setPixel(section: @This(), x: isize, y: isize, color: tvg.Color) void {
+            const bits = color.toRgba8();
+
+            const px = std.math.cast(usize, x) orelse return;
+            const py = std.math.cast(usize, y) orelse return;
+
+            if (px >= section.width or py >= section.height)
+                return;
+            const buf = &section.buffer[section.width * py + px];
+            const dst = buf.*;
+            const src = Color{
+                .r = bits[0],
+                .g = bits[1],
+                .b = bits[2],
+                .a = bits[3],
+            };
+
+            buf.* = Color.alphaBlend(dst, src, src.a);
+        }
+    };
+
+    try tvg.render(
+        arena.allocator(),
+        TvgCanvas{
+            .buffer = pixels.ptr,
+            .width = key.width,
+            .height = key.height,
+        },
+        data,
+    );
+}
@@ -0,0 +1,215 @@
+//! Renders the desktop with the `SoftwareRenderer`, instead of or next to OpenGL.
+//!
+//! - `.software` rasterizes the draw commands of the desktop on the CPU and shows the frame
+//!   in the window as a single texture, so the CPU path can be used and inspected with the
+//!   same user interface and applications as the OpenGL one.
+//! - `.compare` renders with OpenGL as usual and rasterizes the same draw commands on the CPU.
+//!   Both are timed, and the OpenGL frame is read back to measure how much the results differ.
+//!   The numbers are logged once per `compare_report_period`.
+//!
+//! Displays that can't create a GL context at all are driven by `dunstblick-headless --present`.
+
+const std = @import("std");
+const zerog = @import("zero-graphics");
+
+const SoftwareRenderer = @import("SoftwareRenderer.zig");
+const TextureMirror = @import("TextureMirror.zig");
+const profiler = @import("../profiler.zig");
+
+const logger = std.log.scoped(.software_backend);
+
+const gl = zerog.gles;
+
+const ResourceManager = zerog.ResourceManager;
+const Renderer2D = zerog.Renderer2D;
+const Color = zerog.Color;
+const Size = zerog.Size;
+
+const Self = @This();
+
+pub const Mode = enum {
+    /// Only OpenGL is used.
+    opengl,
+    /// The frame is rasterized on the CPU and displayed as a texture.
+    software,
+    /// OpenGL renders the frame, the CPU rasterizes it as well for comparison.
+    compare,
+};
+
+/// Period in which the comparison is logged in `.compare` mode.
+const compare_report_period = 1000 * std.time.ns_per_ms;
+
+allocator: std.mem.Allocator,
+resource_manager: *ResourceManager,
+
+/// Resolves glyph textures, see `TextureMirror`.
+mirror: TextureMirror,
+
+/// Only valid while `framebuffer_size` isn't empty. Initialized in-place, as its workers keep a pointer.
+framebuffer: SoftwareRenderer = undefined,
+framebuffer_size: Size = Size.empty,
+/// Duration of the last `rasterize()`.
+raster_time: u64 = 0,
+
+/// Draws the rasterized frame in `.software` mode. Separate from the renderer of the
+/// desktop, so idle frames can still replay the recorded draw commands.
+presenter: ?Renderer2D = null,
+frame_texture: ?*ResourceManager.Texture = null,
+
+/// OpenGL frame read back in `.compare` mode.
+readback: std.ArrayListUnmanaged(Color) = .{},
+comparison: Comparison = .{},
+
+const Comparison = struct {
+    frames: u64 = 0,
+    opengl_time: u64 = 0,
+    software_time: u64 = 0,
+    /// Sum of the mean absolute channel difference of each frame.
+    difference: f64 = 0,
+    last_report: i128 = 0,
+};
+
+pub fn init(allocator: std.mem.Allocator, resource_manager: *ResourceManager) Self {
+    return Self{
+        .allocator = allocator,
+        .resource_manager = resource_manager,
+        .mirror = TextureMirror.init(allocator, resource_manager),
+    };
+}
+
+pub fn deinit(self: *Self) void {
+    if (self.frame_texture) |texture| {
+        self.resource_manager.destroyTexture(texture);
+    }
+    if (self.presenter) |*presenter| {
+        presenter.deinit();
+    }
+    if (!self.framebuffer_size.isEmpty()) {
+        self.framebuffer.deinit();
+    }
+    self.readback.deinit(self.allocator);
+    self.mirror.deinit();
+    self.* = undefined;
+}
+
+/// Rasterizes all draw commands recorded in `renderer` into a framebuffer of `size` pixels.
+/// `textures` must resolve the textures of the desktop, the mirror is appended to it.
+pub fn rasterize(self: *Self, renderer: *const Renderer2D, size: Size, textures: []const SoftwareRenderer.TextureSource) !void {
+    const zone = profiler.begin(.rasterize, null);
+    defer zone.end();
+
+    if (size.width != self.framebuffer_size.width or size.height != self.framebuffer_size.height) {
+        if (!self.framebuffer_size.isEmpty()) {
+            self.framebuffer.deinit();
+            self.framebuffer_size = Size.empty;
+        }
+        if (size.isEmpty())
+            return;
+        try self.framebuffer.init(self.allocator, size, .{});
+        self.framebuffer_size = size;
+    }
+    if (size.isEmpty())
+        return;
+
+    var sources: [8]SoftwareRenderer.TextureSource = undefined;
+    std.debug.assert(textures.len < sources.len);
+    std.mem.copy(SoftwareRenderer.TextureSource, &sources, textures);
+    sources[textures.len] = self.mirror.textureSource();
+
+    var chain = SoftwareRenderer.TextureSourceChain{ .sources = sources[0 .. textures.len + 1] };
+
+    const start = std.time.nanoTimestamp();
+    defer self.raster_time = @intCast(u64, std.time.nanoTimestamp() - start);
+
+    self.framebuffer.clear(Color{ .r = 0, .g = 0, .b = 0, .a = 0xFF });
+    try self.framebuffer.render(renderer, chain.textureSource());
+}
+
+/// Draws the last rasterized frame into the current viewport of `size` pixels.
+pub fn present(self: *Self, size: Size, frame_changed: bool) !void {
+    if (self.framebuffer_size.isEmpty())
+        return;
+
+    const zone = profiler.begin(.present, null);
+    defer zone.end();
+
+    if (self.presenter == null) {
+        self.presenter = try self.resource_manager.createRenderer2D();
+        self.presenter.?.unit_to_pixel_ratio = 1.0;
+    }
+    const presenter = &self.presenter.?;
+
+    if (frame_changed or self.frame_texture == null) {
+        if (self.frame_texture) |texture| {
+            self.resource_manager.destroyTexture(texture);
+            self.frame_texture = null;
+        }
+        self.frame_texture = try self.resource_manager.createTexture(.ui, ResourceManager.RawRgbaTexture{
+            .width = self.framebuffer_size.width,
+            .height = self.framebuffer_size.height,
+            .pixels = std.mem.sliceAsBytes(self.framebuffer.pixels),
+        });
+
+        presenter.reset();
+        try presenter.drawTexture(zerog.Rectangle{
+            .x = 0,
+            .y = 0,
+            .width = self.framebuffer_size.width,
+            .height = self.framebuffer_size.height,
+        }, self.frame_texture.?, Color.white);
+    }
+
+    presenter.render(size);
+}
+
+/// Reads back the OpenGL frame of `size` pixels at `x`, `y` (bottom-left origin) and compares it
+/// with the last rasterized frame. `opengl_time` is the time OpenGL took to finish the frame.
+pub fn compare(self: *Self, x: i32, y: i32, size: Size, opengl_time: u64) !void {
+    if (self.framebuffer_size.isEmpty() or size.width != self.framebuffer_size.width or size.height != self.framebuffer_size.height)
+        return;
+
+    const width = @as(usize, size.width);
+    const height = @as(usize, size.height);
+
+    try self.readback.resize(self.allocator, width * height);
+    gl.readPixels(x, y, size.width, size.height, gl.RGBA, gl.UNSIGNED_BYTE, self.readback.items.ptr);
+
+    var difference: u64 = 0;
+    var row: usize = 0;
+    while (row < height) : (row += 1) {
+        // OpenGL rows are stored bottom-up
+        const gl_row = self.readback.items[(height - row - 1) * width ..][0..width];
+        const cpu_row = self.framebuffer.pixels[row * width ..][0..width];
+        for (gl_row) |gl_pixel, i| {
+            const cpu_pixel = cpu_row[i];
+            difference += absDiff(gl_pixel.r, cpu_pixel.r) + absDiff(gl_pixel.g, cpu_pixel.g) + absDiff(gl_pixel.b, cpu_pixel.b);
+        }
+    }
+
+    self.comparison.frames += 1;
+    self.comparison.opengl_time += opengl_time;
+    self.comparison.software_time += self.raster_time;
+    self.comparison.difference += @intToFloat(f64, difference) / @intToFloat(f64, 3 * width * height);
+
+    const now = std.time.nanoTimestamp();
+    if (now - self.comparison.last_report >= compare_report_period) {
+        const frames = self.comparison.frames;
+        logger.info("{d} frames of {d}×{d}: opengl {d:.3} ms, software {d:.3} ms, mean difference {d:.2} per channel", .{
+            frames,
+            size.width,
+            size.height,
+            nsToMs(self.comparison.opengl_time / frames),
+            nsToMs(self.comparison.software_time / frames),
+            self.comparison.difference / @intToFloat(f64, frames),
+        });
+        self.comparison = .{ .last_report = now };
+    }
+}
+
+fn absDiff(a: u8, b: u8) u64 {
+    return if (a > b) a - b else b - a;
+}
+
+fn nsToMs(ns: u64) f64 {
+    return @intToFloat(f64, ns) / std.time.ns_per_ms;
+}
@@ -0,0 +1,903 @@
+//! CPU rasterizer for the draw commands recorded by a `Renderer2D`.
+//!
+//! This is used on displays without a usable GPU and by the headless mode. It consumes the
+//! same triangle lists the OpenGL backend would submit and blends them into an RGBA
+//! framebuffer, which can then be handed to a presenter (see `present.zig`).
+//!
+//! The user interface mostly consists of axis-aligned quads, so consecutive triangle pairs
+//! that form a rectangle are merged and filled row by row with vectorized blending. Glyphs
+//! and images are such rectangles as well and are sampled with a fixed-point stepper.
+//! In `.tiled` mode the framebuffer is split into tiles, each tile gets the list of
+//! primitives touching it (in draw order), and the tiles are rasterized on all cores.
+//!
+//! Texture pixels are resolved through a `TextureSource`, as the `ResourceManager` doesn't
+//! keep them on the CPU. The raster cache, the bitmaps of a `DunstblickUI` and the
+//! `TextureMirror` (glyphs) provide one each, combined with a `TextureSourceChain`.
+//! Textures that can't be resolved are treated as plain white.
+
+const std = @import("std");
+const builtin = @import("builtin");
+const zerog = @import("zero-graphics");
+
+const DunstblickUI = @import("../dunst-ui/DunstblickUI.zig");
+
+const Renderer2D = zerog.Renderer2D;
+const ResourceManager = zerog.ResourceManager;
+const Color = zerog.Color;
+const Size = zerog.Size;
+
+const Self = @This();
+
+pub const Mode = enum {
+    /// Scalar per-pixel rasterization of every triangle. Slow, but simple enough to serve as reference.
+    reference,
+    /// Span based rasterization with vectorized fills and blending on the calling thread.
+    simd,
+    /// Like `simd`, but the framebuffer is split into tiles that are rasterized in parallel.
+    tiled,
+};
+
+pub const Options = struct {
+    mode: Mode = .tiled,
+    /// Number of threads used in `.tiled` mode, including the calling one. `null` uses all cores.
+    thread_count: ?usize = null,
+};
+
+/// CPU side pixel data of a texture.
+pub const Image = struct {
+    width: u15,
+    height: u15,
+    pixels: Pixels,
+
+    pub const Pixels = union(enum) {
+        /// Straight alpha colors, multiplied with the vertex color. Used for icons and bitmaps.
+        rgba: []const Color,
+        /// Coverage only, the vertex color is used as the pixel color. Used for glyphs.
+        alpha: []const u8,
+    };
+};
+
+/// Resolves the textures referenced by the draw calls to their pixel data.
+pub const TextureSource = struct {
+    pub const ErasedSelf = opaque {};
+
+    erased_self: *ErasedSelf,
+    lookup_fn: fn (self: *ErasedSelf, texture: *const ResourceManager.Texture) ?Image,
+
+    pub fn lookup(self: @This(), texture: *const ResourceManager.Texture) ?Image {
+        return self.lookup_fn(self.erased_self, texture);
+    }
+};
+
+/// Resolves the bitmap resources of a `DunstblickUI`.
+pub fn bitmapSource(ui: *DunstblickUI) TextureSource {
+    return TextureSource{
+        .erased_self = @ptrCast(*TextureSource.ErasedSelf, ui),
+        .lookup_fn = lookupBitmap,
+    };
+}
+
+fn lookupBitmap(erased_self: *TextureSource.ErasedSelf, texture: *const ResourceManager.Texture) ?Image {
+    const ui = @ptrCast(*DunstblickUI, @alignCast(@alignOf(DunstblickUI), erased_self));
+    const bitmap = ui.getBitmapPixels(texture) orelse return null;
+    return Image{
+        .width = bitmap.width,
+        .height = bitmap.height,
+        .pixels = .{ .rgba = bitmap.pixels },
+    };
+}
+
+/// Asks a list of texture sources in order, the first one that knows the texture wins.
+pub const TextureSourceChain = struct {
+    sources: []const TextureSource,
+
+    pub fn textureSource(self: *TextureSourceChain) TextureSource {
+        return TextureSource{
+            .erased_self = @ptrCast(*TextureSource.ErasedSelf, self),
+            .lookup_fn = lookupChained,
+        };
+    }
+
+    fn lookupChained(erased_self: *TextureSource.ErasedSelf, texture: *const ResourceManager.Texture) ?Image {
+        const self = @ptrCast(*TextureSourceChain, @alignCast(@alignOf(TextureSourceChain), erased_self));
+        for (self.sources) |source| {
+            if (source.lookup(texture)) |image|
+                return image;
+        }
+        return null;
+    }
+};
+
+/// Edge length of a tile in `.tiled` mode.
+const tile_size = 64;
+
+/// Number of pixels processed per vector operation.
+const lanes = 8;
+
+/// Textured spans are sampled in chunks of this many pixels.
+const chunk_size = 64;
+
+allocator: std.mem.Allocator,
+options: Options,
+size: Size,
+pixels: []Color,
+
+/// Primitives of the current frame, in draw order.
+primitives: std.ArrayListUnmanaged(Primitive) = .{},
+
+tiles_x: usize,
+tiles_y: usize,
+/// For each tile, the indices of the primitives that touch it.
+bins: []std.ArrayListUnmanaged(u32),
+
+workers: []std.Thread = &[_]std.Thread{},
+mutex: std.Thread.Mutex = .{},
+work_available: std.Thread.Condition = .{},
+work_done: std.Thread.Condition = .{},
+generation: u64 = 0,
+active_workers: usize = 0,
+shutdown_requested: bool = false,
+next_tile: std.atomic.Atomic(usize) = std.atomic.Atomic(usize).init(0),
+
+/// Initializes the renderer in-place, as the worker threads keep a pointer to it.
+pub fn init(self: *Self, allocator: std.mem.Allocator, size: Size, options: Options) !void {
+    const pixels = try allocator.alloc(Color, @as(usize, size.width) * @as(usize, size.height));
+    errdefer allocator.free(pixels);
+
+    const tiles_x = (@as(usize, size.width) + tile_size - 1) / tile_size;
+    const tiles_y = (@as(usize, size.height) + tile_size - 1) / tile_size;
+
+    const bins = try allocator.alloc(std.ArrayListUnmanaged(u32), tiles_x * tiles_y);
+    errdefer allocator.free(bins);
+    std.mem.set(std.ArrayListUnmanaged(u32), bins, .{});
+
+    self.* = Self{
+        .allocator = allocator,
+        .options = options,
+        .size = size,
+        .pixels = pixels,
+        .tiles_x = tiles_x,
+        .tiles_y = tiles_y,
+        .bins = bins,
+    };
+    self.clear(Color{ .r = 0, .g = 0, .b = 0, .a = 0xFF });
+
+    if (options.mode == .tiled and !builtin.single_threaded) {
+        const thread_count = options.thread_count orelse (std.Thread.getCpuCount() catch 1);
+        if (thread_count > 1) {
+            self.workers = try allocator.alloc(std.Thread, thread_count - 1);
+
+            var spawned: usize = 0;
+            errdefer {
+                self.stopWorkers(spawned);
+                allocator.free(self.workers);
+            }
+            while (spawned < self.workers.len) : (spawned += 1) {
+                self.workers[spawned] = try std.Thread.spawn(.{}, workerMain, .{self});
+            }
+        }
+    }
+}
+
+pub fn deinit(self: *Self) void {
+    self.stopWorkers(self.workers.len);
+    self.allocator.free(self.workers);
+
+    for (self.bins) |*bin| {
+        bin.deinit(self.allocator);
+    }
+    self.allocator.free(self.bins);
+    self.primitives.deinit(self.allocator);
+    self.allocator.free(self.pixels);
+    self.* = undefined;
+}
+
+fn stopWorkers(self: *Self, count: usize) void {
+    {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.shutdown_requested = true;
+    }
+    self.work_available.broadcast();
+    for (self.workers[0..count]) |worker| {
+        worker.join();
+    }
+}
+
+pub fn clear(self: *Self, color: Color) void {
+    std.mem.set(Color, self.pixels, color);
+}
+
+/// Rasterizes all draw calls recorded in `renderer`. Vertex positions are given in
+/// virtual units and are scaled with the `unit_to_pixel_ratio` of the renderer.
+pub fn render(self: *Self, renderer: *const Renderer2D, textures: ?TextureSource) !void {
+    try self.setupPrimitives(renderer, textures);
+
+    const full = Bounds{ .x0 = 0, .y0 = 0, .x1 = self.size.width, .y1 = self.size.height };
+
+    switch (self.options.mode) {
+        .reference => for (self.primitives.items) |prim| {
+            self.drawReference(prim);
+        },
+        .simd => for (self.primitives.items) |prim| {
+            self.drawPrimitive(prim, full);
+        },
+        .tiled => {
+            try self.binPrimitives();
+
+            {
+                self.mutex.lock();
+                defer self.mutex.unlock();
+
+                self.next_tile.store(0, .Monotonic);
+                self.active_workers = self.workers.len;
+                self.generation += 1;
+            }
+            self.work_available.broadcast();
+
+            self.rasterizeTiles();
+
+            self.mutex.lock();
+            defer self.mutex.unlock();
+            while (self.active_workers > 0) {
+                self.work_done.wait(&self.mutex);
+            }
+        },
+    }
+}
+
+/// Writes the framebuffer as a binary PPM image.
+pub fn writePpm(self: *const Self, writer: anytype) !void {
+    try writer.print("P6\n{d} {d}\n255\n", .{ self.size.width, self.size.height });
+    for (self.pixels) |pixel| {
+        try writer.writeAll(&[3]u8{ pixel.r, pixel.g, pixel.b });
+    }
+}
+
+/// Returns a hash over the framebuffer contents, so two renderings can be compared
+/// without storing a reference image.
+pub fn checksum(self: *const Self) u64 {
+    return std.hash.Fnv1a_64.hash(std.mem.sliceAsBytes(self.pixels));
+}
+
+const Vertex = struct {
+    x: f32,
+    y: f32,
+    u: f32 = 0,
+    v: f32 = 0,
+    color: [4]f32,
+
+    /// Converts a vertex of `Renderer2D`, which stores the tint color inline.
+    fn load(vertex: anytype, scale: f32) Vertex {
+        return Vertex{
+            .x = scale * toFloat(vertex.x),
+            .y = scale * toFloat(vertex.y),
+            .u = toFloat(vertex.u),
+            .v = toFloat(vertex.v),
+            .color = [4]f32{
+                @intToFloat(f32, vertex.r),
+                @intToFloat(f32, vertex.g),
+                @intToFloat(f32, vertex.b),
+                @intToFloat(f32, vertex.a),
+            },
+        };
+    }
+
+    fn toColor(self: Vertex) Color {
+        return Color{
+            .r = @floatToInt(u8, std.math.clamp(self.color[0], 0, 255)),
+            .g = @floatToInt(u8, std.math.clamp(self.color[1], 0, 255)),
+            .b = @floatToInt(u8, std.math.clamp(self.color[2], 0, 255)),
+            .a = @floatToInt(u8, std.math.clamp(self.color[3], 0, 255)),
+        };
+    }
+};
+
+fn toFloat(value: anytype) f32 {
+    return switch (@typeInfo(@TypeOf(value))) {
+        .Int, .ComptimeInt => @intToFloat(f32, value),
+        .Float, .ComptimeFloat => @floatCast(f32, value),
+        else => @compileError("unsupported vertex attribute type " ++ @typeName(@TypeOf(value))),
+    };
+}
+
+/// Pixel rectangle with exclusive upper bounds.
+const Bounds = struct {
+    x0: usize,
+    y0: usize,
+    x1: usize,
+    y1: usize,
+
+    fn intersect(a: Bounds, b: Bounds) Bounds {
+        return Bounds{
+            .x0 = std.math.max(a.x0, b.x0),
+            .y0 = std.math.max(a.y0, b.y0),
+            .x1 = std.math.min(a.x1, b.x1),
+            .y1 = std.math.min(a.y1, b.y1),
+        };
+    }
+
+    fn isEmpty(self: Bounds) bool {
+        return self.x0 >= self.x1 or self.y0 >= self.y1;
+    }
+};
+
+const Primitive = struct {
+    kind: Kind,
+    /// For `.rect`, `vertices[0]` is the top-left and `vertices[1]` the bottom-right corner.
+    vertices: [3]Vertex,
+    image: ?Image,
+    /// Covered pixels, clipped to the framebuffer.
+    bounds: Bounds,
+    /// All vertices share the same color, so no interpolation is required.
+    uniform_color: bool,
+
+    const Kind = enum { triangle, rect };
+};
+
+fn setupPrimitives(self: *Self, renderer: *const Renderer2D, textures: ?TextureSource) !void {
+    self.primitives.shrinkRetainingCapacity(0);
+
+    const scale = renderer.unit_to_pixel_ratio;
+    const vertices = renderer.vertices.items;
+    const merge_rects = (self.options.mode != .reference);
+
+    for (renderer.draw_calls.items) |call| {
+        const list = vertices[call.offset..][0..call.count];
+
+        const texture: ?*const ResourceManager.Texture = call.texture;
+        const image = if (texture != null and textures != null)
+            textures.?.lookup(texture.?)
+        else
+            null;
+
+        var i: usize = 0;
+        while (i + 2 < list.len) {
+            const first = [3]Vertex{
+                Vertex.load(list[i + 0], scale),
+                Vertex.load(list[i + 1], scale),
+                Vertex.load(list[i + 2], scale),
+            };
+
+            if (merge_rects and i + 5 < list.len) {
+                const second = [3]Vertex{
+                    Vertex.load(list[i + 3], scale),
+                    Vertex.load(list[i + 4], scale),
+                    Vertex.load(list[i + 5], scale),
+                };
+                if (self.makeRect(first, second, image)) |rect| {
+                    try self.primitives.append(self.allocator, rect);
+                    i += 6;
+                    continue;
+                }
+            }
+
+            if (self.makeTriangle(first, image)) |triangle| {
+                try self.primitives.append(self.allocator, triangle);
+            }
+            i += 3;
+        }
+    }
+}
+
+fn makeTriangle(self: Self, vertices_in: [3]Vertex, image: ?Image) ?Primitive {
+    var vertices = vertices_in;
+
+    const area = edge(vertices[0], vertices[1], vertices[2].x, vertices[2].y);
+    if (area == 0)
+        return null;
+    if (area < 0) {
+        // normalize the winding order, the UI emits both
+        std.mem.swap(Vertex, &vertices[1], &vertices[2]);
+    }
+
+    const bounds = self.clipBounds(
+        std.math.min3(vertices[0].x, vertices[1].x, vertices[2].x),
+        std.math.min3(vertices[0].y, vertices[1].y, vertices[2].y),
+        std.math.max3(vertices[0].x, vertices[1].x, vertices[2].x),
+        std.math.max3(vertices[0].y, vertices[1].y, vertices[2].y),
+    );
+    if (bounds.isEmpty())
+        return null;
+
+    return Primitive{
+        .kind = .triangle,
+        .vertices = vertices,
+        .image = image,
+        .bounds = bounds,
+        .uniform_color = std.mem.eql(f32, &vertices[0].color, &vertices[1].color) and
+            std.mem.eql(f32, &vertices[0].color, &vertices[2].color),
+    };
+}
+
+/// Returns a rectangle primitive if the two triangles exactly cover an axis-aligned
+/// rectangle with a single color and axis-aligned texture coordinates.
+fn makeRect(self: Self, first: [3]Vertex, second: [3]Vertex, image: ?Image) ?Primitive {
+    var all: [6]Vertex = undefined;
+    std.mem.copy(Vertex, all[0..3], &first);
+    std.mem.copy(Vertex, all[3..6], &second);
+
+    var min_x = all[0].x;
+    var min_y = all[0].y;
+    var max_x = all[0].x;
+    var max_y = all[0].y;
+    for (all[1..]) |v| {
+        min_x = std.math.min(min_x, v.x);
+        min_y = std.math.min(min_y, v.y);
+        max_x = std.math.max(max_x, v.x);
+        max_y = std.math.max(max_y, v.y);
+    }
+    if (min_x == max_x or min_y == max_y)
+        return null;
+
+    // Corner index is bit 0 for right, bit 1 for bottom. Each triangle must use three distinct
+    // corners, and the corners left out must be opposite, so the triangles don't overlap.
+    var top_left: ?Vertex = null;
+    var bottom_right: ?Vertex = null;
+    var missing: [2]u2 = undefined;
+    for ([2][3]Vertex{ first, second }) |triangle, t| {
+        var used: u4 = 0;
+        for (triangle) |v| {
+            if (v.x != min_x and v.x != max_x) return null;
+            if (v.y != min_y and v.y != max_y) return null;
+            if (!std.mem.eql(f32, &v.color, &all[0].color)) return null;
+
+            const corner = @as(u2, @boolToInt(v.x == max_x)) | (@as(u2, @boolToInt(v.y == max_y)) << 1);
+            const bit = @as(u4, 1) << corner;
+            if (used & bit != 0) return null;
+            used |= bit;
+
+            switch (corner) {
+                0 => top_left = v,
+                3 => bottom_right = v,
+                else => {},
+            }
+        }
+        missing[t] = @intCast(u2, @ctz(u4, ~used));
+    }
+    if (missing[0] ^ missing[1] != 3)
+        return null;
+
+    const tl = top_left orelse return null;
+    const br = bottom_right orelse return null;
+
+    // texture coordinates must only depend on the corner
+    for (all) |v| {
+        if (v.u != (if (v.x == min_x) tl.u else br.u)) return null;
+        if (v.v != (if (v.y == min_y) tl.v else br.v)) return null;
+    }
+
+    // a pixel is covered when its center is inside the rectangle
+    const bounds = self.clipBounds(min_x, min_y, max_x, max_y);
+    if (bounds.isEmpty())
+        return null;
+
+    return Primitive{
+        .kind = .rect,
+        .vertices = [3]Vertex{ tl, br, undefined },
+        .image = image,
+        .bounds = bounds,
+        .uniform_color = true,
+    };
+}
+
+/// Converts a rectangle in pixel coordinates into the range of pixels whose centers are inside it.
+fn clipBounds(self: Self, min_x: f32, min_y: f32, max_x: f32, max_y: f32) Bounds {
+    const width = @intToFloat(f32, self.size.width);
+    const height = @intToFloat(f32, self.size.height);
+    return Bounds{
+        .x0 = @floatToInt(usize, std.math.clamp(@ceil(min_x - 0.5), 0, width)),
+        .y0 = @floatToInt(usize, std.math.clamp(@ceil(min_y - 0.5), 0, height)),
+        .x1 = @floatToInt(usize, std.math.clamp(@ceil(max_x - 0.5), 0, width)),
+        .y1 = @floatToInt(usize, std.math.clamp(@ceil(max_y - 0.5), 0, height)),
+    };
+}
+
+fn binPrimitives(self: *Self) !void {
+    for (self.bins) |*bin| {
+        bin.shrinkRetainingCapacity(0);
+    }
+
+    for (self.primitives.items) |prim, index| {
+        const tx0 = prim.bounds.x0 / tile_size;
+        const ty0 = prim.bounds.y0 / tile_size;
+        const tx1 = (prim.bounds.x1 - 1) / tile_size;
+        const ty1 = (prim.bounds.y1 - 1) / tile_size;
+
+        var ty = ty0;
+        while (ty <= ty1) : (ty += 1) {
+            var tx = tx0;
+            while (tx <= tx1) : (tx += 1) {
+                try self.bins[ty * self.tiles_x + tx].append(self.allocator, @intCast(u32, index));
+            }
+        }
+    }
+}
+
+fn workerMain(self: *Self) void {
+    var seen_generation: u64 = 0;
+    while (true) {
+        {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+
+            while (self.generation == seen_generation and !self.shutdown_requested) {
+                self.work_available.wait(&self.mutex);
+            }
+            if (self.shutdown_requested)
+                return;
+            seen_generation = self.generation;
+        }
+
+        self.rasterizeTiles();
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.active_workers -= 1;
+        if (self.active_workers == 0) {
+            self.work_done.signal();
+        }
+    }
+}
+
+fn rasterizeTiles(self: *Self) void {
+    while (true) {
+        const index = self.next_tile.fetchAdd(1, .Monotonic);
+        if (index >= self.bins.len)
+            break;
+
+        const tx = index % self.tiles_x;
+        const ty = index / self.tiles_x;
+        const clip = Bounds{
+            .x0 = tx * tile_size,
+            .y0 = ty * tile_size,
+            .x1 = std.math.min((tx + 1) * tile_size, self.size.width),
+            .y1 = std.math.min((ty + 1) * tile_size, self.size.height),
+        };
+
+        for (self.bins[index].items) |prim_index| {
+            self.drawPrimitive(self.primitives.items[prim_index], clip);
+        }
+    }
+}
+
+fn drawPrimitive(self: *Self, prim: Primitive, clip: Bounds) void {
+    const area = prim.bounds.intersect(clip);
+    if (area.isEmpty())
+        return;
+
+    switch (prim.kind) {
+        .rect => self.drawRect(prim, area),
+        .triangle => self.drawTriangle(prim, area),
+    }
+}
+
+fn row(self: *Self, y: usize) []Color {
+    return self.pixels[y * self.size.width ..][0..self.size.width];
+}
+
+fn drawRect(self: *Self, prim: Primitive, area: Bounds) void {
+    const tl = prim.vertices[0];
+    const br = prim.vertices[1];
+    const color = tl.toColor();
+
+    const image = prim.image orelse {
+        var y = area.y0;
+        while (y < area.y1) : (y += 1) {
+            fillSpan(self.row(y)[area.x0..area.x1], color);
+        }
+        return;
+    };
+
+    // Texture coordinates are stepped in 16.16 fixed point texels
+    const du = (br.u - tl.u) / (br.x - tl.x) * @intToFloat(f32, image.width);
+    const dv = (br.v - tl.v) / (br.y - tl.y) * @intToFloat(f32, image.height);
+    const u_start = tl.u * @intToFloat(f32, image.width) + du * (@intToFloat(f32, area.x0) + 0.5 - tl.x);
+    const u_step = @floatToInt(i32, du * 65536.0);
+
+    var scratch: [chunk_size]Color = undefined;
+
+    var y = area.y0;
+    while (y < area.y1) : (y += 1) {
+        const v = tl.v * @intToFloat(f32, image.height) + dv * (@intToFloat(f32, y) + 0.5 - tl.y);
+        const texel_y = std.math.clamp(@floatToInt(i32, @floor(v)), 0, @as(i32, image.height) - 1);
+
+        const target = self.row(y)[area.x0..area.x1];
+        var u = @floatToInt(i32, u_start * 65536.0);
+
+        var offset: usize = 0;
+        while (offset < target.len) : (offset += chunk_size) {
+            const chunk = std.math.min(chunk_size, target.len - offset);
+            for (scratch[0..chunk]) |*pixel| {
+                const texel_x = std.math.clamp(u >> 16, 0, @as(i32, image.width) - 1);
+                pixel.* = sample(image, @intCast(usize, texel_x), @intCast(usize, texel_y), color);
+                u +%= u_step;
+            }
+            blendPixels(target[offset..][0..chunk], scratch[0..chunk]);
+        }
+    }
+}
+
+fn drawTriangle(self: *Self, prim: Primitive, area: Bounds) void {
+    const a = prim.vertices[0];
+    const b = prim.vertices[1];
+    const c = prim.vertices[2];
+    const inv_area = 1.0 / edge(a, b, c.x, c.y);
+
+    const flat = prim.uniform_color and prim.image == null;
+
+    var scratch: [chunk_size]Color = undefined;
+
+    var y = area.y0;
+    while (y < area.y1) : (y += 1) {
+        const py = @intToFloat(f32, y) + 0.5;
+
+        // Each edge function is linear in x, so the covered pixels of a row are one span
+        var lo: f32 = @intToFloat(f32, area.x0);
+        var hi: f32 = @intToFloat(f32, area.x1);
+        for ([3][2]Vertex{ .{ b, c }, .{ c, a }, .{ a, b } }) |e| {
+            const slope = -(e[1].y - e[0].y);
+            const offset = (e[1].x - e[0].x) * (py - e[0].y) + (e[1].y - e[0].y) * e[0].x;
+            if (slope > 0) {
+                lo = std.math.max(lo, @ceil(-offset / slope - 0.5));
+            } else if (slope < 0) {
+                hi = std.math.min(hi, @floor(-offset / slope - 0.5) + 1);
+            } else if (offset < 0) {
+                hi = lo;
+            }
+        }
+        if (lo >= hi)
+            continue;
+
+        const x0 = @floatToInt(usize, lo);
+        const x1 = @floatToInt(usize, hi);
+        const target = self.row(y)[x0..x1];
+
+        if (flat) {
+            fillSpan(target, Vertex.toColor(a));
+            continue;
+        }
+
+        var offset: usize = 0;
+        while (offset < target.len) : (offset += chunk_size) {
+            const chunk = std.math.min(chunk_size, target.len - offset);
+            for (scratch[0..chunk]) |*pixel, i| {
+                const px = @intToFloat(f32, x0 + offset + i) + 0.5;
+                pixel.* = shade(prim, edge(b, c, px, py) * inv_area, edge(c, a, px, py) * inv_area, edge(a, b, px, py) * inv_area);
+            }
+            blendPixels(target[offset..][0..chunk], scratch[0..chunk]);
+        }
+    }
+}
+
+/// Rasterizes `prim` pixel by pixel, without any of the fast paths.
+fn drawReference(self: *Self, prim: Primitive) void {
+    std.debug.assert(prim.kind == .triangle);
+
+    const a = prim.vertices[0];
+    const b = prim.vertices[1];
+    const c = prim.vertices[2];
+    const inv_area = 1.0 / edge(a, b, c.x, c.y);
+
+    var y = prim.bounds.y0;
+    while (y < prim.bounds.y1) : (y += 1) {
+        const py = @intToFloat(f32, y) + 0.5;
+        const target = self.row(y);
+
+        var x = prim.bounds.x0;
+        while (x < prim.bounds.x1) : (x += 1) {
+            const px = @intToFloat(f32, x) + 0.5;
+
+            const w0 = edge(b, c, px, py);
+            const w1 = edge(c, a, px, py);
+            const w2 = edge(a, b, px, py);
+            if (w0 < 0 or w1 < 0 or w2 < 0)
+                continue;
+
+            target[x] = blendPixel(target[x], shade(prim, w0 * inv_area, w1 * inv_area, w2 * inv_area));
+        }
+    }
+}
+
+/// Returns twice the signed area of the triangle (a, b, p).
+fn edge(a: Vertex, b: Vertex, px: f32, py: f32) f32 {
+    return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+}
+
+/// Computes the color of a triangle pixel from its barycentric coordinates.
+fn shade(prim: Primitive, w0: f32, w1: f32, w2: f32) Color {
+    const a = prim.vertices[0];
+    const b = prim.vertices[1];
+    const c = prim.vertices[2];
+
+    var interpolated = a;
+    for (interpolated.color) |*channel, i| {
+        channel.* = w0 * a.color[i] + w1 * b.color[i] + w2 * c.color[i];
+    }
+    const color = interpolated.toColor();
+
+    const image = prim.image orelse return color;
+
+    const u = (w0 * a.u + w1 * b.u + w2 * c.u) * @intToFloat(f32, image.width);
+    const v = (w0 * a.v + w1 * b.v + w2 * c.v) * @intToFloat(f32, image.height);
+    return sample(
+        image,
+        @intCast(usize, std.math.clamp(@floatToInt(i32, @floor(u)), 0, @as(i32, image.width) - 1)),
+        @intCast(usize, std.math.clamp(@floatToInt(i32, @floor(v)), 0, @as(i32, image.height) - 1)),
+        color,
+    );
+}
+
+/// Returns the texel at (`x`, `y`) modulated with `tint`.
+fn sample(image: Image, x: usize, y: usize, tint: Color) Color {
+    const index = y * image.width + x;
+    return switch (image.pixels) {
+        .alpha => |coverage| Color{
+            .r = tint.r,
+            .g = tint.g,
+            .b = tint.b,
+            .a = mul255(tint.a, coverage[index]),
+        },
+        .rgba => |colors| Color{
+            .r = mul255(tint.r, colors[index].r),
+            .g = mul255(tint.g, colors[index].g),
+            .b = mul255(tint.b, colors[index].b),
+            .a = mul255(tint.a, colors[index].a),
+        },
+    };
+}
+
+fn mul255(a: u8, b: u8) u8 {
+    return div255Scalar(@as(u16, a) * b);
+}
+
+fn div255Scalar(x: u16) u8 {
+    return @intCast(u8, (x + 1 + (x >> 8)) >> 8);
+}
+
+const ByteVec = @Vector(lanes * 4, u8);
+const WideVec = @Vector(lanes * 4, u16);
+
+/// Selects the alpha channel of each pixel into all four of its lanes.
+const alpha_shuffle = blk: {
+    var mask: [lanes * 4]i32 = undefined;
+    for (mask) |*m, i| {
+        m.* = @intCast(i32, (i / 4) * 4 + 3);
+    }
+    break :blk mask;
+};
+
+const is_alpha_lane = blk: {
+    var mask: [lanes * 4]bool = undefined;
+    for (mask) |*m, i| {
+        m.* = (i % 4 == 3);
+    }
+    break :blk @as(@Vector(lanes * 4, bool), mask);
+};
+
+/// Divides by 255 with correct rounding for all products of two bytes.
+fn div255(x: WideVec) WideVec {
+    const one = @splat(lanes * 4, @as(u16, 1));
+    const eight = @splat(lanes * 4, @as(u4, 8));
+    return (x + one + (x >> eight)) >> eight;
+}
+
+/// Blends `color` over all pixels in `dst`.
+fn fillSpan(dst: []Color, color: Color) void {
+    if (color.a == 0xFF) {
+        std.mem.set(Color, dst, color);
+        return;
+    }
+    if (color.a == 0)
+        return;
+
+    // `src * alpha` is the same for all pixels, the alpha lane blends towards opaque
+    var premultiplied: [lanes * 4]u16 = undefined;
+    for (premultiplied) |*lane, i| {
+        const channel: u16 = switch (i % 4) {
+            0 => color.r,
+            1 => color.g,
+            2 => color.b,
+            else => 0xFF,
+        };
+        lane.* = channel * color.a;
+    }
+    const src = @as(WideVec, premultiplied);
+    const inv_alpha = @splat(lanes * 4, @as(u16, 0xFF - color.a));
+
+    const bytes = std.mem.sliceAsBytes(dst);
+
+    var i: usize = 0;
+    while (i + lanes <= dst.len) : (i += lanes) {
+        const chunk = bytes[4 * i ..][0 .. lanes * 4];
+        const d = @intCast(WideVec, @as(ByteVec, chunk.*));
+        chunk.* = @intCast(ByteVec, div255(src + d * inv_alpha));
+    }
+    while (i < dst.len) : (i += 1) {
+        dst[i] = blendPixel(dst[i], color);
+    }
+}
+
+/// Blends each pixel of `src` over the pixel at the same position in `dst`.
+fn blendPixels(dst: []Color, src: []const Color) void {
+    std.debug.assert(dst.len == src.len);
+
+    const dst_bytes = std.mem.sliceAsBytes(dst);
+    const src_bytes = std.mem.sliceAsBytes(src);
+    const opaque_alpha = @splat(lanes * 4, @as(u16, 0xFF));
+
+    var i: usize = 0;
+    while (i + lanes <= dst.len) : (i += lanes) {
+        const chunk = dst_bytes[4 * i ..][0 .. lanes * 4];
+        const d = @intCast(WideVec, @as(ByteVec, chunk.*));
+        const s = @intCast(WideVec, @as(ByteVec, src_bytes[4 * i ..][0 .. lanes * 4].*));
+
+        const alpha = @shuffle(u16, s, undefined, alpha_shuffle);
+        const color = @select(u16, is_alpha_lane, opaque_alpha, s);
+
+        chunk.* = @intCast(ByteVec, div255(color * alpha + d * (opaque_alpha - alpha)));
+    }
+    while (i < dst.len) : (i += 1) {
+        dst[i] = blendPixel(dst[i], src[i]);
+    }
+}
+
+/// Blends `src` over `dst` with straight alpha. Rounds exactly like the vectorized paths.
+fn blendPixel(dst: Color, src: Color) Color {
+    const alpha: u16 = src.a;
+    const inv_alpha: u16 = 0xFF - src.a;
+    return Color{
+        .r = div255Scalar(src.r * alpha + dst.r * inv_alpha),
+        .g = div255Scalar(src.g * alpha + dst.g * inv_alpha),
+        .b = div255Scalar(src.b * alpha + dst.b * inv_alpha),
+        .a = div255Scalar(0xFF * alpha + dst.a * inv_alpha),
+    };
+}
+
+test "drawReference covers half of a square" {
+    var renderer: Self = undefined;
+    try renderer.init(std.testing.allocator, Size{ .width = 4, .height = 4 }, .{ .mode = .reference });
+    defer renderer.deinit();
+
+    const white = [4]f32{ 255, 255, 255, 255 };
+    renderer.drawReference(renderer.makeTriangle(.{
+        Vertex{ .x = 0, .y = 0, .color = white },
+        Vertex{ .x = 4, .y = 0, .color = white },
+        Vertex{ .x = 0, .y = 4, .color = white },
+    }, null).?);
+
+    var covered: usize = 0;
+    for (renderer.pixels) |pixel| {
+        if (pixel.r == 0xFF)
+            covered += 1;
+    }
+    try std.testing.expectEqual(@as(usize, 10), covered);
+}
+
+test "vectorized blending matches the scalar path" {
+    var dst: [lanes * 2 + 3]Color = undefined;
+    var src: [dst.len]Color = undefined;
+    for (dst) |*pixel, i| {
+        pixel.* = Color{ .r = @intCast(u8, i * 11), .g = 0x80, .b = 0xFF, .a = @intCast(u8, i * 13) };
+        src[i] = Color{ .r = 0x40, .g = @intCast(u8, i * 7), .b = 0x10, .a = @intCast(u8, 255 - i * 9) };
+    }
+
+    var expected: [dst.len]Color = undefined;
+    for (expected) |*pixel, i| {
+        pixel.* = blendPixel(dst[i], src[i]);
+    }
+
+    var filled = dst;
+    var filled_expected: [dst.len]Color = undefined;
+    for (filled_expected) |*pixel, i| {
+        pixel.* = blendPixel(dst[i], src[0]);
+    }
+
+    blendPixels(&dst, &src);
+    fillSpan(&filled, src[0]);
+
+    for (expected) |pixel, i| {
+        try std.testing.expectEqual(pixel, dst[i]);
+        try std.testing.expectEqual(filled_expected[i], filled[i]);
+    }
+}
@@ -0,0 +1,84 @@
+//! CPU copies of textures that are created inside zero-graphics, for the `SoftwareRenderer`.
+//!
+//! The glyphs of a `Renderer2D.Font` are rasterized by zero-graphics and only uploaded to
+//! the GPU. The `ResourceManager` keeps the creator of every texture, so the GPU data can be
+//! restored after the context was lost. The mirror runs the same creator once per texture
+//! and keeps the pixels.
+//!
+//! Textures are identified by their address, so a mirrored texture must live as long as the
+//! mirror. This holds for glyphs, which are only destroyed together with their font. Textures
+//! with a shorter lifetime (bitmaps, drawings) must be resolved by their owner instead.
+
+const std = @import("std");
+const zerog = @import("zero-graphics");
+
+const SoftwareRenderer = @import("SoftwareRenderer.zig");
+
+const logger = std.log.scoped(.texture_mirror);
+
+const ResourceManager = zerog.ResourceManager;
+const Color = zerog.Color;
+
+const Self = @This();
+
+allocator: std.mem.Allocator,
+resource_manager: *ResourceManager,
+
+/// `null` marks textures whose creator failed, so they aren't tried every frame.
+images: std.AutoHashMapUnmanaged(*const ResourceManager.Texture, ?SoftwareRenderer.Image) = .{},
+
+pub fn init(allocator: std.mem.Allocator, resource_manager: *ResourceManager) Self {
+    return Self{
+        .allocator = allocator,
+        .resource_manager = resource_manager,
+    };
+}
+
+pub fn deinit(self: *Self) void {
+    var it = self.images.valueIterator();
+    while (it.next()) |image| {
+        if (image.*) |img| {
+            self.allocator.free(img.pixels.rgba);
+        }
+    }
+    self.images.deinit(self.allocator);
+    self.* = undefined;
+}
+
+pub fn textureSource(self: *Self) SoftwareRenderer.TextureSource {
+    return SoftwareRenderer.TextureSource{
+        .erased_self = @ptrCast(*SoftwareRenderer.TextureSource.ErasedSelf, self),
+        .lookup_fn = lookupTexture,
+    };
+}
+
+fn lookupTexture(erased_self: *SoftwareRenderer.TextureSource.ErasedSelf, texture: *const ResourceManager.Texture) ?SoftwareRenderer.Image {
+    const self = @ptrCast(*Self, @alignCast(@alignOf(Self), erased_self));
+
+    const entry = self.images.getOrPut(self.allocator, texture) catch return null;
+    if (!entry.found_existing) {
+        entry.value_ptr.* = self.createImage(texture) catch |err| blk: {
+            logger.warn("could not mirror texture of {}×{} pixels: {s}", .{ texture.width, texture.height, @errorName(err) });
+            break :blk null;
+        };
+    }
+    return entry.value_ptr.*;
+}
+
+fn createImage(self: *Self, texture: *const ResourceManager.Texture) !SoftwareRenderer.Image {
+    const data = try texture.source.createData(self.resource_manager);
+    const bytes = data.pixels orelse return error.NoPixelData;
+    defer self.resource_manager.allocator.free(bytes);
+
+    if (bytes.len != 4 * @as(usize, data.width) * @as(usize, data.height))
+        return error.InvalidFormat;
+
+    const pixels = try self.allocator.alloc(Color, @as(usize, data.width) * @as(usize, data.height));
+    std.mem.copy(u8, std.mem.sliceAsBytes(pixels), bytes);
+
+    return SoftwareRenderer.Image{
+        .width = data.width,
+        .height = data.height,
+        .pixels = .{ .rgba = pixels },
+    };
+}
@@ -0,0 +1,278 @@
+//! Targets that show the output of the `SoftwareRenderer` without a GPU.
+//!
+//! - `LinuxFramebuffer` writes into the memory mapped framebuffer device (`/dev/fb0`),
+//!   converting into its pixel format.
+//! - `SharedMemoryImage` exposes the frame as a file in `/dev/shm`, so another process
+//!   (a compositor, a VNC server or a test) can map and display it.
+
+const std = @import("std");
+const builtin = @import("builtin");
+const zerog = @import("zero-graphics");
+
+const logger = std.log.scoped(.present);
+
+const Color = zerog.Color;
+const Size = zerog.Size;
+
+pub const Target = union(enum) {
+    framebuffer: LinuxFramebuffer,
+    shared_memory: SharedMemoryImage,
+
+    /// Parses a target specification, either `fb:<device>` or `shm:<name>`.
+    pub fn open(spec: []const u8, size: Size) !Target {
+        if (std.mem.startsWith(u8, spec, "fb:")) {
+            return Target{ .framebuffer = try LinuxFramebuffer.open(spec[3..]) };
+        } else if (std.mem.startsWith(u8, spec, "shm:")) {
+            return Target{ .shared_memory = try SharedMemoryImage.create(spec[4..], size) };
+        } else {
+            return error.InvalidTarget;
+        }
+    }
+
+    pub fn close(self: *Target) void {
+        switch (self.*) {
+            .framebuffer => |*fb| fb.close(),
+            .shared_memory => |*shm| shm.close(),
+        }
+    }
+
+    pub fn present(self: *Target, pixels: []const Color, size: Size) void {
+        switch (self.*) {
+            .framebuffer => |*fb| fb.present(pixels, size),
+            .shared_memory => |*shm| shm.present(pixels, size),
+        }
+    }
+};
+
+/// Presents into a Linux fbdev device.
+pub const LinuxFramebuffer = struct {
+    const FBIOGET_VSCREENINFO = 0x4600;
+    const FBIOGET_FSCREENINFO = 0x4602;
+
+    const BitField = extern struct {
+        offset: u32,
+        length: u32,
+        msb_right: u32,
+    };
+
+    /// `struct fb_var_screeninfo` from `linux/fb.h`
+    const VarScreenInfo = extern struct {
+        xres: u32,
+        yres: u32,
+        xres_virtual: u32,
+        yres_virtual: u32,
+        xoffset: u32,
+        yoffset: u32,
+        bits_per_pixel: u32,
+        grayscale: u32,
+        red: BitField,
+        green: BitField,
+        blue: BitField,
+        transp: BitField,
+        nonstd: u32,
+        activate: u32,
+        height: u32,
+        width: u32,
+        accel_flags: u32,
+        pixclock: u32,
+        left_margin: u32,
+        right_margin: u32,
+        upper_margin: u32,
+        lower_margin: u32,
+        hsync_len: u32,
+        vsync_len: u32,
+        sync: u32,
+        vmode: u32,
+        rotate: u32,
+        colorspace: u32,
+        reserved: [4]u32,
+    };
+
+    /// `struct fb_fix_screeninfo` from `linux/fb.h`
+    const FixScreenInfo = extern struct {
+        id: [16]u8,
+        smem_start: c_ulong,
+        smem_len: u32,
+        type: u32,
+        type_aux: u32,
+        visual: u32,
+        xpanstep: u16,
+        ypanstep: u16,
+        ywrapstep: u16,
+        line_length: u32,
+        mmio_start: c_ulong,
+        mmio_len: u32,
+        accel: u32,
+        capabilities: u16,
+        reserved: [2]u16,
+    };
+
+    file: std.fs.File,
+    memory: []align(std.mem.page_size) u8,
+    var_info: VarScreenInfo,
+    line_length: usize,
+
+    pub fn open(path: []const u8) !LinuxFramebuffer {
+        if (builtin.os.tag != .linux)
+            return error.Unsupported;
+
+        var file = try std.fs.cwd().openFile(path, .{ .mode = .read_write });
+        errdefer file.close();
+
+        var var_info: VarScreenInfo = undefined;
+        var fix_info: FixScreenInfo = undefined;
+        try ioctl(file.handle, FBIOGET_VSCREENINFO, @ptrToInt(&var_info));
+        try ioctl(file.handle, FBIOGET_FSCREENINFO, @ptrToInt(&fix_info));
+
+        switch (var_info.bits_per_pixel) {
+            16, 32 => {},
+            else => {
+                logger.err("unsupported framebuffer format with {d} bits per pixel", .{var_info.bits_per_pixel});
+                return error.UnsupportedFormat;
+            },
+        }
+
+        const memory = try std.os.mmap(
+            null,
+            fix_info.smem_len,
+            std.os.PROT.READ | std.os.PROT.WRITE,
+            std.os.MAP.SHARED,
+            file.handle,
+            0,
+        );
+
+        logger.info("opened framebuffer {s} with {d}×{d} pixels at {d} bpp", .{
+            path,
+            var_info.xres,
+            var_info.yres,
+            var_info.bits_per_pixel,
+        });
+
+        return LinuxFramebuffer{
+            .file = file,
+            .memory = memory,
+            .var_info = var_info,
+            .line_length = fix_info.line_length,
+        };
+    }
+
+    pub fn close(self: *LinuxFramebuffer) void {
+        std.os.munmap(self.memory);
+        self.file.close();
+        self.* = undefined;
+    }
+
+    fn ioctl(fd: std.os.fd_t, request: u32, arg: usize) !void {
+        const rc = std.os.linux.ioctl(fd, request, arg);
+        switch (std.os.linux.getErrno(rc)) {
+            .SUCCESS => {},
+            else => |errno| return std.os.unexpectedErrno(errno),
+        }
+    }
+
+    pub fn present(self: *LinuxFramebuffer, pixels: []const Color, size: Size) void {
+        const info = self.var_info;
+        const width = std.math.min(size.width, info.xres);
+        const height = std.math.min(size.height, info.yres);
+        const bytes_per_pixel = info.bits_per_pixel / 8;
+
+        var y: usize = 0;
+        while (y < height) : (y += 1) {
+            const src = pixels[y * size.width ..][0..width];
+            const line_start = (y + info.yoffset) * self.line_length + info.xoffset * bytes_per_pixel;
+            const dst = self.memory[line_start..][0 .. width * bytes_per_pixel];
+
+            switch (info.bits_per_pixel) {
+                32 => for (src) |color, x| {
+                    const value = (@as(u32, color.r) << @intCast(u5, info.red.offset)) |
+                        (@as(u32, color.g) << @intCast(u5, info.green.offset)) |
+                        (@as(u32, color.b) << @intCast(u5, info.blue.offset));
+                    std.mem.writeIntNative(u32, dst[4 * x ..][0..4], value);
+                },
+                16 => for (src) |color, x| {
+                    // RGB565, the only 16 bit format still in use
+                    const value = (@as(u16, color.r >> 3) << 11) |
+                        (@as(u16, color.g >> 2) << 5) |
+                        (@as(u16, color.b >> 3));
+                    std.mem.writeIntNative(u16, dst[2 * x ..][0..2], value);
+                },
+                else => unreachable,
+            }
+        }
+    }
+};
+
+/// Presents into a shared memory file. The file starts with a `Header`, followed by
+/// the RGBA pixels of the frame. Readers should poll `Header.frame` and copy the
+/// pixels when it changed.
+pub const SharedMemoryImage = struct {
+    pub const Header = extern struct {
+        magic: [4]u8 = "DBFB".*,
+        width: u32,
+        height: u32,
+        /// Incremented after every presented frame.
+        frame: u32 = 0,
+    };
+
+    file: std.fs.File,
+    path: std.BoundedArray(u8, std.fs.MAX_PATH_BYTES),
+    memory: []align(std.mem.page_size) u8,
+    size: Size,
+
+    pub fn create(name: []const u8, size: Size) !SharedMemoryImage {
+        if (builtin.os.tag != .linux)
+            return error.Unsupported;
+
+        var self = SharedMemoryImage{
+            .file = undefined,
+            .path = .{},
+            .memory = undefined,
+            .size = size,
+        };
+        try self.path.writer().print("/dev/shm/{s}", .{name});
+
+        self.file = try std.fs.cwd().createFile(self.path.constSlice(), .{ .read = true, .truncate = true });
+        errdefer self.file.close();
+
+        const length = @sizeOf(Header) + @sizeOf(Color) * @as(usize, size.width) * @as(usize, size.height);
+        try self.file.setEndPos(length);
+
+        self.memory = try std.os.mmap(
+            null,
+            length,
+            std.os.PROT.READ | std.os.PROT.WRITE,
+            std.os.MAP.SHARED,
+            self.file.handle,
+            0,
+        );
+
+        self.header().* = Header{
+            .width = size.width,
+            .height = size.height,
+        };
+
+        logger.info("presenting {d}×{d} pixels into {s}", .{ size.width, size.height, self.path.constSlice() });
+
+        return self;
+    }
+
+    pub fn close(self: *SharedMemoryImage) void {
+        std.os.munmap(self.memory);
+        self.file.close();
+        std.fs.cwd().deleteFile(self.path.constSlice()) catch {};
+        self.* = undefined;
+    }
+
+    fn header(self: *SharedMemoryImage) *Header {
+        return @ptrCast(*Header, self.memory.ptr);
+    }
+
+    pub fn present(self: *SharedMemoryImage, pixels: []const Color, size: Size) void {
+        std.debug.assert(std.meta.eql(size, self.size));
+
+        std.mem.copy(u8, self.memory[@sizeOf(Header)..], std.mem.sliceAsBytes(pixels));
+
+        const hdr = self.header();
+        _ = @atomicRmw(u32, &hdr.frame, .Add, 1, .Release);
+    }
+};
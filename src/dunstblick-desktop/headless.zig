@@ -0,0 +1,515 @@
+//! Headless benchmark of the dunstblick user interface.
+//!
+//! Renders the layout of the widget tester through the same `DunstblickUI` code the
+//! desktop uses, but without a window or GPU: the recorded draw commands are rasterized
+//! by the `SoftwareRenderer` into an offscreen framebuffer. A script of object updates
+//! is replayed, and the time spent in bindings, layout and rasterization is reported
+//! for every frame.
+//!
+//! This isn't a mode of `widget-tester` or the desktop client: the widget tester is a
+//! dunstblick application that only serves its layout and has no renderer, and the desktop
+//! gets its window and GL context from zero-graphics before any of its code runs. So this
+//! executable renders the resources of the widget tester with the code of the desktop.
+//!
+//! Textures are resolved for the software renderer from the raster cache (drawings),
+//! the bitmap resources and a `TextureMirror` (glyphs).
+//!
+//! With `--present`, the frames are shown on a Linux framebuffer or in a shared memory
+//! image, so the same code path drives displays without a GPU. `--compare` rasterizes
+//! the last frame with every software backend and reports their timings.
+//!
+//! Script format, one update per line, `#` starts a comment:
+//!
+//!     <frame> <property> <integer value>
+//!
+//! The script is looped, the frame numbers are relative to the start of each iteration.
+
+const std = @import("std");
+const args_parser = @import("args");
+const zero_graphics = @import("zero-graphics");
+const protocol = @import("dunstblick-protocol");
+const app_data = @import("app-data");
+
+const DunstblickUI = @import("dunst-ui/DunstblickUI.zig");
+const RasterCache = @import("gui/RasterCache.zig");
+const SoftwareRenderer = @import("gui/SoftwareRenderer.zig");
+const TextureMirror = @import("gui/TextureMirror.zig");
+const present = @import("gui/present.zig");
+const profiler = @import("profiler.zig");
+
+const logger = std.log.scoped(.headless);
+
+/// Cycles through all pages of the widget tester, so every widget gets laid out and drawn.
+const default_script =
+    \\0  main-group 0
+    \\10 main-group 1
+    \\15 input-group 1
+    \\20 input-group 2
+    \\25 input-group 0
+    \\30 main-group 2
+    \\40 main-group 3
+;
+
+/// Upper limit of frames that are rendered until all drawings are rasterized.
+const max_warmup_frames = 1000;
+
+/// Number of times the last frame is rasterized per backend with `--compare`.
+const compare_iterations = 20;
+
+const Update = struct {
+    frame: u32,
+    property: protocol.PropertyName,
+    value: i32,
+};
+
+const Script = struct {
+    updates: []Update,
+    /// Number of frames until the script repeats.
+    period: u32,
+};
+
+fn usage(stream: anytype, exe_name: []const u8) !void {
+    const name = std.fs.path.basename(exe_name);
+
+    try stream.print("usage: {s} [options]\n", .{name});
+    try stream.writeAll(
+        \\Renders the widget tester without a GPU and reports per-frame timings.
+        \\  -h, --help              Shows this text.
+        \\  -n, --frames [count]    Number of measured frames. Default: 100
+        \\  -W, --width [pixels]    Width of the framebuffer. Default: 1280
+        \\  -H, --height [pixels]   Height of the framebuffer. Default: 720
+        \\  -s, --script [file]     Replays the updates in [file] instead of the built-in script.
+        \\  -o, --output [file]     Stores the last frame as a PPM image in [file].
+        \\  -q, --quiet             Only prints the summary, not every frame.
+        \\  -m, --mode [mode]       Rasterizer backend: 'reference', 'simd' or 'tiled'. Default: tiled
+        \\  -j, --threads [count]   Number of rasterizer threads in tiled mode. Default: all cores
+        \\  -p, --present [target]  Shows the frames on 'fb:<device>' or in 'shm:<name>'.
+        \\  -f, --fps [rate]        Limits the frame rate, 0 renders as fast as possible. Default: 0
+        \\  -c, --compare           Rasterizes the last frame with all backends and compares them.
+        \\
+    );
+}
+
+pub fn main() !u8 {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+
+    const allocator = gpa.allocator();
+
+    const args = args_parser.parseForCurrentProcess(struct {
+        frames: u32 = 100,
+        width: u15 = 1280,
+        height: u15 = 720,
+        script: ?[]const u8 = null,
+        output: ?[]const u8 = null,
+        quiet: bool = false,
+        mode: SoftwareRenderer.Mode = .tiled,
+        threads: ?usize = null,
+        present: ?[]const u8 = null,
+        fps: u32 = 0,
+        compare: bool = false,
+        help: bool = false,
+
+        pub const shorthands = .{
+            .n = "frames",
+            .W = "width",
+            .H = "height",
+            .s = "script",
+            .o = "output",
+            .q = "quiet",
+            .m = "mode",
+            .j = "threads",
+            .p = "present",
+            .f = "fps",
+            .c = "compare",
+            .h = "help",
+        };
+    }, allocator, .print) catch return 1;
+    defer args.deinit();
+
+    if (args.options.help) {
+        try usage(std.io.getStdOut().writer(), args.executable_name orelse return 1);
+        return 0;
+    }
+
+    if (args.positionals.len != 0) {
+        try usage(std.io.getStdErr().writer(), args.executable_name orelse return 1);
+        return 1;
+    }
+
+    var script_arena = std.heap.ArenaAllocator.init(allocator);
+    defer script_arena.deinit();
+
+    const script = if (args.options.script) |path| blk: {
+        const source = try std.fs.cwd().readFileAlloc(script_arena.allocator(), path, 1 << 20);
+        break :blk parseScript(script_arena.allocator(), source) catch |err| {
+            logger.err("invalid script {s}: {s}", .{ path, @errorName(err) });
+            return 1;
+        };
+    } else try parseScript(script_arena.allocator(), default_script);
+
+    const screen_size = zero_graphics.Size{ .width = args.options.width, .height = args.options.height };
+
+    try profiler.init(allocator);
+    defer profiler.deinit();
+
+    var resource_manager = zero_graphics.ResourceManager.init(allocator);
+    defer resource_manager.deinit();
+
+    var renderer = try resource_manager.createRenderer2D();
+    defer renderer.deinit();
+
+    // one virtual unit per pixel, so the timings don't depend on the DPI of the build machine
+    renderer.unit_to_pixel_ratio = 1.0;
+
+    var raster_cache: RasterCache = undefined;
+    try raster_cache.init(allocator, &resource_manager, .{});
+    defer raster_cache.deinit();
+
+    var framebuffer: SoftwareRenderer = undefined;
+    try framebuffer.init(allocator, screen_size, .{
+        .mode = args.options.mode,
+        .thread_count = args.options.threads,
+    });
+    defer framebuffer.deinit();
+
+    var target = if (args.options.present) |spec|
+        present.Target.open(spec, screen_size) catch |err| {
+            logger.err("could not open presentation target {s}: {s}", .{ spec, @errorName(err) });
+            return 1;
+        }
+    else
+        null;
+    defer if (target) |*t| t.close();
+
+    var ui = try zero_graphics.UserInterface.init(allocator, &renderer);
+    defer ui.deinit();
+
+    var dunst_ui = DunstblickUI.init(allocator, raster_cache.drawingRasterizer(), null_feedback);
+    defer dunst_ui.deinit();
+
+    inline for (comptime std.meta.declarations(app_data.resources)) |decl| {
+        const res = @field(app_data.resources, decl.name);
+        try dunst_ui.addOrReplaceResource(res.id, res.kind, res.data);
+    }
+
+    {
+        var root = DunstblickUI.Object.init(allocator, app_data.objects.root);
+        errdefer root.deinit();
+
+        try root.addProperty(app_data.properties.@"main-group", .{ .integer = 0 });
+        try root.addProperty(app_data.properties.@"input-group", .{ .integer = 0 });
+
+        try dunst_ui.addOrUpdateObject(root);
+    }
+
+    try dunst_ui.setView(app_data.resources.index.id);
+    try dunst_ui.setRoot(app_data.objects.root);
+
+    var texture_mirror = TextureMirror.init(allocator, &resource_manager);
+    defer texture_mirror.deinit();
+
+    var texture_chain = SoftwareRenderer.TextureSourceChain{
+        .sources = &[_]SoftwareRenderer.TextureSource{
+            raster_cache.textureSource(),
+            SoftwareRenderer.bitmapSource(&dunst_ui),
+            texture_mirror.textureSource(),
+        },
+    };
+
+    var context = Context{
+        .renderer = &renderer,
+        .ui = &ui,
+        .dunst_ui = &dunst_ui,
+        .raster_cache = &raster_cache,
+        .textures = texture_chain.textureSource(),
+        .framebuffer = &framebuffer,
+        .target = if (target) |*t| t else null,
+    };
+
+    // Drawings are rasterized asynchronously, so render until the cache settles.
+    // Otherwise the first measured frames would show a different scene.
+    {
+        var warmup: usize = 0;
+        while (warmup < max_warmup_frames) : (warmup += 1) {
+            try context.renderFrame();
+            if (!raster_cache.isBusy())
+                break;
+            std.time.sleep(std.time.ns_per_ms);
+        }
+    }
+
+    var stdout = std.io.getStdOut().writer();
+
+    const columns = [_]Column{
+        .{ .title = "bindings", .phase = .update_bindings },
+        .{ .title = "measure", .phase = .update_wanted_size },
+        .{ .title = "layout", .phase = .layout },
+        .{ .title = "widgets", .phase = .process_user_interface },
+        .{ .title = "record", .phase = .app_render },
+        .{ .title = "raster", .phase = .rasterize },
+        .{ .title = "present", .phase = .present },
+        .{ .title = "frame", .phase = .frame },
+    };
+
+    if (!args.options.quiet) {
+        try stdout.print("{s: >6}", .{"frame"});
+        for (columns) |column| {
+            try stdout.print(" {s: >10}", .{column.title});
+        }
+        try stdout.writeAll("\n");
+    }
+
+    var totals = [1]u64{0} ** columns.len;
+    var maxima = [1]u64{0} ** columns.len;
+
+    const frame_period = if (args.options.fps > 0) std.time.ns_per_s / args.options.fps else 0;
+    var frame_timer = try std.time.Timer.start();
+
+    var frame: u32 = 0;
+    while (frame < args.options.frames) : (frame += 1) {
+        if (frame_period > 0) {
+            const elapsed = frame_timer.read();
+            if (elapsed < frame_period) {
+                std.time.sleep(frame_period - elapsed);
+            }
+            frame_timer.reset();
+        }
+
+        for (script.updates) |update| {
+            if (update.frame != frame % script.period)
+                continue;
+            const root = dunst_ui.getObject(app_data.objects.root).?;
+            try root.setProperty(update.property, .{ .integer = update.value });
+        }
+
+        try context.renderFrame();
+
+        const stats = profiler.lastFrame();
+
+        if (!args.options.quiet) {
+            try stdout.print("{d: >6}", .{frame});
+        }
+        for (columns) |column, i| {
+            const duration = if (column.phase == .frame) stats.duration else stats.get(column.phase);
+            totals[i] += duration;
+            maxima[i] = std.math.max(maxima[i], duration);
+            if (!args.options.quiet) {
+                try stdout.print(" {d: >10.3}", .{nsToMs(duration)});
+            }
+        }
+        if (!args.options.quiet) {
+            try stdout.writeAll("\n");
+        }
+    }
+
+    if (args.options.frames > 0) {
+        try stdout.print("\n{s: >6}", .{""});
+        for (columns) |column| {
+            try stdout.print(" {s: >10}", .{column.title});
+        }
+        try stdout.print("\n{s: >6}", .{"avg"});
+        for (totals) |total| {
+            try stdout.print(" {d: >10.3}", .{nsToMs(total / args.options.frames)});
+        }
+        try stdout.print("\n{s: >6}", .{"max"});
+        for (maxima) |max| {
+            try stdout.print(" {d: >10.3}", .{nsToMs(max)});
+        }
+        try stdout.writeAll("\n");
+    }
+
+    try stdout.print("\n{d} frames of {d}×{d}, all times in ms. checksum of last frame: {X:0>16}\n", .{
+        args.options.frames,
+        screen_size.width,
+        screen_size.height,
+        framebuffer.checksum(),
+    });
+
+    if (args.options.compare) {
+        try compareBackends(allocator, stdout, &renderer, context.textures, screen_size, args.options.threads);
+    }
+
+    if (args.options.output) |path| {
+        var file = try std.fs.cwd().createFile(path, .{});
+        defer file.close();
+
+        var buffered_writer = std.io.bufferedWriter(file.writer());
+        try framebuffer.writePpm(buffered_writer.writer());
+        try buffered_writer.flush();
+    }
+
+    return 0;
+}
+
+const Column = struct {
+    title: []const u8,
+    phase: profiler.Phase,
+};
+
+const Context = struct {
+    renderer: *zero_graphics.Renderer2D,
+    ui: *zero_graphics.UserInterface,
+    dunst_ui: *DunstblickUI,
+    raster_cache: *RasterCache,
+    textures: SoftwareRenderer.TextureSource,
+    framebuffer: *SoftwareRenderer,
+    target: ?*present.Target,
+
+    fn renderFrame(self: Context) !void {
+        profiler.beginFrame();
+        defer profiler.endFrame(false);
+
+        self.raster_cache.beginFrame();
+        _ = self.raster_cache.update();
+
+        self.renderer.reset();
+
+        const size = self.framebuffer.size;
+        {
+            var builder = self.ui.construct(size);
+            defer builder.finish();
+
+            try self.dunst_ui.processUserInterface(zero_graphics.Rectangle{
+                .x = 0,
+                .y = 0,
+                .width = size.width,
+                .height = size.height,
+            }, builder);
+        }
+
+        {
+            const zone = profiler.begin(.app_render, null);
+            defer zone.end();
+
+            try self.ui.render();
+        }
+
+        {
+            const zone = profiler.begin(.rasterize, null);
+            defer zone.end();
+
+            self.framebuffer.clear(zero_graphics.Color{ .r = 0, .g = 0, .b = 0, .a = 0xFF });
+            try self.framebuffer.render(self.renderer, self.textures);
+        }
+
+        if (self.target) |target| {
+            const zone = profiler.begin(.present, null);
+            defer zone.end();
+
+            target.present(self.framebuffer.pixels, self.framebuffer.size);
+        }
+    }
+};
+
+/// Rasterizes the draw commands currently recorded in `renderer` with every backend.
+fn compareBackends(
+    allocator: std.mem.Allocator,
+    writer: anytype,
+    renderer: *const zero_graphics.Renderer2D,
+    textures: SoftwareRenderer.TextureSource,
+    size: zero_graphics.Size,
+    thread_count: ?usize,
+) !void {
+    try writer.print("\n{s: <10} {s: >10} {s: >10} {s: >18}\n", .{ "backend", "avg", "min", "checksum" });
+
+    for (std.enums.values(SoftwareRenderer.Mode)) |mode| {
+        var backend: SoftwareRenderer = undefined;
+        try backend.init(allocator, size, .{ .mode = mode, .thread_count = thread_count });
+        defer backend.deinit();
+
+        var total: u64 = 0;
+        var min: u64 = std.math.maxInt(u64);
+
+        var i: usize = 0;
+        while (i < compare_iterations) : (i += 1) {
+            var timer = try std.time.Timer.start();
+
+            backend.clear(zero_graphics.Color{ .r = 0, .g = 0, .b = 0, .a = 0xFF });
+            try backend.render(renderer, textures);
+
+            const duration = timer.read();
+            total += duration;
+            min = std.math.min(min, duration);
+        }
+
+        try writer.print("{s: <10} {d: >10.3} {d: >10.3} {X:0>18}\n", .{
+            @tagName(mode),
+            nsToMs(total / compare_iterations),
+            nsToMs(min),
+            backend.checksum(),
+        });
+    }
+}
+
+fn parseScript(allocator: std.mem.Allocator, source: []const u8) !Script {
+    var updates = std.ArrayList(Update).init(allocator);
+    defer updates.deinit();
+
+    var period: u32 = 1;
+
+    var lines = std.mem.split(u8, source, "\n");
+    while (lines.next()) |full_line| {
+        const line = std.mem.trim(u8, if (std.mem.indexOfScalar(u8, full_line, '#')) |i| full_line[0..i] else full_line, " \t\r");
+        if (line.len == 0)
+            continue;
+
+        var tokens = std.mem.tokenize(u8, line, " \t");
+        const frame_text = tokens.next() orelse return error.SyntaxError;
+        const name = tokens.next() orelse return error.SyntaxError;
+        const value_text = tokens.next() orelse return error.SyntaxError;
+        if (tokens.next() != null)
+            return error.SyntaxError;
+
+        const update = Update{
+            .frame = try std.fmt.parseInt(u32, frame_text, 10),
+            .property = lookupProperty(name) orelse {
+                logger.err("unknown property '{s}'", .{name});
+                return error.UnknownProperty;
+            },
+            .value = try std.fmt.parseInt(i32, value_text, 10),
+        };
+        // the script repeats after its last frame, which must fit into the frame counter
+        period = std.math.max(period, std.math.add(u32, update.frame, 1) catch return error.SyntaxError);
+        try updates.append(update);
+    }
+
+    return Script{
+        .updates = updates.toOwnedSlice(),
+        .period = period,
+    };
+}
+
+fn lookupProperty(name: []const u8) ?protocol.PropertyName {
+    inline for (comptime std.meta.declarations(app_data.properties)) |decl| {
+        if (std.mem.eql(u8, decl.name, name))
+            return @field(app_data.properties, decl.name);
+    }
+    return null;
+}
+
+fn nsToMs(ns: u64) f64 {
+    return @intToFloat(f64, ns) / std.time.ns_per_ms;
+}
+
+var null_feedback_storage: u8 = 0;
+
+/// Nobody is listening in headless mode, so user interface feedback is dropped.
+const null_feedback = DunstblickUI.FeedbackInterface{
+    .erased_self = @ptrCast(*DunstblickUI.FeedbackInterface.ErasedSelf, &null_feedback_storage),
+    .trigger_event = ignoreEvent,
+    .trigger_property_changed = ignorePropertyChange,
+};
+
+fn ignoreEvent(erased_self: *DunstblickUI.FeedbackInterface.ErasedSelf, event: protocol.EventID, widget: protocol.WidgetName) DunstblickUI.FeedbackInterface.Error!void {
+    _ = erased_self;
+    _ = event;
+    _ = widget;
+}
+
+fn ignorePropertyChange(erased_self: *DunstblickUI.FeedbackInterface.ErasedSelf, oid: protocol.ObjectID, name: protocol.PropertyName, value: DunstblickUI.Value) DunstblickUI.FeedbackInterface.Error!void {
+    _ = erased_self;
+    _ = oid;
+    _ = name;
+    _ = value;
+}
@@ -0,0 +1,44 @@
+//! Lets the UI thread sleep until input arrives.
+//!
+//! zero-graphics delivers input between two frames, so `update()` can't see input while
+//! it sleeps. SDL can wait on its event queue without removing the event, so the
+//! next frame receives the input as usual. Other threads wake the sleeper by pushing
+//! an user event, which zero-graphics ignores.
+
+const std = @import("std");
+const zero_graphics = @import("zero-graphics");
+
+/// If `false`, `wait()` isn't available and the caller must poll for input.
+pub const supported = (zero_graphics.backend == .desktop);
+
+const sdl = struct {
+    const SDL_USEREVENT = 0x8000;
+
+    /// Mirrors the size of `SDL_Event`, only the type is set.
+    const Event = extern union {
+        type: u32,
+        padding: [56]u8,
+    };
+
+    extern fn SDL_WaitEventTimeout(event: ?*Event, timeout: c_int) c_int;
+    extern fn SDL_PushEvent(event: *Event) c_int;
+};
+
+/// Blocks until an input event is queued, `wake()` was called or `timeout` nanoseconds have passed.
+pub fn wait(timeout: u64) void {
+    comptime std.debug.assert(supported);
+
+    const timeout_ms = std.math.cast(c_int, std.math.divCeil(u64, timeout, std.time.ns_per_ms) catch unreachable) orelse std.math.maxInt(c_int);
+
+    // a null event peeks the queue
+    _ = sdl.SDL_WaitEventTimeout(null, timeout_ms);
+}
+
+/// Wakes up the UI thread from `wait()`. Can be called from any thread.
+pub fn wake() void {
+    if (!supported)
+        return;
+    var event = std.mem.zeroes(sdl.Event);
+    event.type = sdl.SDL_USEREVENT;
+    _ = sdl.SDL_PushEvent(&event);
+}
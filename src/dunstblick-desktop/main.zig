@@ -19,6 +19,12 @@ const Size = zero_graphics.Size;
 const HomeScreen = @import("gui/HomeScreen.zig");
 const ApplicationDescription = @import("gui/ApplicationDescription.zig");
 const ApplicationInstance = @import("gui/ApplicationInstance.zig");
+const RasterCache = @import("gui/RasterCache.zig");
+const FontCache = @import("gui/FontCache.zig");
+const SoftwareRenderer = @import("gui/SoftwareRenderer.zig");
+const SoftwareBackend = @import("gui/SoftwareBackend.zig");
+const profiler = @import("profiler.zig");
+const input_wait = @import("input_wait.zig");
 
 // thread_local is broken on android
 pub const crypto_always_getrandom = (builtin.abi == .android);
@@ -38,13 +44,14 @@ demo_app_desc: DemoAppDescription,
 
 resource_manager: zero_graphics.ResourceManager,
 renderer: zero_graphics.Renderer2D,
+raster_cache: RasterCache,
+font_cache: FontCache,
+software_backend: SoftwareBackend,
 
 screen_size: Size,
 bounded_size: Size,
 virtual_size: Size,
 
-debug_font: *const zero_graphics.Renderer2D.Font,
-
 app_discovery: AppDiscovery,
 
 available_apps: std.ArrayList(*ApplicationDescription),
@@ -54,6 +61,16 @@ settings_editor: SettingsEditor,
 
 dpi_scale: f32 = 1.0,
 
+/// When set, the next frame rebuilds the user interface even if nothing has changed.
+needs_redraw: bool = true,
+
+/// Set by `update()` when nothing has changed. `render()` will then replay the
+/// draw commands of the previous frame instead of recording them again.
+is_idle_frame: bool = false,
+
+/// Time stamp of the last frame that rebuilt the user interface.
+last_redraw: i128 = 0,
+
 settings_root_path: ?[]const u8,
 
 pub fn init(app: *Application, allocator: std.mem.Allocator, input: *zero_graphics.Input) !void {
@@ -70,10 +87,10 @@ pub fn init(app: *Application, allocator: std.mem.Allocator, input: *zero_graphi
         .virtual_size = Size{ .width = 0, .height = 0 },
         .renderer = undefined,
         .home_screen = undefined,
-        .debug_font = undefined,
         .available_apps = std.ArrayList(*ApplicationDescription).init(allocator),
         .app_discovery = undefined,
         .settings = Settings{
+            .debug = .{},
             .ui = .{
                 .scale = @as(f32, 1.0),
                 .padding = .{
@@ -96,10 +113,16 @@ pub fn init(app: *Application, allocator: std.mem.Allocator, input: *zero_graphi
         },
         .settings_root_path = null,
         .resource_manager = undefined,
+        .raster_cache = undefined,
+        .font_cache = undefined,
+        .software_backend = undefined,
     };
     errdefer app.arena.deinit();
     errdefer app.available_apps.deinit();
 
+    try profiler.init(allocator);
+    errdefer profiler.deinit();
+
     if (zero_graphics.backend != .android) {
         app.settings_root_path = if (try known_folders.getPath(app.arena.allocator(), .local_configuration)) |folder|
             try std.fs.path.join(app.arena.allocator(), &[_][]const u8{ folder, "dunstblick" })
@@ -129,15 +152,34 @@ pub fn init(app: *Application, allocator: std.mem.Allocator, input: *zero_graphi
     app.renderer = try app.resource_manager.createRenderer2D();
     errdefer app.renderer.deinit();
 
-    logger.info("load resources...", .{});
-    app.debug_font = try app.renderer.createFont(@embedFile("gui/fonts/firasans-regular.ttf"), 24);
+    logger.info("init raster cache...", .{});
+    try app.raster_cache.init(allocator, &app.resource_manager, .{
+        .disk_cache_path = if (zero_graphics.backend != .android)
+            if (try known_folders.getPath(app.arena.allocator(), .cache)) |folder|
+                try std.fs.path.join(app.arena.allocator(), &[_][]const u8{ folder, "dunstblick", "raster-cache" })
+            else
+                null
+        else
+            null,
+    });
+    errdefer app.raster_cache.deinit();
+
+    // fonts are created on first use
+    app.font_cache = FontCache.init(allocator, &app.renderer);
+    errdefer app.font_cache.deinit();
+
+    app.software_backend = SoftwareBackend.init(allocator, &app.resource_manager);
+    errdefer app.software_backend.deinit();
 
     logger.info("init app discovery...", .{});
-    app.app_discovery = try AppDiscovery.init(allocator);
+    app.app_discovery = try AppDiscovery.init(allocator, &app.raster_cache);
     errdefer app.app_discovery.deinit();
+    if (input_wait.supported) {
+        app.app_discovery.wake_hook = input_wait.wake;
+    }
 
     logger.info("init home screen...", .{});
-    app.home_screen = try HomeScreen.init(allocator, &app.resource_manager, &app.renderer, &app.settings.home_screen);
+    app.home_screen = try HomeScreen.init(allocator, &app.resource_manager, &app.renderer, &app.raster_cache, &app.font_cache, &app.settings.home_screen);
     errdefer app.home_screen.deinit();
 
     logger.info("app ready!", .{});
@@ -147,8 +189,12 @@ pub fn deinit(app: *Application) void {
     app.home_screen.deinit();
     app.app_discovery.deinit();
     app.available_apps.deinit();
+    app.software_backend.deinit();
+    app.raster_cache.deinit();
+    app.font_cache.deinit();
     app.renderer.deinit();
     app.resource_manager.deinit();
+    profiler.deinit();
     app.* = undefined;
     logger.info("app dead", .{});
 }
@@ -247,6 +293,8 @@ fn getTotalScale(app: Application) f32 {
 }
 
 fn updateDpiScale(app: *Application) !void {
+    app.needs_redraw = true;
+
     const dpi = zero_graphics.getDisplayDPI();
     app.dpi_scale = dpi / 254;
     logger.info("Display DPI: {d:.3} (scale: {d})", .{ dpi, app.dpi_scale });
@@ -284,11 +332,35 @@ fn virtToPhysical(app: Application, pt: zero_graphics.Point) zero_graphics.Point
     };
 }
 
+/// The longest time the desktop sleeps in an idle frame. Input and the network
+/// threads of the applications wake it up earlier, the discovery sockets are
+/// polled with this period.
+const max_idle_sleep = 50 * std.time.ns_per_ms;
+
+/// The idle sleep on backends that can't wake up on input. Input events are only
+/// delivered between frames, so this is the worst-case input latency when idle.
+const input_poll_period = 8 * std.time.ns_per_ms;
+
+/// Even without changes, the user interface is rebuilt with this period
+/// to catch up with state that isn't tracked (e.g. texts with the current time).
+const max_redraw_period = 1000 * std.time.ns_per_ms;
+
+/// While the profiler HUD is visible, the user interface is rebuilt at least
+/// with this period, so the HUD shows current numbers.
+const profiler_hud_refresh_period = 250 * std.time.ns_per_ms;
+
 pub fn update(app: *Application) !bool {
-    defer app.renderer.reset();
+    // Idle frames keep the draw commands of the last frame, so `render()` can replay them
+    defer if (!app.is_idle_frame) app.renderer.reset();
+
+    profiler.beginFrame();
+
+    var damaged = app.needs_redraw;
+    app.needs_redraw = false;
 
     try app.home_screen.beginInput();
     while (app.input.pollEvent()) |event| {
+        damaged = true;
         switch (event) {
             .quit => return false,
             .pointer_press => |button| try app.home_screen.mouseDown(button),
@@ -300,7 +372,70 @@ pub fn update(app: *Application) !bool {
 
     try app.home_screen.endInput();
 
-    try app.app_discovery.update();
+    {
+        const zone = profiler.begin(.network, null);
+        defer zone.end();
+
+        try app.app_discovery.update();
+    }
+    if (app.app_discovery.takeChanges()) {
+        damaged = true;
+    }
+
+    {
+        const zone = profiler.begin(.raster_cache, null);
+        defer zone.end();
+
+        if (app.raster_cache.update()) {
+            damaged = true;
+        }
+    }
+
+    const now = std.time.nanoTimestamp();
+    if (now - app.last_redraw >= max_redraw_period) {
+        damaged = true;
+    }
+    if (app.settings.debug.profiler_hud and now - app.last_redraw >= profiler_hud_refresh_period) {
+        damaged = true;
+    }
+
+    const frametime = @floatCast(f32, @intToFloat(f64, app.frame_timer.lap()) / std.time.ns_per_s);
+
+    // Applications are updated in every frame, even when nothing has to be redrawn.
+    // Background applications are updated with their own period and execute their
+    // commands then, without causing a redraw.
+    if (!app.home_screen.size.isEmpty()) {
+        const zone = profiler.begin(.home_screen_update, null);
+        defer zone.end();
+
+        if (try app.home_screen.updateApplications(frametime)) {
+            damaged = true;
+        }
+    }
+
+    // after the update, so commands of visible applications are drawn in the same frame
+    if (app.home_screen.needsRedraw()) {
+        damaged = true;
+    }
+
+    app.is_idle_frame = !damaged;
+    if (app.is_idle_frame) {
+        // Nothing has changed, so sleep until input arrives, the network wakes us up
+        // or the next discovery poll is due.
+        const zone = profiler.begin(.idle, null);
+        defer zone.end();
+
+        if (input_wait.supported) {
+            input_wait.wait(app.app_discovery.getWaitTimeout(max_idle_sleep));
+        } else {
+            try app.app_discovery.waitForEvent(input_poll_period);
+        }
+        return true;
+    }
+
+    app.last_redraw = now;
+
+    app.raster_cache.beginFrame();
 
     {
         app.available_apps.shrinkRetainingCapacity(0);
@@ -316,29 +451,30 @@ pub fn update(app: *Application) !bool {
         try app.home_screen.setAvailableApps(app.available_apps.items);
     }
 
-    const frametime = @floatCast(f32, @intToFloat(f64, app.frame_timer.lap()) / std.time.ns_per_s);
-
     if (!app.home_screen.size.isEmpty()) {
-        try app.home_screen.update(frametime);
+        const zone = profiler.begin(.home_screen_update, null);
+        defer zone.end();
+
+        try app.home_screen.update();
     }
 
     return true;
 }
 
 pub fn render(app: *Application) !void {
-    {
+    defer profiler.endFrame(app.is_idle_frame);
+
+    if (!app.is_idle_frame) {
         if (!app.home_screen.size.isEmpty()) {
+            const zone = profiler.begin(.home_screen_render, null);
+            defer zone.end();
+
             try app.home_screen.render();
         }
 
-        // var buf: [64]u8 = undefined;
-        // try app.renderer.drawString(
-        //     app.debug_font,
-        //     try std.fmt.bufPrint(&buf, "{d:.2} ms", .{1000.0 * frametime}),
-        //     app.virtual_size.width - 100,
-        //     app.virtual_size.height - app.debug_font.font_size - 10,
-        //     zero_graphics.Color.red,
-        // );
+        if (app.settings.debug.profiler_hud) {
+            try app.drawProfilerHud();
+        }
 
         // try app.renderer.?.fillRectangle(
         //     .{
@@ -351,6 +487,16 @@ pub fn render(app: *Application) !void {
         // );
     }
 
+    const mode = app.settings.debug.renderer;
+
+    if (mode != .opengl and !app.is_idle_frame) {
+        const textures = [_]SoftwareRenderer.TextureSource{
+            app.raster_cache.textureSource(),
+            app.app_discovery.bitmapSource(),
+        };
+        try app.software_backend.rasterize(&app.renderer, app.bounded_size, &textures);
+    }
+
     // OpenGL rendering
     {
         gl.clearColor(0.0, 0.0, 0.0, 1.0);
@@ -366,11 +512,129 @@ pub fn render(app: *Application) !void {
         gl.frontFace(gl.CCW);
         gl.cullFace(gl.BACK);
 
+        if (mode == .software) {
+            try app.software_backend.present(app.bounded_size, !app.is_idle_frame);
+            return;
+        }
+
+        const zone = profiler.begin(.render_submit, null);
+        defer zone.end();
+
+        const start = std.time.nanoTimestamp();
         app.renderer.render(app.bounded_size);
+
+        if (mode == .compare and !app.is_idle_frame) {
+            // wait for the GPU, so the timing covers the whole frame
+            gl.finish();
+            const opengl_time = @intCast(u64, std.time.nanoTimestamp() - start);
+
+            try app.software_backend.compare(
+                app.settings.ui.padding.left,
+                app.settings.ui.padding.bottom,
+                app.bounded_size,
+                opengl_time,
+            );
+        }
     }
 }
 
+fn drawProfilerHud(app: *Application) !void {
+    const phases = [_]profiler.Phase{
+        .network,
+        .raster_cache,
+        .home_screen_update,
+        .update_bindings,
+        .update_wanted_size,
+        .layout,
+        .process_user_interface,
+        .home_screen_render,
+        .render_submit,
+        .rasterize,
+    };
+
+    const summary = profiler.summarize();
+    const apps = profiler.appStats();
+
+    // shares the glyphs with the user interface
+    const debug_font = app.home_screen.ui.default_font;
+
+    const hud_width = std.math.min(app.virtual_size.width, 400);
+    const line_height = debug_font.font_size + 2;
+    const line_count = 1 + phases.len + apps.len;
+
+    const hud_rect = zero_graphics.Rectangle{
+        .x = @intCast(i16, app.virtual_size.width - hud_width),
+        .y = 0,
+        .width = hud_width,
+        .height = std.math.min(app.virtual_size.height, @intCast(u15, line_count * line_height + 10)),
+    };
+
+    try app.renderer.fillRectangle(hud_rect, .{ .r = 0x00, .g = 0x00, .b = 0x00, .a = 0xC0 });
+
+    const x = hud_rect.x + 5;
+    var y = hud_rect.y + 5;
+
+    var buf: [128]u8 = undefined;
+    try app.renderer.drawString(
+        debug_font,
+        std.fmt.bufPrint(&buf, "frame {d:.2} ms, max {d:.2} ms, {d} idle", .{
+            nsToMs(summary.average_busy),
+            nsToMs(summary.max_busy),
+            summary.idle_frames,
+        }) catch unreachable,
+        x,
+        y,
+        zero_graphics.Color.white,
+    );
+    y += line_height;
+
+    for (phases) |phase| {
+        try app.renderer.drawString(
+            debug_font,
+            std.fmt.bufPrint(&buf, "  {s}: {d:.2} ms", .{ @tagName(phase), nsToMs(summary.get(phase)) }) catch unreachable,
+            x,
+            y,
+            zero_graphics.Color.white,
+        );
+        y += line_height;
+    }
+
+    for (apps) |stats| {
+        try app.renderer.drawString(
+            debug_font,
+            std.fmt.bufPrint(&buf, "{s}: {d:.2} ms", .{
+                stats.name[0..std.math.min(stats.name.len, 32)],
+                stats.average / std.time.ns_per_ms,
+            }) catch unreachable,
+            x,
+            y,
+            .{ .r = 0xFF, .g = 0xD0, .b = 0x40 },
+        );
+        y += line_height;
+    }
+}
+
+fn nsToMs(ns: u64) f64 {
+    return @intToFloat(f64, ns) / std.time.ns_per_ms;
+}
+
+fn exportTrace(app: *Application) !void {
+    const settings_root_path = app.settings_root_path orelse {
+        logger.warn("no configuration folder could be found!", .{});
+        return;
+    };
+
+    var dir = try std.fs.cwd().makeOpenPath(settings_root_path, .{});
+    defer dir.close();
+
+    var name_buf: [64]u8 = undefined;
+    const file_name = try profiler.exportTrace(dir, &name_buf);
+
+    logger.info("wrote frame trace to {s}/{s}", .{ settings_root_path, file_name });
+}
+
 const Settings = struct {
+    debug: Debug = .{},
     ui: UserInterface,
     home_screen: HomeScreen.Config,
 
@@ -379,6 +643,13 @@ const Settings = struct {
         padding: Padding,
     };
 
+    const Debug = struct {
+        /// Shows the frame profiler on top of the desktop.
+        profiler_hud: bool = false,
+        /// Renders with OpenGL, on the CPU, or with both to compare them.
+        renderer: SoftwareBackend.Mode = .opengl,
+    };
+
     const Padding = struct {
         left: u15,
         top: u15,
@@ -540,6 +811,42 @@ const SettingsEditor = struct {
             }
         }
         try builder.advance(16);
+        {
+            const hud = &self.settings.debug.profiler_hud;
+
+            var dock = zero_graphics.UserInterface.DockLayout.init(builder.stack.get(32));
+
+            if (try builder.ui.button(dock.get(.right, 100), "Export", null, .{
+                .enabled = (app.settings_root_path != null),
+            })) {
+                app.exportTrace() catch |err| logger.err("failed to export frame trace: {s}", .{@errorName(err)});
+            }
+
+            if (try builder.ui.button(dock.getRest().shrink(1), if (hud.*) "Hide profiler" else "Show profiler", null, .{})) {
+                hud.* = !hud.*;
+            }
+        }
+        try builder.advance(16);
+        {
+            const renderer = &self.settings.debug.renderer;
+
+            var dock = zero_graphics.UserInterface.DockLayout.init(builder.stack.get(32));
+            try ui.label(dock.get(.left, 100), "Renderer:", .{});
+
+            const label = switch (renderer.*) {
+                .opengl => "OpenGL",
+                .software => "Software",
+                .compare => "Compare both",
+            };
+            if (try builder.ui.button(dock.getRest().shrink(1), label, null, .{})) {
+                renderer.* = switch (renderer.*) {
+                    .opengl => .software,
+                    .software => .compare,
+                    .compare => .opengl,
+                };
+            }
+        }
+        try builder.advance(16);
         {
             var dock = zero_graphics.UserInterface.DockLayout.init(builder.stack.get(32));
 
@@ -582,6 +889,7 @@ const DemoAppDescription = struct {
             .timer = std.time.milliTimestamp(),
             .msg_buf = undefined,
         };
+        app.instance.continuous_redraw = true; // the demo is animated
         app.updateStatus();
         return &app.instance;
     }
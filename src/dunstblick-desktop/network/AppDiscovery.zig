@@ -1,5 +1,6 @@
 const std = @import("std");
 const network = @import("network");
+const zero_graphics = @import("zero-graphics");
 const protocol = @import("dunstblick-protocol");
 const logger = std.log.scoped(.app_discovery);
 
@@ -7,6 +8,9 @@ const ApplicationDescription = @import("../gui/ApplicationDescription.zig");
 const ApplicationInstance = @import("../gui/ApplicationInstance.zig");
 
 const NetworkApplication = @import("NetworkApplication.zig");
+const ContentCache = @import("ContentCache.zig");
+const RasterCache = @import("../gui/RasterCache.zig");
+const SoftwareRenderer = @import("../gui/SoftwareRenderer.zig");
 
 const Self = @This();
 
@@ -23,8 +27,18 @@ const multicast_ep = network.EndPoint{
     .port = protocol.udp.port,
 };
 
-/// The time period in which we will send out a discover message
-const scan_period = 100 * std.time.ns_per_ms;
+/// The time period in which we will send out a discover message while applications
+/// appear, change or disappear.
+const min_scan_period = 100 * std.time.ns_per_ms;
+
+/// When a scan found no changes, the scan period is doubled up to this value.
+/// Providers announce themselves when they start, change or shut down, so the
+/// long period only delays detecting providers that vanished silently.
+const max_scan_period = 3200 * std.time.ns_per_ms;
+
+/// An application is gone when it didn't respond to this many scans in a row
+/// and wasn't seen for at least `keep_alive_period`.
+const keep_alive_scans = 3;
 
 /// The time period how long a application will stay alive after it was discovered.
 const keep_alive_period = 1000 * std.time.ns_per_ms;
@@ -35,15 +49,49 @@ arena: std.heap.ArenaAllocator,
 multicast_sock: network.Socket,
 socket_set: network.SocketSet,
 
+/// Joined to the discovery multicast group to receive the announcements providers
+/// send on their own. Is `null` when the discovery port can't be shared on this system.
+announce_sock: ?network.Socket,
+
+/// A loopback socket that is used by the network threads of the applications
+/// to wake up the UI thread when new commands are available.
+wake_sock: network.Socket,
+wake_end_point: network.EndPoint,
+wake_pending: std.atomic.Atomic(bool) = std.atomic.Atomic(bool).init(false),
+/// Called by `wakeUp()` when the UI thread doesn't sleep in `waitForEvent()`, but waits for input.
+wake_hook: ?fn () void = null,
+
 app_list: AppList,
 free_app_list: AppList,
 
 active_apps: AppInstanceList,
 
+/// Shared with all spawned applications to render their drawings.
+raster_cache: *RasterCache,
+
 /// This stores the time stamp when the next scan update will happen.
 next_scan: i128,
 
-pub fn init(allocator: std.mem.Allocator) !Self {
+/// The current time between two scans, between `min_scan_period` and `max_scan_period`.
+scan_period: u64 = min_scan_period,
+
+/// Number of scans sent so far.
+scan_count: u64 = 0,
+
+/// Set when an application appeared, changed or disappeared since the last scan.
+scan_found_changes: bool = false,
+
+/// Descriptions and icons of all discovered applications by their content hash.
+/// Applications with the same content share the memory, and each content is only
+/// transferred once.
+content_cache: ContentCache,
+
+/// Set when the list of applications or any connection has changed since the last `takeChanges()`.
+/// Commands of the applications don't count: they are executed in the update of the application,
+/// which invalidates it, and the desktop only redraws for visible applications.
+changed: bool = true,
+
+pub fn init(allocator: std.mem.Allocator, raster_cache: *RasterCache) !Self {
     errdefer |err| logger.err("failed to init app discovery: {}", .{err});
 
     var multicast_sock = try network.Socket.create(.ipv4, .udp);
@@ -57,36 +105,97 @@ pub fn init(allocator: std.mem.Allocator) !Self {
         .write = false,
     });
 
+    var wake_sock = try network.Socket.create(.ipv4, .udp);
+    errdefer wake_sock.close();
+
+    try wake_sock.bind(network.EndPoint{
+        .address = network.Address{ .ipv4 = network.Address.IPv4.init(127, 0, 0, 1) },
+        .port = 0,
+    });
+
+    try socket_set.add(wake_sock, .{
+        .read = true,
+        .write = false,
+    });
+
+    const announce_sock = createAnnounceSocket() catch |err| blk: {
+        logger.warn("cannot receive application announcements, only relying on discovery scans: {s}", .{@errorName(err)});
+        break :blk null;
+    };
+    errdefer if (announce_sock) |sock| sock.close();
+
+    if (announce_sock) |sock| {
+        try socket_set.add(sock, .{
+            .read = true,
+            .write = false,
+        });
+    }
+
     return Self{
         .allocator = allocator,
         .arena = std.heap.ArenaAllocator.init(allocator),
+        .content_cache = ContentCache.init(allocator),
 
         .multicast_sock = multicast_sock,
         .socket_set = socket_set,
+        .announce_sock = announce_sock,
+
+        .wake_sock = wake_sock,
+        .wake_end_point = try wake_sock.getLocalEndPoint(),
 
         .app_list = .{},
         .free_app_list = .{},
 
         .active_apps = .{},
 
+        .raster_cache = raster_cache,
+
         .next_scan = std.time.nanoTimestamp(),
     };
 }
 
+fn createAnnounceSocket() !network.Socket {
+    var sock = try network.Socket.create(.ipv4, .udp);
+    errdefer sock.close();
+
+    try sock.enablePortReuse(true);
+    try sock.bindToPort(protocol.udp.port);
+    try sock.joinMulticastGroup(.{
+        .interface = network.Address.IPv4.any,
+        .group = multicast_ep.address.ipv4,
+    });
+
+    return sock;
+}
+
 pub fn deinit(self: *Self) void {
-    while (self.active_apps.first) |node| {
-        self.destroyApplication(node);
+    while (self.active_apps.popFirst()) |node| {
+        if (!node.data.flagged_for_deletion) {
+            node.data.deinit();
+        }
+        if (node.data.isDestroyable()) {
+            node.data.destroy();
+            self.allocator.destroy(node);
+        } else {
+            // The network thread is blocked and will never touch `self` again,
+            // so it can't be waited for. Its state is leaked on exit.
+            logger.warn("network thread of '{s}' is still running", .{node.data.instance.description.display_name});
+        }
     }
+    while (self.app_list.first) |node| {
+        self.freeApp(node);
+    }
+    self.content_cache.deinit();
     self.socket_set.deinit();
+    if (self.announce_sock) |sock| sock.close();
+    self.wake_sock.close();
     self.multicast_sock.close();
     self.arena.deinit();
     self.* = undefined;
 }
 
 fn destroyApplication(self: *Self, node: *AppInstanceNode) void {
-    if (!node.data.flagged_for_deletion) {
-        node.data.deinit();
-    }
+    node.data.destroy();
     self.active_apps.remove(node);
     self.allocator.destroy(node);
 }
@@ -106,7 +215,7 @@ fn freeApp(self: *Self, app_node: *AppNode) void {
     self.app_list.remove(app_node);
     self.free_app_list.append(app_node);
 
-    app_node.data.strings_buffer.deinit();
+    app_node.data.name_buffer.deinit();
 
     app_node.data = undefined;
 }
@@ -114,31 +223,38 @@ fn freeApp(self: *Self, app_node: *AppNode) void {
 pub fn update(self: *Self) !void {
     const time_stamp = std.time.nanoTimestamp();
 
-    // Clean up all deleted applications:
+    // Clean up all deleted applications as soon as their network thread has exited:
     {
         var it = self.active_apps.first;
         while (it) |node| {
             it = node.next;
-            if (node.data.flagged_for_deletion) {
+            if (node.data.flagged_for_deletion and node.data.isDestroyable()) {
                 self.destroyApplication(node);
             }
         }
     }
 
     if (time_stamp >= self.next_scan) {
-        var discover_msg = protocol.udp.Discover{
-            .header = protocol.udp.Header.create(.discover),
-        };
+        // providers that only know version 1 respond with a `DiscoverResponse`
+        var discover_msg = protocol.udp.DiscoverV2{};
         _ = try self.multicast_sock.sendTo(multicast_ep, std.mem.asBytes(&discover_msg));
+        self.scan_count += 1;
+
+        // back off while the set of applications is stable
+        self.scan_period = if (self.scan_found_changes)
+            min_scan_period
+        else
+            std.math.min(2 * self.scan_period, max_scan_period);
+        self.scan_found_changes = false;
 
-        if (time_stamp - self.next_scan > 2 * scan_period) {
+        if (time_stamp - self.next_scan > 2 * self.scan_period) {
             // we are more than 3 scan periods behind, let's just catch
             // up by discarding all missed scans
-            self.next_scan = time_stamp + scan_period;
+            self.next_scan = time_stamp + self.scan_period;
         } else {
             // if we are still only slightly behind or on time,
             // let's continue scanning in fixed periods.
-            self.next_scan += scan_period;
+            self.next_scan += self.scan_period;
         }
     }
 
@@ -149,81 +265,22 @@ pub fn update(self: *Self) !void {
         if (count == 0)
             break;
 
-        {
-            var it = self.active_apps.first;
-            while (it) |node| : (it = node.next) {
-                std.debug.assert(node.data.flagged_for_deletion == false);
-
-                if (node.data.socket) |sock| {
-                    if (self.socket_set.isReadyWrite(sock)) {
-                        try node.data.notifyWritable();
-                    }
-                    if (self.socket_set.isReadyRead(sock)) {
-                        try node.data.notifyReadable();
-                    }
-                }
-            }
+        if (self.socket_set.isReadyRead(self.wake_sock)) {
+            var dummy: [16]u8 = undefined;
+            _ = try self.wake_sock.receive(&dummy);
+
+            // Reset *before* the queues are checked, so a command pushed after
+            // the check will send another wake up.
+            self.wake_pending.store(false, .Release);
         }
 
         if (self.socket_set.isReadyRead(self.multicast_sock)) {
-            var message: protocol.udp.Message = undefined;
-            const receive_info = try self.multicast_sock.receiveFrom(std.mem.asBytes(&message));
-            if (receive_info.numberOfBytes >= @sizeOf(protocol.udp.DiscoverResponse) and message.header.type == .respond_discover) {
-                const resp = &message.discover_response;
-
-                const address = receive_info.sender.address;
-                const udp_port = receive_info.sender.port;
-                const tcp_port = resp.tcp_port;
-
-                const app_node = blk: {
-                    var it = self.app_list.first;
-                    while (it) |node| : (it = node.next) {
-                        if (node.data.tcp_port != tcp_port)
-                            continue;
-                        if (node.data.udp_port != udp_port)
-                            continue;
-                        if (!node.data.address.eql(address))
-                            continue;
-                        break :blk node;
-                    }
-                    break :blk null;
-                };
-
-                const updated_app = if (app_node) |node| blk: {
-                    break :blk node;
-                } else blk: {
-                    const node = try self.allocApp();
-                    node.data = Application{
-                        .discovery = self,
-                        .description = ApplicationDescription{
-                            .display_name = undefined,
-                            .icon = null,
-                            .vtable = ApplicationDescription.Interface.get(Application),
-                            .state = .ready,
-                        },
-                        .address = address,
-                        .tcp_port = tcp_port,
-                        .udp_port = udp_port,
-                        .last_seen = undefined,
-                        .app_description = null,
-                        .strings_buffer = std.ArrayList(u8).init(self.allocator),
-                    };
-                    self.app_list.append(node);
-                    break :blk node;
-                };
-                errdefer self.freeApp(updated_app);
-
-                try updated_app.data.setStrings(
-                    resp.getName(),
-                    if (resp.getDescriptionPtr()) |desc| desc.get() else null,
-                    if (resp.getIconPtr()) |icon| icon.get() else null,
-                );
-
-                updated_app.data.last_seen = time_stamp;
-
-                // The app removal was requested, but we would've re-added it here
-                // anyways, so we can just *not* remove it
-                updated_app.data.was_removal_requested = false;
+            try self.receiveMessage(self.multicast_sock, time_stamp);
+        }
+
+        if (self.announce_sock) |sock| {
+            if (self.socket_set.isReadyRead(sock)) {
+                try self.receiveMessage(sock, time_stamp);
             }
         }
     }
@@ -235,16 +292,275 @@ pub fn update(self: *Self) !void {
 
             if (node.data.was_removal_requested) {
                 self.freeApp(node);
+                self.changed = true;
             } else {
-                node.data.description.state = if ((time_stamp - node.data.last_seen) <= keep_alive_period)
+                const is_alive = !node.data.withdrawn and
+                    ((self.scan_count - node.data.last_seen_scan <= keep_alive_scans) or (time_stamp - node.data.last_seen <= keep_alive_period));
+                const state = if (is_alive)
                     ApplicationDescription.State.ready
                 else
                     ApplicationDescription.State.gone;
+                if (node.data.description.state != state) {
+                    self.changed = true;
+                    self.scan_found_changes = true;
+                }
+                node.data.description.state = state;
             }
         }
     }
 }
 
+/// Receives and processes a single discovery message from `sock`.
+fn receiveMessage(self: *Self, sock: network.Socket, time_stamp: i128) !void {
+    var message: protocol.udp.Message = undefined;
+    const receive_info = try sock.receiveFrom(std.mem.asBytes(&message));
+    const length = receive_info.numberOfBytes;
+    const sender = receive_info.sender;
+
+    if (length < @sizeOf(protocol.udp.Header) or !std.mem.eql(u8, &message.header.magic, &protocol.udp.magic))
+        return;
+
+    switch (message.header.type) {
+        .respond_discover => {
+            if (length < @sizeOf(protocol.udp.DiscoverResponse))
+                return;
+            const resp = &message.discover_response;
+            if (length < resp.getTotalPacketLength())
+                return;
+
+            const app = try self.getOrCreateApp(sender, resp.tcp_port, resp.getName(), time_stamp);
+            try self.setContent(app, .description, if (resp.getDescriptionPtr()) |desc| desc.get() else null, time_stamp);
+            try self.setContent(app, .icon, if (resp.getIconPtr()) |icon| icon.get() else null, time_stamp);
+        },
+        .announce => {
+            if (length < @sizeOf(protocol.udp.Announcement))
+                return;
+            const announcement = &message.announcement;
+
+            const app = try self.getOrCreateApp(sender, announcement.tcp_port, announcement.getName(), time_stamp);
+            try self.useContent(app, sender, .description, announcement.getDescriptionHash(), time_stamp);
+            try self.useContent(app, sender, .icon, announcement.getIconHash(), time_stamp);
+        },
+        .respond_content => {
+            if (length < @offsetOf(protocol.udp.ContentResponse, "data"))
+                return;
+            const resp = &message.content_response;
+            if (length < resp.getTotalPacketLength())
+                return;
+
+            const content = self.content_cache.receive(resp.hash, resp.get()) catch |err| switch (err) {
+                error.InvalidHash => {
+                    logger.warn("received content from {} that doesn't match its hash", .{sender});
+                    return;
+                },
+                error.OutOfMemory => |e| return e,
+            } orelse {
+                logger.debug("dropping content from {} that wasn't requested", .{sender});
+                return;
+            };
+            self.assignContent(resp.hash, content);
+        },
+        .withdraw => {
+            if (length < @sizeOf(protocol.udp.Withdraw))
+                return;
+            if (self.findApp(sender, message.withdraw.tcp_port)) |node| {
+                node.data.withdrawn = true;
+            }
+        },
+        .discover, .query_content => {
+            // requests of other display clients
+        },
+        _ => {},
+    }
+}
+
+fn findApp(self: *Self, sender: network.EndPoint, tcp_port: u16) ?*AppNode {
+    var it = self.app_list.first;
+    while (it) |node| : (it = node.next) {
+        if (node.data.tcp_port != tcp_port)
+            continue;
+        if (node.data.udp_port != sender.port)
+            continue;
+        if (!node.data.address.eql(sender.address))
+            continue;
+        return node;
+    }
+    return null;
+}
+
+/// Returns the application that was discovered at `sender` and marks it as seen.
+fn getOrCreateApp(self: *Self, sender: network.EndPoint, tcp_port: u16, name: []const u8, time_stamp: i128) !*Application {
+    const app_node = if (self.findApp(sender, tcp_port)) |node| blk: {
+        try node.data.setName(name);
+        break :blk node;
+    } else blk: {
+        const node = try self.allocApp();
+        node.data = Application{
+            .discovery = self,
+            .description = ApplicationDescription{
+                .display_name = "",
+                .icon = null,
+                .vtable = ApplicationDescription.Interface.get(Application),
+                .state = .ready,
+            },
+            .address = sender.address,
+            .tcp_port = tcp_port,
+            .udp_port = sender.port,
+            .last_seen = undefined,
+            .last_seen_scan = undefined,
+            .app_description = null,
+            .name_buffer = std.ArrayList(u8).init(self.allocator),
+        };
+        self.app_list.append(node);
+        errdefer self.freeApp(node);
+
+        try node.data.setName(name);
+        break :blk node;
+    };
+
+    const app = &app_node.data;
+    app.last_seen = time_stamp;
+    app.last_seen_scan = self.scan_count;
+    app.withdrawn = false;
+
+    // The app removal was requested, but we would've re-added it here
+    // anyways, so we can just *not* remove it
+    app.was_removal_requested = false;
+
+    if (app.changed) {
+        app.changed = false;
+        self.changed = true;
+        self.scan_found_changes = true;
+    }
+
+    return app;
+}
+
+/// Assigns received content to all applications waiting for it.
+fn assignContent(self: *Self, hash: protocol.udp.ContentHash, content: [:0]const u8) void {
+    var it = self.app_list.first;
+    while (it) |node| : (it = node.next) {
+        node.data.assignContent(hash, content);
+    }
+    self.changed = true;
+}
+
+/// Assigns the content that was transferred in a version 1 `DiscoverResponse`.
+fn setContent(self: *Self, app: *Application, kind: protocol.udp.ContentKind, data: ?[]const u8, time_stamp: i128) !void {
+    const hash = if (data) |content| protocol.udp.computeContentHash(content) else null;
+    if (app.setContentHash(kind, hash)) {
+        if (data) |content| {
+            const stored = self.content_cache.store(hash.?, content, time_stamp, ContentUsage{ .discovery = self }) catch |err| switch (err) {
+                error.CacheFull => {
+                    logger.warn("content cache is full, dropping {s} of '{s}'", .{ @tagName(kind), app.description.display_name });
+                    return;
+                },
+                error.OutOfMemory => |e| return e,
+            };
+            app.assignContent(hash.?, stored);
+        }
+        self.changed = true;
+    }
+}
+
+/// Assigns the content announced with `hash`, requesting it from `sender` if it isn't known yet.
+fn useContent(self: *Self, app: *Application, sender: network.EndPoint, kind: protocol.udp.ContentKind, hash: ?protocol.udp.ContentHash, time_stamp: i128) !void {
+    if (app.setContentHash(kind, hash)) {
+        self.changed = true;
+    }
+    const content_hash = hash orelse return;
+
+    if (self.content_cache.get(content_hash)) |content| {
+        app.assignContent(content_hash, content);
+        return;
+    }
+    if (!try self.content_cache.request(content_hash, time_stamp, ContentUsage{ .discovery = self }))
+        return;
+
+    var query = protocol.udp.ContentQuery{
+        .kind = kind,
+        .hash = content_hash,
+    };
+    _ = self.multicast_sock.sendTo(sender, std.mem.asBytes(&query)) catch |err| {
+        logger.warn("failed to request content from {}: {s}", .{ sender, @errorName(err) });
+    };
+}
+
+/// Keeps the content of the discovered applications in the cache. Running applications
+/// copy their description, so only the application list is checked.
+const ContentUsage = struct {
+    discovery: *Self,
+
+    pub fn isUsed(self: ContentUsage, hash: protocol.udp.ContentHash, content: ?[:0]const u8) bool {
+        var it = self.discovery.app_list.first;
+        while (it) |node| : (it = node.next) {
+            const app = &node.data;
+            if (std.meta.eql(app.description_hash, hash) or std.meta.eql(app.icon_hash, hash))
+                return true;
+            // changed content is still shown until its replacement arrives
+            if (content) |data| {
+                if (app.app_description != null and app.app_description.?.ptr == data.ptr)
+                    return true;
+                if (app.description.icon != null and app.description.icon.?.ptr == data.ptr)
+                    return true;
+            }
+        }
+        return false;
+    }
+};
+
+/// Returns `true` if anything has changed since the last call.
+pub fn takeChanges(self: *Self) bool {
+    defer self.changed = false;
+    return self.changed;
+}
+
+/// Blocks until network data is available, an application has received new commands
+/// or `timeout` nanoseconds have passed. The wait is cut short when the next discovery scan is due.
+pub fn waitForEvent(self: *Self, timeout: u64) !void {
+    _ = try network.waitForSocketEvent(&self.socket_set, self.getWaitTimeout(timeout));
+}
+
+/// Returns `timeout`, cut short when the next discovery scan is due.
+pub fn getWaitTimeout(self: Self, timeout: u64) u64 {
+    const until_scan = std.math.max(0, self.next_scan - std.time.nanoTimestamp());
+    return std.math.min(timeout, @intCast(u64, until_scan));
+}
+
+/// Wakes up the UI thread from `waitForEvent()`. Can be called from any thread.
+pub fn wakeUp(self: *Self) void {
+    if (!self.wake_pending.swap(true, .AcqRel)) {
+        if (self.wake_hook) |hook| {
+            hook();
+        }
+        _ = self.wake_sock.sendTo(self.wake_end_point, "!") catch |err| {
+            logger.warn("failed to wake up the ui thread: {s}", .{@errorName(err)});
+            self.wake_pending.store(false, .Release);
+        };
+    }
+}
+
+/// Resolves the bitmaps of all running applications for the software renderer.
+pub fn bitmapSource(self: *Self) SoftwareRenderer.TextureSource {
+    return SoftwareRenderer.TextureSource{
+        .erased_self = @ptrCast(*SoftwareRenderer.TextureSource.ErasedSelf, self),
+        .lookup_fn = lookupBitmap,
+    };
+}
+
+fn lookupBitmap(erased_self: *SoftwareRenderer.TextureSource.ErasedSelf, texture: *const zero_graphics.ResourceManager.Texture) ?SoftwareRenderer.Image {
+    const self = @ptrCast(*Self, @alignCast(@alignOf(Self), erased_self));
+
+    var it = self.active_apps.first;
+    while (it) |node| : (it = node.next) {
+        if (node.data.flagged_for_deletion)
+            continue;
+        if (SoftwareRenderer.bitmapSource(&node.data.user_interface).lookup(texture)) |image|
+            return image;
+    }
+    return null;
+}
+
 pub fn iterator(self: Self) Iterator {
     return Iterator{
         .it = self.app_list.first,
@@ -274,12 +590,25 @@ pub const Application = struct {
     udp_port: u16,
 
     last_seen: i128,
+    /// The `scan_count` when the application was seen the last time.
+    last_seen_scan: u64,
 
+    /// Points into the content cache of the discovery, which keeps it while it's used.
     app_description: ?[:0]const u8,
 
-    strings_buffer: std.ArrayList(u8),
+    description_hash: ?protocol.udp.ContentHash = null,
+    icon_hash: ?protocol.udp.ContentHash = null,
+
+    /// Stores the display name.
+    name_buffer: std.ArrayList(u8),
     was_removal_requested: bool = false,
 
+    /// The provider has shut down.
+    withdrawn: bool = false,
+
+    /// The name was changed since the application was seen the last time.
+    changed: bool = true,
+
     discovery: *Self,
 
     pub fn spawn(desc: *ApplicationDescription, allocator: std.mem.Allocator) ApplicationDescription.Interface.SpawnError!*ApplicationInstance {
@@ -311,39 +640,44 @@ pub const Application = struct {
         self.was_removal_requested = true;
     }
 
-    /// Allocates or resizes enough memory to store application name and potentially the icon and description text.
-    fn setStrings(self: *@This(), app_name: []const u8, description: ?[]const u8, icon: ?[]const u8) !void {
-        var len = app_name.len + 1;
-        if (description) |data|
-            len += data.len + 1;
-        if (icon) |data|
-            len += data.len;
-
-        try self.strings_buffer.resize(len);
-
-        var start: usize = 0;
-        {
-            std.mem.copy(u8, self.strings_buffer.items[start .. start + app_name.len], app_name);
-            self.strings_buffer.items[start + app_name.len] = 0;
-            self.description.display_name = self.strings_buffer.items[start .. start + app_name.len :0];
-            start += app_name.len + 1;
-        }
+    fn setName(self: *@This(), name: []const u8) !void {
+        if (std.mem.eql(u8, self.description.display_name, name))
+            return;
 
-        if (description) |desc| {
-            std.mem.copy(u8, self.strings_buffer.items[start .. start + desc.len], desc);
-            self.strings_buffer.items[start + desc.len] = 0;
-            self.app_description = self.strings_buffer.items[start .. start + desc.len :0];
-            start += desc.len + 1;
-        } else {
-            self.app_description = null;
-        }
+        try self.name_buffer.resize(name.len + 1);
+        std.mem.copy(u8, self.name_buffer.items, name);
+        self.name_buffer.items[name.len] = 0;
+        self.description.display_name = self.name_buffer.items[0..name.len :0];
+        self.changed = true;
+    }
 
-        if (icon) |data| {
-            std.mem.copy(u8, self.strings_buffer.items[start .. start + data.len], data);
-            self.description.icon = self.strings_buffer.items[start .. start + data.len];
-            start += data.len;
-        } else {
-            self.description.icon = null;
+    /// Sets the announced hash of the description or icon. Returns `true` if it changed.
+    /// The content itself is assigned when it's available.
+    fn setContentHash(self: *@This(), kind: protocol.udp.ContentKind, hash: ?protocol.udp.ContentHash) bool {
+        const current = switch (kind) {
+            .description => &self.description_hash,
+            .icon => &self.icon_hash,
+            _ => return false,
+        };
+        if (std.meta.eql(current.*, hash))
+            return false;
+        current.* = hash;
+
+        // a removed content is gone immediately, a changed one is replaced when it arrives
+        if (hash == null) {
+            switch (kind) {
+                .description => self.app_description = null,
+                .icon => self.description.icon = null,
+                _ => unreachable,
+            }
         }
+        return true;
+    }
+
+    fn assignContent(self: *@This(), hash: protocol.udp.ContentHash, content: [:0]const u8) void {
+        if (self.description_hash != null and std.mem.eql(u8, &self.description_hash.?, &hash))
+            self.app_description = content;
+        if (self.icon_hash != null and std.mem.eql(u8, &self.icon_hash.?, &hash))
+            self.description.icon = content;
     }
 };
@@ -0,0 +1,256 @@
+//! Descriptions and icons of the discovered applications, identified by their content hash.
+//!
+//! A hash goes through two states: it's `requested` when an application announced it and a
+//! `ContentQuery` was sent, and `available` when the matching `ContentResponse` arrived.
+//! Responses for hashes that weren't requested are dropped, so other hosts on the network
+//! can't fill the cache with unsolicited content.
+//!
+//! The cache holds at most `max_entries`. To make room, stale requests and content that no
+//! application uses anymore are evicted. What's in use is decided by the caller: `usage`
+//! must provide `fn isUsed(self, hash: ContentHash, content: ?[:0]const u8) bool`, where
+//! `content` is `null` for requested entries.
+
+const std = @import("std");
+const protocol = @import("dunstblick-protocol");
+
+const ContentHash = protocol.udp.ContentHash;
+
+const Self = @This();
+
+/// Maximum number of requested and available entries.
+pub const max_entries = 64;
+
+/// A description or icon that wasn't received is requested again after this period.
+pub const retry_period = 500 * std.time.ns_per_ms;
+
+const Entry = union(enum) {
+    /// The content was requested at the given time stamp, but wasn't received yet.
+    requested: i128,
+    /// The content, allocated with the allocator of the cache.
+    available: [:0]const u8,
+};
+
+allocator: std.mem.Allocator,
+entries: std.AutoHashMapUnmanaged(ContentHash, Entry) = .{},
+
+pub fn init(allocator: std.mem.Allocator) Self {
+    return Self{ .allocator = allocator };
+}
+
+pub fn deinit(self: *Self) void {
+    var it = self.entries.valueIterator();
+    while (it.next()) |entry| {
+        if (entry.* == .available) {
+            self.allocator.free(entry.available);
+        }
+    }
+    self.entries.deinit(self.allocator);
+    self.* = undefined;
+}
+
+/// Returns the content of `hash` if it was received.
+pub fn get(self: Self, hash: ContentHash) ?[:0]const u8 {
+    const entry = self.entries.get(hash) orelse return null;
+    return switch (entry) {
+        .available => |content| content,
+        .requested => null,
+    };
+}
+
+/// Marks `hash` as requested. Returns `true` when a `ContentQuery` must be sent, which is
+/// not the case while an earlier request is pending or the cache is full of used entries.
+pub fn request(self: *Self, hash: ContentHash, now: i128, usage: anytype) !bool {
+    if (self.entries.getPtr(hash)) |entry| {
+        switch (entry.*) {
+            .available => return false,
+            .requested => |requested| {
+                if (now - requested < retry_period)
+                    return false;
+                entry.* = .{ .requested = now };
+                return true;
+            },
+        }
+    }
+
+    if (!self.makeRoom(now, usage))
+        return false;
+
+    try self.entries.putNoClobber(self.allocator, hash, .{ .requested = now });
+    return true;
+}
+
+/// Stores the content of a `ContentResponse`. Returns the stored content, or `null` if
+/// `hash` wasn't requested.
+pub fn receive(self: *Self, hash: ContentHash, data: []const u8) !?[:0]const u8 {
+    if (!std.mem.eql(u8, &protocol.udp.computeContentHash(data), &hash))
+        return error.InvalidHash;
+
+    const entry = self.entries.getPtr(hash) orelse return null;
+    switch (entry.*) {
+        .available => |content| return content,
+        .requested => {
+            const content = try self.allocator.dupeZ(u8, data);
+            entry.* = .{ .available = content };
+            return content;
+        },
+    }
+}
+
+/// Stores content that was sent along with the application (a version 1 `DiscoverResponse`).
+pub fn store(self: *Self, hash: ContentHash, data: []const u8, now: i128, usage: anytype) ![:0]const u8 {
+    if (self.entries.getPtr(hash)) |entry| {
+        if (entry.* == .available)
+            return entry.available;
+    } else if (!self.makeRoom(now, usage)) {
+        return error.CacheFull;
+    }
+
+    const content = try self.allocator.dupeZ(u8, data);
+    errdefer self.allocator.free(content);
+
+    try self.entries.put(self.allocator, hash, .{ .available = content });
+    return content;
+}
+
+/// Evicts entries until a new one fits. Returns `false` if everything is in use.
+fn makeRoom(self: *Self, now: i128, usage: anytype) bool {
+    while (self.entries.count() >= max_entries) {
+        const victim = self.findVictim(now, usage) orelse return false;
+        const entry = self.entries.fetchRemove(victim).?;
+        if (entry.value == .available) {
+            self.allocator.free(entry.value.available);
+        }
+    }
+    return true;
+}
+
+/// Returns an entry that can be evicted, preferring stale requests over unused content.
+fn findVictim(self: *Self, now: i128, usage: anytype) ?ContentHash {
+    var unused: ?ContentHash = null;
+
+    var it = self.entries.iterator();
+    while (it.next()) |kv| {
+        switch (kv.value_ptr.*) {
+            .requested => |requested| {
+                if (now - requested >= retry_period or !usage.isUsed(kv.key_ptr.*, null))
+                    return kv.key_ptr.*;
+            },
+            .available => |content| {
+                if (unused == null and !usage.isUsed(kv.key_ptr.*, content))
+                    unused = kv.key_ptr.*;
+            },
+        }
+    }
+    return unused;
+}
+
+const TestUsage = struct {
+    used: []const ContentHash = &.{},
+
+    pub fn isUsed(self: TestUsage, hash: ContentHash, content: ?[:0]const u8) bool {
+        _ = content;
+        for (self.used) |used| {
+            if (std.mem.eql(u8, &used, &hash))
+                return true;
+        }
+        return false;
+    }
+};
+
+fn testHash(index: usize) ContentHash {
+    var hash = std.mem.zeroes(ContentHash);
+    std.mem.writeIntLittle(u64, &hash, index);
+    return hash;
+}
+
+test "unsolicited content is dropped" {
+    var cache = Self.init(std.testing.allocator);
+    defer cache.deinit();
+
+    const data = "an icon";
+    const hash = protocol.udp.computeContentHash(data);
+
+    try std.testing.expectEqual(@as(?[:0]const u8, null), try cache.receive(hash, data));
+    try std.testing.expectEqual(@as(?[:0]const u8, null), cache.get(hash));
+    try std.testing.expectEqual(@as(usize, 0), cache.entries.count());
+}
+
+test "requested content is stored" {
+    var cache = Self.init(std.testing.allocator);
+    defer cache.deinit();
+
+    const data = "a description";
+    const hash = protocol.udp.computeContentHash(data);
+
+    try std.testing.expect(try cache.request(hash, 0, TestUsage{}));
+    try std.testing.expectEqual(@as(?[:0]const u8, null), cache.get(hash));
+
+    // content that doesn't match the requested hash is rejected
+    try std.testing.expectError(error.InvalidHash, cache.receive(hash, "something else"));
+
+    const content = (try cache.receive(hash, data)).?;
+    try std.testing.expectEqualStrings(data, content);
+    try std.testing.expectEqualStrings(data, cache.get(hash).?);
+
+    // available content isn't requested again
+    try std.testing.expect(!try cache.request(hash, retry_period, TestUsage{}));
+}
+
+test "pending requests are retried after the retry period" {
+    var cache = Self.init(std.testing.allocator);
+    defer cache.deinit();
+
+    const hash = testHash(1);
+
+    try std.testing.expect(try cache.request(hash, 0, TestUsage{}));
+    try std.testing.expect(!try cache.request(hash, retry_period - 1, TestUsage{}));
+    try std.testing.expect(try cache.request(hash, retry_period, TestUsage{}));
+}
+
+test "unused content is evicted when the cache is full" {
+    var cache = Self.init(std.testing.allocator);
+    defer cache.deinit();
+
+    var i: usize = 0;
+    while (i < max_entries) : (i += 1) {
+        const hash = testHash(i);
+        try std.testing.expect(try cache.request(hash, 0, TestUsage{}));
+        _ = try cache.store(hash, "content", 0, TestUsage{});
+    }
+
+    var used: [max_entries]ContentHash = undefined;
+    for (used) |*hash, index| {
+        hash.* = testHash(index);
+    }
+
+    // everything is in use, so nothing is requested
+    try std.testing.expect(!try cache.request(testHash(max_entries), 0, TestUsage{ .used = &used }));
+    try std.testing.expectError(error.CacheFull, cache.store(testHash(max_entries), "data", 0, TestUsage{ .used = &used }));
+
+    // the only unused entry makes room
+    try std.testing.expect(try cache.request(testHash(max_entries), 0, TestUsage{ .used = used[1..] }));
+    try std.testing.expectEqual(@as(?[:0]const u8, null), cache.get(testHash(0)));
+    try std.testing.expectEqual(@as(usize, max_entries), cache.entries.count());
+}
+
+test "stale requests are evicted first" {
+    var cache = Self.init(std.testing.allocator);
+    defer cache.deinit();
+
+    var used: [max_entries + 1]ContentHash = undefined;
+    for (used) |*hash, index| {
+        hash.* = testHash(index);
+    }
+
+    var i: usize = 0;
+    while (i < max_entries) : (i += 1) {
+        try std.testing.expect(try cache.request(testHash(i), 0, TestUsage{ .used = &used }));
+    }
+
+    // all requests are pending and in use
+    try std.testing.expect(!try cache.request(testHash(max_entries), 1, TestUsage{ .used = &used }));
+
+    // after the retry period, the requests are stale and can be replaced
+    try std.testing.expect(try cache.request(testHash(max_entries), retry_period, TestUsage{ .used = &used }));
+    try std.testing.expectEqual(@as(usize, max_entries), cache.entries.count());
+}
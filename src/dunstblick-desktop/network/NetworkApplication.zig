@@ -10,6 +10,8 @@ const ApplicationInstance = @import("../gui/ApplicationInstance.zig");
 const ApplicationDescription = @import("../gui/ApplicationDescription.zig");
 
 const DunstblickUI = @import("../dunst-ui/DunstblickUI.zig");
+const MpscQueue = @import("mpsc_queue.zig").MpscQueue;
+const profiler = @import("../profiler.zig");
 
 const Size = zero_graphics.Size;
 
@@ -23,32 +25,178 @@ const State = enum {
 
 const Resource = struct {
     kind: protocol.ResourceKind,
+    size: u32,
     hash: [8]u8,
 };
 
+/// A decoded message of the application. Commands are created by the network thread
+/// and executed on the UI thread in `update()`.
+const Command = union(enum) {
+    status: StatusChange,
+    upload_resource: ResourceUpload,
+    add_or_update_object: DunstblickUI.Object,
+    remove_object: protocol.ObjectID,
+    set_view: protocol.ResourceID,
+    set_root: protocol.ObjectID,
+    set_property: PropertyUpdate,
+    animate_property: PropertyAnimation,
+    clear: PropertyRef,
+    insert_range: InsertRange,
+    remove_range: RemoveRange,
+    move_range: MoveRange,
+
+    const StatusChange = union(enum) {
+        loading_resources,
+        running,
+        /// The reason is either static or allocated in the arena of the application.
+        exited: []const u8,
+    };
+
+    const ResourceUpload = struct {
+        id: protocol.ResourceID,
+        kind: protocol.ResourceKind,
+        /// Allocated with the allocator of the application, ownership is passed to the user interface.
+        data: []u8,
+    };
+
+    const PropertyRef = struct {
+        oid: protocol.ObjectID,
+        name: protocol.PropertyName,
+    };
+
+    const PropertyUpdate = struct {
+        oid: protocol.ObjectID,
+        name: protocol.PropertyName,
+        value: DunstblickUI.Value,
+    };
+
+    const PropertyAnimation = struct {
+        oid: protocol.ObjectID,
+        name: protocol.PropertyName,
+        value: DunstblickUI.Value,
+        /// Duration in seconds.
+        duration: f32,
+        easing: protocol.Easing,
+        notify: bool,
+    };
+
+    const InsertRange = struct {
+        oid: protocol.ObjectID,
+        name: protocol.PropertyName,
+        index: usize,
+        items: []protocol.ObjectID,
+    };
+
+    const RemoveRange = struct {
+        oid: protocol.ObjectID,
+        name: protocol.PropertyName,
+        index: usize,
+        count: usize,
+    };
+
+    const MoveRange = struct {
+        oid: protocol.ObjectID,
+        name: protocol.PropertyName,
+        index_from: usize,
+        index_to: usize,
+        count: usize,
+    };
+
+    fn deinit(self: *Command, allocator: std.mem.Allocator) void {
+        switch (self.*) {
+            .upload_resource => |res| allocator.free(res.data),
+            .add_or_update_object => |*obj| obj.deinit(),
+            .set_property => |*prop| prop.value.deinit(),
+            .animate_property => |*anim| anim.value.deinit(),
+            .insert_range => |range| allocator.free(range.items),
+            .status, .remove_object, .set_view, .set_root, .clear, .remove_range, .move_range => {},
+        }
+        self.* = undefined;
+    }
+};
+
+const CommandQueue = MpscQueue(Command);
+
+/// The network thread checks for shutdown requests with this period.
+const shutdown_poll_period = 100 * std.time.ns_per_ms;
+
+const receive_buffer_size = 64 * 1024;
+
+/// Number of connection attempts when resuming a session after the connection was lost.
+const max_resume_attempts = 6;
+
+/// Delay before the second attempt to resume a session, doubled with every further attempt.
+const resume_delay = 100 * std.time.ns_per_ms;
+
+/// Upper bound for the size of the messages that are queued while a session resumes.
+const max_pending_size = 64 * 1024;
+
 const Self = @This();
 
 flagged_for_deletion: bool = false,
 instance: ApplicationInstance,
 allocator: std.mem.Allocator,
+
+/// After the network thread was spawned, this is only used by the network thread.
 arena: std.heap.ArenaAllocator,
 
-socket: ?network.Socket,
+socket: network.Socket,
 
 remote_end_point: network.EndPoint,
 
+/// Shared between the UI thread (sending events) and the network thread, guarded by `client_lock`.
 client: protocol.tcp.ClientStateMachine(network.Socket.Writer),
+client_lock: std.Thread.Mutex = .{},
+
+/// Messages of the UI thread that were sent while the session resumed, guarded by `client_lock`.
+/// They are sent in order when the session is resumed, and dropped when it's restarted.
+pending_messages: std.ArrayListUnmanaged([]u8) = .{},
+/// Total size of `pending_messages`, guarded by `client_lock`.
+pending_size: usize = 0,
 
+/// The state as seen by the UI thread.
 state: State = .unconnected,
 
+/// Guarded by `client_lock`.
 screen_size: Size,
 
+/// Only accessed by the network thread.
 resources: std.AutoArrayHashMap(protocol.ResourceID, Resource),
 
 discovery: *AppDiscovery,
 
 user_interface: DunstblickUI,
 
+network_thread: ?std.Thread = null,
+shutdown_requested: std.atomic.Atomic(bool) = std.atomic.Atomic(bool).init(false),
+/// Set by the network thread as its last access to this application.
+network_thread_done: std.atomic.Atomic(bool) = std.atomic.Atomic(bool).init(false),
+/// Guards `discovery` against the shutdown, as the network thread might outlive `AppDiscovery`.
+wake_lock: std.Thread.Mutex = .{},
+
+/// Commands decoded by the network thread, waiting to be executed on the UI thread.
+commands: CommandQueue,
+
+/// Pushed by the network thread when the connection has ended. This node is preallocated,
+/// so the UI is notified even when memory is exhausted.
+exit_node: CommandQueue.Node,
+
+/// Set by the network thread when the application sent a disconnect reason.
+exit_reason: ?[]const u8 = null,
+
+/// Set by the network thread when the handshake is done.
+is_established: bool = false,
+
+/// Only accessed by the network thread. Issued by the application after the handshake,
+/// allows to continue after a lost connection without transferring everything again.
+session: ?protocol.tcp.Session = null,
+
+/// Only accessed by the network thread. Number of messages received in the session.
+received_messages: u64 = 0,
+
+/// Only accessed by the network thread. Set while the handshake resumes the session.
+resuming: bool = false,
+
 const support_non_block = (builtin.os.tag == .linux and builtin.abi != .android);
 
 pub fn init(self: *Self, allocator: std.mem.Allocator, app_desc: *const AppDiscovery.Application) !void {
@@ -59,7 +207,7 @@ pub fn init(self: *Self, allocator: std.mem.Allocator, app_desc: *const AppDisco
         },
         .allocator = allocator,
         .arena = std.heap.ArenaAllocator.init(allocator),
-        .socket = null,
+        .socket = undefined,
         .client = undefined,
         .remote_end_point = network.EndPoint{
             .address = app_desc.address,
@@ -68,17 +216,24 @@ pub fn init(self: *Self, allocator: std.mem.Allocator, app_desc: *const AppDisco
         .screen_size = Size.empty,
         .resources = std.AutoArrayHashMap(protocol.ResourceID, Resource).init(allocator),
         .discovery = app_desc.discovery,
-        .user_interface = DunstblickUI.init(allocator, DunstblickUI.FeedbackInterface{
+        .user_interface = DunstblickUI.init(allocator, app_desc.discovery.raster_cache.drawingRasterizer(), DunstblickUI.FeedbackInterface{
             .erased_self = @ptrCast(*DunstblickUI.FeedbackInterface.ErasedSelf, self),
             .trigger_event = triggerEvent,
             .trigger_property_changed = triggerPropertyChanged,
         }),
+        .commands = undefined,
+        .exit_node = CommandQueue.Node{ .data = undefined },
     };
+    errdefer self.arena.deinit();
+    errdefer self.resources.deinit();
+    errdefer self.user_interface.deinit();
+
+    self.commands.init();
 
     self.socket = try network.Socket.create(std.meta.activeTag(app_desc.address), .tcp);
-    errdefer self.socket.?.close();
+    errdefer self.socket.close();
 
-    self.client = protocol.tcp.ClientStateMachine(network.Socket.Writer).init(allocator, self.socket.?.writer());
+    self.client = protocol.tcp.ClientStateMachine(network.Socket.Writer).init(allocator, self.socket.writer());
     errdefer self.client.deinit();
 
     self.instance.description.display_name = try self.arena.allocator().dupeZ(u8, self.instance.description.display_name);
@@ -87,230 +242,446 @@ pub fn init(self: *Self, allocator: std.mem.Allocator, app_desc: *const AppDisco
     }
 
     self.instance.status = .{ .starting = "Connecting..." };
+    self.state = .socket_connecting;
 
-    if (support_non_block) {
-        var flags = try std.os.fcntl(self.socket.?.internal, std.os.F.GETFL, 0);
-        flags |= @as(usize, std.os.O.NONBLOCK);
-        _ = try std.os.fcntl(self.socket.?.internal, std.os.F.SETFL, flags);
+    self.network_thread = try std.Thread.spawn(.{}, networkThread, .{self});
+}
+
+/// Requests the shutdown of the network thread and releases the user interface. This never blocks:
+/// the network thread might be stuck in a blocking `connect()` that can't be interrupted on
+/// all platforms, so the remaining state is released by `destroy()` after `isDestroyable()`.
+pub fn deinit(self: *Self) void {
+    {
+        self.wake_lock.lock();
+        defer self.wake_lock.unlock();
+        self.shutdown_requested.store(true, .Release);
     }
 
-    try self.discovery.socket_set.add(self.socket.?, .{ .read = true, .write = support_non_block });
-    errdefer self.discovery.socket_set.remove(self.socket.?);
+    self.user_interface.deinit();
+    self.flagged_for_deletion = true;
+}
 
-    try self.tryConnect();
+/// Returns `true` when the network thread has exited and `destroy()` won't block.
+pub fn isDestroyable(self: *Self) bool {
+    return self.network_thread == null or self.network_thread_done.load(.Acquire);
 }
 
-pub fn deinit(self: *Self) void {
-    if (self.socket) |*sock| {
-        self.client.deinit();
-        sock.close();
+/// Releases the state shared with the network thread. Requires `deinit()` and `isDestroyable()`.
+pub fn destroy(self: *Self) void {
+    std.debug.assert(self.flagged_for_deletion);
+    std.debug.assert(self.isDestroyable());
+
+    if (self.network_thread) |thread| {
+        thread.join();
     }
-    self.user_interface.deinit();
+
+    while (self.commands.pop()) |node| {
+        node.data.deinit(self.allocator);
+        self.destroyCommandNode(node);
+    }
+
+    self.clearPendingMessages();
+    self.pending_messages.deinit(self.allocator);
+    self.client.deinit();
+    self.socket.close();
+    self.resources.deinit();
     self.arena.deinit();
     self.* = undefined;
-    self.flagged_for_deletion = true;
 }
 
 pub fn isFaulted(self: Self) bool {
     return self.state == .faulted;
 }
 
-fn tryConnect(self: *Self) !void {
-    std.debug.assert(self.socket != null);
+fn isShutdownRequested(self: *Self) bool {
+    return self.shutdown_requested.load(.Acquire);
+}
+
+/// Wakes up the UI thread unless the application was closed, as `discovery` might be gone then.
+fn wakeUp(self: *Self) void {
+    self.wake_lock.lock();
+    defer self.wake_lock.unlock();
+    if (!self.isShutdownRequested()) {
+        self.discovery.wakeUp();
+    }
+}
+
+fn destroyCommandNode(self: *Self, node: *CommandQueue.Node) void {
+    if (node != &self.exit_node) {
+        self.allocator.destroy(node);
+    }
+}
+
+/// Queues a command for the UI thread and takes ownership of its payload.
+fn pushCommand(self: *Self, command: Command) !void {
+    var cmd = command;
+    const node = self.allocator.create(CommandQueue.Node) catch |err| {
+        cmd.deinit(self.allocator);
+        return err;
+    };
+    node.* = .{ .data = cmd };
+    self.commands.push(node);
+}
 
-    if (self.socket.?.connect(self.remote_end_point)) {
-        // remove blocking from socket
-        if (support_non_block) {
-            var flags = try std.os.fcntl(self.socket.?.internal, std.os.F.GETFL, 0);
-            flags &= ~@as(usize, std.os.O.NONBLOCK);
-            _ = try std.os.fcntl(self.socket.?.internal, std.os.F.SETFL, flags);
+// Network thread:
+
+fn networkThread(self: *Self) void {
+    self.runConnection() catch |err| {
+        if (err != error.Shutdown) {
+            logger.err("connection to '{s}' failed: {s}", .{ self.instance.description.display_name, @errorName(err) });
         }
 
-        // start handshaking
-        try self.client.initiateHandshake(null, null);
+        self.exit_node.data = Command{ .status = .{ .exited = switch (err) {
+            error.ConnectionRefused => "Connection refused",
+            error.ConnectionLost => "Lost connection to application.",
+            error.HandshakeRejected => "Handshake rejected",
+            error.InvalidCredentials => "Invalid credentials",
+            error.DuplicateResource => "protocol violation: dup res",
+            error.UnknownResource => "protocol violation: invalid res",
+            error.InvalidHash => "protocol violation: invalid hash",
+            error.InvalidMessage => "protocol violation: received invalid message",
+            error.Disconnected => self.exit_reason orelse "Disconnected",
+            error.OutOfMemory => "Out of memory",
+            else => "Lost connection to application.",
+        } } };
+    };
+    self.commands.push(&self.exit_node);
+    self.wakeUp();
+
+    // after this, the UI thread may release the application at any time
+    self.network_thread_done.store(true, .Release);
+}
+
+fn runConnection(self: *Self) !void {
+    var socket_set = try network.SocketSet.init(self.allocator);
+    defer socket_set.deinit();
 
-        self.instance.status = .{ .starting = "Loading resources..." };
-        self.state = .protocol_connecting;
-    } else |err| {
-        switch (err) {
-            error.ConnectionRefused => {
-                self.state = .faulted;
-                self.instance.status = .{ .exited = "Connection refused" };
+    try self.connectSocket(&socket_set);
+    try self.startHandshake();
+
+    const buffer = try self.allocator.alloc(u8, receive_buffer_size);
+    defer self.allocator.free(buffer);
+
+    while (true) {
+        self.receiveMessages(&socket_set, buffer) catch |err| switch (err) {
+            error.ConnectionLost => {
+                const session = self.session orelse return err;
+                try self.resumeSession(&socket_set, session);
             },
-            error.WouldBlock => {
-                self.state = .socket_connecting;
+            error.SessionRejected => {
+                logger.info("'{s}' can't resume the session, reconnecting", .{self.instance.description.display_name});
+                try self.restartSession(&socket_set);
             },
             else => |e| return e,
+        };
+    }
+}
+
+/// Connects the socket without blocking forever, so the user can close
+/// a starting application.
+fn connectSocket(self: *Self, socket_set: *network.SocketSet) !void {
+    if (support_non_block) {
+        var flags = try std.os.fcntl(self.socket.internal, std.os.F.GETFL, 0);
+        flags |= @as(usize, std.os.O.NONBLOCK);
+        _ = try std.os.fcntl(self.socket.internal, std.os.F.SETFL, flags);
+    }
+
+    try socket_set.add(self.socket, .{ .read = false, .write = true });
+    defer socket_set.remove(self.socket);
+
+    while (true) {
+        if (self.socket.connect(self.remote_end_point)) {
+            break;
+        } else |err| switch (err) {
+            error.WouldBlock => {},
+            else => |e| return e,
         }
+        while ((try network.waitForSocketEvent(socket_set, shutdown_poll_period)) == 0) {
+            if (self.isShutdownRequested())
+                return error.Shutdown;
+        }
+    }
+
+    // remove blocking from socket
+    if (support_non_block) {
+        var flags = try std.os.fcntl(self.socket.internal, std.os.F.GETFL, 0);
+        flags &= ~@as(usize, std.os.O.NONBLOCK);
+        _ = try std.os.fcntl(self.socket.internal, std.os.F.SETFL, flags);
     }
-    // logger.info("tryConnect() => {}", .{self.state});
 }
 
-pub fn notifyWritable(self: *Self) !void {
-    // logger.info("socket write {}", .{self.state});
-    switch (self.state) {
-        .unconnected => return error.InvalidState,
+fn startHandshake(self: *Self) !void {
+    {
+        self.client_lock.lock();
+        defer self.client_lock.unlock();
+        self.client.request_session = true;
+        try self.client.initiateHandshake(null, null);
+    }
 
-        .socket_connecting => {
-            try self.tryConnect();
-            if (self.state != .socket_connecting) {
-                if (self.socket) |sock| {
-                    self.discovery.socket_set.remove(sock);
-                    try self.discovery.socket_set.add(sock, .{ .read = true, .write = false });
-                }
-            }
-        },
+    try self.pushCommand(.{ .status = .loading_resources });
+    self.wakeUp();
+}
+
+/// Replaces the socket and the protocol state machine with new ones and connects again.
+fn reconnect(self: *Self, socket_set: *network.SocketSet) !void {
+    const socket = try network.Socket.create(std.meta.activeTag(self.remote_end_point.address), .tcp);
+    {
+        self.client_lock.lock();
+        defer self.client_lock.unlock();
 
-        .protocol_connecting, .connected, .faulted => {},
+        self.client.deinit();
+        self.socket.close();
+        self.socket = socket;
+        self.client = protocol.tcp.ClientStateMachine(network.Socket.Writer).init(self.allocator, socket.writer());
     }
+    try self.connectSocket(socket_set);
 }
 
-pub fn notifyReadable(self: *Self) !void {
-    // logger.info("socket read {}", .{self.state});
-    switch (self.state) {
-        .unconnected, .socket_connecting => return error.InvalidState,
+/// Reconnects after the connection was lost and resumes the session, so the application
+/// only sends the messages that were missed and the user interface stays as it is.
+fn resumeSession(self: *Self, socket_set: *network.SocketSet, session: protocol.tcp.Session) !void {
+    if (self.resuming) {
+        // lost again before the application answered, don't try forever
+        return self.restartSession(socket_set);
+    }
+
+    logger.info("lost connection to '{s}', resuming the session", .{self.instance.description.display_name});
+
+    var delay: u64 = resume_delay;
+    var attempt: usize = 1;
+    while (true) : (attempt += 1) {
+        if (self.reconnect(socket_set)) {
+            break;
+        } else |err| {
+            if (err == error.Shutdown or attempt >= max_resume_attempts)
+                return err;
+        }
+        try self.sleepUnlessShutdown(delay);
+        delay *= 2;
+    }
 
-        .protocol_connecting, .connected => {
-            var backing_buffer: [8192]u8 = undefined;
+    self.client_lock.lock();
+    defer self.client_lock.unlock();
 
-            const len = try self.socket.?.receive(&backing_buffer);
+    try self.client.initiateResume(session, self.received_messages);
+    self.resuming = true;
+}
 
-            if (len == 0) {
-                self.disconnect(null);
-                self.instance.status = .{ .exited = "Lost connection to application." };
-                return;
+/// Falls back to a full handshake on a new connection when the session can't be resumed.
+/// The application then sends all resources and objects again.
+fn restartSession(self: *Self, socket_set: *network.SocketSet) !void {
+    {
+        self.client_lock.lock();
+        defer self.client_lock.unlock();
+        if (self.pending_messages.items.len > 0) {
+            logger.warn("dropping {} messages to '{s}' for the lost session", .{ self.pending_messages.items.len, self.instance.description.display_name });
+        }
+        self.clearPendingMessages();
+    }
+
+    self.session = null;
+    self.received_messages = 0;
+    self.resuming = false;
+    self.is_established = false;
+    self.resources.clearRetainingCapacity();
+
+    try self.reconnect(socket_set);
+    try self.startHandshake();
+}
+
+fn sleepUnlessShutdown(self: *Self, duration: u64) !void {
+    var remaining = duration;
+    while (remaining > 0) {
+        if (self.isShutdownRequested())
+            return error.Shutdown;
+        const step = std.math.min(remaining, shutdown_poll_period);
+        std.time.sleep(step);
+        remaining -= step;
+    }
+}
+
+fn receiveMessages(self: *Self, socket_set: *network.SocketSet, buffer: []u8) !void {
+    try socket_set.add(self.socket, .{ .read = true, .write = false });
+    defer socket_set.remove(self.socket);
+
+    while (true) {
+        if (self.isShutdownRequested())
+            return error.Shutdown;
+
+        if ((try network.waitForSocketEvent(socket_set, shutdown_poll_period)) == 0)
+            continue;
+
+        const len = self.socket.receive(buffer) catch return error.ConnectionLost;
+        if (len == 0)
+            return error.ConnectionLost;
+
+        const zone = profiler.begin(.network, self.instance.description.display_name);
+        defer zone.end();
+
+        var offset: usize = 0;
+        while (offset < len) {
+            const push_info = blk: {
+                self.client_lock.lock();
+                defer self.client_lock.unlock();
+                break :blk try self.client.pushData(buffer[offset..len]);
+            };
+            offset += push_info.consumed;
+
+            // The event data stays valid until the next call to `pushData`,
+            // which is only called by this thread.
+            if (push_info.event) |event| {
+                try self.handleEvent(event);
             }
+        }
 
-            const buffer = backing_buffer[0..len];
-
-            var offset: usize = 0;
-            while (offset < buffer.len) {
-                const push_info = try self.client.pushData(buffer[offset..]);
-                offset += push_info.consumed;
-                if (push_info.event) |event| {
-                    // logger.debug("received event: {s}", .{@tagName(std.meta.activeTag(event))});
-                    switch (event) {
-                        .acknowledge_handshake => |data| { //  AcknowledgeHandshake{ .requires_username = false, .requires_password = false, .rejects_username = false, .rejects_password = false } }
-                            if (!data.ok()) {
-                                self.disconnect(null);
-                            }
-                            // TODO: Send auth info if required
-                        },
-                        .authenticate_result => |data| { //  AuthenticateResult{ .result = Result.success } }
-                            if (data.result != .success) {
-                                self.instance.status = .{ .exited = switch (data.result) {
-                                    .success => unreachable,
-                                    .invalid_credentials => "Invalid credentials",
-                                } };
-                                self.disconnect(null);
-                            } else {
-                                try self.client.sendConnectHeader(
-                                    self.screen_size.width,
-                                    self.screen_size.height,
-                                    std.EnumSet(protocol.ClientCapabilities).init(.{
-                                        .mouse = true,
-                                        .keyboard = true,
-                                        .touch = true,
-                                        .highdpi = false,
-                                        .tiltable = false,
-                                        .resizable = true,
-                                        .req_accessibility = false,
-                                    }),
-                                );
-                            }
-                        },
-                        .connect_response => |info| {
-                            // TODO: Request available resources
-                            logger.info("server provides {} resources", .{info.resource_count});
-                        },
-                        .connect_response_item => |info| {
-                            const gop = try self.resources.getOrPut(info.descriptor.id);
-                            if (gop.found_existing) {
-                                self.disconnect(null);
-                                self.instance.status = .{ .exited = "protocol violation: dup res" };
-                                return;
-                            }
-                            gop.value_ptr.* = .{
-                                .kind = info.descriptor.type,
-                                .hash = info.descriptor.hash,
-                            };
-
-                            if (info.is_last) {
-                                // just request all resources
-
-                                var temp_list = std.ArrayList(protocol.ResourceID).init(self.allocator);
-                                defer temp_list.deinit();
-
-                                try temp_list.ensureTotalCapacity(self.resources.count());
-                                var it = self.resources.iterator();
-                                while (it.next()) |res| {
-                                    temp_list.appendAssumeCapacity(res.key_ptr.*);
-                                }
-
-                                try self.client.sendResourceRequest(temp_list.items);
-                            }
-                        },
-                        .resource_header => |info| {
-                            if (self.resources.getEntry(info.resource_id)) |entry| {
-                                const received_hash = protocol.computeResourceHash(info.data);
-                                if (!std.mem.eql(u8, &received_hash, &entry.value_ptr.hash)) {
-                                    self.disconnect(null);
-                                    self.instance.status = .{ .exited = "protocol violation: invalid hash" };
-                                    return;
-                                }
-
-                                try self.user_interface.addOrReplaceResource(
-                                    info.resource_id,
-                                    entry.value_ptr.kind,
-                                    info.data,
-                                );
-                            } else {
-                                self.disconnect(null);
-                                self.instance.status = .{ .exited = "protocol violation: invalid res" };
-                                return;
-                            }
-                        },
-                        .message => |packet| {
-                            self.decodeAndExecuteMessage(packet) catch |err| {
-                                logger.err("received invalid message: {s}", .{@errorName(err)});
-                                self.disconnect(null);
-                                self.instance.status = .{ .exited = "protocol violation: received invalid message" };
-                                return;
-                            };
-                        },
-                    }
-
-                    if (self.client.isConnectionEstablished()) {
-                        // we're done with doing handshake stuff,
-                        // we're ready to go :)
-                        self.instance.status = .running;
-                        self.state = .connected;
-                    }
-                }
+        self.wakeUp();
+    }
+}
+
+fn isConnectionEstablished(self: *Self) bool {
+    self.client_lock.lock();
+    defer self.client_lock.unlock();
+    return self.client.isConnectionEstablished();
+}
+
+fn handleEvent(self: *Self, event: protocol.tcp.ClientReceiveEvent) !void {
+    // logger.debug("received event: {s}", .{@tagName(std.meta.activeTag(event))});
+    switch (event) {
+        .acknowledge_handshake => |data| { //  AcknowledgeHandshake{ .requires_username = false, .requires_password = false, .rejects_username = false, .rejects_password = false } }
+            if (!data.ok()) {
+                return error.HandshakeRejected;
+            }
+            if (self.resuming) {
+                self.client_lock.lock();
+                defer self.client_lock.unlock();
+                try self.client.sendResumeRequest();
+            }
+            // TODO: Send auth info if required
+        },
+        .authenticate_result => |data| { //  AuthenticateResult{ .result = Result.success } }
+            if (data.result != .success) {
+                return switch (data.result) {
+                    .success => unreachable,
+                    .invalid_credentials => error.InvalidCredentials,
+                    .unknown_session => error.SessionRejected,
+                };
+            }
+            if (data.resumed) {
+                logger.info("resumed the session with '{s}'", .{self.instance.description.display_name});
+                self.resuming = false;
+                try self.sendPendingMessages();
+                return;
+            }
+            if (data.has_session) {
+                // the connect header is sent after the session info
+                return;
             }
+            try self.sendConnectHeader();
+        },
+        .session_info => |session| {
+            self.session = session;
+            self.received_messages = 0;
+            try self.sendConnectHeader();
         },
-        .faulted => {
-            if (self.socket) |sock| {
-                var backing_buffer: [8192]u8 = undefined;
-
-                const len = try sock.receive(&backing_buffer);
-                if (len == 0) {
-                    self.disconnect(null);
-                    self.instance.status = .{ .exited = "Lost connection to application." };
-                } else {
-                    logger.info("received {} byte in faulted state: {}", .{
-                        len,
-                        std.fmt.fmtSliceHexLower(backing_buffer[0..len]),
-                    });
+        .connect_response => |info| {
+            // TODO: Request available resources
+            logger.info("server provides {} resources", .{info.resource_count});
+        },
+        .connect_response_item => |info| {
+            const gop = try self.resources.getOrPut(info.descriptor.id);
+            if (gop.found_existing) {
+                return error.DuplicateResource;
+            }
+            gop.value_ptr.* = .{
+                .kind = info.descriptor.type,
+                .size = info.descriptor.size,
+                .hash = info.descriptor.hash,
+            };
+
+            if (info.is_last) {
+                // just request all resources
+
+                var temp_list = std.ArrayList(protocol.ResourceID).init(self.allocator);
+                defer temp_list.deinit();
+
+                try temp_list.ensureTotalCapacity(self.resources.count());
+                var it = self.resources.iterator();
+                while (it.next()) |res| {
+                    temp_list.appendAssumeCapacity(res.key_ptr.*);
                 }
-            } else {
-                return error.InvalidState;
+
+                self.client_lock.lock();
+                defer self.client_lock.unlock();
+
+                try self.client.sendResourceRequest(temp_list.items);
+            }
+        },
+        .resource_header => |info| {
+            const entry = self.resources.getEntry(info.resource_id) orelse return error.UnknownResource;
+
+            // The hash was computed by the state machine while receiving.
+            if (info.data.len != entry.value_ptr.size or !std.mem.eql(u8, &info.hash, &entry.value_ptr.hash)) {
+                return error.InvalidHash;
+            }
+
+            // The state machine has received the resource into storage of the final size,
+            // so it's passed through to the user interface without another copy.
+            const data = blk: {
+                self.client_lock.lock();
+                defer self.client_lock.unlock();
+                break :blk self.client.takeResourceData().?;
+            };
+
+            try self.pushCommand(.{ .upload_resource = .{
+                .id = info.resource_id,
+                .kind = entry.value_ptr.kind,
+                .data = data,
+            } });
+        },
+        .message => |packet| {
+            self.received_messages += 1;
+
+            const command = self.decodeMessage(packet) catch |err| switch (err) {
+                error.OutOfMemory, error.Disconnected => |e| return e,
+                else => {
+                    logger.err("received invalid message: {s}", .{@errorName(err)});
+                    return error.InvalidMessage;
+                },
+            };
+            if (command) |cmd| {
+                try self.pushCommand(cmd);
             }
         },
     }
+
+    if (!self.is_established and self.isConnectionEstablished()) {
+        // we're done with doing handshake stuff,
+        // we're ready to go :)
+        self.is_established = true;
+        try self.pushCommand(.{ .status = .running });
+    }
 }
 
-fn decodeAndExecuteMessage(self: *Self, packet: []const u8) !void {
+fn sendConnectHeader(self: *Self) !void {
+    self.client_lock.lock();
+    defer self.client_lock.unlock();
+
+    try self.client.sendConnectHeader(
+        self.screen_size.width,
+        self.screen_size.height,
+        std.EnumSet(protocol.ClientCapabilities).init(.{
+            .mouse = true,
+            .keyboard = true,
+            .touch = true,
+            .highdpi = false,
+            .tiltable = false,
+            .resizable = true,
+            .req_accessibility = false,
+        }),
+    );
+}
+
+fn decodeMessage(self: *Self, packet: []const u8) !?Command {
     // logger.info("Received packet of {} bytes: {}", .{
     //     packet.len,
     //     std.fmt.fmtSliceHexUpper(packet),
@@ -327,7 +698,11 @@ fn decodeAndExecuteMessage(self: *Self, packet: []const u8) !void {
 
             const data = try decoder.readToEnd();
 
-            try self.user_interface.addOrReplaceResource(resource, kind, data);
+            return Command{ .upload_resource = .{
+                .id = resource,
+                .kind = kind,
+                .data = try self.allocator.dupe(u8, data),
+            } };
         },
 
         .addOrUpdateObject => { // (obj)
@@ -350,22 +725,22 @@ fn decodeAndExecuteMessage(self: *Self, packet: []const u8) !void {
                 try obj.addProperty(prop, value);
             }
 
-            try self.user_interface.addOrUpdateObject(obj);
+            return Command{ .add_or_update_object = obj };
         },
 
         .removeObject => { // (oid)
             const oid = @intToEnum(protocol.ObjectID, try decoder.readVarUInt());
-            self.user_interface.removeObject(oid);
+            return Command{ .remove_object = oid };
         },
 
         .setView => { // (rid)
             const rid = @intToEnum(protocol.ResourceID, try decoder.readVarUInt());
-            try self.user_interface.setView(rid);
+            return Command{ .set_view = rid };
         },
 
         .setRoot => { // (oid)
             const oid = @intToEnum(protocol.ObjectID, try decoder.readVarUInt());
-            try self.user_interface.setRoot(oid);
+            return Command{ .set_root = oid };
         },
 
         .setProperty => { // (oid, name, value)
@@ -375,25 +750,45 @@ fn decodeAndExecuteMessage(self: *Self, packet: []const u8) !void {
 
             const value_type = @intToEnum(protocol.Type, try decoder.readByte());
 
+            var value = try DunstblickUI.Value.deserialize(self.allocator, value_type, &decoder);
+
+            return Command{ .set_property = .{
+                .oid = oid,
+                .name = propName,
+                .value = value,
+            } };
+        },
+
+        .animateProperty => { // (oid, name, value, duration, easing, notify)
+            const oid = @intToEnum(protocol.ObjectID, try decoder.readVarUInt());
+            const propName = @intToEnum(protocol.PropertyName, try decoder.readVarUInt());
+            const value_type = @intToEnum(protocol.Type, try decoder.readByte());
+
             var value = try DunstblickUI.Value.deserialize(self.allocator, value_type, &decoder);
             errdefer value.deinit();
 
-            if (self.user_interface.getObject(oid)) |object| {
-                try object.setProperty(propName, value);
-            } else {
-                logger.err("object {} does not exist!", .{@enumToInt(oid)});
-            }
+            const duration = try decoder.readVarUInt();
+            const easing = @intToEnum(protocol.Easing, try decoder.readByte());
+            const notify = (try decoder.readByte()) != 0;
+
+            return Command{ .animate_property = .{
+                .oid = oid,
+                .name = propName,
+                .value = value,
+                .duration = @intToFloat(f32, duration) / std.time.ms_per_s,
+                .easing = easing,
+                .notify = notify,
+            } };
         },
 
         .clear => { // (oid, name)
             const oid = @intToEnum(protocol.ObjectID, try decoder.readVarUInt());
             const propName = @intToEnum(protocol.PropertyName, try decoder.readVarUInt());
 
-            if (self.user_interface.getObject(oid)) |object| {
-                try object.clear(propName);
-            } else {
-                logger.err("object {} does not exist!", .{@enumToInt(oid)});
-            }
+            return Command{ .clear = .{
+                .oid = oid,
+                .name = propName,
+            } };
         },
 
         .insertRange => { // (oid, name, index, count, oids …) // manipulate lists
@@ -402,20 +797,19 @@ fn decodeAndExecuteMessage(self: *Self, packet: []const u8) !void {
             const index = try decoder.readVarUInt();
             const count = try decoder.readVarUInt();
 
-            var refs = std.ArrayList(protocol.ObjectID).init(self.allocator);
-            defer refs.deinit();
-
-            try refs.resize(count);
+            const refs = try self.allocator.alloc(protocol.ObjectID, count);
+            errdefer self.allocator.free(refs);
 
-            for (refs.items) |*item| {
+            for (refs) |*item| {
                 item.* = @intToEnum(protocol.ObjectID, try decoder.readVarUInt());
             }
 
-            if (self.user_interface.getObject(oid)) |object| {
-                try object.insertRange(propName, index, refs.items);
-            } else {
-                logger.err("object {} does not exist!", .{@enumToInt(oid)});
-            }
+            return Command{ .insert_range = .{
+                .oid = oid,
+                .name = propName,
+                .index = index,
+                .items = refs,
+            } };
         },
 
         .removeRange => { // (oid, name, index, count) // manipulate lists
@@ -424,11 +818,12 @@ fn decodeAndExecuteMessage(self: *Self, packet: []const u8) !void {
             const index = try decoder.readVarUInt();
             const count = try decoder.readVarUInt();
 
-            if (self.user_interface.getObject(oid)) |object| {
-                try object.removeRange(propName, index, count);
-            } else {
-                logger.err("object {} does not exist!", .{@enumToInt(oid)});
-            }
+            return Command{ .remove_range = .{
+                .oid = oid,
+                .name = propName,
+                .index = index,
+                .count = count,
+            } };
         },
 
         .moveRange => { // (oid, name, indexFrom, indexTo, count) // manipulate lists
@@ -438,24 +833,123 @@ fn decodeAndExecuteMessage(self: *Self, packet: []const u8) !void {
             const indexTo = try decoder.readVarUInt();
             const count = try decoder.readVarUInt();
 
-            if (self.user_interface.getObject(oid)) |object| {
-                try object.moveRange(propName, indexFrom, indexTo, count);
-            } else {
-                logger.err("object {} does not exist!", .{@enumToInt(oid)});
-            }
+            return Command{ .move_range = .{
+                .oid = oid,
+                .name = propName,
+                .index_from = indexFrom,
+                .index_to = indexTo,
+                .count = count,
+            } };
         },
 
         .disconnect => {
-            const reason = try decoder.readString(self.arena.allocator());
-            self.disconnect(null);
-
-            self.instance.status = .{ .exited = reason };
+            self.exit_reason = try decoder.readString(self.arena.allocator());
+            return error.Disconnected;
         },
 
         else => {
             logger.warn("received message of unknown type: {}", .{
                 message_type,
             });
+            return null;
+        },
+    }
+}
+
+// UI thread:
+
+/// Executes a command received by the network thread and takes ownership of its payload.
+fn executeCommand(self: *Self, command: Command) !void {
+    switch (command) {
+        .status => |status| {
+            switch (status) {
+                .loading_resources => {
+                    self.instance.status = .{ .starting = "Loading resources..." };
+                    self.state = .protocol_connecting;
+                },
+                .running => {
+                    self.instance.status = .running;
+                    self.state = .connected;
+                },
+                .exited => |reason| {
+                    self.instance.status = .{ .exited = reason };
+                    self.state = .faulted;
+                },
+            }
+        },
+
+        .upload_resource => |res| {
+            try self.user_interface.addOrReplaceResourceOwned(res.id, res.kind, res.data);
+        },
+
+        .add_or_update_object => |const_obj| {
+            var obj = const_obj;
+            errdefer obj.deinit();
+            try self.user_interface.addOrUpdateObject(obj);
+        },
+
+        .remove_object => |oid| {
+            self.user_interface.removeObject(oid);
+        },
+
+        .set_view => |rid| {
+            try self.user_interface.setView(rid);
+        },
+
+        .set_root => |oid| {
+            try self.user_interface.setRoot(oid);
+        },
+
+        .set_property => |const_prop| {
+            var prop = const_prop;
+            errdefer prop.value.deinit();
+            if (self.user_interface.getObject(prop.oid)) |object| {
+                self.user_interface.cancelAnimation(prop.oid, prop.name);
+                try object.setProperty(prop.name, prop.value);
+            } else {
+                logger.err("object {} does not exist!", .{@enumToInt(prop.oid)});
+                prop.value.deinit();
+            }
+        },
+
+        .animate_property => |anim| {
+            self.user_interface.animateProperty(anim.oid, anim.name, anim.value, anim.duration, anim.easing, anim.notify) catch |err| switch (err) {
+                error.ObjectNotFound => logger.err("object {} does not exist!", .{@enumToInt(anim.oid)}),
+                else => |e| return e,
+            };
+        },
+
+        .clear => |prop| {
+            if (self.user_interface.getObject(prop.oid)) |object| {
+                try object.clear(prop.name);
+            } else {
+                logger.err("object {} does not exist!", .{@enumToInt(prop.oid)});
+            }
+        },
+
+        .insert_range => |range| {
+            defer self.allocator.free(range.items);
+            if (self.user_interface.getObject(range.oid)) |object| {
+                try object.insertRange(range.name, range.index, range.items);
+            } else {
+                logger.err("object {} does not exist!", .{@enumToInt(range.oid)});
+            }
+        },
+
+        .remove_range => |range| {
+            if (self.user_interface.getObject(range.oid)) |object| {
+                try object.removeRange(range.name, range.index, range.count);
+            } else {
+                logger.err("object {} does not exist!", .{@enumToInt(range.oid)});
+            }
+        },
+
+        .move_range => |range| {
+            if (self.user_interface.getObject(range.oid)) |object| {
+                try object.moveRange(range.name, range.index_from, range.index_to, range.count);
+            } else {
+                logger.err("object {} does not exist!", .{@enumToInt(range.oid)});
+            }
         },
     }
 }
@@ -483,7 +977,7 @@ fn triggerEvent(erased_self: *DunstblickUI.FeedbackInterface.ErasedSelf, event:
     buffer.writeID(@enumToInt(event)) catch |err| return mapEncodeError(err);
     buffer.writeID(@enumToInt(widget)) catch |err| return mapEncodeError(err);
 
-    self.client.sendMessage(stream.getWritten()) catch |err| return mapSendError(err);
+    try self.sendMessage(stream.getWritten());
 }
 
 fn triggerPropertyChanged(erased_self: *DunstblickUI.FeedbackInterface.ErasedSelf, oid: protocol.ObjectID, name: protocol.PropertyName, value: DunstblickUI.Value) DunstblickUI.FeedbackInterface.Error!void {
@@ -502,32 +996,98 @@ fn triggerPropertyChanged(erased_self: *DunstblickUI.FeedbackInterface.ErasedSel
     buffer.writeID(@enumToInt(name)) catch |err| return mapEncodeError(err);
     value.serialize(&buffer, true) catch |err| return mapEncodeError(err);
 
-    self.client.sendMessage(stream.getWritten()) catch |err| return mapSendError(err);
+    try self.sendMessage(stream.getWritten());
+}
+
+fn sendMessage(self: *Self, message: []const u8) DunstblickUI.FeedbackInterface.Error!void {
+    if (self.state != .connected)
+        return error.IoError;
+
+    self.client_lock.lock();
+    defer self.client_lock.unlock();
+
+    // the network thread is resuming the session, or hasn't sent the queued messages yet
+    if (!self.client.isConnectionEstablished() or self.pending_messages.items.len > 0) {
+        if (self.pending_size + message.len > max_pending_size)
+            return error.IoError;
+
+        const copy = try self.allocator.dupe(u8, message);
+        errdefer self.allocator.free(copy);
+        try self.pending_messages.append(self.allocator, copy);
+        self.pending_size += copy.len;
+        return;
+    }
+
+    self.client.sendMessage(message) catch |err| return mapSendError(err);
+}
+
+/// Sends the messages that were queued while the session resumed. Called by the network thread.
+fn sendPendingMessages(self: *Self) !void {
+    self.client_lock.lock();
+    defer self.client_lock.unlock();
+
+    while (self.pending_messages.items.len > 0) {
+        const message = self.pending_messages.items[0];
+        try self.client.sendMessage(message);
+        _ = self.pending_messages.orderedRemove(0);
+        self.pending_size -= message.len;
+        self.allocator.free(message);
+    }
+}
+
+/// Requires `client_lock` to be held.
+fn clearPendingMessages(self: *Self) void {
+    for (self.pending_messages.items) |message| {
+        self.allocator.free(message);
+    }
+    self.pending_messages.clearRetainingCapacity();
+    self.pending_size = 0;
 }
 
 pub fn update(self: *Self, dt: f32) !void {
-    _ = dt;
-    switch (self.state) {
-        .unconnected => {
-            // make socket non-blocking for connect
+    if (self.state == .connected and self.user_interface.isAnimating()) {
+        try self.user_interface.updateAnimations(dt);
+        self.instance.invalidate();
+    }
 
-        },
-        .socket_connecting => {
-            // wait for the callback
-        },
-        .protocol_connecting => {
-            // we're waiting for the connection
-        },
-        .connected => {
-            // try self.user_interface.update(dt);
-            // we're done now :)
-        },
-        .faulted => {},
+    const start = std.time.nanoTimestamp();
+    while (self.commands.pop()) |node| {
+        defer self.destroyCommandNode(node);
+
+        if (self.state == .faulted) {
+            // the connection is gone, just drop everything that is still in flight
+            node.data.deinit(self.allocator);
+            continue;
+        }
+
+        self.executeCommand(node.data) catch |err| {
+            logger.err("failed to execute command: {s}", .{@errorName(err)});
+            self.disconnect(null);
+            self.instance.status = .{ .exited = "protocol violation: received invalid message" };
+        };
+
+        // remaining commands are executed in the next frames, so a burst
+        // of updates doesn't drop frames
+        if (std.time.nanoTimestamp() - start >= self.instance.update_budget)
+            break;
+    }
+
+    if (!self.commands.isEmpty()) {
+        // continue with the remaining commands in the next frame
+        self.instance.invalidate();
     }
+
+    // property animations are advanced every frame until they are finished
+    self.instance.continuous_redraw = self.user_interface.isAnimating();
+
+    try self.user_interface.trimMemory(self.instance.cache_budget, self.instance.is_visible);
+    self.instance.memory_usage = self.user_interface.getMemoryUsage();
 }
 
 pub fn resize(self: *Self, size: Size) !void {
-    //
+    self.client_lock.lock();
+    defer self.client_lock.unlock();
+
     self.screen_size = size;
 }
 
@@ -571,23 +1131,17 @@ pub fn processUserInterface(self: *Self, rectangle: zero_graphics.Rectangle, ui:
     // }
 }
 
+/// Stops the network thread. The socket is closed in `deinit()` when the thread has finished.
 fn disconnect(self: *Self, quit_message: ?[]const u8) void {
-    if (self.socket) |*sock| {
-        if (self.client.isConnectionEstablished()) {
-            if (quit_message) |msg| {
-                // TODO: Send proper quit message
-                self.client.sendMessage(msg) catch {};
-            }
+    if (self.state == .connected) {
+        if (quit_message) |msg| {
+            // TODO: Send proper quit message
+            self.sendMessage(msg) catch {};
         }
-
-        self.client.deinit();
-
-        self.discovery.socket_set.remove(sock.*);
-
-        sock.close();
-        self.state = .faulted;
     }
-    self.socket = null;
+
+    self.shutdown_requested.store(true, .Release);
+    self.state = .faulted;
 }
 
 pub fn close(self: *Self) void {
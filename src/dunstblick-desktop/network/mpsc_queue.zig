@@ -0,0 +1,151 @@
+//! A lock-free, intrusive multi-producer/single-consumer queue.
+//!
+//! Producers never block and never allocate, the nodes are owned by the caller.
+//! This is the queue design by Dmitry Vyukov: `push` is a single atomic exchange,
+//! `pop` may only be called by one consumer at a time.
+
+const std = @import("std");
+
+pub fn MpscQueue(comptime T: type) type {
+    return struct {
+        const Self = @This();
+
+        pub const Node = struct {
+            next: ?*Node = null,
+            data: T,
+        };
+
+        /// The most recently pushed node. Only written by producers.
+        head: *Node,
+
+        /// The next node to be popped. Only accessed by the consumer.
+        tail: *Node,
+
+        stub: Node,
+
+        /// Initializes the queue in-place, as it references its own stub node.
+        pub fn init(self: *Self) void {
+            self.* = Self{
+                .head = undefined,
+                .tail = undefined,
+                .stub = Node{ .data = undefined },
+            };
+            self.head = &self.stub;
+            self.tail = &self.stub;
+        }
+
+        /// Appends `node` to the queue. Can be called from any thread.
+        pub fn push(self: *Self, node: *Node) void {
+            @atomicStore(?*Node, &node.next, null, .Monotonic);
+            const prev = @atomicRmw(*Node, &self.head, .Xchg, node, .AcqRel);
+            @atomicStore(?*Node, &prev.next, node, .Release);
+        }
+
+        /// Removes the oldest node from the queue. Returns `null` if the queue is empty
+        /// or a producer is in the middle of a `push`. May only be called from the consumer thread.
+        pub fn pop(self: *Self) ?*Node {
+            var tail = self.tail;
+            var next = @atomicLoad(?*Node, &tail.next, .Acquire);
+
+            if (tail == &self.stub) {
+                tail = next orelse return null;
+                self.tail = tail;
+                next = @atomicLoad(?*Node, &tail.next, .Acquire);
+            }
+
+            if (next) |node| {
+                self.tail = node;
+                return tail;
+            }
+
+            const head = @atomicLoad(*Node, &self.head, .Acquire);
+            if (tail != head) {
+                // a producer has swapped the head, but not yet linked its node
+                return null;
+            }
+
+            // `tail` is the last node, requeue the stub so `tail` can be unlinked
+            self.push(&self.stub);
+
+            next = @atomicLoad(?*Node, &tail.next, .Acquire);
+            if (next) |node| {
+                self.tail = node;
+                return tail;
+            }
+            return null;
+        }
+
+        /// Returns `true` if the queue contains no nodes. May only be called from the consumer thread.
+        pub fn isEmpty(self: *Self) bool {
+            return (self.tail == &self.stub) and (@atomicLoad(?*Node, &self.stub.next, .Acquire) == null);
+        }
+    };
+}
+
+test "MpscQueue keeps insertion order" {
+    const Queue = MpscQueue(u32);
+
+    var queue: Queue = undefined;
+    queue.init();
+
+    try std.testing.expect(queue.isEmpty());
+    try std.testing.expect(queue.pop() == null);
+
+    var nodes: [4]Queue.Node = undefined;
+    for (nodes) |*node, i| {
+        node.* = .{ .data = @intCast(u32, i) };
+        queue.push(node);
+    }
+
+    try std.testing.expect(!queue.isEmpty());
+
+    for (nodes) |*node| {
+        try std.testing.expectEqual(node, queue.pop().?);
+    }
+
+    try std.testing.expect(queue.pop() == null);
+    try std.testing.expect(queue.isEmpty());
+
+    queue.push(&nodes[0]);
+    try std.testing.expectEqual(&nodes[0], queue.pop().?);
+}
+
+test "MpscQueue with concurrent producers" {
+    const Queue = MpscQueue(usize);
+    const per_thread = 1000;
+    const thread_count = 4;
+
+    var queue: Queue = undefined;
+    queue.init();
+
+    var nodes: [thread_count][per_thread]Queue.Node = undefined;
+
+    const Producer = struct {
+        fn run(q: *Queue, list: *[per_thread]Queue.Node) void {
+            for (list) |*node, i| {
+                node.* = .{ .data = i };
+                q.push(node);
+            }
+        }
+    };
+
+    var threads: [thread_count]std.Thread = undefined;
+    for (threads) |*thread, i| {
+        thread.* = try std.Thread.spawn(.{}, Producer.run, .{ &queue, &nodes[i] });
+    }
+
+    var received: usize = 0;
+    while (received < thread_count * per_thread) {
+        if (queue.pop() != null) {
+            received += 1;
+        } else {
+            std.Thread.yield() catch {};
+        }
+    }
+
+    for (threads) |thread| {
+        thread.join();
+    }
+
+    try std.testing.expect(queue.pop() == null);
+}
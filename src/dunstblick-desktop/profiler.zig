@@ -0,0 +1,447 @@
+//! Frame profiler of the desktop client.
+//!
+//! Frame phases are measured with scoped zones:
+//!
+//!     const zone = profiler.begin(.layout, null);
+//!     defer zone.end();
+//!
+//! Zones with a label (the display name of an application) are also accumulated
+//! per application, so a slow frame can be attributed to a phase *and* an app.
+//! The most recent zones are kept in a ring buffer and can be exported in the
+//! Chrome trace event format (open with chrome://tracing or https://ui.perfetto.dev).
+//!
+//! Zones may be recorded from any thread, but frame statistics are only collected
+//! for the thread that called `init()`.
+
+const std = @import("std");
+
+const logger = std.log.scoped(.profiler);
+
+pub const Phase = enum {
+    /// A whole frame, from the start of `update()` to the end of `render()`.
+    frame,
+    /// Time slept in an idle frame while waiting for network events.
+    idle,
+    /// Pumping the network connections of app discovery and all applications.
+    network,
+    /// Uploading finished rasterizations to the GPU.
+    raster_cache,
+    /// Building the user interface of the home screen, including all applications.
+    home_screen_update,
+    /// Recording the draw commands of the home screen.
+    home_screen_render,
+    /// Submitting the recorded draw commands to the GPU.
+    render_submit,
+    /// Rasterizing the recorded draw commands on the CPU (headless mode).
+    rasterize,
+    /// Copying the rasterized frame to the display (headless mode).
+    present,
+
+    // Per-application phases, labelled with the application name:
+    app_update,
+    app_ui,
+    app_render,
+
+    // Phases of a dunstblick view, nested into `app_ui`:
+    update_bindings,
+    update_wanted_size,
+    layout,
+    process_user_interface,
+};
+
+pub const phase_count = @typeInfo(Phase).Enum.fields.len;
+
+/// Number of frames kept for the statistics.
+pub const history_length = 120;
+
+/// Number of applications that are tracked at the same time.
+pub const max_apps = 16;
+
+/// Number of zones kept for the trace export.
+const event_capacity = 1 << 14;
+
+pub const FrameStats = struct {
+    duration: u64 = 0,
+    idle: bool = false,
+    phases: [phase_count]u64 = [1]u64{0} ** phase_count,
+
+    pub fn get(self: FrameStats, phase: Phase) u64 {
+        return self.phases[@enumToInt(phase)];
+    }
+
+    /// Returns the frame time without the time slept in idle frames.
+    pub fn busyTime(self: FrameStats) u64 {
+        return self.duration -| self.get(.idle);
+    }
+};
+
+pub const AppStats = struct {
+    name: []const u8,
+    /// Time spent in the last frame that rebuilt the user interface.
+    last: u64 = 0,
+    /// Exponential moving average of `last`.
+    average: f64 = 0,
+    /// Time accumulated in the current frame.
+    current: u64 = 0,
+    /// Index of the last frame the application was seen in.
+    last_seen: u64 = 0,
+};
+
+pub const Summary = struct {
+    /// Number of frames in the history that rebuilt the user interface.
+    active_frames: usize = 0,
+    /// Number of frames in the history that replayed the previous frame.
+    idle_frames: usize = 0,
+    average_busy: u64 = 0,
+    max_busy: u64 = 0,
+    /// Average time per phase over the active frames.
+    phases: [phase_count]u64 = [1]u64{0} ** phase_count,
+
+    pub fn get(self: Summary, phase: Phase) u64 {
+        return self.phases[@enumToInt(phase)];
+    }
+};
+
+const Event = struct {
+    phase: Phase,
+    label: ?[]const u8,
+    thread: std.Thread.Id,
+    start: u64,
+    duration: u64,
+};
+
+const State = struct {
+    allocator: std.mem.Allocator,
+    timer: std.time.Timer,
+    main_thread: std.Thread.Id,
+
+    mutex: std.Thread.Mutex = .{},
+
+    /// Interned zone labels. They are never freed before `deinit()`, so events
+    /// stay valid even after the application is gone.
+    labels: std.StringHashMapUnmanaged(void) = .{},
+
+    events: []Event,
+    event_head: usize = 0,
+    event_count: usize = 0,
+
+    frame_index: u64 = 0,
+    frame_start: u64 = 0,
+    current: FrameStats = .{},
+    history: [history_length]FrameStats = [1]FrameStats{.{}} ** history_length,
+
+    apps: std.BoundedArray(AppStats, max_apps) = .{},
+};
+
+var state: ?State = null;
+
+pub fn init(allocator: std.mem.Allocator) !void {
+    std.debug.assert(state == null);
+
+    const events = try allocator.alloc(Event, event_capacity);
+    errdefer allocator.free(events);
+
+    state = State{
+        .allocator = allocator,
+        .timer = try std.time.Timer.start(),
+        .main_thread = std.Thread.getCurrentId(),
+        .events = events,
+    };
+}
+
+pub fn deinit() void {
+    const s = if (state) |*s| s else return;
+
+    var iter = s.labels.keyIterator();
+    while (iter.next()) |label| {
+        s.allocator.free(label.*);
+    }
+    s.labels.deinit(s.allocator);
+    s.allocator.free(s.events);
+
+    state = null;
+}
+
+pub const Zone = struct {
+    phase: Phase,
+    label: ?[]const u8,
+    start: u64,
+
+    pub fn end(self: Zone) void {
+        if (state) |*s| {
+            const now = s.timer.read();
+
+            s.mutex.lock();
+            defer s.mutex.unlock();
+
+            record(s, self.phase, self.label, self.start, now -| self.start);
+        }
+    }
+};
+
+/// Starts a new zone. `label` is copied, so it may be freed before the zone ends.
+pub fn begin(phase: Phase, label: ?[]const u8) Zone {
+    const s = if (state) |*s| s else return Zone{ .phase = phase, .label = null, .start = 0 };
+
+    const interned = if (label) |text| blk: {
+        s.mutex.lock();
+        defer s.mutex.unlock();
+        break :blk intern(s, text);
+    } else null;
+
+    return Zone{
+        .phase = phase,
+        .label = interned,
+        .start = s.timer.read(),
+    };
+}
+
+fn intern(s: *State, text: []const u8) ?[]const u8 {
+    const gop = s.labels.getOrPut(s.allocator, text) catch return null;
+    if (!gop.found_existing) {
+        gop.key_ptr.* = s.allocator.dupe(u8, text) catch {
+            s.labels.removeByPtr(gop.key_ptr);
+            return null;
+        };
+    }
+    return gop.key_ptr.*;
+}
+
+fn record(s: *State, phase: Phase, label: ?[]const u8, start: u64, duration: u64) void {
+    const thread = std.Thread.getCurrentId();
+
+    s.events[s.event_head] = Event{
+        .phase = phase,
+        .label = label,
+        .thread = thread,
+        .start = start,
+        .duration = duration,
+    };
+    s.event_head = (s.event_head + 1) % s.events.len;
+    s.event_count = std.math.min(s.event_count + 1, s.events.len);
+
+    if (thread != s.main_thread)
+        return;
+
+    s.current.phases[@enumToInt(phase)] += duration;
+
+    if (label) |name| {
+        const app = for (s.apps.slice()) |*app| {
+            if (app.name.ptr == name.ptr)
+                break app;
+        } else blk: {
+            if (s.apps.len == max_apps) {
+                // forget the application that wasn't seen for the longest time
+                var oldest: usize = 0;
+                for (s.apps.slice()) |app, i| {
+                    if (app.last_seen < s.apps.get(oldest).last_seen)
+                        oldest = i;
+                }
+                _ = s.apps.swapRemove(oldest);
+            }
+            s.apps.appendAssumeCapacity(AppStats{ .name = name });
+            break :blk &s.apps.slice()[s.apps.len - 1];
+        };
+        app.current += duration;
+        app.last_seen = s.frame_index;
+    }
+}
+
+/// Marks the start of a new frame.
+pub fn beginFrame() void {
+    const s = if (state) |*s| s else return;
+
+    const now = s.timer.read();
+
+    s.mutex.lock();
+    defer s.mutex.unlock();
+
+    s.frame_start = now;
+    s.current = .{};
+}
+
+/// Marks the end of the current frame. `idle` is set when the frame only replayed
+/// the draw commands of the previous one.
+pub fn endFrame(idle: bool) void {
+    const s = if (state) |*s| s else return;
+
+    const now = s.timer.read();
+
+    s.mutex.lock();
+    defer s.mutex.unlock();
+
+    record(s, .frame, null, s.frame_start, now -| s.frame_start);
+
+    s.current.duration = now -| s.frame_start;
+    s.current.idle = idle;
+    s.history[s.frame_index % history_length] = s.current;
+
+    if (!idle) {
+        for (s.apps.slice()) |*app| {
+            app.last = app.current;
+            app.average = if (app.average == 0)
+                @intToFloat(f64, app.last)
+            else
+                0.9 * app.average + 0.1 * @intToFloat(f64, app.last);
+            app.current = 0;
+        }
+    }
+
+    // Drop applications that didn't show up for a whole history
+    var i: usize = 0;
+    while (i < s.apps.len) {
+        if (s.frame_index - s.apps.get(i).last_seen > history_length) {
+            _ = s.apps.swapRemove(i);
+        } else {
+            i += 1;
+        }
+    }
+
+    s.frame_index += 1;
+}
+
+/// Returns the statistics of the last finished frame.
+pub fn lastFrame() FrameStats {
+    const s = if (state) |*s| s else return FrameStats{};
+
+    s.mutex.lock();
+    defer s.mutex.unlock();
+
+    if (s.frame_index == 0)
+        return FrameStats{};
+    return s.history[(s.frame_index - 1) % history_length];
+}
+
+/// Returns the statistics over the recorded frame history.
+pub fn summarize() Summary {
+    var summary = Summary{};
+    const s = if (state) |*s| s else return summary;
+
+    s.mutex.lock();
+    defer s.mutex.unlock();
+
+    const frame_count = std.math.min(s.frame_index, history_length);
+
+    var busy_sum: u64 = 0;
+    for (s.history[0..frame_count]) |frame| {
+        if (frame.idle) {
+            summary.idle_frames += 1;
+            continue;
+        }
+        summary.active_frames += 1;
+        busy_sum += frame.busyTime();
+        summary.max_busy = std.math.max(summary.max_busy, frame.busyTime());
+        for (frame.phases) |duration, i| {
+            summary.phases[i] += duration;
+        }
+    }
+
+    if (summary.active_frames > 0) {
+        summary.average_busy = busy_sum / summary.active_frames;
+        for (summary.phases) |*duration| {
+            duration.* /= summary.active_frames;
+        }
+    }
+
+    return summary;
+}
+
+/// Returns the per-application statistics. Must only be called from the thread that called `init()`,
+/// the returned slice is invalidated by the next call to `endFrame()`.
+pub fn appStats() []const AppStats {
+    const s = if (state) |*s| s else return &[_]AppStats{};
+    return s.apps.constSlice();
+}
+
+/// Writes all recorded zones as a Chrome trace event file.
+pub fn writeTrace(writer: anytype) !void {
+    const s = if (state) |*s| s else return error.ProfilerNotInitialized;
+
+    s.mutex.lock();
+    defer s.mutex.unlock();
+
+    try writer.writeAll("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    const first = (s.event_head + s.events.len - s.event_count) % s.events.len;
+
+    var i: usize = 0;
+    while (i < s.event_count) : (i += 1) {
+        const event = s.events[(first + i) % s.events.len];
+
+        var name_buf: [256]u8 = undefined;
+        const name = if (event.label) |label|
+            std.fmt.bufPrint(&name_buf, "{s} ({s})", .{ @tagName(event.phase), label }) catch @tagName(event.phase)
+        else
+            @tagName(event.phase);
+
+        if (i > 0) try writer.writeAll(",\n");
+        try writer.writeAll("{\"name\":");
+        try std.json.stringify(name, .{}, writer);
+        // timestamps are in microseconds
+        try writer.print(",\"cat\":\"{s}\",\"ph\":\"X\",\"pid\":1,\"tid\":{d},\"ts\":{d}.{d:0>3},\"dur\":{d}.{d:0>3}", .{
+            if (event.label != null) "app" else "desktop",
+            event.thread,
+            event.start / std.time.ns_per_us,
+            event.start % std.time.ns_per_us,
+            event.duration / std.time.ns_per_us,
+            event.duration % std.time.ns_per_us,
+        });
+        if (event.label) |label| {
+            try writer.writeAll(",\"args\":{\"app\":");
+            try std.json.stringify(label, .{}, writer);
+            try writer.writeAll("}");
+        }
+        try writer.writeAll("}");
+    }
+
+    try writer.writeAll("\n]}\n");
+}
+
+/// Exports all recorded zones into `dir`. The file name contains the current time
+/// stamp and is written into `name_buf`.
+pub fn exportTrace(dir: std.fs.Dir, name_buf: []u8) ![]const u8 {
+    const file_name = try std.fmt.bufPrint(name_buf, "trace-{d}.json", .{std.time.timestamp()});
+
+    var atomic_file = try dir.atomicFile(file_name, .{});
+    defer atomic_file.deinit();
+
+    var buffered_writer = std.io.bufferedWriter(atomic_file.file.writer());
+    try writeTrace(buffered_writer.writer());
+    try buffered_writer.flush();
+
+    try atomic_file.finish();
+
+    logger.info("exported trace to {s}", .{file_name});
+
+    return file_name;
+}
+
+test "zones are attributed to phases and applications" {
+    try init(std.testing.allocator);
+    defer deinit();
+
+    beginFrame();
+    {
+        const outer = begin(.app_ui, "Calculator");
+        defer outer.end();
+
+        const inner = begin(.layout, null);
+        inner.end();
+    }
+    endFrame(false);
+
+    const apps = appStats();
+    try std.testing.expectEqual(@as(usize, 1), apps.len);
+    try std.testing.expectEqualStrings("Calculator", apps[0].name);
+
+    const summary = summarize();
+    try std.testing.expectEqual(@as(usize, 1), summary.active_frames);
+    try std.testing.expect(summary.get(.app_ui) >= summary.get(.layout));
+
+    var buffer = std.ArrayList(u8).init(std.testing.allocator);
+    defer buffer.deinit();
+
+    try writeTrace(buffer.writer());
+    try std.testing.expect(std.mem.indexOf(u8, buffer.items, "\"layout\"") != null);
+    try std.testing.expect(std.mem.indexOf(u8, buffer.items, "\"app_ui (Calculator)\"") != null);
+}
@@ -0,0 +1,604 @@
+//! Encoder and decoder for dunstblick bitmap resources.
+//!
+//! Bitmaps are transferred as QOI images (https://qoiformat.org/). The encoder
+//! in this file can additionally emit *restart points*: every `segment_pixels` pixels,
+//! the stream is encoded so it doesn't depend on anything that was decoded before
+//! (no run crosses the boundary, the first pixel is a literal and no index entry from
+//! the previous segment is referenced). The byte offsets of these points are appended
+//! behind the QOI end marker.
+//!
+//! The result is still a valid QOI stream. Decoders that don't know about the trailer
+//! will ignore it, while `decode` uses it to decode the segments in parallel.
+//!
+//! Trailer layout (all integers big endian):
+//! - `"qidx"`
+//! - `segment_pixels: u32`
+//! - `segment_count` times `offset: u32` (byte offset of the segment in the file)
+//! - `segment_count: u32`
+
+const std = @import("std");
+
+pub const Color = extern struct {
+    r: u8,
+    g: u8,
+    b: u8,
+    a: u8,
+
+    fn hash(c: Color) u6 {
+        return @truncate(u6, @as(usize, c.r) *% 3 +% @as(usize, c.g) *% 5 +% @as(usize, c.b) *% 7 +% @as(usize, c.a) *% 11);
+    }
+
+    fn eql(a: Color, b: Color) bool {
+        return @bitCast(u32, a) == @bitCast(u32, b);
+    }
+};
+
+comptime {
+    std.debug.assert(@sizeOf(Color) == 4);
+}
+
+pub const Image = struct {
+    width: u32,
+    height: u32,
+    pixels: []Color,
+
+    pub fn deinit(self: *Image, allocator: std.mem.Allocator) void {
+        allocator.free(self.pixels);
+        self.* = undefined;
+    }
+};
+
+pub const ConstImage = struct {
+    width: u32,
+    height: u32,
+    pixels: []const Color,
+};
+
+pub const DecodeError = error{ OutOfMemory, InvalidData, ImageTooLarge };
+
+pub const DecodeOptions = struct {
+    /// When set, the rows of the image are stored bottom-up.
+    flip_y: bool = false,
+
+    /// Maximum number of threads used for decoding. `null` uses the number of CPUs.
+    /// Only streams with restart points can be decoded in parallel.
+    max_threads: ?usize = null,
+
+    /// Images with less pixels than this are always decoded on the calling thread,
+    /// as spawning threads is more expensive than decoding them.
+    parallel_threshold: usize = 256 * 1024,
+};
+
+pub const EncodeOptions = struct {
+    /// Distance between two restart points in pixels. `null` emits a plain QOI file.
+    segment_pixels: ?u32 = default_segment_pixels,
+};
+
+/// Restart point distance used by the SDK. 64k pixels split a 4K image into ~127 segments,
+/// while the index only adds 4 byte per segment.
+pub const default_segment_pixels: u32 = 65536;
+
+const magic = "qoif".*;
+const index_magic = "qidx".*;
+const header_size = 14;
+const end_marker = [8]u8{ 0, 0, 0, 0, 0, 0, 0, 1 };
+
+const op_index: u8 = 0x00;
+const op_diff: u8 = 0x40;
+const op_luma: u8 = 0x80;
+const op_run: u8 = 0xC0;
+const op_rgb: u8 = 0xFE;
+const op_rgba: u8 = 0xFF;
+
+const start_color = Color{ .r = 0, .g = 0, .b = 0, .a = 255 };
+
+const Header = struct {
+    width: u32,
+    height: u32,
+    channels: u8,
+};
+
+fn readHeader(data: []const u8) DecodeError!Header {
+    if (data.len < header_size + end_marker.len)
+        return error.InvalidData;
+    if (!std.mem.eql(u8, data[0..4], &magic))
+        return error.InvalidData;
+    const header = Header{
+        .width = std.mem.readIntBig(u32, data[4..8]),
+        .height = std.mem.readIntBig(u32, data[8..12]),
+        .channels = data[12],
+    };
+    if (header.channels != 3 and header.channels != 4)
+        return error.InvalidData;
+    if (header.width == 0 or header.height == 0)
+        return error.InvalidData;
+    return header;
+}
+
+/// A segment of the stream that can be decoded independently.
+const Segment = struct {
+    /// Encoded chunks of the segment. Might contain trailing data of the next segments.
+    chunks: []const u8,
+    /// Output pixels of the segment.
+    pixels: []Color,
+};
+
+/// Returns `true` if `data` contains restart points that allow parallel decoding.
+pub fn hasRestartIndex(data: []const u8) bool {
+    return (findIndex(data) catch null) != null;
+}
+
+const RestartIndex = struct {
+    segment_pixels: u32,
+    offsets: []const u8, // big endian u32 array
+    chunks_end: usize,
+
+    fn count(self: RestartIndex) usize {
+        return self.offsets.len / 4;
+    }
+
+    fn offset(self: RestartIndex, i: usize) usize {
+        return std.mem.readIntBig(u32, self.offsets[4 * i ..][0..4]);
+    }
+};
+
+/// Searches the trailer behind the end marker. The trailer is located from the back of the
+/// file, as the end marker can't be found by scanning forward through the chunk data.
+fn findIndex(data: []const u8) DecodeError!?RestartIndex {
+    const header = try readHeader(data);
+    const pixel_count = @as(u64, header.width) * header.height;
+
+    if (data.len < header_size + end_marker.len + 12)
+        return null;
+
+    const count = std.mem.readIntBig(u32, data[data.len - 4 ..][0..4]);
+    const trailer_size = 12 + 4 * @as(u64, count);
+    if (trailer_size + header_size + end_marker.len > data.len)
+        return null;
+
+    const trailer = data[data.len - @intCast(usize, trailer_size) ..];
+    if (!std.mem.eql(u8, trailer[0..4], &index_magic))
+        return null;
+
+    const chunks_end = data.len - @intCast(usize, trailer_size) - end_marker.len;
+    if (!std.mem.eql(u8, data[chunks_end..][0..end_marker.len], &end_marker))
+        return null;
+
+    const index = RestartIndex{
+        .segment_pixels = std.mem.readIntBig(u32, trailer[4..8]),
+        .offsets = trailer[8 .. trailer.len - 4],
+        .chunks_end = chunks_end,
+    };
+    if (index.segment_pixels == 0)
+        return error.InvalidData;
+    if (index.count() != std.math.divCeil(u64, pixel_count, index.segment_pixels) catch unreachable)
+        return error.InvalidData;
+
+    var previous: usize = header_size;
+    var s: usize = 0;
+    while (s < index.count()) : (s += 1) {
+        const off = index.offset(s);
+        if (off < previous or off > chunks_end)
+            return error.InvalidData;
+        previous = off;
+    }
+    if (index.offset(0) != header_size)
+        return error.InvalidData;
+
+    return index;
+}
+
+/// Decodes a QOI bitmap into RGBA pixels. Streams with restart points are decoded in parallel.
+/// Memory is owned by the caller and must be freed with `Image.deinit`.
+pub fn decode(allocator: std.mem.Allocator, data: []const u8, options: DecodeOptions) DecodeError!Image {
+    const header = try readHeader(data);
+
+    const pixel_count = std.math.mul(usize, header.width, header.height) catch return error.ImageTooLarge;
+
+    const pixels = try allocator.alloc(Color, pixel_count);
+    errdefer allocator.free(pixels);
+
+    const index = try findIndex(data);
+
+    const thread_count = if (index != null and pixel_count >= options.parallel_threshold)
+        std.math.min(
+            options.max_threads orelse (std.Thread.getCpuCount() catch 1),
+            index.?.count(),
+        )
+    else
+        1;
+
+    if (thread_count <= 1) {
+        const chunks_end = if (index) |idx| idx.chunks_end else data.len;
+        try decodeSegment(Segment{
+            .chunks = data[header_size..chunks_end],
+            .pixels = pixels,
+        });
+    } else {
+        try decodeParallel(data, index.?, pixels, thread_count);
+    }
+
+    if (options.flip_y) {
+        flipRows(pixels, header.width, header.height);
+    }
+
+    return Image{
+        .width = header.width,
+        .height = header.height,
+        .pixels = pixels,
+    };
+}
+
+/// Decodes the image in a single pass on the calling thread, ignoring the restart index.
+pub fn decodeSequential(allocator: std.mem.Allocator, data: []const u8) DecodeError!Image {
+    return decode(allocator, data, .{ .max_threads = 1 });
+}
+
+const Worker = struct {
+    data: []const u8,
+    index: RestartIndex,
+    pixels: []Color,
+    first_segment: usize,
+    end_segment: usize,
+    result: DecodeError!void = {},
+
+    fn run(worker: *Worker) void {
+        worker.result = worker.decodeRange();
+    }
+
+    fn decodeRange(worker: Worker) DecodeError!void {
+        var s = worker.first_segment;
+        while (s < worker.end_segment) : (s += 1) {
+            const pixel_start = s * worker.index.segment_pixels;
+            const pixel_end = std.math.min(pixel_start + worker.index.segment_pixels, worker.pixels.len);
+            const chunk_end = if (s + 1 < worker.index.count())
+                worker.index.offset(s + 1)
+            else
+                worker.index.chunks_end;
+            try decodeSegment(Segment{
+                .chunks = worker.data[worker.index.offset(s)..chunk_end],
+                .pixels = worker.pixels[pixel_start..pixel_end],
+            });
+        }
+    }
+};
+
+fn decodeParallel(data: []const u8, index: RestartIndex, pixels: []Color, thread_count: usize) DecodeError!void {
+    std.debug.assert(thread_count > 1);
+
+    var workers_buffer: [64]Worker = undefined;
+    var threads_buffer: [64]std.Thread = undefined;
+
+    const worker_count = std.math.min(thread_count, workers_buffer.len);
+    const workers = workers_buffer[0..worker_count];
+    const segment_count = index.count();
+
+    for (workers) |*worker, i| {
+        worker.* = Worker{
+            .data = data,
+            .index = index,
+            .pixels = pixels,
+            .first_segment = (segment_count * i) / worker_count,
+            .end_segment = (segment_count * (i + 1)) / worker_count,
+        };
+    }
+
+    // The calling thread decodes the first range itself, all others are spawned.
+    var spawned: usize = 0;
+    for (workers[1..]) |*worker| {
+        threads_buffer[spawned] = std.Thread.spawn(.{}, Worker.run, .{worker}) catch {
+            // no more threads available, decode the range synchronously
+            worker.run();
+            continue;
+        };
+        spawned += 1;
+    }
+
+    workers[0].run();
+
+    for (threads_buffer[0..spawned]) |thread| {
+        thread.join();
+    }
+
+    for (workers) |worker| {
+        try worker.result;
+    }
+}
+
+/// Vector width used for the output stage.
+const lane_count = 8;
+const PixelVector = @Vector(lane_count, u32);
+
+/// Writes `count` copies of `color` to `dest`. Long runs are written with vector stores.
+inline fn fillRun(dest: []Color, color: Color) void {
+    const words = std.mem.bytesAsSlice(u32, std.mem.sliceAsBytes(dest));
+    const value = @bitCast(u32, color);
+    const splat = @splat(lane_count, value);
+
+    var i: usize = 0;
+    while (i + lane_count <= words.len) : (i += lane_count) {
+        words[i..][0..lane_count].* = splat;
+    }
+    while (i < words.len) : (i += 1) {
+        words[i] = value;
+    }
+}
+
+/// Swaps the rows of the image in place, moving `lane_count` pixels per step.
+fn flipRows(pixels: []Color, width: u32, height: u32) void {
+    const words = std.mem.bytesAsSlice(u32, std.mem.sliceAsBytes(pixels));
+    var top: usize = 0;
+    var bottom: usize = height - 1;
+    while (top < bottom) : ({
+        top += 1;
+        bottom -= 1;
+    }) {
+        const a = words[width * top ..][0..width];
+        const b = words[width * bottom ..][0..width];
+
+        var x: usize = 0;
+        while (x + lane_count <= width) : (x += lane_count) {
+            const va: PixelVector = a[x..][0..lane_count].*;
+            const vb: PixelVector = b[x..][0..lane_count].*;
+            a[x..][0..lane_count].* = vb;
+            b[x..][0..lane_count].* = va;
+        }
+        while (x < width) : (x += 1) {
+            std.mem.swap(u32, &a[x], &b[x]);
+        }
+    }
+}
+
+fn decodeSegment(segment: Segment) DecodeError!void {
+    const chunks = segment.chunks;
+    const pixels = segment.pixels;
+
+    var index = std.mem.zeroes([64]Color);
+    var current = start_color;
+
+    var p: usize = 0;
+    var i: usize = 0;
+    while (i < pixels.len) {
+        if (p >= chunks.len)
+            return error.InvalidData;
+        const b1 = chunks[p];
+        p += 1;
+
+        if (b1 == op_rgb) {
+            if (p + 3 > chunks.len) return error.InvalidData;
+            current.r = chunks[p + 0];
+            current.g = chunks[p + 1];
+            current.b = chunks[p + 2];
+            p += 3;
+        } else if (b1 == op_rgba) {
+            if (p + 4 > chunks.len) return error.InvalidData;
+            current = Color{
+                .r = chunks[p + 0],
+                .g = chunks[p + 1],
+                .b = chunks[p + 2],
+                .a = chunks[p + 3],
+            };
+            p += 4;
+        } else switch (b1 & 0xC0) {
+            op_index => current = index[b1 & 0x3F],
+            op_diff => {
+                current.r +%= ((b1 >> 4) & 0x03) -% 2;
+                current.g +%= ((b1 >> 2) & 0x03) -% 2;
+                current.b +%= ((b1 >> 0) & 0x03) -% 2;
+            },
+            op_luma => {
+                if (p >= chunks.len) return error.InvalidData;
+                const b2 = chunks[p];
+                p += 1;
+                const vg = (b1 & 0x3F) -% 32;
+                current.r +%= vg -% 8 +% ((b2 >> 4) & 0x0F);
+                current.g +%= vg;
+                current.b +%= vg -% 8 +% ((b2 >> 0) & 0x0F);
+            },
+            op_run => {
+                const run = std.math.min(@as(usize, b1 & 0x3F) + 1, pixels.len - i);
+                fillRun(pixels[i .. i + run], current);
+                i += run;
+                index[current.hash()] = current;
+                continue;
+            },
+            else => unreachable,
+        }
+
+        index[current.hash()] = current;
+        pixels[i] = current;
+        i += 1;
+    }
+}
+
+/// Encodes `image` as a QOI file. When `options.segment_pixels` is set, restart points
+/// and the trailer index are emitted.
+/// Memory is owned by the caller.
+pub fn encode(allocator: std.mem.Allocator, image: ConstImage, options: EncodeOptions) error{OutOfMemory}![]u8 {
+    std.debug.assert(image.pixels.len == @as(usize, image.width) * image.height);
+
+    var output = std.ArrayList(u8).init(allocator);
+    defer output.deinit();
+
+    var offsets = std.ArrayList(u32).init(allocator);
+    defer offsets.deinit();
+
+    try output.ensureTotalCapacity(header_size + image.pixels.len + end_marker.len);
+
+    try output.appendSlice(&magic);
+    try output.writer().writeIntBig(u32, image.width);
+    try output.writer().writeIntBig(u32, image.height);
+    try output.append(4); // channels
+    try output.append(0); // colorspace: sRGB with linear alpha
+
+    var index = std.mem.zeroes([64]Color);
+    var index_valid: u64 = 0;
+    var previous = start_color;
+    var run: u8 = 0;
+
+    for (image.pixels) |pixel, i| {
+        const is_restart = if (options.segment_pixels) |segment_pixels|
+            (i % segment_pixels) == 0
+        else
+            false;
+
+        if (is_restart) {
+            if (run > 0) {
+                try output.append(op_run | (run - 1));
+                run = 0;
+            }
+            try offsets.append(@intCast(u32, output.items.len));
+
+            // A literal doesn't depend on the previous pixel, and invalidating the index
+            // makes sure the segment only references entries it has written itself.
+            index_valid = 0;
+            try output.appendSlice(&[_]u8{ op_rgba, pixel.r, pixel.g, pixel.b, pixel.a });
+            index[pixel.hash()] = pixel;
+            index_valid |= @as(u64, 1) << pixel.hash();
+            previous = pixel;
+            continue;
+        }
+
+        if (pixel.eql(previous)) {
+            run += 1;
+            if (run == 62) {
+                try output.append(op_run | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0) {
+            try output.append(op_run | (run - 1));
+            run = 0;
+        }
+
+        const hash = pixel.hash();
+        const hash_bit = @as(u64, 1) << hash;
+        if ((index_valid & hash_bit) != 0 and index[hash].eql(pixel)) {
+            try output.append(op_index | hash);
+        } else {
+            index[hash] = pixel;
+            index_valid |= hash_bit;
+
+            if (pixel.a == previous.a) {
+                const vr = @bitCast(i8, pixel.r -% previous.r);
+                const vg = @bitCast(i8, pixel.g -% previous.g);
+                const vb = @bitCast(i8, pixel.b -% previous.b);
+                const vg_r = vr -% vg;
+                const vg_b = vb -% vg;
+
+                if (vr > -3 and vr < 2 and vg > -3 and vg < 2 and vb > -3 and vb < 2) {
+                    try output.append(op_diff |
+                        (@bitCast(u8, vr +% 2) << 4) |
+                        (@bitCast(u8, vg +% 2) << 2) |
+                        (@bitCast(u8, vb +% 2) << 0));
+                } else if (vg_r > -9 and vg_r < 8 and vg > -33 and vg < 32 and vg_b > -9 and vg_b < 8) {
+                    try output.append(op_luma | @bitCast(u8, vg +% 32));
+                    try output.append((@bitCast(u8, vg_r +% 8) << 4) | @bitCast(u8, vg_b +% 8));
+                } else {
+                    try output.appendSlice(&[_]u8{ op_rgb, pixel.r, pixel.g, pixel.b });
+                }
+            } else {
+                try output.appendSlice(&[_]u8{ op_rgba, pixel.r, pixel.g, pixel.b, pixel.a });
+            }
+        }
+        previous = pixel;
+    }
+    if (run > 0) {
+        try output.append(op_run | (run - 1));
+    }
+
+    try output.appendSlice(&end_marker);
+
+    if (options.segment_pixels) |segment_pixels| {
+        try output.appendSlice(&index_magic);
+        try output.writer().writeIntBig(u32, segment_pixels);
+        for (offsets.items) |offset| {
+            try output.writer().writeIntBig(u32, offset);
+        }
+        try output.writer().writeIntBig(u32, @intCast(u32, offsets.items.len));
+    }
+
+    return output.toOwnedSlice();
+}
+
+fn makeTestImage(allocator: std.mem.Allocator, width: u32, height: u32) ![]Color {
+    const pixels = try allocator.alloc(Color, width * height);
+    var rng = std.rand.DefaultPrng.init(1337);
+    for (pixels) |*pixel, i| {
+        const x = i % width;
+        const y = i / width;
+        pixel.* = if (y < height / 3)
+            Color{ .r = 0x30, .g = 0x30, .b = 0x40, .a = 0xFF } // flat area
+        else if (y < 2 * height / 3)
+            Color{ .r = @truncate(u8, x), .g = @truncate(u8, y), .b = @truncate(u8, x + y), .a = 0xFF } // gradient
+        else
+            @bitCast(Color, rng.random().int(u32)); // noise
+    }
+    return pixels;
+}
+
+test "encode and decode round trip without restart points" {
+    const pixels = try makeTestImage(std.testing.allocator, 67, 41);
+    defer std.testing.allocator.free(pixels);
+
+    const data = try encode(std.testing.allocator, .{ .width = 67, .height = 41, .pixels = pixels }, .{ .segment_pixels = null });
+    defer std.testing.allocator.free(data);
+
+    try std.testing.expect(!hasRestartIndex(data));
+
+    var image = try decode(std.testing.allocator, data, .{});
+    defer image.deinit(std.testing.allocator);
+
+    try std.testing.expectEqualSlices(u8, std.mem.sliceAsBytes(pixels), std.mem.sliceAsBytes(image.pixels));
+}
+
+test "parallel decoding of restart points matches sequential decoding" {
+    const pixels = try makeTestImage(std.testing.allocator, 301, 217);
+    defer std.testing.allocator.free(pixels);
+
+    const data = try encode(std.testing.allocator, .{ .width = 301, .height = 217, .pixels = pixels }, .{ .segment_pixels = 1000 });
+    defer std.testing.allocator.free(data);
+
+    try std.testing.expect(hasRestartIndex(data));
+
+    var sequential = try decodeSequential(std.testing.allocator, data);
+    defer sequential.deinit(std.testing.allocator);
+
+    var parallel = try decode(std.testing.allocator, data, .{ .max_threads = 4, .parallel_threshold = 0 });
+    defer parallel.deinit(std.testing.allocator);
+
+    try std.testing.expectEqualSlices(u8, std.mem.sliceAsBytes(pixels), std.mem.sliceAsBytes(sequential.pixels));
+    try std.testing.expectEqualSlices(u8, std.mem.sliceAsBytes(pixels), std.mem.sliceAsBytes(parallel.pixels));
+}
+
+test "flip_y" {
+    const pixels = try makeTestImage(std.testing.allocator, 19, 7);
+    defer std.testing.allocator.free(pixels);
+
+    const data = try encode(std.testing.allocator, .{ .width = 19, .height = 7, .pixels = pixels }, .{});
+    defer std.testing.allocator.free(data);
+
+    var image = try decode(std.testing.allocator, data, .{ .flip_y = true });
+    defer image.deinit(std.testing.allocator);
+
+    var y: usize = 0;
+    while (y < 7) : (y += 1) {
+        try std.testing.expectEqualSlices(
+            u8,
+            std.mem.sliceAsBytes(pixels[19 * (6 - y) ..][0..19]),
+            std.mem.sliceAsBytes(image.pixels[19 * y ..][0..19]),
+        );
+    }
+}
+
+test "truncated data is rejected" {
+    const pixels = try makeTestImage(std.testing.allocator, 16, 16);
+    defer std.testing.allocator.free(pixels);
+
+    const data = try encode(std.testing.allocator, .{ .width = 16, .height = 16, .pixels = pixels }, .{ .segment_pixels = null });
+    defer std.testing.allocator.free(data);
+
+    try std.testing.expectError(error.InvalidData, decode(std.testing.allocator, data[0 .. data.len / 2], .{}));
+}
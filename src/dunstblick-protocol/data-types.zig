@@ -114,6 +114,18 @@ pub const DisconnectReason = enum(u32) {
     protocol_mismatch = 5,
 };
 
+/// The timing function of a property animation, see `DisplayCommand.animateProperty`.
+pub const Easing = enum(u8) {
+    linear = 0,
+    /// Starts slow and accelerates.
+    ease_in = 1,
+    /// Starts fast and decelerates.
+    ease_out = 2,
+    /// Accelerates in the first half and decelerates in the second one.
+    ease_in_out = 3,
+    _,
+};
+
 pub const Color = extern struct {
     red: u8,
     green: u8,
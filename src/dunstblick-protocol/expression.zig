@@ -0,0 +1,484 @@
+//! Binding expressions are small programs that are embedded into a layout and evaluated
+//! by the display client. They compute a property value from the properties of the
+//! bound object, so simple UI reactions don't need a round trip to the application.
+//!
+//! An expression is encoded as stack based byte code. Each instruction is an `Opcode`,
+//! optionally followed by its operand. The program is terminated by `Opcode.end` and
+//! must leave exactly one value on the stack.
+
+const std = @import("std");
+
+const types = @import("data-types.zig");
+const layout_format = @import("layout.zig");
+
+const Value = @import("value.zig").Value;
+const Decoder = @import("decoder.zig").Decoder;
+
+pub const Opcode = enum(u8) {
+    /// Ends the program. The value on the top of the stack is the result.
+    end = 0,
+
+    /// Pushes the value of a property of the bound object. (name: varuint)
+    property = 1,
+    /// (value: varsint)
+    integer = 2,
+    /// (value: f32)
+    number = 3,
+    /// (len: varuint, text: [len]u8)
+    string = 4,
+    /// (value: u8)
+    boolean = 5,
+    /// (value: u8)
+    enumeration = 6,
+
+    /// Unary operators, pop one value and push the result.
+    negate = 7,
+    not = 8,
+
+    /// Binary operators, pop the right hand side, then the left hand side and push the result.
+    add = 9,
+    subtract = 10,
+    multiply = 11,
+    divide = 12,
+    equal = 13,
+    not_equal = 14,
+    less = 15,
+    less_equal = 16,
+    greater = 17,
+    greater_equal = 18,
+    @"and" = 19,
+    @"or" = 20,
+
+    /// Pops the false value, the true value and the condition and pushes one of the values.
+    select = 21,
+
+    /// Pops `count` arguments and the format string and pushes the formatted string.
+    /// Each `{}` in the format string is replaced by the next argument, `{{` and `}}`
+    /// produce literal braces. (count: varuint)
+    format = 22,
+
+    _,
+};
+
+/// Maximum number of values an expression may keep on the stack.
+pub const max_stack_depth = 16;
+
+pub const ReadError = error{
+    EndOfStream,
+    InvalidEnumTag,
+    InvalidExpression,
+    /// The expression needs more than `max_stack_depth` stack slots.
+    ExpressionTooComplex,
+};
+
+/// Reads an expression from `decoder` and validates it.
+/// Returns the byte code of the expression including the final `end` instruction,
+/// which is a slice of the decoder source.
+pub fn read(decoder: *Decoder) ReadError![]const u8 {
+    const start = decoder.offset;
+
+    var depth: usize = 0;
+    while (true) {
+        const opcode = try decoder.readEnum(Opcode);
+        const pops: usize = switch (opcode) {
+            .end => {
+                if (depth != 1)
+                    return error.InvalidExpression;
+                return decoder.source[start..decoder.offset];
+            },
+            .property, .integer => blk: {
+                _ = try decoder.readVarUInt();
+                break :blk 0;
+            },
+            .number => blk: {
+                _ = try decoder.readRaw(4);
+                break :blk 0;
+            },
+            .string => blk: {
+                _ = try decoder.readRaw(try decoder.readVarUInt());
+                break :blk 0;
+            },
+            .boolean, .enumeration => blk: {
+                _ = try decoder.readByte();
+                break :blk 0;
+            },
+            .negate, .not => 1,
+            .add, .subtract, .multiply, .divide, .equal, .not_equal, .less, .less_equal, .greater, .greater_equal, .@"and", .@"or" => 2,
+            .select => 3,
+            .format => 1 + @as(usize, try decoder.readVarUInt()),
+            _ => return error.InvalidExpression,
+        };
+        if (pops > depth)
+            return error.InvalidExpression;
+        depth = depth - pops + 1;
+        if (depth > max_stack_depth)
+            return error.ExpressionTooComplex;
+    }
+}
+
+pub const EvaluateError = error{
+    OutOfMemory,
+    EndOfStream,
+    InvalidEnumTag,
+    InvalidExpression,
+    UnknownProperty,
+    UnsupportedOperation,
+    DivisionByZero,
+    InvalidFormat,
+};
+
+/// Evaluates the expression `code` that was returned by `read`.
+/// `source` provides the values for property references with a function
+/// `getProperty(source, protocol.PropertyName) ?*Value`.
+/// The result is owned by the caller and allocated with `allocator`.
+pub fn evaluate(allocator: std.mem.Allocator, code: []const u8, source: anytype) EvaluateError!Value {
+    // Intermediate strings live in the arena, only the result is copied out.
+    var arena = std.heap.ArenaAllocator.init(allocator);
+    defer arena.deinit();
+
+    var stack: [max_stack_depth]Value = undefined;
+    var depth: usize = 0;
+
+    var decoder = Decoder.init(code);
+    while (true) {
+        const opcode = try decoder.readEnum(Opcode);
+
+        const result: Value = switch (opcode) {
+            .end => {
+                if (depth != 1)
+                    return error.InvalidExpression;
+                return switch (stack[0]) {
+                    .string => |str| Value{ .string = try types.String.init(allocator, str.get()) },
+                    .integer, .number, .boolean, .enumeration, .object, .resource => stack[0],
+                    else => return error.UnsupportedOperation,
+                };
+            },
+
+            .property => blk: {
+                const name = @intToEnum(types.PropertyName, try decoder.readVarUInt());
+                const value = source.getProperty(name) orelse return error.UnknownProperty;
+                break :blk value.*;
+            },
+            .integer => Value{ .integer = try decoder.readVarSInt() },
+            .number => Value{ .number = try decoder.readNumber() },
+            .string => Value{ .string = types.String.readOnly(try decoder.readRaw(try decoder.readVarUInt())) },
+            .boolean => Value{ .boolean = (try decoder.readByte()) != 0 },
+            .enumeration => Value{ .enumeration = try decoder.readByte() },
+
+            .negate => switch (try pop(&stack, &depth)) {
+                .integer => |i| Value{ .integer = -%i },
+                .number => |f| Value{ .number = -f },
+                else => return error.UnsupportedOperation,
+            },
+            .not => Value{ .boolean = !try isTrue(try pop(&stack, &depth)) },
+
+            .add, .subtract, .multiply, .divide => blk: {
+                const rhs = try pop(&stack, &depth);
+                const lhs = try pop(&stack, &depth);
+                if (opcode == .add and (lhs == .string or rhs == .string)) {
+                    var text = std.ArrayList(u8).init(arena.allocator());
+                    try appendText(&text, lhs);
+                    try appendText(&text, rhs);
+                    break :blk Value{ .string = types.String.readOnly(text.items) };
+                }
+                break :blk try arithmetic(opcode, lhs, rhs);
+            },
+
+            .equal, .not_equal => blk: {
+                const rhs = try pop(&stack, &depth);
+                const lhs = try pop(&stack, &depth);
+                break :blk Value{ .boolean = (try isEqual(lhs, rhs)) == (opcode == .equal) };
+            },
+
+            .less, .less_equal, .greater, .greater_equal => blk: {
+                const rhs = try pop(&stack, &depth);
+                const lhs = try pop(&stack, &depth);
+                const order = try compare(lhs, rhs);
+                break :blk Value{ .boolean = switch (opcode) {
+                    .less => (order == .lt),
+                    .less_equal => (order != .gt),
+                    .greater => (order == .gt),
+                    .greater_equal => (order != .lt),
+                    else => unreachable,
+                } };
+            },
+
+            .@"and", .@"or" => blk: {
+                const rhs = try isTrue(try pop(&stack, &depth));
+                const lhs = try isTrue(try pop(&stack, &depth));
+                break :blk Value{ .boolean = if (opcode == .@"and") (lhs and rhs) else (lhs or rhs) };
+            },
+
+            .select => blk: {
+                const if_false = try pop(&stack, &depth);
+                const if_true = try pop(&stack, &depth);
+                break :blk if (try isTrue(try pop(&stack, &depth))) if_true else if_false;
+            },
+
+            .format => blk: {
+                const count = try decoder.readVarUInt();
+                if (count >= depth)
+                    return error.InvalidExpression;
+                depth -= count;
+                const args = stack[depth .. depth + count];
+
+                const fmt = try pop(&stack, &depth);
+                if (fmt != .string)
+                    return error.UnsupportedOperation;
+
+                var text = std.ArrayList(u8).init(arena.allocator());
+                try formatText(&text, fmt.string.get(), args);
+                break :blk Value{ .string = types.String.readOnly(text.items) };
+            },
+
+            _ => return error.InvalidExpression,
+        };
+
+        if (depth >= max_stack_depth)
+            return error.InvalidExpression;
+        stack[depth] = result;
+        depth += 1;
+    }
+}
+
+fn pop(stack: *[max_stack_depth]Value, depth: *usize) !Value {
+    if (depth.* == 0)
+        return error.InvalidExpression;
+    depth.* -= 1;
+    return stack[depth.*];
+}
+
+fn isTrue(value: Value) !bool {
+    return switch (value) {
+        .boolean => |b| b,
+        .integer => |i| (i != 0),
+        .number => |f| (f != 0),
+        .string => |s| (s.get().len > 0),
+        .object => |o| (o != .invalid),
+        else => error.UnsupportedOperation,
+    };
+}
+
+fn isNumeric(value: Value) bool {
+    return (value == .integer or value == .number);
+}
+
+fn toNumber(value: Value) !f32 {
+    return switch (value) {
+        .integer => |i| @intToFloat(f32, i),
+        .number => |f| f,
+        else => error.UnsupportedOperation,
+    };
+}
+
+fn arithmetic(opcode: Opcode, lhs: Value, rhs: Value) !Value {
+    if (lhs == .integer and rhs == .integer) {
+        const a = lhs.integer;
+        const b = rhs.integer;
+        return Value{ .integer = switch (opcode) {
+            .add => a +% b,
+            .subtract => a -% b,
+            .multiply => a *% b,
+            .divide => if (b == 0) return error.DivisionByZero else @divTrunc(a, b),
+            else => unreachable,
+        } };
+    }
+
+    const a = try toNumber(lhs);
+    const b = try toNumber(rhs);
+    return Value{ .number = switch (opcode) {
+        .add => a + b,
+        .subtract => a - b,
+        .multiply => a * b,
+        .divide => a / b,
+        else => unreachable,
+    } };
+}
+
+fn isEqual(lhs: Value, rhs: Value) !bool {
+    if (isNumeric(lhs) and isNumeric(rhs))
+        return (try compare(lhs, rhs)) == .eq;
+    if (std.meta.activeTag(lhs) != std.meta.activeTag(rhs))
+        return false;
+    return switch (lhs) {
+        .string => |s| std.mem.eql(u8, s.get(), rhs.string.get()),
+        .boolean => |b| (b == rhs.boolean),
+        .enumeration => |e| (e == rhs.enumeration),
+        .object => |o| (o == rhs.object),
+        .resource => |r| (r == rhs.resource),
+        else => error.UnsupportedOperation,
+    };
+}
+
+fn compare(lhs: Value, rhs: Value) !std.math.Order {
+    if (lhs == .integer and rhs == .integer)
+        return std.math.order(lhs.integer, rhs.integer);
+    if (lhs == .string and rhs == .string)
+        return std.mem.order(u8, lhs.string.get(), rhs.string.get());
+    return std.math.order(try toNumber(lhs), try toNumber(rhs));
+}
+
+fn appendText(text: *std.ArrayList(u8), value: Value) !void {
+    switch (value) {
+        .integer => |i| try text.writer().print("{d}", .{i}),
+        .number => |f| try text.writer().print("{d}", .{f}),
+        .string => |s| try text.appendSlice(s.get()),
+        .boolean => |b| try text.appendSlice(if (b) "true" else "false"),
+        .enumeration => |e| {
+            for (layout_format.enumerations) |desc| {
+                if (@enumToInt(desc.value) == e)
+                    return try text.appendSlice(desc.enumeration);
+            }
+            try text.writer().print("{d}", .{e});
+        },
+        else => return error.UnsupportedOperation,
+    }
+}
+
+fn formatText(text: *std.ArrayList(u8), fmt: []const u8, args: []const Value) !void {
+    var next_arg: usize = 0;
+    var i: usize = 0;
+    while (i < fmt.len) : (i += 1) {
+        const rest = fmt[i..];
+        if (std.mem.startsWith(u8, rest, "{{") or std.mem.startsWith(u8, rest, "}}")) {
+            try text.append(fmt[i]);
+            i += 1;
+        } else if (std.mem.startsWith(u8, rest, "{}")) {
+            if (next_arg >= args.len)
+                return error.InvalidFormat;
+            try appendText(text, args[next_arg]);
+            next_arg += 1;
+            i += 1;
+        } else {
+            try text.append(fmt[i]);
+        }
+    }
+    if (next_arg != args.len)
+        return error.InvalidFormat;
+}
+
+/// Returns the number of `{}` placeholders in `fmt`.
+pub fn countPlaceholders(fmt: []const u8) usize {
+    var count: usize = 0;
+    var i: usize = 0;
+    while (i < fmt.len) : (i += 1) {
+        const rest = fmt[i..];
+        if (std.mem.startsWith(u8, rest, "{{") or std.mem.startsWith(u8, rest, "}}")) {
+            i += 1;
+        } else if (std.mem.startsWith(u8, rest, "{}")) {
+            count += 1;
+            i += 1;
+        }
+    }
+    return count;
+}
+
+const TestSource = struct {
+    values: []Value,
+
+    pub fn getProperty(self: TestSource, name: types.PropertyName) ?*Value {
+        const index = @enumToInt(name);
+        if (index == 0 or index > self.values.len)
+            return null;
+        return &self.values[index - 1];
+    }
+};
+
+fn testEvaluate(code: []const u8, values: []Value) !Value {
+    var decoder = Decoder.init(code);
+    const program = try read(&decoder);
+    try std.testing.expectEqual(code.len, program.len);
+    return try evaluate(std.testing.allocator, program, TestSource{ .values = values });
+}
+
+test "expressions compute with bound properties" {
+    var values = [_]Value{
+        Value{ .integer = 3 },
+        Value{ .number = 0.5 },
+        Value{ .boolean = true },
+    };
+
+    const op = struct {
+        fn f(o: Opcode) u8 {
+            return @enumToInt(o);
+        }
+    }.f;
+
+    // property(1) * 2 + 1
+    try std.testing.expectEqual(Value{ .integer = 7 }, try testEvaluate(&[_]u8{
+        op(.property), 1, op(.integer), 4, op(.multiply), op(.integer), 2, op(.add), op(.end),
+    }, &values));
+
+    // -property(1) + property(2)
+    try std.testing.expectEqual(Value{ .number = -2.5 }, try testEvaluate(&[_]u8{
+        op(.property), 1, op(.negate), op(.property), 2, op(.add), op(.end),
+    }, &values));
+
+    // !property(3) || property(1) >= 3
+    try std.testing.expectEqual(Value{ .boolean = true }, try testEvaluate(&[_]u8{
+        op(.property), 3, op(.not), op(.property), 1, op(.integer), 6, op(.greater_equal), op(.@"or"), op(.end),
+    }, &values));
+
+    // property(1) == 3 ? visible : collapsed
+    const visible = @enumToInt(types.Enum.visible);
+    const collapsed = @enumToInt(types.Enum.collapsed);
+    try std.testing.expectEqual(Value{ .enumeration = visible }, try testEvaluate(&[_]u8{
+        op(.property), 1, op(.integer), 6, op(.equal), op(.enumeration), visible, op(.enumeration), collapsed, op(.select), op(.end),
+    }, &values));
+
+    try std.testing.expectError(error.UnknownProperty, testEvaluate(&[_]u8{ op(.property), 4, op(.end) }, &values));
+    try std.testing.expectError(error.DivisionByZero, testEvaluate(&[_]u8{ op(.integer), 2, op(.integer), 0, op(.divide), op(.end) }, &values));
+}
+
+test "expressions format strings" {
+    var values = [_]Value{
+        Value{ .integer = 3 },
+        Value{ .string = types.String.readOnly("songs") },
+    };
+
+    var code: [32]u8 = undefined;
+    var stream = std.io.fixedBufferStream(&code);
+    var encoder = @import("encoder.zig").Encoder(@TypeOf(stream.writer())).init(stream.writer());
+
+    try encoder.writeByte(@enumToInt(Opcode.string));
+    try encoder.writeString("{} {} {{}}");
+    try encoder.writeByte(@enumToInt(Opcode.property));
+    try encoder.writeVarUInt(1);
+    try encoder.writeByte(@enumToInt(Opcode.property));
+    try encoder.writeVarUInt(2);
+    try encoder.writeByte(@enumToInt(Opcode.format));
+    try encoder.writeVarUInt(2);
+    try encoder.writeByte(@enumToInt(Opcode.end));
+
+    var result = try testEvaluate(stream.getWritten(), &values);
+    defer result.deinit();
+
+    try std.testing.expectEqualStrings("3 songs {}", result.string.get());
+    try std.testing.expectEqual(@as(usize, 2), countPlaceholders("{} {} {{}}"));
+}
+
+test "invalid expressions are rejected" {
+    const invalid = [_][]const u8{
+        &[_]u8{@enumToInt(Opcode.end)},
+        &[_]u8{@enumToInt(Opcode.add)},
+        &[_]u8{ @enumToInt(Opcode.integer), 1, @enumToInt(Opcode.integer), 1, @enumToInt(Opcode.end) },
+        &[_]u8{ @enumToInt(Opcode.integer), 1 },
+        &[_]u8{0xFF},
+    };
+    for (invalid) |code| {
+        var decoder = Decoder.init(code);
+        try std.testing.expect(std.meta.isError(read(&decoder)));
+    }
+}
+
+test "expressions that need too many stack slots are rejected" {
+    var code: [2 * (max_stack_depth + 1)]u8 = undefined;
+    var i: usize = 0;
+    while (i < max_stack_depth + 1) : (i += 1) {
+        code[2 * i + 0] = @enumToInt(Opcode.integer);
+        code[2 * i + 1] = 1;
+    }
+
+    var decoder = Decoder.init(&code);
+    try std.testing.expectError(error.ExpressionTooComplex, read(&decoder));
+}
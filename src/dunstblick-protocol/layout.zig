@@ -2,6 +2,11 @@ const std = @import("std");
 const types = @import("data-types.zig");
 const enums = @import("enums.zig");
 
+/// Tag of a child widget that is a copy of a subtree written earlier in the same layout.
+/// It is followed by the `uint` offset of that subtree, relative to the start of the layout.
+/// The referenced subtree must end before the tag.
+pub const subtree_reference_tag = 0xF0;
+
 pub const WidgetDescriptor = struct {
     widget: []const u8,
     type: types.WidgetType,
@@ -15,16 +15,25 @@ pub const tcp = struct {
 
     pub const ServerStateMachine = server_state_machine.ServerStateMachine;
     pub const ClientStateMachine = client_state_machine.ClientStateMachine;
+    pub const ClientReceiveEvent = client_state_machine.ReceiveEvent;
+
+    pub const Session = @import("tcp/shared_types.zig").Session;
 };
 
 pub const layout_format = @import("layout.zig");
 
+pub const expression = @import("expression.zig");
+
+pub const bitmap = @import("bitmap.zig");
+
 pub const enums = @import("enums.zig");
 
 pub const data_types = @import("data-types.zig");
 
 pub const Value = @import("value.zig").Value;
 
+pub const TypedProperty = @import("typed-property.zig").TypedProperty;
+
 pub const Decoder = @import("decoder.zig").Decoder;
 
 pub const ZigZagInt = @import("zigzagint.zig");
@@ -59,6 +68,7 @@ pub const DisplayCommand = enum(u8) {
     insertRange = 8, // (oid, name, index, count, value …) // manipulate lists
     removeRange = 9, // (oid, name, index, count) // manipulate lists
     moveRange = 10, // (oid, name, indexFrom, indexTo, count) // manipulate lists
+    animateProperty = 11, // (oid, name, value, duration, easing, notify) // interpolates from the current value on the display client
     _,
 };
 
@@ -69,6 +79,7 @@ pub const ApplicationCommand = enum(u8) {
 };
 
 test {
+    _ = bitmap;
     _ = makeEncoder;
     _ = beginDisplayCommandEncoding;
     _ = beginApplicationCommandEncoding;
@@ -78,6 +89,9 @@ test {
     _ = tcp.v1;
     _ = tcp.ServerStateMachine;
     _ = tcp.ClientStateMachine;
+    _ = expression;
+    _ = udp;
+    _ = @import("typed-property.zig");
 
     // pure data declaration, must always be valid
     std.testing.refAllDecls(layout_format);
@@ -769,6 +783,7 @@ fn testCommonHandshake(
                     const msg = try expectClientEvent(stream, client, .resource_header);
                     try std.testing.expectEqual(resources_descriptors[i].id, msg.resource_id);
                     try std.testing.expectEqualSlices(u8, resources[i], msg.data);
+                    try std.testing.expectEqual(computeResourceHash(resources[i]), msg.hash);
                 }
             }
         }
@@ -1216,3 +1231,214 @@ test "Network protocol implementation (unencrypted, no authentication, many reso
 
     try testCommonHandshake(&server, &client, &stream, .many, .one);
 }
+
+test "Network protocol implementation (session resumption)" {
+    var backing_buffer: [4096]u8 = undefined;
+    var stream = TestStream{ .buffer = &backing_buffer, .pos = 0 };
+
+    const test_key: [32]u8 = "0123456789ABCDEF0123456789ABCDEF".*;
+
+    var server_session: tcp.Session = undefined;
+    var client_session: tcp.Session = undefined;
+
+    // The first connection asks for a session
+    {
+        var server = tcp.ServerStateMachine(TestStream.Writer).init(std.testing.allocator, stream.writer());
+        defer server.deinit();
+
+        var client = tcp.ClientStateMachine(TestStream.Writer).init(std.testing.allocator, stream.writer());
+        defer client.deinit();
+
+        {
+            stream.reset();
+            client.request_session = true;
+            try client.initiateHandshake(null, test_key);
+        }
+
+        {
+            const msg = try expectServerEvent(&stream, &server, .initiate_handshake);
+
+            try std.testing.expectEqual(true, msg.wants_session);
+            try std.testing.expectEqual(false, msg.resume_session);
+        }
+
+        {
+            stream.reset();
+            const auth_action = try server.acknowledgeHandshake(.{
+                .requires_username = false,
+                .requires_password = false,
+                .rejects_username = false,
+                .rejects_password = false,
+            });
+            try std.testing.expectEqual(tcp.server_state_machine.AuthAction.expect_auth_info, auth_action);
+        }
+
+        {
+            const msg = try expectClientEvent(&stream, &client, .acknowledge_handshake);
+            try std.testing.expectEqual(true, msg.ok());
+        }
+
+        {
+            stream.reset();
+            try client.sendAuthenticationInfo();
+        }
+
+        {
+            _ = try expectServerEvent(&stream, &server, .authenticate_info);
+            try std.testing.expectEqual(tcp.server_state_machine.AuthenticationResult.success, server.setKeyAndVerify(test_key));
+        }
+
+        {
+            stream.reset();
+            server_session = try server.sendAuthenticationResultWithSession(true);
+        }
+
+        {
+            // authentication result and session info are sent in one go
+            const data = stream.getWritten();
+
+            const result = try client.pushData(data);
+            try std.testing.expect(result.event != null);
+            try std.testing.expectEqual(tcp.AuthenticationResult.Result.success, result.event.?.authenticate_result.result);
+            try std.testing.expectEqual(true, result.event.?.authenticate_result.has_session);
+
+            const info = try client.pushData(data[result.consumed..]);
+            try std.testing.expect(info.event != null);
+            try std.testing.expectEqual(data.len, result.consumed + info.consumed);
+            client_session = info.event.?.session_info;
+        }
+
+        try std.testing.expectEqualSlices(u8, &server_session.id, &client_session.id);
+        try std.testing.expectEqualSlices(u8, &server_session.key, &client_session.key);
+
+        // the session key depends on the password
+        try std.testing.expect(!std.mem.eql(u8, &test_key, &server_session.key));
+
+        try testCommonHandshake(&server, &client, &stream, .one, .one);
+    }
+
+    // The second connection resumes the session without a password
+    {
+        var server = tcp.ServerStateMachine(TestStream.Writer).init(std.testing.allocator, stream.writer());
+        defer server.deinit();
+
+        var client = tcp.ClientStateMachine(TestStream.Writer).init(std.testing.allocator, stream.writer());
+        defer client.deinit();
+
+        {
+            stream.reset();
+            try client.initiateResume(client_session, 42);
+        }
+
+        {
+            const msg = try expectServerEvent(&stream, &server, .initiate_handshake);
+
+            try std.testing.expectEqual(false, msg.has_password);
+            try std.testing.expectEqual(true, msg.resume_session);
+        }
+
+        {
+            stream.reset();
+            const auth_action = try server.acknowledgeHandshake(.{
+                .requires_username = false,
+                .requires_password = false,
+                .rejects_username = false,
+                .rejects_password = false,
+            });
+            try std.testing.expectEqual(tcp.server_state_machine.AuthAction.expect_resume, auth_action);
+        }
+
+        {
+            const msg = try expectClientEvent(&stream, &client, .acknowledge_handshake);
+            try std.testing.expectEqual(true, msg.ok());
+        }
+
+        {
+            stream.reset();
+            try client.sendResumeRequest();
+        }
+
+        {
+            const msg = try expectServerEvent(&stream, &server, .resume_request);
+
+            try std.testing.expectEqualSlices(u8, &server_session.id, &msg.session_id);
+            try std.testing.expectEqual(@as(u64, 42), msg.sequence);
+
+            try std.testing.expectEqual(tcp.server_state_machine.AuthenticationResult.success, server.setKeyAndVerify(server_session.key));
+        }
+
+        {
+            stream.reset();
+            try server.sendAuthenticationResult(.success, true);
+        }
+
+        {
+            const msg = try expectClientEvent(&stream, &client, .authenticate_result);
+
+            try std.testing.expectEqual(tcp.AuthenticationResult.Result.success, msg.result);
+            try std.testing.expectEqual(true, msg.resumed);
+        }
+
+        try std.testing.expectEqual(true, server.isConnectionEstablished());
+        try std.testing.expectEqual(true, client.isConnectionEstablished());
+
+        {
+            stream.reset();
+            try server.sendMessage("Welcome back!");
+        }
+
+        {
+            const msg = try expectClientEvent(&stream, &client, .message);
+            try std.testing.expectEqualStrings("Welcome back!", msg);
+        }
+    }
+
+    // An unknown session is rejected
+    {
+        var server = tcp.ServerStateMachine(TestStream.Writer).init(std.testing.allocator, stream.writer());
+        defer server.deinit();
+
+        var client = tcp.ClientStateMachine(TestStream.Writer).init(std.testing.allocator, stream.writer());
+        defer client.deinit();
+
+        {
+            stream.reset();
+            try client.initiateResume(client_session, 0);
+        }
+
+        _ = try expectServerEvent(&stream, &server, .initiate_handshake);
+
+        {
+            stream.reset();
+            _ = try server.acknowledgeHandshake(.{
+                .requires_username = false,
+                .requires_password = false,
+                .rejects_username = false,
+                .rejects_password = false,
+            });
+        }
+
+        _ = try expectClientEvent(&stream, &client, .acknowledge_handshake);
+
+        {
+            stream.reset();
+            try client.sendResumeRequest();
+        }
+
+        _ = try expectServerEvent(&stream, &server, .resume_request);
+
+        {
+            stream.reset();
+            try server.sendAuthenticationResult(.unknown_session, false);
+        }
+
+        try std.testing.expectEqual(true, server.isFaulted());
+
+        {
+            const msg = try expectClientEvent(&stream, &client, .authenticate_result);
+            try std.testing.expectEqual(tcp.AuthenticationResult.Result.unknown_session, msg.result);
+        }
+
+        try std.testing.expectEqual(true, client.isFaulted());
+    }
+}
@@ -76,6 +76,16 @@ pub fn hash(self: *Self, data: []const u8) Hash {
     return self.charm.hash(data);
 }
 
+/// Derives the key of a resumable session from the secret sent by the server. When the
+/// connection was authenticated with a password, the key also depends on it, so an observer
+/// of an unencrypted handshake can't take over the session.
+pub fn deriveSessionKey(secret: Key, password_key: ?Key) Key {
+    const key = password_key orelse return secret;
+    var session_key: Key = undefined;
+    std.crypto.auth.hmac.sha2.HmacSha256.create(&session_key, &secret, &key);
+    return session_key;
+}
+
 pub fn hashPassword(password: []const u8, salt: []const u8) Key {
     var key: Key = undefined;
     std.crypto.pwhash.pbkdf2(
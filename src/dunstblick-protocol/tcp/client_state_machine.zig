@@ -45,6 +45,7 @@ pub const ReceiveData = struct {
 pub const ReceiveEvent = union(enum) {
     acknowledge_handshake: AcknowledgeHandshake,
     authenticate_result: AuthenticateResult,
+    session_info: shared_types.Session,
     connect_response: ConnectResponse,
     connect_response_item: ConnectResponseItem,
     resource_header: ResourceHeader,
@@ -71,16 +72,127 @@ pub const ReceiveEvent = union(enum) {
     };
     const AuthenticateResult = struct {
         result: protocol.AuthenticationResult.Result,
+        /// A `session_info` event follows, send the connect header after that one.
+        has_session: bool,
+        /// The connection resumed a session and is established now.
+        resumed: bool,
     };
     const ConnectResponse = struct {
         resource_count: u32,
     };
     const ResourceHeader = struct {
         resource_id: types.ResourceID,
+        /// Valid until the next call to `pushData`, unless taken with `takeResourceData`.
         data: []const u8,
+        /// The hash of `data`, computed while receiving.
+        hash: types.ResourceHash,
     };
 };
 
+/// Receives a resource directly into its final storage, which is allocated with the exact size
+/// once the length prefix is known. Unencrypted data is hashed while it arrives, encrypted
+/// data is decrypted in-place when complete.
+const IncomingResource = struct {
+    const id_len = @sizeOf(types.ResourceID);
+
+    /// Contains `id ++ data ++ tag` when encrypted, otherwise only `data`.
+    storage: []u8,
+
+    /// Receives the resource id for unencrypted transfers.
+    id_buffer: [id_len]u8 = undefined,
+
+    /// Number of received message bytes (id, data and tag).
+    received: usize = 0,
+
+    /// Total number of message bytes.
+    total: usize,
+
+    encrypted: bool,
+
+    hasher: std.hash.Fnv1a_64 = std.hash.Fnv1a_64.init(),
+
+    fn init(allocator: std.mem.Allocator, data_len: u32, encrypted: bool) error{OutOfMemory}!IncomingResource {
+        const tag_len = if (encrypted) @as(usize, 16) else 0;
+        const total = id_len + @as(usize, data_len) + tag_len;
+        return IncomingResource{
+            .storage = try allocator.alloc(u8, if (encrypted) total else data_len),
+            .total = total,
+            .encrypted = encrypted,
+        };
+    }
+
+    /// Consumes as much of `new_data` as belongs to the resource and returns the number of consumed bytes.
+    fn push(self: *IncomingResource, new_data: []const u8) usize {
+        const chunk = new_data[0..std.math.min(new_data.len, self.total - self.received)];
+
+        if (self.encrypted) {
+            std.mem.copy(u8, self.storage[self.received..], chunk);
+        } else {
+            var rest = chunk;
+            if (self.received < id_len) {
+                const len = std.math.min(id_len - self.received, rest.len);
+                std.mem.copy(u8, self.id_buffer[self.received..], rest[0..len]);
+                rest = rest[len..];
+            }
+            if (rest.len > 0) {
+                const offset = self.received + (chunk.len - rest.len) - id_len;
+                std.mem.copy(u8, self.storage[offset..], rest);
+                self.hasher.update(rest);
+            }
+        }
+
+        self.received += chunk.len;
+        return chunk.len;
+    }
+
+    fn isComplete(self: IncomingResource) bool {
+        return (self.received == self.total);
+    }
+
+    const Result = struct {
+        id: types.ResourceID,
+        data: []u8,
+        hash: types.ResourceHash,
+    };
+
+    /// Decrypts the resource if necessary and returns the final storage, which is owned by the caller.
+    fn finish(self: *IncomingResource, allocator: std.mem.Allocator, crypto: *CryptoState) !Result {
+        std.debug.assert(self.isComplete());
+
+        var id_bytes: [id_len]u8 = undefined;
+        var data = self.storage;
+
+        if (self.encrypted) {
+            const payload = self.storage[0 .. self.total - 16];
+            const tag = self.storage[self.total - 16 ..][0..16];
+            try crypto.decrypt(tag.*, payload);
+
+            std.mem.copy(u8, &id_bytes, payload[0..id_len]);
+
+            // Move the data to the front, so the storage can be shrunk in-place
+            // and handed out without another allocation.
+            const data_len = payload.len - id_len;
+            std.mem.copy(u8, self.storage[0..data_len], payload[id_len..]);
+            data = try allocator.realloc(self.storage, data_len);
+
+            self.hasher.update(data);
+        } else {
+            id_bytes = self.id_buffer;
+        }
+
+        var hash: types.ResourceHash = undefined;
+        std.mem.writeIntLittle(u64, &hash, self.hasher.final());
+
+        self.* = undefined;
+
+        return Result{
+            .id = @intToEnum(types.ResourceID, std.mem.readIntLittle(u32, &id_bytes)),
+            .data = data,
+            .hash = hash,
+        };
+    }
+};
+
 pub fn ClientStateMachine(comptime Writer: type) type {
     return struct {
         const Self = @This();
@@ -101,6 +213,13 @@ pub fn ClientStateMachine(comptime Writer: type) type {
         username: ?[32]u8 = null,
         crpyto_key: ?CryptoState.Key = null,
 
+        /// Set before `initiateHandshake` to ask the server for a resumable session.
+        request_session: bool = false,
+
+        /// The session that is resumed, see `initiateResume`.
+        resume_session: ?shared_types.Session = null,
+        resume_sequence: u64 = 0,
+
         temp_msg_buffer: std.ArrayListUnmanaged(u8) = .{},
         receive_buffer: shared_types.MsgReceiveBuffer = .{},
 
@@ -112,6 +231,16 @@ pub fn ClientStateMachine(comptime Writer: type) type {
         /// Number of resources that are requested by the client.
         requested_resource_count: u32 = undefined,
 
+        /// The largest resource size announced by the server. Bounds the
+        /// allocation for a received resource.
+        max_resource_size: u32 = 0,
+
+        /// The resource that is currently received.
+        incoming_resource: ?IncomingResource = null,
+
+        /// The data of the last `resource_header` event, freed on the next call to `pushData`.
+        received_resource: ?[]u8 = null,
+
         pub fn init(allocator: std.mem.Allocator, writer: Writer) Self {
             return Self{
                 .allocator = allocator,
@@ -121,6 +250,12 @@ pub fn ClientStateMachine(comptime Writer: type) type {
         }
 
         pub fn deinit(self: *Self) void {
+            if (self.incoming_resource) |res| {
+                self.allocator.free(res.storage);
+            }
+            if (self.received_resource) |data| {
+                self.allocator.free(data);
+            }
             self.temp_msg_buffer.deinit(self.allocator);
             self.receive_buffer.deinit(self.allocator);
             self.* = undefined;
@@ -152,7 +287,19 @@ pub fn ClientStateMachine(comptime Writer: type) type {
             return std.mem.bytesAsValue(T, data[0..@sizeOf(T)]);
         }
 
+        /// Takes ownership of the data of the last `resource_header` event, so it can be stored without a copy.
+        /// The data is allocated with the allocator passed to `init`.
+        pub fn takeResourceData(self: *Self) ?[]u8 {
+            defer self.received_resource = null;
+            return self.received_resource;
+        }
+
         pub fn pushData(self: *Self, new_data: []const u8) ReceiveError!ReceiveData {
+            if (self.received_resource) |data| {
+                self.allocator.free(data);
+                self.received_resource = null;
+            }
+
             const expected_additional_len = if (self.crypto.encryption_enabled)
                 @as(usize, 16)
             else
@@ -179,7 +326,9 @@ pub fn ClientStateMachine(comptime Writer: type) type {
                             );
 
                             if (response.event.?.acknowledge_handshake.ok()) {
-                                if (self.username != null or self.crpyto_key != null) {
+                                if (self.resume_session != null) {
+                                    self.state = .resume_request;
+                                } else if (self.username != null or self.crpyto_key != null) {
                                     self.state = .authenticate_info;
                                 } else {
                                     self.state = .authenticate_result;
@@ -192,27 +341,61 @@ pub fn ClientStateMachine(comptime Writer: type) type {
                     }
                 },
                 .authenticate_info => return error.UnexpectedData,
+                .resume_request => return error.UnexpectedData,
                 .authenticate_result => {
                     switch (try self.receive_buffer.pushData(self.allocator, new_data, expected_additional_len + @sizeOf(protocol.AuthenticationResult))) {
                         .need_more => return ReceiveData.notEnough(new_data.len),
                         .ok => |info| {
                             const value = try self.decryptAndGet(info, protocol.AuthenticationResult);
 
-                            if (self.crpyto_key == null and value.flags.encrypted) {
+                            const resuming = (self.resume_session != null);
+
+                            if (self.crpyto_key == null and !resuming and value.flags.encrypted) {
+                                self.state = .faulted;
+                                return error.ProtocolViolation;
+                            }
+                            if (value.flags.has_session and (!self.request_session or resuming)) {
                                 self.state = .faulted;
                                 return error.ProtocolViolation;
                             }
 
                             self.crypto.encryption_enabled = value.flags.encrypted;
-                            self.state = .connect_header;
 
                             if (value.result != .success) {
                                 self.state = .faulted;
+                            } else if (resuming) {
+                                self.state = .established;
+                            } else if (value.flags.has_session) {
+                                self.state = .session_info;
+                            } else {
+                                self.state = .connect_header;
                             }
 
                             return ReceiveData.createEvent(
                                 info.consumed,
-                                ReceiveEvent{ .authenticate_result = .{ .result = value.result } },
+                                ReceiveEvent{ .authenticate_result = .{
+                                    .result = value.result,
+                                    .has_session = value.flags.has_session,
+                                    .resumed = (resuming and value.result == .success),
+                                } },
+                            );
+                        },
+                    }
+                },
+                .session_info => {
+                    switch (try self.receive_buffer.pushData(self.allocator, new_data, expected_additional_len + @sizeOf(protocol.SessionInfo))) {
+                        .need_more => return ReceiveData.notEnough(new_data.len),
+                        .ok => |info| {
+                            const value = try self.decryptAndGet(info, protocol.SessionInfo);
+
+                            self.state = .connect_header;
+
+                            return ReceiveData.createEvent(
+                                info.consumed,
+                                ReceiveEvent{ .session_info = .{
+                                    .id = value.session_id,
+                                    .key = CryptoState.deriveSessionKey(value.secret, self.crpyto_key),
+                                } },
                             );
                         },
                     }
@@ -248,6 +431,8 @@ pub fn ClientStateMachine(comptime Writer: type) type {
 
                             const index = current_index.*;
 
+                            self.max_resource_size = std.math.max(self.max_resource_size, value.size);
+
                             current_index.* += 1;
                             if (current_index.* >= self.available_resource_count) {
                                 self.state = .resource_request;
@@ -266,39 +451,51 @@ pub fn ClientStateMachine(comptime Writer: type) type {
                 },
                 .resource_request => return error.UnexpectedData,
                 .resource_header => |*current_index| {
-                    switch (try self.receive_buffer.pushPrefix(self.allocator, new_data, 4)) {
-                        .need_more => return ReceiveData.notEnough(new_data.len),
-                        .ok => |prefix_info| {
-                            // prefix_info.consumed
-                            const len = std.mem.readIntLittle(u32, prefix_info.data[0..4]);
+                    var prefix_consumed: usize = 0;
+                    if (self.incoming_resource == null) {
+                        switch (try self.receive_buffer.pushData(self.allocator, new_data, 4)) {
+                            .need_more => return ReceiveData.notEnough(new_data.len),
+                            .ok => |prefix_info| {
+                                const len = std.mem.readIntLittle(u32, prefix_info.data[0..4]);
+                                if (len > self.max_resource_size) {
+                                    self.state = .faulted;
+                                    return error.ProtocolViolation;
+                                }
+                                self.incoming_resource = try IncomingResource.init(self.allocator, len, self.crypto.encryption_enabled);
+                                prefix_consumed = prefix_info.consumed;
+                            },
+                        }
+                    }
 
-                            const total_len = @sizeOf(u32) + @sizeOf(types.ResourceID) + len;
+                    const resource = &self.incoming_resource.?;
 
-                            switch (try self.receive_buffer.pushData(self.allocator, new_data[prefix_info.consumed..], expected_additional_len + total_len)) {
-                                .need_more => return ReceiveData.notEnough(new_data.len),
-                                .ok => |info| {
-                                    const data = try self.decrypt(info.data[4..]);
+                    const consumed = prefix_consumed + resource.push(new_data[prefix_consumed..]);
+                    if (!resource.isComplete())
+                        return ReceiveData.notEnough(consumed);
 
-                                    const resource_id = @intToEnum(types.ResourceID, std.mem.readIntLittle(u32, data[0..4]));
+                    const result = resource.finish(self.allocator, &self.crypto) catch |err| {
+                        self.allocator.free(resource.storage);
+                        self.incoming_resource = null;
+                        return err;
+                    };
+                    self.incoming_resource = null;
+                    self.received_resource = result.data;
 
-                                    current_index.* += 1;
-                                    if (current_index.* >= self.requested_resource_count) {
-                                        self.state = .established;
-                                    }
+                    current_index.* += 1;
+                    if (current_index.* >= self.requested_resource_count) {
+                        self.state = .established;
+                    }
 
-                                    return ReceiveData.createEvent(
-                                        prefix_info.consumed + info.consumed,
-                                        ReceiveEvent{
-                                            .resource_header = .{
-                                                .resource_id = resource_id,
-                                                .data = data[4..],
-                                            },
-                                        },
-                                    );
-                                },
-                            }
+                    return ReceiveData.createEvent(
+                        consumed,
+                        ReceiveEvent{
+                            .resource_header = .{
+                                .resource_id = result.id,
+                                .data = result.data,
+                                .hash = result.hash,
+                            },
                         },
-                    }
+                    );
                 },
                 .established => {
                     switch (try self.receive_buffer.pushPrefix(self.allocator, new_data, 4)) {
@@ -375,6 +572,7 @@ pub fn ClientStateMachine(comptime Writer: type) type {
                 .flags = .{
                     .has_username = (username != null),
                     .has_password = (key != null),
+                    .wants_session = self.request_session,
                 },
             };
 
@@ -382,6 +580,44 @@ pub fn ClientStateMachine(comptime Writer: type) type {
             self.state = .acknowledge_handshake;
         }
 
+        /// Starts a handshake that resumes `session` of a previous connection. `sequence` is the
+        /// number of messages received in the session, the server sends all later ones again.
+        /// When the server doesn't know the session anymore, `authenticate_result` reports
+        /// `unknown_session` and a new connection with a full handshake is required.
+        pub fn initiateResume(self: *Self, session: shared_types.Session, sequence: u64) SendError!void {
+            std.debug.assert(self.state == .initiate_handshake);
+
+            self.resume_session = session;
+            self.resume_sequence = sequence;
+
+            var handshake = protocol.InitiateHandshake{
+                .client_nonce = self.crypto.client_nonce,
+                .flags = .{
+                    .has_username = false,
+                    .has_password = false,
+                    .resume_session = true,
+                },
+            };
+
+            try self.send(std.mem.asBytes(&handshake));
+            self.state = .acknowledge_handshake;
+        }
+
+        pub fn sendResumeRequest(self: *Self) SendError!void {
+            std.debug.assert(self.state == .resume_request);
+            const session = self.resume_session.?;
+
+            var request = protocol.ResumeRequest{
+                .session_id = session.id,
+                .auth_token = self.crypto.start(session.key, .client),
+                .sequence = self.resume_sequence,
+            };
+
+            try self.send(std.mem.asBytes(&request));
+
+            self.state = .authenticate_result;
+        }
+
         pub fn sendAuthenticationInfo(self: *Self) SendError!void {
             std.debug.assert(self.state == .authenticate_info);
 
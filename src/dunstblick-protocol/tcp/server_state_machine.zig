@@ -36,6 +36,7 @@ pub const ReceiveData = struct {
 pub const ReceiveEvent = union(enum) {
     initiate_handshake: InitiateHandshake,
     authenticate_info: AuthenticateInfo,
+    resume_request: ResumeRequest,
     connect_header: ConnectHeader,
     resource_request: ResourceRequest,
     message: []const u8,
@@ -43,6 +44,10 @@ pub const ReceiveEvent = union(enum) {
     const InitiateHandshake = struct {
         has_username: bool,
         has_password: bool,
+        /// The client wants a resumable session, use `sendAuthenticationResultWithSession()`.
+        wants_session: bool,
+        /// The client will send a `resume_request` instead of authentication information.
+        resume_session: bool,
     };
     const AuthenticateInfo = struct {
         /// If not null, the user has provided a user name
@@ -52,6 +57,12 @@ pub const ReceiveEvent = union(enum) {
         /// the `setKeyAndVerify()` method.
         requires_key: bool,
     };
+    const ResumeRequest = struct {
+        session_id: [16]u8,
+        /// Number of messages the client received in the session so far.
+        /// Messages starting at this sequence number must be sent again.
+        sequence: u64,
+    };
     const ConnectHeader = struct {
         capabilities: std.EnumSet(types.ClientCapabilities),
         screen_width: u16,
@@ -71,6 +82,11 @@ pub const AuthAction = enum {
     /// just invoke `sendAuthenticationResult()`
     send_auth_result,
 
+    /// The server waits for a resume request.
+    /// Provide more data from the client, then verify the session key
+    /// with `setKeyAndVerify()`.
+    expect_resume,
+
     /// Drop the connection, the authentication would fail anyways (server does not expect what client sends)
     drop,
 };
@@ -112,6 +128,9 @@ pub fn ServerStateMachine(comptime Writer: type) type {
 
         auth_token: ?CryptoState.Hash = null,
 
+        /// The key passed to `setKeyAndVerify()`, session keys are derived from it.
+        key: ?CryptoState.Key = null,
+
         receive_buffer: shared_types.MsgReceiveBuffer = .{},
         temp_msg_buffer: std.ArrayListUnmanaged(u8) = .{},
 
@@ -125,6 +144,7 @@ pub fn ServerStateMachine(comptime Writer: type) type {
 
         will_receive_username: bool = false,
         will_receive_password: bool = false,
+        resuming: bool = false,
 
         pub fn init(allocator: std.mem.Allocator, writer: Writer) Self {
             return Self{
@@ -153,6 +173,7 @@ pub fn ServerStateMachine(comptime Writer: type) type {
             const sent_auth_token = self.auth_token.?;
 
             const valid_auth_token = self.crypto.start(key, .server);
+            self.key = key;
 
             const auth_valid = std.mem.eql(u8, &sent_auth_token, &valid_auth_token);
 
@@ -205,6 +226,10 @@ pub fn ServerStateMachine(comptime Writer: type) type {
                             self.crypto.client_nonce = value.client_nonce;
                             self.will_receive_username = value.flags.has_username;
                             self.will_receive_password = value.flags.has_password;
+                            self.resuming = value.flags.resume_session;
+
+                            if (self.resuming and (self.will_receive_username or self.will_receive_password))
+                                return error.ProtocolViolation;
 
                             self.state = .acknowledge_handshake;
                             return ReceiveData.createEvent(
@@ -213,6 +238,8 @@ pub fn ServerStateMachine(comptime Writer: type) type {
                                     .initiate_handshake = .{
                                         .has_username = value.flags.has_username,
                                         .has_password = value.flags.has_password,
+                                        .wants_session = value.flags.wants_session,
+                                        .resume_session = value.flags.resume_session,
                                     },
                                 },
                             );
@@ -257,7 +284,29 @@ pub fn ServerStateMachine(comptime Writer: type) type {
                         },
                     }
                 },
+                .resume_request => {
+                    switch (try self.receive_buffer.pushData(self.allocator, new_data, expected_additional_len + @sizeOf(protocol.ResumeRequest))) {
+                        .need_more => return ReceiveData.notEnough(new_data.len),
+                        .ok => |info| {
+                            const value = try self.decryptAndGet(info, protocol.ResumeRequest);
+
+                            self.auth_token = value.auth_token;
+                            self.state = .authenticate_result;
+
+                            return ReceiveData.createEvent(
+                                info.consumed,
+                                ReceiveEvent{
+                                    .resume_request = .{
+                                        .session_id = value.session_id,
+                                        .sequence = value.sequence,
+                                    },
+                                },
+                            );
+                        },
+                    }
+                },
                 .authenticate_result => return error.UnexpectedData,
+                .session_info => return error.UnexpectedData,
                 .connect_header => {
                     switch (try self.receive_buffer.pushData(self.allocator, new_data, expected_additional_len + @sizeOf(protocol.ConnectHeader))) {
                         .need_more => return ReceiveData.notEnough(new_data.len),
@@ -396,6 +445,9 @@ pub fn ServerStateMachine(comptime Writer: type) type {
             {
                 self.state = .faulted;
                 return .drop;
+            } else if (self.resuming) {
+                self.state = .resume_request;
+                return .expect_resume;
             } else {
                 if (self.will_receive_username or self.will_receive_password) {
                     self.state = .authenticate_info;
@@ -408,15 +460,50 @@ pub fn ServerStateMachine(comptime Writer: type) type {
         }
 
         pub fn sendAuthenticationResult(self: *Self, result: protocol.AuthenticationResult.Result, encrypt_transport: bool) SendError!void {
+            try self.sendAuthenticationResultImpl(result, encrypt_transport, false);
+
+            if (result == .success) {
+                // A resumed session is established right away
+                self.state = if (self.resuming) .established else .connect_header;
+            } else {
+                self.state = .faulted;
+            }
+        }
+
+        /// Sends a successful authentication result and issues a session the client
+        /// can resume later. The returned session must be kept to verify a `resume_request`.
+        pub fn sendAuthenticationResultWithSession(self: *Self, encrypt_transport: bool) SendError!shared_types.Session {
+            std.debug.assert(!self.resuming);
+
+            try self.sendAuthenticationResultImpl(.success, encrypt_transport, true);
+
+            var bits: protocol.SessionInfo = undefined;
+            std.crypto.random.bytes(&bits.session_id);
+            std.crypto.random.bytes(&bits.secret);
+
+            const session = shared_types.Session{
+                .id = bits.session_id,
+                .key = CryptoState.deriveSessionKey(bits.secret, self.key),
+            };
+
+            try self.send(std.mem.asBytes(&bits));
+
+            self.state = .connect_header;
+
+            return session;
+        }
+
+        fn sendAuthenticationResultImpl(self: *Self, result: protocol.AuthenticationResult.Result, encrypt_transport: bool, has_session: bool) SendError!void {
             std.debug.assert(self.state == .authenticate_result);
 
-            // Encryption is only allowed when a password was provided
-            std.debug.assert(!encrypt_transport or self.will_receive_password);
+            // Encryption is only allowed when a password or session key was provided
+            std.debug.assert(!encrypt_transport or self.will_receive_password or self.resuming);
 
             var bits = protocol.AuthenticationResult{
                 .result = result,
                 .flags = .{
                     .encrypted = encrypt_transport,
+                    .has_session = has_session,
                 },
             };
 
@@ -425,12 +512,6 @@ pub fn ServerStateMachine(comptime Writer: type) type {
             // After this, crypto handshake is done, we can now successfully
             // encrypt our messages if wanted
             self.crypto.encryption_enabled = encrypt_transport;
-
-            if (result == .success) {
-                self.state = .connect_header;
-            } else {
-                self.state = .faulted;
-            }
         }
 
         pub fn sendConnectResponse(self: *Self, resources: []const protocol.ConnectResponseItem) SendError!void {
@@ -6,7 +6,9 @@ pub const State = union(enum) {
     initiate_handshake,
     acknowledge_handshake,
     authenticate_info,
+    resume_request,
     authenticate_result,
+    session_info,
     connect_header,
     connect_response,
     connect_response_item: usize,
@@ -20,6 +22,12 @@ pub const State = union(enum) {
     faulted,
 };
 
+/// A session that can be resumed after the connection was lost.
+pub const Session = struct {
+    id: [16]u8,
+    key: CryptoState.Key,
+};
+
 pub const ConsumeResult = union(enum) {
     need_more,
     ok: Info,
@@ -21,6 +21,8 @@ comptime {
     assert(@sizeOf(InitiateHandshake.Flags) == 2);
     assert(@sizeOf(AcknowledgeHandshake.Response) == 2);
     assert(@sizeOf(AuthenticationResult.Result) == 2);
+    assert(@sizeOf(SessionInfo) == 48);
+    assert(@sizeOf(ResumeRequest) == 56);
 }
 
 /// Client → Server
@@ -49,7 +51,15 @@ pub const InitiateHandshake = extern struct {
         /// can also be just a single password for a server.
         has_password: bool,
 
-        padding: u14 = 0,
+        /// Asks the server to issue a session that can be resumed after the
+        /// connection was lost, see `SessionInfo`.
+        wants_session: bool = false,
+
+        /// The client resumes a session and will send a `ResumeRequest` instead
+        /// of `AuthenticationInfo`. `has_username` and `has_password` must not be set.
+        resume_session: bool = false,
+
+        padding: u12 = 0,
     };
 };
 
@@ -111,6 +121,11 @@ pub const AuthenticationResult = extern struct {
         /// The provided user credentials are invalid or the user name is
         /// not known.
         invalid_credentials = 1,
+
+        /// The session of a `ResumeRequest` is not known anymore or can't be
+        /// resumed at the requested sequence number. The client has to connect
+        /// again with a full handshake.
+        unknown_session = 2,
     };
 
     result: Result,
@@ -122,10 +137,36 @@ pub const AuthenticationResult = extern struct {
         /// Note that it might be possible that
         encrypted: bool,
 
-        padding: u15 = 0,
+        /// A `SessionInfo` follows this message.
+        has_session: bool = false,
+
+        padding: u14 = 0,
     },
 };
 
+/// Server → Client
+/// Sent after a successful `AuthenticationResult` with `has_session` set. The session can
+/// be resumed by a new connection with a `ResumeRequest`. When the client authenticated
+/// with a password, the session key is derived from `secret` and the password key.
+pub const SessionInfo = extern struct {
+    session_id: [16]u8,
+    secret: [32]u8,
+};
+
+/// Client → Server
+/// Sent after `AcknowledgeHandshake` when `InitiateHandshake.flags.resume_session` is set.
+/// The server answers with `AuthenticationResult`. On success, the connection is established
+/// right away, and the server sends all messages starting at `sequence` again.
+pub const ResumeRequest = extern struct {
+    session_id: [16]u8,
+
+    /// `hash(client_nonce ++ server_nonce)`, keyed with the session key.
+    auth_token: [32]u8,
+
+    /// Number of messages the client has received in the established session.
+    sequence: u64,
+};
+
 /// Client → Server
 /// Sent after a successful `AuthenticationResult`. Will inform the server about
 /// the client geometry and capabilities.
@@ -0,0 +1,110 @@
+const std = @import("std");
+
+const types = @import("data-types.zig");
+const Value = @import("value.zig").Value;
+
+/// Returns the Zig type that holds a value of the protocol type `value_type`.
+pub fn ValueType(comptime value_type: types.Type) type {
+    return switch (value_type) {
+        .integer => i32,
+        .number => f32,
+        .string => []const u8,
+        .enumeration => u8,
+        .margins => types.Margins,
+        .color => types.Color,
+        .size => types.Size,
+        .point => types.Point,
+        .resource => types.ResourceID,
+        .boolean => bool,
+        .sizelist => types.SizeList,
+        .object => types.ObjectID,
+        .objectlist => []const types.ObjectID,
+        .event => types.EventID,
+        .widget => types.WidgetName,
+    };
+}
+
+/// A property name with a statically known type.
+/// The value of the property is encoded without any dynamic dispatch, and passing
+/// a value of the wrong type is a compile error.
+/// The bindings generated by `dunstblick-compiler --bindgen` declare all properties
+/// that are bound in layouts this way.
+pub fn TypedProperty(comptime property_type: types.Type) type {
+    return struct {
+        const Self = @This();
+
+        pub const value_type = property_type;
+        pub const Type = ValueType(property_type);
+
+        name: types.PropertyName,
+
+        pub fn init(name: u32) Self {
+            return Self{ .name = @intToEnum(types.PropertyName, name) };
+        }
+
+        /// Writes `value` in the wire format, without the type tag.
+        pub fn encode(encoder: anytype, value: Type) !void {
+            switch (property_type) {
+                .integer => try encoder.writeVarSInt(value),
+                .number => try encoder.writeNumber(value),
+                .string => try encoder.writeString(value),
+                .enumeration => try encoder.writeByte(value),
+                .margins => {
+                    try encoder.writeVarUInt(value.left);
+                    try encoder.writeVarUInt(value.top);
+                    try encoder.writeVarUInt(value.right);
+                    try encoder.writeVarUInt(value.bottom);
+                },
+                .color => try encoder.writeRaw(&[4]u8{ value.red, value.green, value.blue, value.alpha }),
+                .size => {
+                    try encoder.writeVarUInt(value.width);
+                    try encoder.writeVarUInt(value.height);
+                },
+                .point => {
+                    try encoder.writeVarSInt(value.x);
+                    try encoder.writeVarSInt(value.y);
+                },
+                .boolean => try encoder.writeByte(@boolToInt(value)),
+                .resource, .object, .event, .widget => try encoder.writeID(@enumToInt(value)),
+                .objectlist => {
+                    try encoder.writeVarUInt(@intCast(u32, value.len));
+                    for (value) |id| {
+                        try encoder.writeID(@enumToInt(id));
+                    }
+                },
+                // Size lists are rarely changed, they share the encoder of `Value`.
+                .sizelist => try (Value{ .sizelist = value }).serialize(encoder, false),
+            }
+        }
+    };
+}
+
+test "typed properties encode like values" {
+    const Encoder = @import("encoder.zig").Encoder;
+
+    var typed_buffer: [64]u8 = undefined;
+    var value_buffer: [64]u8 = undefined;
+
+    inline for (.{
+        .{ .type = types.Type.integer, .value = @as(i32, 1234) },
+        .{ .type = types.Type.number, .value = @as(f32, 0.5) },
+        .{ .type = types.Type.string, .value = @as([]const u8, "Hello") },
+        .{ .type = types.Type.margins, .value = types.Margins{ .left = 1, .top = 200, .right = 3, .bottom = 40000 } },
+        .{ .type = types.Type.color, .value = types.Color{ .red = 1, .green = 2, .blue = 3, .alpha = 4 } },
+        .{ .type = types.Type.object, .value = @intToEnum(types.ObjectID, 300) },
+    }) |case| {
+        var typed_stream = std.io.fixedBufferStream(&typed_buffer);
+        var typed_encoder = Encoder(@TypeOf(typed_stream.writer())).init(typed_stream.writer());
+        try TypedProperty(case.type).encode(&typed_encoder, case.value);
+
+        var value_stream = std.io.fixedBufferStream(&value_buffer);
+        var value_encoder = Encoder(@TypeOf(value_stream.writer())).init(value_stream.writer());
+        const value = @unionInit(Value, @tagName(case.type), switch (case.type) {
+            .string => types.String.readOnly(case.value),
+            else => case.value,
+        });
+        try value.serialize(&value_encoder, false);
+
+        try std.testing.expectEqualSlices(u8, value_stream.getWritten(), typed_stream.getWritten());
+    }
+}
@@ -3,13 +3,28 @@ const std = @import("std");
 pub const AnnouncementType = enum(u16) {
     discover = 0,
     respond_discover = 1,
+    announce = 2,
+    query_content = 3,
+    respond_content = 4,
+    withdraw = 5,
     _,
 };
 
+/// The discovery protocol version implemented here.
+///
+/// Version 2 replaces the `DiscoverResponse` with the compact `Announcement`, which only
+/// contains hashes of the description and the icon. Clients fetch the content with a
+/// `ContentQuery` when they don't know the hash yet. Providers also multicast their
+/// `Announcement` when they start or change, and a `Withdraw` when they shut down.
+pub const protocol_version = 2;
+
 /// magic byte sequence to recognize dunstblick messages
 pub const magic = [4]u8{ 0x73, 0xe6, 0x37, 0x28 };
 
 pub const port = 1309;
+
+/// Maximum length of the display name of an application in bytes.
+pub const max_name_length = 64;
 pub const multicast_group_v4 = [4]u8{ 224, 0, 0, 1 };
 
 /// Shared header for every
@@ -32,6 +47,30 @@ pub const Discover = extern struct {
     header: Header,
 };
 
+/// Discovery request of a client that understands version 2 of the protocol.
+/// Providers that implement version 2 respond with an `Announcement`, older
+/// ones see a plain `Discover` and respond with a `DiscoverResponse`.
+pub const DiscoverV2 = extern struct {
+    header: Header = Header.create(.discover),
+    version: u16 = protocol_version,
+};
+
+/// Identifies the description or icon of an application, the first 8 bytes of
+/// the BLAKE3 hash of the content.
+pub const ContentHash = [8]u8;
+
+pub fn computeContentHash(data: []const u8) ContentHash {
+    var hash: ContentHash = undefined;
+    std.crypto.hash.Blake3.hash(data, &hash, .{});
+    return hash;
+}
+
+pub const ContentKind = enum(u16) {
+    description = 0,
+    icon = 1,
+    _,
+};
+
 /// Response to a `Discover` message.
 /// This message contains information on how to connect to the application.
 pub const DiscoverResponse = extern struct {
@@ -106,7 +145,7 @@ pub const DiscoverResponse = extern struct {
     header: Header = Header.create(.respond_discover),
     features: Features,
     tcp_port: u16,
-    display_name: [64]u8, // NUL-padded
+    display_name: [max_name_length]u8, // NUL-padded
 
     pub fn setName(self: *@This(), str: []const u8) !void {
         if (str.len > self.display_name.len)
@@ -163,6 +202,79 @@ pub const DiscoverResponse = extern struct {
     }
 };
 
+/// Response to a `DiscoverV2` message. This message is also multicast to the
+/// discovery group when a provider starts or changes its description.
+pub const Announcement = extern struct {
+    header: Header = Header.create(.announce),
+    /// Same as in `DiscoverResponse`, `has_description` and `has_icon` tell if
+    /// the corresponding hash is valid.
+    features: DiscoverResponse.Features,
+    tcp_port: u16,
+    display_name: [max_name_length]u8, // NUL-padded
+    description_hash: ContentHash,
+    icon_hash: ContentHash,
+
+    pub fn setName(self: *@This(), str: []const u8) !void {
+        if (str.len > self.display_name.len)
+            return error.InputTooLong;
+        std.mem.set(u8, &self.display_name, 0);
+        std.mem.copy(u8, &self.display_name, str);
+    }
+
+    pub fn getName(self: @This()) []const u8 {
+        return std.mem.sliceTo(&self.display_name, 0);
+    }
+
+    pub fn getDescriptionHash(self: @This()) ?ContentHash {
+        return if (self.features.has_description) self.description_hash else null;
+    }
+
+    pub fn getIconHash(self: @This()) ?ContentHash {
+        return if (self.features.has_icon) self.icon_hash else null;
+    }
+};
+
+/// Requests the description or icon with the given hash. Sent to the
+/// address an `Announcement` was received from.
+pub const ContentQuery = extern struct {
+    header: Header = Header.create(.query_content),
+    kind: ContentKind,
+    hash: ContentHash,
+};
+
+/// Response to a `ContentQuery`. Only the first `size` bytes of `data` are sent.
+pub const ContentResponse = extern struct {
+    pub const max_length = std.math.max(DiscoverResponse.ShortDescription.max_length, DiscoverResponse.IconDescription.max_length);
+
+    header: Header = Header.create(.respond_content),
+    kind: ContentKind,
+    hash: ContentHash,
+    size: u16,
+    data: [max_length]u8,
+
+    pub fn get(self: *const @This()) []const u8 {
+        return self.data[0..std.math.min(self.data.len, self.size)];
+    }
+
+    pub fn set(self: *@This(), data: []const u8) !void {
+        if (data.len > self.data.len)
+            return error.InputTooLong;
+        self.size = @intCast(u16, data.len);
+        std.mem.copy(u8, &self.data, data);
+    }
+
+    pub fn getTotalPacketLength(self: @This()) usize {
+        return @offsetOf(@This(), "data") + self.size;
+    }
+};
+
+/// Multicast by a provider that shuts down, so clients can remove it without
+/// waiting for the discovery to time out.
+pub const Withdraw = extern struct {
+    header: Header = Header.create(.withdraw),
+    tcp_port: u16,
+};
+
 // comptime {
 //     @compileLog(@sizeOf(DiscoverResponse));
 //     for (std.meta.fields(DiscoverResponse)) |fld| {
@@ -175,12 +287,79 @@ pub const DiscoverResponse = extern struct {
 pub const Message = extern union {
     header: Header,
     discover: Discover,
+    discover_v2: DiscoverV2,
     discover_response: DiscoverResponse,
+    announcement: Announcement,
+    content_query: ContentQuery,
+    content_response: ContentResponse,
+    withdraw: Withdraw,
     max_buffer: [DiscoverResponse.buffer_size]u8,
 };
 
 comptime {
     std.debug.assert(@sizeOf(Header) == 6);
     std.debug.assert(@sizeOf(Discover) == 6);
+    std.debug.assert(@sizeOf(DiscoverV2) == 8);
     std.debug.assert(@sizeOf(DiscoverResponse) == 74);
+    std.debug.assert(@sizeOf(Announcement) == 90);
+    std.debug.assert(@sizeOf(ContentQuery) == 16);
+    std.debug.assert(@sizeOf(ContentResponse) == 530);
+    std.debug.assert(@sizeOf(Withdraw) == 8);
+}
+
+test "announcement round trip" {
+    var features = std.mem.zeroes(DiscoverResponse.Features);
+    features.has_description = true;
+
+    var announcement = Announcement{
+        .features = features,
+        .tcp_port = 1234,
+        .display_name = undefined,
+        .description_hash = computeContentHash("description"),
+        .icon_hash = undefined,
+    };
+    try announcement.setName("Calculator");
+    try std.testing.expectError(error.InputTooLong, announcement.setName("x" ** (max_name_length + 1)));
+
+    var message: Message = undefined;
+    std.mem.copy(u8, std.mem.asBytes(&message), std.mem.asBytes(&announcement));
+
+    try std.testing.expectEqual(AnnouncementType.announce, message.header.type);
+    try std.testing.expectEqualStrings("Calculator", message.announcement.getName());
+    try std.testing.expectEqual(@as(u16, 1234), message.announcement.tcp_port);
+    try std.testing.expectEqual(@as(?ContentHash, computeContentHash("description")), message.announcement.getDescriptionHash());
+    try std.testing.expectEqual(@as(?ContentHash, null), message.announcement.getIconHash());
+}
+
+test "content response only sends the used part of the buffer" {
+    var response = ContentResponse{
+        .kind = .icon,
+        .hash = computeContentHash("icon data"),
+        .size = undefined,
+        .data = undefined,
+    };
+    try response.set("icon data");
+
+    try std.testing.expectEqualStrings("icon data", response.get());
+    try std.testing.expectEqual(@offsetOf(ContentResponse, "data") + 9, response.getTotalPacketLength());
+    try std.testing.expectEqualSlices(u8, &response.hash, &computeContentHash(response.get()));
+
+    var too_long: [ContentResponse.max_length + 1]u8 = undefined;
+    try std.testing.expectError(error.InputTooLong, response.set(&too_long));
+
+    // a corrupt size must not read past the buffer
+    response.size = std.math.maxInt(u16);
+    try std.testing.expectEqual(@as(usize, ContentResponse.max_length), response.get().len);
+}
+
+test "content query layout" {
+    const query = ContentQuery{
+        .kind = .description,
+        .hash = computeContentHash("description"),
+    };
+    const bytes = std.mem.asBytes(&query);
+
+    try std.testing.expectEqualSlices(u8, &magic, bytes[0..4]);
+    try std.testing.expectEqual(AnnouncementType.query_content, std.mem.bytesToValue(Header, bytes[0..@sizeOf(Header)]).type);
+    try std.testing.expectEqualSlices(u8, &query.hash, bytes[@offsetOf(ContentQuery, "hash")..][0..@sizeOf(ContentHash)]);
 }
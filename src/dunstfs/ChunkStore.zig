@@ -0,0 +1,456 @@
+//! Content-defined chunk storage for datasets.
+//!
+//! Datasets are split into chunks with FastCDC: the chunk boundaries are derived from the
+//! data itself with a rolling gear hash, so an insertion or deletion only changes the chunks
+//! around it. Each chunk is stored once, named by its BLAKE3 hash, in a fan-out directory
+//! (`ab/abcdef…`). A dataset is a manifest that lists its chunks in order.
+//!
+//! Manifest format, all integers little endian:
+//! - magic `DFSC`, `u32` version, `u64` dataset size, `u32` chunk count
+//! - per chunk: 32 byte hash, `u32` chunk size
+
+const std = @import("std");
+
+const logger = std.log.scoped(.dfs_chunks);
+
+const ChunkStore = @This();
+
+pub const min_chunk_size = 16 << 10;
+pub const avg_chunk_size = 64 << 10;
+pub const max_chunk_size = 256 << 10;
+
+pub const manifest_magic = "DFSC";
+pub const manifest_version = 1;
+
+pub const Hash = [32]u8;
+
+pub const Entry = struct {
+    hash: Hash,
+    size: u32,
+};
+
+/// Directory that contains the fan-out directories with the chunks.
+dir: std.fs.Dir,
+
+/// Creates the fan-out directories in `dir` if necessary.
+pub fn init(dir: std.fs.Dir) !ChunkStore {
+    var i: usize = 0;
+    while (i < 256) : (i += 1) {
+        var name: [2]u8 = undefined;
+        _ = std.fmt.bufPrint(&name, "{x:0>2}", .{i}) catch unreachable;
+        dir.makeDir(&name) catch |err| switch (err) {
+            error.PathAlreadyExists => {},
+            else => |e| return e,
+        };
+    }
+    return ChunkStore{ .dir = dir };
+}
+
+const ChunkPath = [2 + 1 + 2 * @sizeOf(Hash)]u8;
+
+fn getChunkPath(hash: Hash) ChunkPath {
+    var path: ChunkPath = undefined;
+    _ = std.fmt.bufPrint(&path, "{s}/{s}", .{
+        std.fmt.fmtSliceHexLower(hash[0..1]),
+        std.fmt.fmtSliceHexLower(&hash),
+    }) catch unreachable;
+    return path;
+}
+
+pub fn hasChunk(self: ChunkStore, hash: Hash) bool {
+    const path = getChunkPath(hash);
+    self.dir.access(&path, .{}) catch return false;
+    return true;
+}
+
+/// Stores `data` as the chunk `hash`. The chunk is written to a temporary file first,
+/// so concurrent ingests of the same chunk and crashes never leave a broken chunk.
+fn storeChunk(self: ChunkStore, hash: Hash, data: []const u8) !void {
+    const path = getChunkPath(hash);
+
+    var random: [8]u8 = undefined;
+    std.crypto.random.bytes(&random);
+
+    var temp_path: [path.len + 1 + 2 * random.len]u8 = undefined;
+    _ = std.fmt.bufPrint(&temp_path, "{s}.{s}", .{ &path, std.fmt.fmtSliceHexLower(&random) }) catch unreachable;
+
+    {
+        var file = try self.dir.createFile(&temp_path, .{ .exclusive = true, .mode = 0o444 });
+        defer file.close();
+        errdefer self.dir.deleteFile(&temp_path) catch {};
+
+        try file.writeAll(data);
+    }
+    errdefer self.dir.deleteFile(&temp_path) catch {};
+
+    try self.dir.rename(&temp_path, &path);
+}
+
+/// Deletes the temporary files of chunks that were interrupted by a crash.
+pub fn removeIncompleteChunks(self: ChunkStore) !void {
+    var i: usize = 0;
+    while (i < 256) : (i += 1) {
+        var name: [2]u8 = undefined;
+        _ = std.fmt.bufPrint(&name, "{x:0>2}", .{i}) catch unreachable;
+
+        var dir = try self.dir.openDir(&name, .{ .iterate = true });
+        defer dir.close();
+
+        var iter = dir.iterate();
+        while (try iter.next()) |entry| {
+            // complete chunks are named by their hash only, temporary files have a random suffix
+            if (entry.kind == .File and std.mem.indexOfScalar(u8, entry.name, '.') != null) {
+                logger.info("deleting incomplete chunk {s}/{s}", .{ &name, entry.name });
+                try dir.deleteFile(entry.name);
+            }
+        }
+    }
+}
+
+/// Splits a stream into chunks, stores the new ones and collects the manifest.
+/// The data is cut into chunks in batches, and the chunks of a batch are hashed on
+/// up to `thread_count` threads.
+pub const Writer = struct {
+    /// Number of bytes that are cut into chunks at once.
+    pub const batch_size = 8 << 20;
+
+    store: ChunkStore,
+    thread_count: usize,
+
+    /// Data that isn't chunked yet is in `buffer[start..end]`.
+    buffer: []u8,
+    start: usize = 0,
+    end: usize = 0,
+
+    /// Chunks of the current batch, points into `buffer`.
+    batch: std.ArrayListUnmanaged([]const u8) = .{},
+
+    entries: std.ArrayList(Entry),
+    size: u64 = 0,
+
+    /// Number of bytes in chunks that weren't stored already.
+    new_bytes: u64 = 0,
+
+    pub fn init(allocator: std.mem.Allocator, store: ChunkStore, thread_count: usize) !Writer {
+        return Writer{
+            .store = store,
+            .thread_count = std.math.max(1, thread_count),
+            .buffer = try allocator.alloc(u8, batch_size + max_chunk_size),
+            .entries = std.ArrayList(Entry).init(allocator),
+        };
+    }
+
+    pub fn deinit(self: *Writer) void {
+        self.entries.allocator.free(self.buffer);
+        self.batch.deinit(self.entries.allocator);
+        self.entries.deinit();
+        self.* = undefined;
+    }
+
+    pub fn write(self: *Writer, data: []const u8) !void {
+        var rest = data;
+        while (rest.len > 0) {
+            if (self.end == self.buffer.len) {
+                try self.emitChunks(false);
+                std.mem.copy(u8, self.buffer, self.buffer[self.start..self.end]);
+                self.end -= self.start;
+                self.start = 0;
+            }
+
+            const len = std.math.min(rest.len, self.buffer.len - self.end);
+            std.mem.copy(u8, self.buffer[self.end..], rest[0..len]);
+            self.end += len;
+            rest = rest[len..];
+        }
+    }
+
+    /// Stores the rest of the data. Must be called after the last `write()`.
+    pub fn finish(self: *Writer) !void {
+        try self.emitChunks(true);
+    }
+
+    /// Cuts the buffered data into chunks, hashes them and stores the new ones. Unless
+    /// `final` is set, less than `max_chunk_size` bytes stay in the buffer, as the next
+    /// cut point may depend on data that wasn't written yet.
+    fn emitChunks(self: *Writer, final: bool) !void {
+        const allocator = self.entries.allocator;
+        const first = self.entries.items.len;
+
+        self.batch.shrinkRetainingCapacity(0);
+
+        // a full chunk is always cut inside `max_chunk_size`
+        var offset = self.start;
+        while (offset < self.end and (final or self.end - offset >= max_chunk_size)) {
+            const data = self.buffer[offset..self.end];
+            const chunk = data[0..findCutPoint(data)];
+
+            try self.batch.append(allocator, chunk);
+            try self.entries.append(Entry{ .hash = undefined, .size = @intCast(u32, chunk.len) });
+            offset += chunk.len;
+        }
+
+        const entries = self.entries.items[first..];
+        {
+            var job = HashJob{ .chunks = self.batch.items, .entries = entries };
+
+            var threads: [63]std.Thread = undefined;
+            var spawned: usize = 0;
+            defer for (threads[0..spawned]) |thread| {
+                thread.join();
+            };
+
+            const wanted = std.math.min(std.math.min(self.thread_count, entries.len), threads.len + 1);
+            while (spawned + 1 < wanted) : (spawned += 1) {
+                threads[spawned] = std.Thread.spawn(.{}, HashJob.work, .{&job}) catch break;
+            }
+
+            // the calling thread hashes chunks as well
+            job.work();
+        }
+
+        for (entries) |entry, i| {
+            const chunk = self.batch.items[i];
+            if (!self.store.hasChunk(entry.hash)) {
+                try self.store.storeChunk(entry.hash, chunk);
+                self.new_bytes += chunk.len;
+            }
+        }
+
+        self.size += offset - self.start;
+        self.start = offset;
+    }
+
+    const HashJob = struct {
+        chunks: []const []const u8,
+        entries: []Entry,
+        next: usize = 0,
+
+        fn work(job: *HashJob) void {
+            while (true) {
+                const index = @atomicRmw(usize, &job.next, .Add, 1, .Monotonic);
+                if (index >= job.entries.len)
+                    return;
+
+                std.crypto.hash.Blake3.hash(job.chunks[index], &job.entries[index].hash, .{});
+            }
+        }
+    };
+
+    pub fn writeManifest(self: Writer, writer: anytype) !void {
+        try writer.writeAll(manifest_magic);
+        try writer.writeIntLittle(u32, manifest_version);
+        try writer.writeIntLittle(u64, self.size);
+        try writer.writeIntLittle(u32, @intCast(u32, self.entries.items.len));
+        for (self.entries.items) |entry| {
+            try writer.writeAll(&entry.hash);
+            try writer.writeIntLittle(u32, entry.size);
+        }
+    }
+};
+
+pub const ManifestHeader = struct {
+    size: u64,
+    chunk_count: u32,
+};
+
+pub fn readManifestHeader(reader: anytype) !ManifestHeader {
+    var magic: [manifest_magic.len]u8 = undefined;
+    try reader.readNoEof(&magic);
+    if (!std.mem.eql(u8, &magic, manifest_magic))
+        return error.InvalidManifest;
+    if ((try reader.readIntLittle(u32)) != manifest_version)
+        return error.InvalidManifest;
+
+    return ManifestHeader{
+        .size = try reader.readIntLittle(u64),
+        .chunk_count = try reader.readIntLittle(u32),
+    };
+}
+
+/// Reassembles the dataset described by the manifest in `manifest_file` into `target`.
+/// The chunks are copied one after another, on Linux without passing through user space.
+/// Returns the size of the dataset.
+pub fn reassemble(self: ChunkStore, manifest_file: std.fs.File, target: std.fs.File) !u64 {
+    var buffered = std.io.bufferedReader(manifest_file.reader());
+    const reader = buffered.reader();
+
+    const header = try readManifestHeader(reader);
+
+    var offset: u64 = 0;
+    var i: u32 = 0;
+    while (i < header.chunk_count) : (i += 1) {
+        var entry: Entry = undefined;
+        try reader.readNoEof(&entry.hash);
+        entry.size = try reader.readIntLittle(u32);
+
+        const path = getChunkPath(entry.hash);
+        var chunk = self.dir.openFile(&path, .{}) catch |err| {
+            logger.err("failed to open chunk {s}: {s}", .{ &path, @errorName(err) });
+            return err;
+        };
+        defer chunk.close();
+
+        const copied = try chunk.copyRangeAll(0, target, offset, entry.size);
+        if (copied != entry.size)
+            return error.CorruptDataset;
+        offset += copied;
+    }
+
+    if (offset != header.size)
+        return error.CorruptDataset;
+    return offset;
+}
+
+/// Random, but fixed values for the gear hash. Changing them changes all chunk boundaries.
+const gear = blk: {
+    @setEvalBranchQuota(10_000);
+    var table: [256]u64 = undefined;
+    var state: u64 = 0x2545F4914F6CDD1D;
+    for (table) |*entry| {
+        // SplitMix64
+        state +%= 0x9E3779B97F4A7C15;
+        var z = state;
+        z = (z ^ (z >> 30)) *% 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) *% 0x94D049BB133111EB;
+        entry.* = z ^ (z >> 31);
+    }
+    break :blk table;
+};
+
+fn topBitsMask(comptime bits: u6) u64 {
+    return ~(@as(u64, std.math.maxInt(u64)) >> bits);
+}
+
+// Normalized chunking: a stricter mask before the average size and a looser one after it
+// keep most chunks close to the average size. The masks use the upper bits of the gear
+// hash, which depend on the last 64 bytes.
+const mask_small = topBitsMask(std.math.log2_int(u64, avg_chunk_size) + 2);
+const mask_large = topBitsMask(std.math.log2_int(u64, avg_chunk_size) - 2);
+
+/// Returns the length of the first chunk of `data`.
+fn findCutPoint(data: []const u8) usize {
+    if (data.len <= min_chunk_size)
+        return data.len;
+
+    const len = std.math.min(data.len, max_chunk_size);
+    const normal = std.math.min(len, avg_chunk_size);
+
+    var hash: u64 = 0;
+    var i: usize = min_chunk_size;
+    while (i < normal) : (i += 1) {
+        hash = (hash << 1) +% gear[data[i]];
+        if (hash & mask_small == 0)
+            return i + 1;
+    }
+    while (i < len) : (i += 1) {
+        hash = (hash << 1) +% gear[data[i]];
+        if (hash & mask_large == 0)
+            return i + 1;
+    }
+    return len;
+}
+
+fn fillTestData(data: []u8) void {
+    var rng = std.rand.DefaultPrng.init(1234);
+    rng.random().bytes(data);
+}
+
+fn collectCutPoints(allocator: std.mem.Allocator, data: []const u8) ![]usize {
+    var points = std.ArrayList(usize).init(allocator);
+    errdefer points.deinit();
+
+    var offset: usize = 0;
+    while (offset < data.len) {
+        offset += findCutPoint(data[offset..]);
+        try points.append(offset);
+    }
+    return points.toOwnedSlice();
+}
+
+test "chunk boundaries resynchronize after an insertion" {
+    const allocator = std.testing.allocator;
+
+    const original = try allocator.alloc(u8, 4 << 20);
+    defer allocator.free(original);
+    fillTestData(original);
+
+    // insert a few bytes close to the start
+    const modified = try std.mem.concat(allocator, u8, &.{ original[0..1000], "inserted", original[1000..] });
+    defer allocator.free(modified);
+
+    const original_points = try collectCutPoints(allocator, original);
+    defer allocator.free(original_points);
+    const modified_points = try collectCutPoints(allocator, modified);
+    defer allocator.free(modified_points);
+
+    for (original_points) |point, i| {
+        const size = point - if (i > 0) original_points[i - 1] else 0;
+        try std.testing.expect(size <= max_chunk_size);
+        if (point < original.len)
+            try std.testing.expect(size >= min_chunk_size);
+    }
+
+    // all but the first chunk must be shared
+    var shared: usize = 0;
+    for (original_points) |point| {
+        if (std.mem.indexOfScalar(usize, modified_points, point + 8) != null)
+            shared += 1;
+    }
+    try std.testing.expect(shared + 1 >= original_points.len);
+}
+
+test "chunked round trip" {
+    const allocator = std.testing.allocator;
+
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+
+    const store = try ChunkStore.init(tmp.dir);
+
+    // more than a batch, so the chunks are cut and hashed in two steps
+    const data = try allocator.alloc(u8, Writer.batch_size + (1 << 20));
+    defer allocator.free(data);
+    fillTestData(data);
+
+    var manifest = std.ArrayList(u8).init(allocator);
+    defer manifest.deinit();
+
+    {
+        var writer = try Writer.init(allocator, store, 4);
+        defer writer.deinit();
+
+        // odd write sizes to cross the buffer boundaries
+        var offset: usize = 0;
+        while (offset < data.len) : (offset += 100_000) {
+            try writer.write(data[offset..std.math.min(offset + 100_000, data.len)]);
+        }
+        try writer.finish();
+
+        try std.testing.expectEqual(@as(u64, data.len), writer.new_bytes);
+        try writer.writeManifest(manifest.writer());
+    }
+
+    // storing the same data again doesn't store any new chunk
+    {
+        var writer = try Writer.init(allocator, store, 4);
+        defer writer.deinit();
+
+        try writer.write(data);
+        try writer.finish();
+        try std.testing.expectEqual(@as(u64, 0), writer.new_bytes);
+    }
+
+    try tmp.dir.writeFile("manifest", manifest.items);
+
+    var manifest_file = try tmp.dir.openFile("manifest", .{});
+    defer manifest_file.close();
+
+    var target = try tmp.dir.createFile("target", .{ .read = true });
+    defer target.close();
+
+    try std.testing.expectEqual(@as(u64, data.len), try store.reassemble(manifest_file, target));
+
+    const result = try tmp.dir.readFileAlloc(allocator, "target", data.len + 1);
+    defer allocator.free(result);
+    try std.testing.expectEqualSlices(u8, data, result);
+}
@@ -0,0 +1,306 @@
+//! Multi-threaded BLAKE3 hashing for large files.
+//!
+//! BLAKE3 is a hash tree: the input is split into 1 KiB chunks, and the chaining values of
+//! two neighbouring subtrees are combined by a parent node. The left subtree always spans
+//! the largest power of two chunks that is smaller than the input. This makes subtrees of
+//! `segment_size` bytes independent of each other, so they can be hashed on all CPUs and
+//! merged afterwards. The result is identical to `std.crypto.hash.Blake3`.
+//!
+//! `std.crypto.hash.Blake3` only exposes the root hash, so the compression function
+//! is implemented here again.
+
+const std = @import("std");
+
+const chunk_len = 1024;
+const block_len = 64;
+
+/// Number of bytes in a segment, the unit that is hashed by a single thread.
+/// Must be a power of two multiple of the chunk size.
+pub const segment_size = 256 * chunk_len;
+
+/// Below this size, hashing on multiple threads costs more than it saves.
+pub const parallel_threshold = 4 * segment_size;
+
+const iv = [8]u32{ 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+const msg_permutation = [16]u8{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+
+const Flags = struct {
+    const chunk_start: u32 = 1;
+    const chunk_end: u32 = 2;
+    const parent: u32 = 4;
+    const root: u32 = 8;
+};
+
+const ChainingValue = [8]u32;
+
+fn g(state: *[16]u32, a: usize, b: usize, c: usize, d: usize, mx: u32, my: u32) void {
+    state[a] = state[a] +% state[b] +% mx;
+    state[d] = std.math.rotr(u32, state[d] ^ state[a], 16);
+    state[c] = state[c] +% state[d];
+    state[b] = std.math.rotr(u32, state[b] ^ state[c], 12);
+    state[a] = state[a] +% state[b] +% my;
+    state[d] = std.math.rotr(u32, state[d] ^ state[a], 8);
+    state[c] = state[c] +% state[d];
+    state[b] = std.math.rotr(u32, state[b] ^ state[c], 7);
+}
+
+fn compress(cv: ChainingValue, block: [16]u32, counter: u64, len: u32, flags: u32) ChainingValue {
+    var state = [16]u32{
+        cv[0],                    cv[1],                            cv[2], cv[3],
+        cv[4],                    cv[5],                            cv[6], cv[7],
+        iv[0],                    iv[1],                            iv[2], iv[3],
+        @truncate(u32, counter), @truncate(u32, counter >> 32), len,   flags,
+    };
+
+    var m = block;
+    var round: usize = 0;
+    while (round < 7) : (round += 1) {
+        g(&state, 0, 4, 8, 12, m[0], m[1]);
+        g(&state, 1, 5, 9, 13, m[2], m[3]);
+        g(&state, 2, 6, 10, 14, m[4], m[5]);
+        g(&state, 3, 7, 11, 15, m[6], m[7]);
+        g(&state, 0, 5, 10, 15, m[8], m[9]);
+        g(&state, 1, 6, 11, 12, m[10], m[11]);
+        g(&state, 2, 7, 8, 13, m[12], m[13]);
+        g(&state, 3, 4, 9, 14, m[14], m[15]);
+
+        var permuted: [16]u32 = undefined;
+        for (permuted) |*word, i| {
+            word.* = m[msg_permutation[i]];
+        }
+        m = permuted;
+    }
+
+    var result: ChainingValue = undefined;
+    for (result) |*word, i| {
+        word.* = state[i] ^ state[i + 8];
+    }
+    return result;
+}
+
+fn chunkCv(data: []const u8, counter: u64, root: bool) ChainingValue {
+    std.debug.assert(data.len <= chunk_len);
+
+    var cv = iv;
+    var offset: usize = 0;
+    while (true) {
+        const len = std.math.min(block_len, data.len - offset);
+
+        var bytes = [_]u8{0} ** block_len;
+        std.mem.copy(u8, &bytes, data[offset..][0..len]);
+
+        var block: [16]u32 = undefined;
+        for (block) |*word, i| {
+            word.* = std.mem.readIntLittle(u32, bytes[4 * i ..][0..4]);
+        }
+
+        const is_last = (offset + len == data.len);
+
+        var flags: u32 = 0;
+        if (offset == 0) flags |= Flags.chunk_start;
+        if (is_last) flags |= Flags.chunk_end;
+        if (is_last and root) flags |= Flags.root;
+
+        cv = compress(cv, block, counter, @intCast(u32, len), flags);
+
+        offset += len;
+        if (is_last)
+            return cv;
+    }
+}
+
+fn parentCv(left: ChainingValue, right: ChainingValue, root: bool) ChainingValue {
+    var block: [16]u32 = undefined;
+    std.mem.copy(u32, block[0..8], &left);
+    std.mem.copy(u32, block[8..16], &right);
+    return compress(iv, block, 0, block_len, Flags.parent | if (root) Flags.root else 0);
+}
+
+/// Returns the largest power of two that is smaller than `n`.
+fn leftSubtreeSize(n: u64) u64 {
+    std.debug.assert(n > 1);
+    return @as(u64, 1) << std.math.log2_int(u64, n - 1);
+}
+
+/// Computes the chaining value of the subtree that covers `data`, which starts at chunk `counter`.
+fn subtreeCv(data: []const u8, counter: u64) ChainingValue {
+    if (data.len <= chunk_len)
+        return chunkCv(data, counter, false);
+
+    const chunks = (data.len + chunk_len - 1) / chunk_len;
+    const left_chunks = leftSubtreeSize(chunks);
+    const left_len = chunk_len * left_chunks;
+
+    return parentCv(
+        subtreeCv(data[0..left_len], counter),
+        subtreeCv(data[left_len..], counter + left_chunks),
+        false,
+    );
+}
+
+/// Merges the chaining values of consecutive segments, following the tree layout of BLAKE3.
+fn mergeSegments(cvs: []const ChainingValue, root: bool) ChainingValue {
+    if (cvs.len == 1) {
+        std.debug.assert(!root);
+        return cvs[0];
+    }
+    const left = leftSubtreeSize(cvs.len);
+    return parentCv(mergeSegments(cvs[0..left], false), mergeSegments(cvs[left..], false), root);
+}
+
+/// Hashes data in parallel on multiple threads. The data is passed in pieces of
+/// whole segments with `update()`, so large files can be hashed while they are read.
+pub const ParallelHasher = struct {
+    const Self = @This();
+
+    allocator: std.mem.Allocator,
+    thread_count: usize,
+
+    /// Chaining values of all segments passed so far.
+    segments: std.ArrayList(ChainingValue),
+
+    pub fn init(allocator: std.mem.Allocator, thread_count: usize) Self {
+        return Self{
+            .allocator = allocator,
+            .thread_count = std.math.max(1, thread_count),
+            .segments = std.ArrayList(ChainingValue).init(allocator),
+        };
+    }
+
+    pub fn deinit(self: *Self) void {
+        self.segments.deinit();
+        self.* = undefined;
+    }
+
+    /// Hashes the next part of the input. `data.len` must be a multiple of `segment_size`.
+    /// An input of a single segment must be passed to `final()`, as its root node is inside the segment.
+    pub fn update(self: *Self, data: []const u8) !void {
+        std.debug.assert(data.len % segment_size == 0);
+        try self.hashSegments(data);
+    }
+
+    /// Hashes the rest of the input, which may have any size, and returns the hash.
+    pub fn final(self: *Self, data: []const u8) ![32]u8 {
+        var out: [32]u8 = undefined;
+
+        if (self.segments.items.len == 0 and data.len <= segment_size) {
+            // the whole input is a single segment, its root is a chunk or parent node inside it
+            std.crypto.hash.Blake3.hash(data, &out, .{});
+            return out;
+        }
+
+        try self.hashSegments(data);
+        std.debug.assert(self.segments.items.len > 1);
+
+        const root = mergeSegments(self.segments.items, true);
+        for (root) |word, i| {
+            std.mem.writeIntLittle(u32, out[4 * i ..][0..4], word);
+        }
+        return out;
+    }
+
+    fn hashSegments(self: *Self, data: []const u8) !void {
+        const count = (data.len + segment_size - 1) / segment_size;
+        if (count == 0)
+            return;
+
+        const first = self.segments.items.len;
+        try self.segments.resize(first + count);
+
+        var job = Job{
+            .data = data,
+            .cvs = self.segments.items[first..],
+            .first_counter = @as(u64, first) * (segment_size / chunk_len),
+        };
+
+        var threads: [63]std.Thread = undefined;
+        var spawned: usize = 0;
+        defer for (threads[0..spawned]) |thread| {
+            thread.join();
+        };
+
+        const wanted = std.math.min(std.math.min(self.thread_count, count), threads.len + 1);
+        while (spawned + 1 < wanted) : (spawned += 1) {
+            threads[spawned] = std.Thread.spawn(.{}, Job.work, .{&job}) catch break;
+        }
+
+        // the calling thread hashes segments as well
+        job.work();
+    }
+
+    const Job = struct {
+        data: []const u8,
+        cvs: []ChainingValue,
+        first_counter: u64,
+        next: usize = 0,
+
+        fn work(job: *Job) void {
+            while (true) {
+                const index = @atomicRmw(usize, &job.next, .Add, 1, .Monotonic);
+                if (index >= job.cvs.len)
+                    return;
+
+                const offset = segment_size * index;
+                const end = std.math.min(offset + segment_size, job.data.len);
+                job.cvs[index] = subtreeCv(job.data[offset..end], job.first_counter + index * (segment_size / chunk_len));
+            }
+        }
+    };
+};
+
+/// Hashes `data` on up to `thread_count` threads.
+pub fn hash(allocator: std.mem.Allocator, data: []const u8, thread_count: usize) ![32]u8 {
+    var hasher = ParallelHasher.init(allocator, thread_count);
+    defer hasher.deinit();
+
+    return try hasher.final(data);
+}
+
+fn fillTestData(data: []u8) void {
+    for (data) |*c, i| {
+        c.* = @truncate(u8, i *% 31 +% (i >> 10));
+    }
+}
+
+test "tree hash matches std.crypto.hash.Blake3" {
+    const data = try std.testing.allocator.alloc(u8, 5 * segment_size + 3 * chunk_len + 17);
+    defer std.testing.allocator.free(data);
+    fillTestData(data);
+
+    for ([_]usize{ 0, 1, 64, 1023, 1024, 1025, 4096, 5000, segment_size, segment_size + 1, 2 * segment_size, 3 * segment_size + 1, data.len }) |len| {
+        var expected: [32]u8 = undefined;
+        std.crypto.hash.Blake3.hash(data[0..len], &expected, .{});
+
+        try std.testing.expectEqual(expected, try hash(std.testing.allocator, data[0..len], 4));
+
+        // also check the subtree logic below the segment size
+        if (len > chunk_len and len <= segment_size) {
+            const chunks = (len + chunk_len - 1) / chunk_len;
+            const left = chunk_len * leftSubtreeSize(chunks);
+            const root = parentCv(subtreeCv(data[0..left], 0), subtreeCv(data[left..len], left / chunk_len), true);
+
+            var actual: [32]u8 = undefined;
+            for (root) |word, i| {
+                std.mem.writeIntLittle(u32, actual[4 * i ..][0..4], word);
+            }
+            try std.testing.expectEqual(expected, actual);
+        }
+    }
+}
+
+test "incremental tree hash" {
+    const data = try std.testing.allocator.alloc(u8, 7 * segment_size + 100);
+    defer std.testing.allocator.free(data);
+    fillTestData(data);
+
+    var expected: [32]u8 = undefined;
+    std.crypto.hash.Blake3.hash(data, &expected, .{});
+
+    var hasher = ParallelHasher.init(std.testing.allocator, 3);
+    defer hasher.deinit();
+
+    try hasher.update(data[0 .. 2 * segment_size]);
+    try hasher.update(data[2 * segment_size .. 7 * segment_size]);
+    try std.testing.expectEqual(expected, try hasher.final(data[7 * segment_size ..]));
+}
@@ -5,6 +5,7 @@ const builtin = @import("builtin");
 const Uuid = @import("uuid6");
 const sqlite3 = @import("sqlite3");
 const dunst_environment = @import("dunst-environment");
+const rpc_server = @import("dunst-rpc-server");
 
 const libmagic = @import("magic.zig");
 const MagicSet = libmagic.MagicSet;
@@ -12,15 +13,18 @@ const MagicSet = libmagic.MagicSet;
 const logger = std.log.scoped(.dfs);
 
 const rpc = @import("rpc.zig");
+const blake3 = @import("blake3.zig");
+const ChunkStore = @import("ChunkStore.zig");
 
 fn printUsage(stream: anytype, exe_name: []const u8) !void {
     _ = exe_name;
     try stream.writeAll(
-        \\dfs-daemon [-h] [-e] [-v] [--version]
-        \\  -h, --help     Show this help
-        \\  -e, --expose   Expose service to public interface
-        \\  -v, --verbose  Prints more diagnostics
-        \\      --version  Prints version information
+        \\dfs-daemon [-h] [-e] [-v] [--version] [--whole-files]
+        \\  -h, --help         Show this help
+        \\  -e, --expose       Expose service to public interface
+        \\  -v, --verbose      Prints more diagnostics
+        \\      --version      Prints version information
+        \\      --whole-files  Stores new datasets as whole files instead of deduplicated chunks
         \\
     );
 }
@@ -34,13 +38,14 @@ const version = struct {
     const patch = 0;
 };
 
-const RpcHostEndPoint = rpc.Definition.HostEndPoint(network.Socket.Reader, network.Socket.Writer, SystemInterface);
+const RpcHostEndPoint = rpc.Definition.HostEndPoint(rpc_server.Stream.Reader, rpc_server.Stream.Writer, SystemInterface);
 
 const CliOptions = struct {
     help: bool = false,
     expose: bool = false,
     version: bool = false,
     verbose: bool = false,
+    @"whole-files": bool = false,
 
     pub const shorthands = .{
         .h = "help",
@@ -100,9 +105,23 @@ pub fn main() !u8 {
     };
 
     logger.info("Open dataset folder...", .{});
-    var dataset_dir = try root_dir.openDir("datasets", .{});
+    var dataset_dir = try root_dir.openDir("datasets", .{ .iterate = true });
     defer dataset_dir.close();
 
+    try removeIncompleteIngests(dataset_dir);
+
+    logger.info("Open chunk store...", .{});
+    dataset_dir.makeDir("chunks") catch |err| switch (err) {
+        error.PathAlreadyExists => {},
+        else => |e| return e,
+    };
+
+    var chunk_dir = try dataset_dir.openDir("chunks", .{});
+    defer chunk_dir.close();
+
+    const chunk_store = try ChunkStore.init(chunk_dir);
+    try chunk_store.removeIncompleteChunks();
+
     // meh. sqlite needs this (still), though
     try root_dir.setAsCwd();
 
@@ -114,48 +133,50 @@ pub fn main() !u8 {
 
     var interface = SystemInterface{
         .allocator = global_allocator,
-        .db = undefined,
-        .db_intf = undefined,
+        .databases = DatabasePool.init(global_allocator, "storage.db3"),
         .dataset_dir = dataset_dir,
+        .chunk_store = chunk_store,
+        .chunk_datasets = !cli.options.@"whole-files",
         .uuid_source = source,
     };
 
-    logger.info("Opening sqlite3 databse...", .{});
-    interface.db = try sqlite3.Db.init(.{
-        .mode = .{ .File = "storage.db3" },
-        .open_flags = .{
-            .write = true,
-            .create = true,
-        },
-    });
-    defer interface.db.deinit();
-
-    logger.info("Initialize database...", .{});
-    inline for (prepared_statement_sources.init_statements) |code| {
-        var init_db_stmt = interface.db.prepareDynamic(code) catch |err| {
-            logger.err("error while executing sql:\n{s}", .{code});
-            return err;
-        };
-        defer init_db_stmt.deinit();
+    defer interface.databases.deinit();
 
-        try init_db_stmt.exec(.{}, .{});
-    }
+    {
+        logger.info("Opening sqlite3 databse...", .{});
+        var db = try sqlite3.Db.init(.{
+            .mode = .{ .File = "storage.db3" },
+            .open_flags = .{
+                .write = true,
+                .create = true,
+            },
+        });
+        defer db.deinit();
 
-    logger.info("Create prepared statements...", .{});
+        logger.info("Initialize database...", .{});
+        inline for (prepared_statement_sources.init_statements) |code| {
+            var init_db_stmt = db.prepareDynamic(code) catch |err| {
+                logger.err("error while executing sql:\n{s}", .{code});
+                return err;
+            };
+            defer init_db_stmt.deinit();
 
-    var diags = sqlite3.Diagnostics{};
-    inline for (comptime std.meta.fields(DatabaseInterface)) |fld| {
-        @field(interface.db_intf, fld.name) = interface.db.prepareWithDiags(@field(prepared_statement_sources, fld.name), .{
-            .diags = &diags,
-        }) catch |err| {
-            logger.err("failed to initialize db statement: {}, {}", .{
-                err,
-                diags,
-            });
+            try init_db_stmt.exec(.{}, .{});
+        }
+
+        // With a write-ahead log, readers don't block the writer and the writer doesn't
+        // block readers. The journal mode is stored in the database file.
+        if (sqlite3.c.sqlite3_exec(db.db, "PRAGMA journal_mode = WAL", null, null, null) != sqlite3.c.SQLITE_OK) {
+            logger.err("failed to enable the write-ahead log: {}", .{db.getDetailedError()});
             return 1;
-        };
+        }
     }
 
+    logger.info("Create prepared statements...", .{});
+
+    // Verifies the statements early, the connection is reused by the first client
+    interface.databases.release(interface.databases.acquire() catch return 1);
+
     logger.info("Prepare RPC interface...", .{});
 
     var listener = try network.Socket.create(.ipv4, .tcp);
@@ -172,15 +193,12 @@ pub fn main() !u8 {
 
     logger.info("Starting RPC interface...", .{});
 
-    logger.info("ready.", .{});
+    var server = try ManagementServer.init(global_allocator, &interface, .{});
+    defer server.deinit();
 
-    while (true) {
-        var client_socket = try listener.accept();
-        errdefer client_socket.close();
+    logger.info("ready.", .{});
 
-        var management_thread = try std.Thread.spawn(.{}, processManagementConnectionSafe, .{ client_socket, &interface });
-        management_thread.detach();
-    }
+    try server.run(listener);
 
     return 0;
 }
@@ -194,10 +212,14 @@ const SystemInterface = struct {
     };
 
     allocator: std.mem.Allocator,
-    global_lock: std.Thread.Mutex = .{},
-    db: sqlite3.Db,
-    db_intf: DatabaseInterface,
+    /// Every request uses its own connection, so reads run concurrently.
+    databases: DatabasePool,
+    /// Serializes all writes to the database, see `beginWrite()`.
+    write_lock: std.Thread.Mutex = .{},
     dataset_dir: std.fs.Dir,
+    chunk_store: ChunkStore,
+    /// Stores new datasets as chunks. Chunked datasets are readable either way.
+    chunk_datasets: bool,
     uuid_source: Uuid.v4.Source,
 
     // pub fn getServiceStatus(service: []const u8) rpc.ServiceControlError!rpc.ServiceStatus {
@@ -211,23 +233,53 @@ const SystemInterface = struct {
     //     return cmd.getServiceStatus.result;
     // }
 
-    pub fn lock(self: *SystemInterface) void {
-        self.global_lock.lock();
+    /// Returns a database connection for reading. Release it with `releaseDatabase()`.
+    fn acquireDatabase(sys: *SystemInterface) error{ IoError, OutOfMemory }!*Database {
+        return sys.databases.acquire() catch |err| switch (err) {
+            error.OutOfMemory => error.OutOfMemory,
+            else => error.IoError,
+        };
     }
 
-    pub fn unlock(self: *SystemInterface) void {
-        self.global_lock.unlock();
+    fn releaseDatabase(sys: *SystemInterface, db: *Database) void {
+        sys.databases.release(db);
     }
 
-    fn mapSqlError(sys: *SystemInterface, err: (sqlite3.Error || error{ OutOfMemory, Workaround })) error{ IoError, OutOfMemory } {
-        return switch (err) {
-            error.OutOfMemory => error.OutOfMemory,
-            else => {
-                logger.warn("mappig sql error {s} to IoError:", .{@errorName(err)});
-                logger.warn("{}", .{sys.db.getDetailedError()});
-                return error.IoError;
-            },
-        };
+    /// Returns a database connection with an open transaction. There is only a single
+    /// writer at a time, so the statements of a request never run into `SQLITE_BUSY`.
+    /// Commit the changes with `Database.commit()`, `endWrite()` rolls back everything else.
+    fn beginWrite(sys: *SystemInterface) error{ IoError, OutOfMemory }!*Database {
+        const db = try sys.acquireDatabase();
+        errdefer sys.releaseDatabase(db);
+
+        sys.write_lock.lock();
+        errdefer sys.write_lock.unlock();
+
+        db.db.exec("BEGIN IMMEDIATE", .{}, .{}) catch |err| return db.mapSqlError(err);
+
+        return db;
+    }
+
+    fn endWrite(sys: *SystemInterface, db: *Database) void {
+        db.rollback();
+        sys.write_lock.unlock();
+        sys.releaseDatabase(db);
+    }
+
+    /// Returns a database connection with an open read transaction, so requests with
+    /// several queries see a single snapshot of the database. End it with `endRead()`.
+    fn beginRead(sys: *SystemInterface) error{ IoError, OutOfMemory }!*Database {
+        const db = try sys.acquireDatabase();
+        errdefer sys.releaseDatabase(db);
+
+        db.db.exec("BEGIN", .{}, .{}) catch |err| return db.mapSqlError(err);
+
+        return db;
+    }
+
+    fn endRead(sys: *SystemInterface, db: *Database) void {
+        db.rollback();
+        sys.releaseDatabase(db);
     }
 
     // File management
@@ -245,21 +297,30 @@ const SystemInterface = struct {
         };
         defer source_file.close();
 
-        const file_hash = try computeFileHash(source_file);
-        source_file.seekTo(0) catch return error.IoError; // rewind the file
-
         const file_title = name orelse try determineFileTitle(
             rpc_wrap.allocator,
             source_file_path,
             source_file,
             MimeType.parse(mime_type),
         );
+        source_file.seekTo(0) catch return error.IoError; // rewind the file
+
+        const ingested = sys.ingestFile(rpc_wrap.allocator, source_file) catch |err| return switch (err) {
+            error.OutOfMemory => error.OutOfMemory,
+            error.AccessDenied => error.AccessDenied,
+            else => error.IoError,
+        };
+        // The temporary file is renamed by `addDataset()` or not needed, also when anything below fails
+        defer sys.dataset_dir.deleteFile(&ingested.temp_name) catch |err| switch (err) {
+            error.FileNotFound => {},
+            else => logger.err("failed to delete temporary file {s}: {s}", .{ &ingested.temp_name, @errorName(err) }),
+        };
 
         // Everything before this point is not required to be serialized with the database access.
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.beginWrite();
+        defer sys.endWrite(db);
 
-        const dataset = sys.addDataset(rpc_wrap.allocator, mime_type, source_file, file_hash) catch |err| return switch (err) {
+        const dataset = sys.addDataset(db, rpc_wrap.allocator, mime_type, &ingested) catch |err| return switch (err) {
             error.AccessDenied => error.AccessDenied,
             else => error.IoError,
         };
@@ -283,30 +344,32 @@ const SystemInterface = struct {
         const file_uuid_str = uuidToString(file_uuid);
         const file_uuid_text = sqlite3.Text{ .data = &file_uuid_str };
 
-        sys.db_intf.create_file.reset();
-        sys.db_intf.create_file.exec(.{}, .{
+        db.intf.create_file.reset();
+        db.intf.create_file.exec(.{}, .{
             file_uuid_text,
             file_title,
-        }) catch |err| return sys.mapSqlError(err);
+        }) catch |err| return db.mapSqlError(err);
 
-        sys.db_intf.add_revision.reset();
-        sys.db_intf.add_revision.exec(.{}, .{
+        db.intf.add_revision.reset();
+        db.intf.add_revision.exec(.{}, .{
             file_uuid_text,
             file_dataset,
             file_uuid_text,
-        }) catch |err| return sys.mapSqlError(err);
+        }) catch |err| return db.mapSqlError(err);
 
         logger.info("created file({s}, {s}, {s}, {s})", .{ file_title, mime_type, &dataset.checksum, dataset.creation_date });
 
         for (tags) |tag_string| {
             const tag = sqlite3.Text{ .data = tag_string };
-            sys.db_intf.add_tag.reset();
-            sys.db_intf.add_tag.exec(.{}, .{
+            db.intf.add_tag.reset();
+            db.intf.add_tag.exec(.{}, .{
                 .file = file_uuid_text,
                 .tag = tag,
-            }) catch |err| return sys.mapSqlError(err);
+            }) catch |err| return db.mapSqlError(err);
         }
 
+        db.commit() catch |err| return db.mapSqlError(err);
+
         return file_uuid;
     }
 
@@ -318,43 +381,47 @@ const SystemInterface = struct {
     }
 
     pub fn rename(sys: *SystemInterface, file: Uuid, maybe_name: ?[]const u8) rpc.RenameFileError!void {
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.beginWrite();
+        defer sys.endWrite(db);
 
-        var canonical_format = try sys.assertFile(file);
+        var canonical_format = try assertFile(db, file);
         var uuid_text = sqlite3.Text{ .data = &canonical_format };
 
         if (maybe_name) |name| {
             const name_text = sqlite3.Text{ .data = name };
 
-            sys.db_intf.set_file_name.reset();
-            sys.db_intf.set_file_name.exec(.{}, .{
+            db.intf.set_file_name.reset();
+            db.intf.set_file_name.exec(.{}, .{
                 name_text,
                 uuid_text,
-            }) catch |err| return sys.mapSqlError(err);
+            }) catch |err| return db.mapSqlError(err);
         } else {
-            sys.db_intf.delete_file_name.reset();
-            sys.db_intf.delete_file_name.exec(.{}, .{
+            db.intf.delete_file_name.reset();
+            db.intf.delete_file_name.exec(.{}, .{
                 uuid_text,
-            }) catch |err| return sys.mapSqlError(err);
+            }) catch |err| return db.mapSqlError(err);
         }
+
+        db.commit() catch |err| return db.mapSqlError(err);
     }
 
     pub fn delete(sys: *SystemInterface, file: Uuid) rpc.RemoveFileError!void {
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.beginWrite();
+        defer sys.endWrite(db);
 
-        var canonical_format = try sys.assertFile(file);
+        var canonical_format = try assertFile(db, file);
         var uuid_text = sqlite3.Text{ .data = &canonical_format };
 
-        sys.db_intf.delete_all_revisions.reset();
-        sys.db_intf.delete_all_revisions.exec(.{}, .{uuid_text}) catch |err| return sys.mapSqlError(err);
+        db.intf.delete_all_revisions.reset();
+        db.intf.delete_all_revisions.exec(.{}, .{uuid_text}) catch |err| return db.mapSqlError(err);
 
-        sys.db_intf.delete_all_tags.reset();
-        sys.db_intf.delete_all_tags.exec(.{}, .{uuid_text}) catch |err| return sys.mapSqlError(err);
+        db.intf.delete_all_tags.reset();
+        db.intf.delete_all_tags.exec(.{}, .{uuid_text}) catch |err| return db.mapSqlError(err);
 
-        sys.db_intf.delete_file.reset();
-        sys.db_intf.delete_file.exec(.{}, .{uuid_text}) catch |err| return sys.mapSqlError(err);
+        db.intf.delete_file.reset();
+        db.intf.delete_file.exec(.{}, .{uuid_text}) catch |err| return db.mapSqlError(err);
+
+        db.commit() catch |err| return db.mapSqlError(err);
     }
 
     pub fn get(sys_wrap: rpc.AllocatingCall(*SystemInterface), file: Uuid, target_file_path: []const u8) rpc.GetFileError!rpc.Revision {
@@ -365,12 +432,6 @@ const SystemInterface = struct {
             return error.InvalidDestinationFile;
         }
 
-        sys.lock();
-        defer sys.unlock();
-
-        var canonical_format = try sys.assertFile(file);
-        var uuid_text = sqlite3.Text{ .data = &canonical_format };
-
         const RevisionData = struct {
             revision: u32,
             dataset: []const u8,
@@ -378,18 +439,30 @@ const SystemInterface = struct {
             mime_type: []const u8,
         };
 
-        sys.db_intf.fetch_latest_revision.reset();
-        const maybe_raw_rev_info = sys.db_intf.fetch_latest_revision.oneAlloc(RevisionData, allocator, .{}, .{
-            uuid_text,
-        }) catch |err| return sys.mapSqlError(err);
+        // Only the lookup needs the database, the copy runs without holding a connection
+        const raw_rev_info = blk: {
+            const db = try sys.beginRead();
+            defer sys.endRead(db);
 
-        const raw_rev_info = maybe_raw_rev_info orelse {
-            logger.err("failed to get dataset for file {}: not found", .{file});
-            return error.IoError;
+            var canonical_format = try assertFile(db, file);
+            var uuid_text = sqlite3.Text{ .data = &canonical_format };
+
+            db.intf.fetch_latest_revision.reset();
+            const maybe_raw_rev_info = db.intf.fetch_latest_revision.oneAlloc(RevisionData, allocator, .{}, .{
+                uuid_text,
+            }) catch |err| return db.mapSqlError(err);
+
+            break :blk maybe_raw_rev_info orelse {
+                logger.err("failed to get dataset for file {}: not found", .{file});
+                return error.IoError;
+            };
         };
 
         const revision_string = raw_rev_info.dataset;
 
+        if (revision_string.len != 64)
+            return error.IoError;
+
         var dataset: [32]u8 = undefined;
         _ = std.fmt.hexToBytes(&dataset, revision_string) catch return error.IoError;
 
@@ -401,6 +474,27 @@ const SystemInterface = struct {
             .size = 0, // TODO: Implement these
         };
 
+        const manifest_name = getManifestName(revision_string[0..64]);
+        if (sys.dataset_dir.openFile(&manifest_name, .{})) |manifest_file| {
+            defer manifest_file.close();
+
+            revision.size = sys.reassembleDataset(manifest_file, target_file_path) catch |err| {
+                logger.err("failed to reassemble dataset {s} into file {s}: {s}", .{
+                    revision_string,
+                    target_file_path,
+                    @errorName(err),
+                });
+                return error.IoError;
+            };
+            return revision;
+        } else |err| switch (err) {
+            error.FileNotFound => {}, // stored as a whole file
+            else => {
+                logger.err("failed to open dataset manifest {s}: {s}", .{ &manifest_name, @errorName(err) });
+                return error.IoError;
+            },
+        }
+
         var file_stat = sys.dataset_dir.statFile(revision_string) catch |err| {
             logger.err("failed to stat dataset {s}: {s}", .{
                 revision_string,
@@ -428,6 +522,15 @@ const SystemInterface = struct {
         return revision;
     }
 
+    /// Streams the chunks of a dataset into a new file at `target_file_path`.
+    fn reassembleDataset(sys: *SystemInterface, manifest_file: std.fs.File, target_file_path: []const u8) !u64 {
+        var target_file = try std.fs.cwd().createFile(target_file_path, .{});
+        defer target_file.close();
+        errdefer std.fs.cwd().deleteFile(target_file_path) catch {};
+
+        return try sys.chunk_store.reassemble(manifest_file, target_file);
+    }
+
     pub fn open(file: Uuid, read_only: bool) rpc.OpenFileError!void {
         _ = file;
         _ = read_only;
@@ -436,8 +539,8 @@ const SystemInterface = struct {
 
     pub fn info(rpc_wrap: rpc.AllocatingCall(*SystemInterface), file: Uuid) rpc.FileInfoError!rpc.FileInfo {
         const sys = rpc_wrap.value;
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.beginRead();
+        defer sys.endRead(db);
 
         const Tag = struct {
             uuid: []const u8,
@@ -445,14 +548,14 @@ const SystemInterface = struct {
             last_change: []const u8,
         };
 
-        var canonical_format = try sys.assertFile(file);
+        var canonical_format = try assertFile(db, file);
         var uuid_text = sqlite3.Text{ .data = &canonical_format };
 
-        sys.db_intf.query_file_info.reset();
-        sys.db_intf.query_file_tags.reset();
-        sys.db_intf.query_file_revs.reset();
+        db.intf.query_file_info.reset();
+        db.intf.query_file_tags.reset();
+        db.intf.query_file_revs.reset();
 
-        const tag_or_null = sys.db_intf.query_file_info.oneAlloc(Tag, rpc_wrap.allocator, .{}, .{uuid_text}) catch |err| return sys.mapSqlError(err);
+        const tag_or_null = db.intf.query_file_info.oneAlloc(Tag, rpc_wrap.allocator, .{}, .{uuid_text}) catch |err| return db.mapSqlError(err);
 
         const tag: Tag = tag_or_null orelse return error.FileNotFound;
 
@@ -463,8 +566,8 @@ const SystemInterface = struct {
             creation_date: []const u8,
         };
 
-        const tags: [][]const u8 = sys.db_intf.query_file_tags.all([]const u8, rpc_wrap.allocator, .{}, .{uuid_text}) catch |err| return sys.mapSqlError(err);
-        const revisions: []Revision = sys.db_intf.query_file_revs.all(Revision, rpc_wrap.allocator, .{}, .{uuid_text}) catch |err| return sys.mapSqlError(err);
+        const tags: [][]const u8 = db.intf.query_file_tags.all([]const u8, rpc_wrap.allocator, .{}, .{uuid_text}) catch |err| return db.mapSqlError(err);
+        const revisions: []Revision = db.intf.query_file_revs.all(Revision, rpc_wrap.allocator, .{}, .{uuid_text}) catch |err| return db.mapSqlError(err);
 
         const revs = try rpc_wrap.allocator.alloc(rpc.Revision, revisions.len);
 
@@ -493,8 +596,8 @@ const SystemInterface = struct {
 
     pub fn list(rpc_wrap: rpc.AllocatingCall(*SystemInterface), skip: u32, limit: ?u32, include_filters: []const []const u8, exclude_filters: []const []const u8) rpc.ListFilesError![]rpc.FileListItem {
         const sys = rpc_wrap.value;
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.acquireDatabase();
+        defer sys.releaseDatabase(db);
 
         const query_text = blk: {
             var builder = std.ArrayList(u8).init(rpc_wrap.allocator);
@@ -552,20 +655,20 @@ const SystemInterface = struct {
 
         // std.debug.print("{s}\n", .{query_text});
 
-        var query = sys.db.prepareDynamic(query_text) catch |err| return sys.mapSqlError(err);
+        var query = db.db.prepareDynamic(query_text) catch |err| return db.mapSqlError(err);
         defer query.deinit();
 
         const real_limit: u32 = limit orelse @as(u32, std.math.maxInt(u32));
         var iter = query.iterator(FileListItemRaw, .{
             .count = real_limit,
             .offset = skip,
-        }) catch |err| return sys.mapSqlError(err);
+        }) catch |err| return db.mapSqlError(err);
 
         var items = std.ArrayList(rpc.FileListItem).init(rpc_wrap.allocator);
         defer items.deinit();
 
         while (true) {
-            const maybe_item = iter.nextAlloc(rpc_wrap.allocator, .{ .diags = null }) catch |err| return sys.mapSqlError(err);
+            const maybe_item = iter.nextAlloc(rpc_wrap.allocator, .{ .diags = null }) catch |err| return db.mapSqlError(err);
             const item = maybe_item orelse break;
             try items.append(rpc.FileListItem{
                 .uuid = Uuid.parse(item.uuid) catch |e| {
@@ -583,8 +686,8 @@ const SystemInterface = struct {
 
     pub fn find(rpc_wrap: rpc.AllocatingCall(*SystemInterface), skip: u32, limit: ?u32, filter: []const u8, exact: bool) rpc.ListFilesError![]rpc.FileListItem {
         const sys = rpc_wrap.value;
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.acquireDatabase();
+        defer sys.releaseDatabase(db);
 
         const real_limit: u32 = limit orelse std.math.maxInt(u32);
 
@@ -593,8 +696,8 @@ const SystemInterface = struct {
             real_filter.data = try std.fmt.allocPrint(rpc_wrap.allocator, "%{s}%", .{filter});
         }
 
-        sys.db_intf.find_file.reset();
-        var iter = sys.db_intf.find_file.iterator(FileListItemRaw, .{
+        db.intf.find_file.reset();
+        var iter = db.intf.find_file.iterator(FileListItemRaw, .{
             real_filter,
             real_limit,
             skip,
@@ -625,12 +728,12 @@ const SystemInterface = struct {
         return items.toOwnedSlice();
     }
 
-    fn assertFile(sys: *SystemInterface, file: Uuid) ![36]u8 {
+    fn assertFile(db: *Database, file: Uuid) ![36]u8 {
         var canonical_format = uuidToString(file);
         const uuid_text = sqlite3.Text{ .data = &canonical_format };
 
-        sys.db_intf.file_exists.reset();
-        const maybe_result = sys.db_intf.file_exists.one(u32, .{}, .{uuid_text}) catch return error.IoError;
+        db.intf.file_exists.reset();
+        const maybe_result = db.intf.file_exists.one(u32, .{}, .{uuid_text}) catch return error.IoError;
         if (maybe_result == null) {
             return error.FileNotFound;
         }
@@ -642,52 +745,56 @@ const SystemInterface = struct {
     pub fn addTags(rpc_wrap: rpc.AllocatingCall(*SystemInterface), file: Uuid, tags: []const []const u8) rpc.AddTagError!void {
         const sys = rpc_wrap.value;
 
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.beginWrite();
+        defer sys.endWrite(db);
 
-        var canonical_format = try sys.assertFile(file);
+        var canonical_format = try assertFile(db, file);
         var uuid_text = sqlite3.Text{ .data = &canonical_format };
 
         for (tags) |tag| {
             var tag_text = sqlite3.Text{ .data = tag };
-            sys.db_intf.add_tag.reset();
-            sys.db_intf.add_tag.exec(.{}, .{ uuid_text, tag_text }) catch |err| {
+            db.intf.add_tag.reset();
+            db.intf.add_tag.exec(.{}, .{ uuid_text, tag_text }) catch |err| {
                 std.log.warn("failed to add tag: {s}", .{@errorName(err)});
                 return error.IoError;
             };
         }
+
+        db.commit() catch |err| return db.mapSqlError(err);
     }
 
     pub fn removeTags(rpc_wrap: rpc.AllocatingCall(*SystemInterface), file: Uuid, tags: []const []const u8) rpc.RemoveTagError!void {
         const sys = rpc_wrap.value;
 
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.beginWrite();
+        defer sys.endWrite(db);
 
-        var canonical_format = try sys.assertFile(file);
+        var canonical_format = try assertFile(db, file);
         var uuid_text = sqlite3.Text{ .data = &canonical_format };
 
         for (tags) |tag| {
             var tag_text = sqlite3.Text{ .data = tag };
-            sys.db_intf.remove_tag.reset();
-            sys.db_intf.remove_tag.exec(.{}, .{ uuid_text, tag_text }) catch |err| {
+            db.intf.remove_tag.reset();
+            db.intf.remove_tag.exec(.{}, .{ uuid_text, tag_text }) catch |err| {
                 std.log.warn("failed to remove tag: {s}", .{@errorName(err)});
                 return error.IoError;
             };
         }
+
+        db.commit() catch |err| return db.mapSqlError(err);
     }
 
     pub fn listFileTags(rpc_wrap: rpc.AllocatingCall(*SystemInterface), file: Uuid) rpc.ListFileTagsError![]const []const u8 {
         const sys = rpc_wrap.value;
 
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.beginRead();
+        defer sys.endRead(db);
 
-        var canonical_format = try sys.assertFile(file);
+        var canonical_format = try assertFile(db, file);
         const uuid_text = sqlite3.Text{ .data = &canonical_format };
 
-        sys.db_intf.fetch_file_tags.reset();
-        return sys.db_intf.fetch_file_tags.all(
+        db.intf.fetch_file_tags.reset();
+        return db.intf.fetch_file_tags.all(
             []const u8,
             rpc_wrap.allocator,
             .{},
@@ -701,8 +808,8 @@ const SystemInterface = struct {
     pub fn listTags(rpc_wrap: rpc.AllocatingCall(*SystemInterface), filter: ?[]const u8, limit: ?u32) rpc.ListTagsError![]rpc.TagInfo {
         const sys = rpc_wrap.value;
 
-        sys.lock();
-        defer sys.unlock();
+        const db = try sys.acquireDatabase();
+        defer sys.releaseDatabase(db);
 
         const real_limit: u32 = limit orelse std.math.maxInt(u32);
         const real_filter = sqlite3.Text{ .data = filter orelse "%" };
@@ -710,8 +817,8 @@ const SystemInterface = struct {
         var items = std.ArrayList(rpc.TagInfo).init(rpc_wrap.allocator);
         defer items.deinit();
 
-        sys.db_intf.list_tags.reset();
-        var iter = sys.db_intf.list_tags.iterator(rpc.TagInfo, .{ .filter = real_filter, .limit = real_limit }) catch |err| return switch (err) {
+        db.intf.list_tags.reset();
+        var iter = db.intf.list_tags.iterator(rpc.TagInfo, .{ .filter = real_filter, .limit = real_limit }) catch |err| return switch (err) {
             error.OutOfMemory => |e| e,
             else => error.IoError,
         };
@@ -741,102 +848,156 @@ const SystemInterface = struct {
         mime_type: []const u8,
         creation_date: []const u8,
     };
+
+    /// A source file that was copied into the dataset directory, but isn't a dataset yet.
+    /// For chunked datasets, the temporary file is the manifest and the chunks are already stored.
+    const IngestedFile = struct {
+        checksum: [64]u8,
+        temp_name: [ingest_prefix.len + 16]u8,
+        chunked: bool,
+    };
+
+    const ingest_prefix = ".ingest-";
+
+    /// Files smaller than this are stored as a whole, as they would only be a few chunks.
+    const chunking_threshold = ChunkStore.max_chunk_size;
+
+    /// Copies `source_file` into a temporary file in the dataset directory and hashes it
+    /// in the same pass, so the source file is only read once. On file systems with
+    /// reflink support the data is cloned instead and only read for hashing.
+    /// Large files are hashed on all CPUs. If chunking is enabled, large files are split into
+    /// chunks in the same pass, and only the chunks that aren't stored yet are written.
+    /// Doesn't touch the database, so it doesn't need the write lock.
+    fn ingestFile(sys: *SystemInterface, allocator: std.mem.Allocator, source_file: std.fs.File) !IngestedFile {
+        const source_size = (try source_file.stat()).size;
+
+        var ingested: IngestedFile = undefined;
+        {
+            var random: [8]u8 = undefined;
+            std.crypto.random.bytes(&random);
+            _ = std.fmt.bufPrint(&ingested.temp_name, ingest_prefix ++ "{}", .{std.fmt.fmtSliceHexLower(&random)}) catch unreachable;
+        }
+        ingested.chunked = (sys.chunk_datasets and source_size >= chunking_threshold);
+
+        var temp_file = try sys.dataset_dir.createFile(&ingested.temp_name, .{
+            .exclusive = true,
+            .mode = 0o444, // make all datasets read-only
+        });
+        defer temp_file.close();
+        errdefer sys.dataset_dir.deleteFile(&ingested.temp_name) catch |err| logger.err("failed to delete incomplete file {s}: {s}", .{ &ingested.temp_name, @errorName(err) });
+
+        var chunk_writer: ChunkStore.Writer = undefined;
+        if (ingested.chunked) {
+            chunk_writer = try ChunkStore.Writer.init(allocator, sys.chunk_store, std.Thread.getCpuCount() catch 1);
+        }
+        defer if (ingested.chunked) chunk_writer.deinit();
+
+        const copy_target = if (ingested.chunked)
+            IngestTarget{ .chunks = &chunk_writer }
+        else if (cloneFile(temp_file, source_file))
+            IngestTarget{ .none = {} }
+        else
+            IngestTarget{ .file = temp_file };
+
+        const file_hash = if (source_size < blake3.parallel_threshold)
+            try hashAndCopy(allocator, source_file, copy_target)
+        else
+            try hashAndCopyParallel(allocator, source_file, copy_target, source_size);
+
+        if (ingested.chunked) {
+            try chunk_writer.finish();
+
+            var buffered_writer = std.io.bufferedWriter(temp_file.writer());
+            try chunk_writer.writeManifest(buffered_writer.writer());
+            try buffered_writer.flush();
+
+            logger.info("stored {} of {} bytes in {} chunks", .{ chunk_writer.new_bytes, chunk_writer.size, chunk_writer.entries.items.len });
+        }
+
+        _ = std.fmt.bufPrint(&ingested.checksum, "{}", .{std.fmt.fmtSliceHexLower(&file_hash)}) catch unreachable;
+
+        return ingested;
+    }
+
+    /// Moves an ingested file to its dataset name and registers the dataset. If the dataset
+    /// already exists, the ingested file is left in place and must be deleted by the caller.
+    /// Chunked datasets are named by their manifest, see `getManifestName()`.
     fn addDataset(
         sys: *SystemInterface,
+        db: *Database,
         allocator: std.mem.Allocator,
         mime_type: []const u8,
-        source_file: std.fs.File,
-        file_hash: [32]u8,
+        ingested: *const IngestedFile,
     ) !Dataset {
-        var hash_str: [64]u8 = undefined;
-        _ = std.fmt.bufPrint(&hash_str, "{}", .{std.fmt.fmtSliceHexLower(&file_hash)}) catch unreachable;
+        const hash_str = &ingested.checksum;
 
-        const hash_text = sqlite3.Text{ .data = &hash_str };
+        const hash_text = sqlite3.Text{ .data = hash_str };
         const mime_text = sqlite3.Text{ .data = mime_type };
 
-        sys.db_intf.fetch_dataset.reset();
-        if (try sys.db_intf.fetch_dataset.oneAlloc(Dataset, allocator, .{}, .{hash_text})) |dataset_desc| {
+        db.intf.fetch_dataset.reset();
+        if (try db.intf.fetch_dataset.oneAlloc(Dataset, allocator, .{}, .{hash_text})) |dataset_desc| {
             // we already have this dataset, be happy :)
             return dataset_desc;
         }
 
-        sys.db_intf.create_dataset.reset();
-        try sys.db_intf.create_dataset.exec(.{}, .{
+        const manifest_name = getManifestName(hash_str);
+        const dataset_name: []const u8 = if (ingested.chunked) &manifest_name else hash_str;
+
+        try sys.dataset_dir.rename(&ingested.temp_name, dataset_name);
+        errdefer sys.dataset_dir.deleteFile(dataset_name) catch |err| logger.err("failed to delete incomplete file {s}: {s}", .{ dataset_name, @errorName(err) });
+
+        db.intf.create_dataset.reset();
+        try db.intf.create_dataset.exec(.{}, .{
             hash_text,
             mime_text,
         });
 
-        sys.db_intf.fetch_dataset.reset();
-        const dataset_desc = (try sys.db_intf.fetch_dataset.oneAlloc(Dataset, allocator, .{}, .{hash_text})) orelse {
+        db.intf.fetch_dataset.reset();
+        const dataset_desc = (try db.intf.fetch_dataset.oneAlloc(Dataset, allocator, .{}, .{hash_text})) orelse {
             @panic("unprotected race condition"); // race condition, someone deleted the file very tightly between insert_stmt and this.
         };
 
-        errdefer sys.dataset_dir.deleteFile(&hash_str) catch |err| logger.err("failed to delete incomplete file {s}: {s}", .{ &hash_str, @errorName(err) });
-
-        var output_file = try sys.dataset_dir.createFile(&hash_str, .{
-            .mode = 0o444, // make all datasets read-only
-        });
-        defer output_file.close();
-
-        var fifo = std.fifo.LinearFifo(u8, .{ .Static = 8192 }).init();
-
-        try fifo.pump(source_file.reader(), output_file.writer());
-
         return dataset_desc;
     }
 };
 
-fn processManagementConnection(allocator: std.mem.Allocator, socket: network.Socket, interface: *SystemInterface) !void {
-    const protocol_magic = rpc.protocol_magic;
-    const protocol_version: u8 = rpc.protocol_version;
+const ManagementServer = rpc_server.Server(*SystemInterface, ManagementSession);
 
-    const reader = socket.reader();
-    const writer = socket.writer();
+/// A client of the management interface. The server drives it one batch of calls at a time.
+const ManagementSession = struct {
+    end_point: RpcHostEndPoint,
 
-    var remote_auth: [protocol_magic.len]u8 = undefined;
-    try reader.readNoEof(&remote_auth);
-    if (!std.mem.eql(u8, &remote_auth, &protocol_magic))
-        return error.ProtocolMismatch;
+    pub fn init(session: *ManagementSession, interface: *SystemInterface, allocator: std.mem.Allocator, stream: *rpc_server.Stream) !void {
+        const protocol_magic = rpc.protocol_magic;
+        const protocol_version: u8 = rpc.protocol_version;
 
-    var remote_version = try reader.readIntLittle(u8);
-    if (remote_version != protocol_version)
-        return error.ProtocolMismatch;
+        const reader = stream.reader();
+        const writer = stream.writer();
 
-    var end_point = RpcHostEndPoint.init(allocator, reader, writer);
-    defer end_point.destroy();
+        var remote_auth: [protocol_magic.len]u8 = undefined;
+        try reader.readNoEof(&remote_auth);
+        if (!std.mem.eql(u8, &remote_auth, &protocol_magic))
+            return error.ProtocolMismatch;
 
-    try end_point.connect(interface);
+        var remote_version = try reader.readIntLittle(u8);
+        if (remote_version != protocol_version)
+            return error.ProtocolMismatch;
 
-    end_point.acceptCalls() catch |err| switch (err) {
-        error.EndOfStream => {}, // this is just a safe disconnect
-        else => |e| {
-            logger.err("client connection failed: {s}", .{@errorName(e)});
-            if (builtin.mode == .Debug) {
-                if (@errorReturnTrace()) |trace| {
-                    std.debug.dumpStackTrace(trace.*);
-                }
-            }
-            return e;
-        },
-    };
-}
+        session.end_point = RpcHostEndPoint.init(allocator, reader, writer);
+        errdefer session.end_point.destroy();
 
-fn processManagementConnectionSafe(socket: network.Socket, interface: *SystemInterface) void {
-    defer socket.close();
+        try session.end_point.connect(interface);
+    }
 
-    var thread_allocator = std.heap.GeneralPurposeAllocator(.{}){};
-    defer _ = thread_allocator.deinit();
+    pub fn deinit(session: *ManagementSession) void {
+        session.end_point.destroy();
+    }
 
-    processManagementConnection(thread_allocator.allocator(), socket, interface) catch |err| {
-        std.log.err("management thread died: {s}", .{@errorName(err)});
-        if (builtin.mode == .Debug and builtin.os.tag != .windows) {
-            // TODO: Fix windows stack trace printing on wine
-            if (@errorReturnTrace()) |trace| {
-                std.debug.dumpStackTrace(trace.*);
-            }
-        }
-    };
-}
+    /// Returns `error.WouldBlock` when the client has no more calls pending.
+    pub fn serve(session: *ManagementSession) !void {
+        try session.end_point.acceptCalls();
+    }
+};
 
 // Set the log level to warning
 pub const log_level: std.log.Level = if (builtin.mode == .Debug) std.log.Level.debug else std.log.Level.info;
@@ -994,6 +1155,148 @@ const DatabaseInterface = struct {
     fetch_latest_revision: sqlite3.StatementType(.{}, prepared_statement_sources.fetch_latest_revision) = undefined,
 };
 
+/// A connection to the database with its own prepared statements.
+/// A connection is only used by one thread at a time.
+const Database = struct {
+    /// Time a connection waits for a lock before failing with `SQLITE_BUSY`, for example
+    /// while the write-ahead log is checkpointed.
+    const busy_timeout = 5 * std.time.ms_per_s;
+
+    db: sqlite3.Db,
+    intf: DatabaseInterface,
+
+    fn open(self: *Database, path: [:0]const u8) !void {
+        self.db = try sqlite3.Db.init(.{
+            .mode = .{ .File = path },
+            .open_flags = .{
+                .write = true,
+                .create = true,
+            },
+            // connections are never shared between threads
+            .threading_mode = .MultiThread,
+        });
+        errdefer self.db.deinit();
+
+        _ = sqlite3.c.sqlite3_busy_timeout(self.db.db, busy_timeout);
+
+        // Safe in WAL mode, a crash can only lose the last transactions, but never corrupt the database
+        try self.db.exec("PRAGMA synchronous = NORMAL", .{}, .{});
+
+        var diags = sqlite3.Diagnostics{};
+        inline for (comptime std.meta.fields(DatabaseInterface)) |fld| {
+            @field(self.intf, fld.name) = self.db.prepareWithDiags(@field(prepared_statement_sources, fld.name), .{
+                .diags = &diags,
+            }) catch |err| {
+                logger.err("failed to initialize db statement: {}, {}", .{
+                    err,
+                    diags,
+                });
+                return err;
+            };
+        }
+    }
+
+    fn close(self: *Database) void {
+        inline for (comptime std.meta.fields(DatabaseInterface)) |fld| {
+            @field(self.intf, fld.name).deinit();
+        }
+        self.db.deinit();
+        self.* = undefined;
+    }
+
+    /// Resets all prepared statements. A statement that was stepped but not reset
+    /// keeps its read transaction open, which blocks checkpoints of the write-ahead log.
+    fn resetStatements(self: *Database) void {
+        inline for (comptime std.meta.fields(DatabaseInterface)) |fld| {
+            @field(self.intf, fld.name).reset();
+        }
+    }
+
+    fn commit(self: *Database) !void {
+        try self.db.exec("COMMIT", .{}, .{});
+    }
+
+    /// Rolls back the open transaction, if any.
+    fn rollback(self: *Database) void {
+        if (sqlite3.c.sqlite3_get_autocommit(self.db.db) != 0)
+            return;
+        self.db.exec("ROLLBACK", .{}, .{}) catch |err| {
+            logger.err("failed to roll back transaction: {s}", .{@errorName(err)});
+        };
+    }
+
+    fn mapSqlError(self: *Database, err: (sqlite3.Error || error{ OutOfMemory, Workaround })) error{ IoError, OutOfMemory } {
+        return switch (err) {
+            error.OutOfMemory => error.OutOfMemory,
+            else => {
+                logger.warn("mappig sql error {s} to IoError:", .{@errorName(err)});
+                logger.warn("{}", .{self.db.getDetailedError()});
+                return error.IoError;
+            },
+        };
+    }
+};
+
+/// Keeps idle database connections around, so each request can use its own connection
+/// without opening the database and preparing all statements again. The pool grows
+/// with the number of concurrent requests.
+const DatabasePool = struct {
+    allocator: std.mem.Allocator,
+    path: [:0]const u8,
+
+    mutex: std.Thread.Mutex = .{},
+    idle: std.ArrayListUnmanaged(*Database) = .{},
+
+    fn init(allocator: std.mem.Allocator, path: [:0]const u8) DatabasePool {
+        return DatabasePool{
+            .allocator = allocator,
+            .path = path,
+        };
+    }
+
+    /// Closes all idle connections. Connections in use must be released before.
+    fn deinit(self: *DatabasePool) void {
+        for (self.idle.items) |db| {
+            db.close();
+            self.allocator.destroy(db);
+        }
+        self.idle.deinit(self.allocator);
+        self.* = undefined;
+    }
+
+    fn acquire(self: *DatabasePool) !*Database {
+        {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+
+            if (self.idle.popOrNull()) |db|
+                return db;
+        }
+
+        const db = try self.allocator.create(Database);
+        errdefer self.allocator.destroy(db);
+
+        try db.open(self.path);
+
+        return db;
+    }
+
+    /// Returns `db` to the pool. An idle connection must not hold a read transaction,
+    /// so all statements are reset and an open transaction is rolled back.
+    fn release(self: *DatabasePool, db: *Database) void {
+        db.resetStatements();
+        db.rollback();
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        self.idle.append(self.allocator, db) catch {
+            db.close();
+            self.allocator.destroy(db);
+        };
+    }
+};
+
 const MimeType = struct {
     group: []const u8,
     subtype: ?[]const u8,
@@ -1040,17 +1343,95 @@ fn determineFileTitle(allocator: std.mem.Allocator, file_path: []const u8, file:
     return basename[0 .. basename.len - ext.len];
 }
 
-fn computeFileHash(file: std.fs.File) ![32]u8 {
+const manifest_suffix = ".chunks";
+
+/// Returns the file name of the manifest of a chunked dataset.
+fn getManifestName(checksum: *const [64]u8) [64 + manifest_suffix.len]u8 {
+    var name: [64 + manifest_suffix.len]u8 = undefined;
+    std.mem.copy(u8, name[0..64], checksum);
+    std.mem.copy(u8, name[64..], manifest_suffix);
+    return name;
+}
+
+/// Deletes the temporary files of ingests that were interrupted by a crash.
+fn removeIncompleteIngests(dataset_dir: std.fs.Dir) !void {
+    var iter = dataset_dir.iterate();
+    while (try iter.next()) |entry| {
+        if (entry.kind == .File and std.mem.startsWith(u8, entry.name, SystemInterface.ingest_prefix)) {
+            logger.info("deleting incomplete file {s}", .{entry.name});
+            try dataset_dir.deleteFile(entry.name);
+        }
+    }
+}
+
+const ingest_buffer_size = 1 << 20; // 1 MiB
+
+/// The window of a large file that is read and hashed at once. Large enough
+/// to keep all CPUs busy with `blake3.segment_size` segments.
+const parallel_window_size = 64 << 20; // 64 MiB
+
+/// Where the data of an ingested file goes.
+const IngestTarget = union(enum) {
+    /// The data is already in place (cloned), only hash it.
+    none,
+    file: std.fs.File,
+    chunks: *ChunkStore.Writer,
+
+    fn writeAll(target: IngestTarget, data: []const u8) !void {
+        switch (target) {
+            .none => {},
+            .file => |file| try file.writeAll(data),
+            .chunks => |writer| try writer.write(data),
+        }
+    }
+};
+
+/// Streams `source` into `dest` and hashes it in the same pass.
+fn hashAndCopy(allocator: std.mem.Allocator, source: std.fs.File, dest: IngestTarget) ![32]u8 {
+    const buffer = try allocator.alloc(u8, ingest_buffer_size);
+    defer allocator.free(buffer);
+
     var blake_hash = std.crypto.hash.Blake3.init(.{ .key = null });
     while (true) {
-        var buffer: [8192]u8 = undefined;
-        const len = file.read(&buffer) catch return error.IoError;
+        const len = try source.read(buffer);
         if (len == 0)
             break;
         blake_hash.update(buffer[0..len]);
+        try dest.writeAll(buffer[0..len]);
     }
 
     var final: [32]u8 = undefined;
     blake_hash.final(&final);
     return final;
 }
+
+/// Same as `hashAndCopy`, but reads the file in large windows and hashes
+/// each window on all CPUs. `size` is used to size the buffer.
+fn hashAndCopyParallel(allocator: std.mem.Allocator, source: std.fs.File, dest: IngestTarget, size: u64) ![32]u8 {
+    const window_size = std.math.min(parallel_window_size, std.mem.alignForward(std.math.cast(usize, size) orelse parallel_window_size, blake3.segment_size));
+
+    const buffer = try allocator.alloc(u8, window_size);
+    defer allocator.free(buffer);
+
+    var hasher = blake3.ParallelHasher.init(allocator, std.Thread.getCpuCount() catch 1);
+    defer hasher.deinit();
+
+    while (true) {
+        const len = try source.readAll(buffer);
+        try dest.writeAll(buffer[0..len]);
+        if (len < buffer.len)
+            return try hasher.final(buffer[0..len]);
+        try hasher.update(buffer);
+    }
+}
+
+/// Shares the data of `source` with `dest` on copy-on-write file systems (reflink).
+/// Returns `false` if the file system or platform doesn't support it.
+fn cloneFile(dest: std.fs.File, source: std.fs.File) bool {
+    if (builtin.os.tag != .linux)
+        return false;
+
+    const FICLONE = 0x40049409;
+    const rc = std.os.linux.ioctl(dest.handle, FICLONE, @intCast(usize, source.handle));
+    return (std.os.linux.getErrno(rc) == .SUCCESS);
+}
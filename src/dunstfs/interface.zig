@@ -103,12 +103,6 @@ pub fn main() !u8 {
     if (cli.options.verbose)
         current_log_level = .info;
 
-    var rpc = RpcClient.connect(gpa.allocator(), cli.options.host) catch |err| {
-        logger.err("could not connect to rpc daemon: {s}", .{@errorName(err)});
-        return 1;
-    };
-    defer rpc.deinit();
-
     var http_server = try serve.HttpListener.init(global_allocator);
     defer http_server.deinit();
 
@@ -125,6 +119,13 @@ pub fn main() !u8 {
         var context = try http_server.getContext();
         defer context.deinit();
 
+        // The daemon closes connections that stay silent, so each request uses its own
+        var rpc = RpcClient.connect(gpa.allocator(), cli.options.host) catch |err| {
+            logger.err("could not connect to rpc daemon: {s}", .{@errorName(err)});
+            continue;
+        };
+        defer rpc.deinit();
+
         handleRequest(context, &rpc, img_dir, temp_memory.allocator()) catch |err| {
             logger.err("failed to handle request to {s}: {s}", .{
                 context.request.url,
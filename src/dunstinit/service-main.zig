@@ -3,6 +3,7 @@ const args_parser = @import("args");
 const network = @import("network");
 const builtin = @import("builtin");
 const dunst_environment = @import("dunst-environment");
+const rpc_server = @import("dunst-rpc-server");
 
 const rpc = @import("rpc.zig");
 
@@ -16,7 +17,7 @@ fn printUsage(stream: anytype, exe_name: []const u8) !void {
     );
 }
 
-const RpcHostEndPoint = rpc.Definition.HostEndPoint(network.Socket.Reader, network.Socket.Writer, HostControl);
+const RpcHostEndPoint = rpc.Definition.HostEndPoint(rpc_server.Stream.Reader, rpc_server.Stream.Writer, HostControl);
 
 var command_queue: ControlQueue = undefined;
 
@@ -60,7 +61,7 @@ pub fn main() !u8 {
 
     try listener.listen();
 
-    var control_thread = try std.Thread.spawn(.{}, acceptConnectionsThread, .{listener});
+    var control_thread = try std.Thread.spawn(.{}, acceptConnectionsThread, .{ gpa.allocator(), listener });
     control_thread.detach();
 
     const json_parse_options = std.json.ParseOptions{
@@ -480,57 +481,55 @@ const HostControl = struct {
     }
 };
 
-fn processManagementConnection(allocator: std.mem.Allocator, socket: network.Socket) !void {
-    const protocol_magic = rpc.protocol_magic;
-    const protocol_version: u8 = rpc.protocol_version;
+/// A client of the management interface. The server drives it one batch of calls at a time.
+const ManagementSession = struct {
+    ctrl: HostControl,
+    end_point: RpcHostEndPoint,
 
-    const reader = socket.reader();
-    const writer = socket.writer();
+    pub fn init(session: *ManagementSession, context: void, allocator: std.mem.Allocator, stream: *rpc_server.Stream) !void {
+        _ = context;
 
-    var remote_auth: [protocol_magic.len]u8 = undefined;
-    try reader.readNoEof(&remote_auth);
-    if (!std.mem.eql(u8, &remote_auth, &protocol_magic))
-        return error.ProtocolMismatch;
+        const protocol_magic = rpc.protocol_magic;
+        const protocol_version: u8 = rpc.protocol_version;
 
-    var remote_version = try reader.readIntLittle(u8);
-    if (remote_version != protocol_version)
-        return error.ProtocolMismatch;
+        const reader = stream.reader();
+        const writer = stream.writer();
 
-    var end_point = RpcHostEndPoint.init(allocator, reader, writer);
-    defer end_point.destroy();
+        var remote_auth: [protocol_magic.len]u8 = undefined;
+        try reader.readNoEof(&remote_auth);
+        if (!std.mem.eql(u8, &remote_auth, &protocol_magic))
+            return error.ProtocolMismatch;
 
-    var ctrl = HostControl{};
+        var remote_version = try reader.readIntLittle(u8);
+        if (remote_version != protocol_version)
+            return error.ProtocolMismatch;
 
-    try end_point.connect(&ctrl);
+        session.ctrl = HostControl{};
+        session.end_point = RpcHostEndPoint.init(allocator, reader, writer);
+        errdefer session.end_point.destroy();
 
-    try end_point.acceptCalls();
-}
+        // the end point keeps a pointer to `ctrl`, which is why sessions are initialized in place
+        try session.end_point.connect(&session.ctrl);
+    }
 
-fn processManagementConnectionSafe(socket: network.Socket) void {
-    defer socket.close();
+    pub fn deinit(session: *ManagementSession) void {
+        session.end_point.destroy();
+    }
 
-    var thread_allocator = std.heap.GeneralPurposeAllocator(.{}){};
-    defer _ = thread_allocator.deinit();
+    /// Returns `error.WouldBlock` when the client has no more calls pending.
+    pub fn serve(session: *ManagementSession) !void {
+        try session.end_point.acceptCalls();
+    }
+};
 
-    processManagementConnection(thread_allocator.allocator(), socket) catch |err| {
-        std.log.err("management thread died: {s}", .{@errorName(err)});
-        if (builtin.mode == .Debug and builtin.os.tag != .windows) {
-            // TODO: Fix windows stack trace printing on wine
-            if (@errorReturnTrace()) |trace| {
-                std.debug.dumpStackTrace(trace.*);
-            }
-        }
-    };
-}
+const ManagementServer = rpc_server.Server(void, ManagementSession);
 
-fn acceptConnectionsThread(listener: network.Socket) !void {
-    while (true) {
-        var client_socket = try listener.accept();
-        errdefer client_socket.close();
+fn acceptConnectionsThread(allocator: std.mem.Allocator, listener: network.Socket) !void {
+    // control commands are executed one after another by the main loop anyways
+    var server = try ManagementServer.init(allocator, {}, .{ .worker_count = 4, .max_connections = 64 });
+    defer server.deinit();
 
-        var management_thread = try std.Thread.spawn(.{}, processManagementConnectionSafe, .{client_socket});
-        management_thread.detach();
-    }
+    try server.run(listener);
 }
 
 extern "kernel32" fn GetProcessId(process: std.os.windows.HANDLE) std.os.windows.DWORD;
@@ -86,6 +86,15 @@ enum dunstblick_DisconnectReason {
   DUNSTBLICK_DISCONNECT_PROTOCOL_MISMATCH = 5,
 };
 
+/// @brief Timing functions for property animations.
+/// @see dunstblick_AnimateProperty
+enum dunstblick_Easing {
+  DUNSTBLICK_EASING_LINEAR = 0,
+  DUNSTBLICK_EASING_EASE_IN = 1,     ///< Starts slow and accelerates.
+  DUNSTBLICK_EASING_EASE_OUT = 2,    ///< Starts fast and decelerates.
+  DUNSTBLICK_EASING_EASE_IN_OUT = 3, ///< Accelerates in the first half and decelerates in the second one.
+};
+
 /// @brief A unique resource identifier.
 typedef uint32_t dunstblick_ResourceID;
 
@@ -338,6 +347,32 @@ enum dunstblick_Error dunstblick_SetProperty(
     struct dunstblick_Value const *value ///< new value of the property. must fit the previously uploaded type!
 );                                       // "unsafe command", uses the serverside object type or fails of property does not exist
 
+/// Changes a property of an object to a value that is already encoded in the wire format.
+/// This is used by the bindings generated with `dunstblick-compiler --bindgen`, which
+/// encode the values of their typed properties directly.
+enum dunstblick_Error dunstblick_SetEncodedProperty(
+    struct dunstblick_Connection *, ///< The connection where the action should be applied.
+    dunstblick_ObjectID,            ///< id of the object
+    dunstblick_PropertyName,        ///< name of the property
+    uint8_t type,                   ///< the @ref dunstblick_Type of the encoded value
+    void const *data,               ///< the encoded value, without the type tag
+    size_t length                   ///< length of `data` in bytes
+);
+
+/// Animates a property of an object from its current value to a new value.
+/// The display client interpolates the value every frame, which replaces sending
+/// @ref dunstblick_SetProperty many times per second. Only integer, number, color,
+/// size and point properties are animated, other types are changed immediately.
+enum dunstblick_Error dunstblick_AnimateProperty(
+    struct dunstblick_Connection *,       ///< The connection where the action should be applied.
+    dunstblick_ObjectID,                  ///< id of the object
+    dunstblick_PropertyName,              ///< name of the property
+    struct dunstblick_Value const *value, ///< target value of the property. must fit the previously uploaded type!
+    uint32_t duration,                    ///< duration of the animation in milliseconds
+    enum dunstblick_Easing easing,        ///< timing function of the animation
+    bool notify                           ///< when set, a property changed event is sent after the animation has finished
+);
+
 /// Clears a list property of an object.
 /// This action will remove all object references from an objectlist property.
 enum dunstblick_Error dunstblick_Clear(struct dunstblick_Connection *, ///< The connection where the action should be applied.
@@ -383,6 +418,15 @@ enum dunstblick_Error dunstblick_SetObjectProperty(struct dunstblick_Object *,
                                                    struct dunstblick_Value const *value ///< the value of the property
 );
 
+/// Sets a property on the given object to a value that is already encoded in the wire format.
+/// @see dunstblick_SetEncodedProperty
+enum dunstblick_Error dunstblick_SetEncodedObjectProperty(struct dunstblick_Object *, ///< object of which a property should be set.
+                                                          dunstblick_PropertyName,    ///< name of the property
+                                                          uint8_t type,               ///< the @ref dunstblick_Type of the encoded value
+                                                          void const *data,           ///< the encoded value, without the type tag
+                                                          size_t length               ///< length of `data` in bytes
+);
+
 /// The object will either be added to the list of objects
 /// or, if an object with the same ID already exists, will replace that object.
 /// The new object will only have the properties set in this transaction,
@@ -417,6 +461,7 @@ typedef enum dunstblick_Error dunstblick_Error;
 typedef enum dunstblick_ClientCapabilities dunstblick_ClientCapabilities;
 typedef enum dunstblick_Type dunstblick_Type;
 typedef enum dunstblick_ResourceKind dunstblick_ResourceKind;
+typedef enum dunstblick_Easing dunstblick_Easing;
 
 #endif // DUNSTBLICK_NO_GLOBAL_NAMESPACE
 
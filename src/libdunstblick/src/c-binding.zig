@@ -278,6 +278,15 @@ export fn dunstblick_SetProperty(con: *app.Connection, oid: protocol.ObjectID, n
     return mapDunstblickErrorVoid(con.setProperty(oid, name, convertValueToZig(value.*)));
 }
 
+export fn dunstblick_SetEncodedProperty(con: *app.Connection, oid: protocol.ObjectID, name: protocol.PropertyName, value_type: u8, data: [*]const u8, length: usize) callconv(.C) NativeErrorCode {
+    const value_type_enum = std.meta.intToEnum(protocol.Type, value_type) catch return .invalid_type;
+    return mapDunstblickErrorVoid(con.setEncodedProperty(oid, name, value_type_enum, data[0..length]));
+}
+
+export fn dunstblick_AnimateProperty(con: *app.Connection, oid: protocol.ObjectID, name: protocol.PropertyName, value: *const c.dunstblick_Value, duration: u32, easing: protocol.Easing, notify: bool) callconv(.C) NativeErrorCode {
+    return mapDunstblickErrorVoid(con.animateProperty(oid, name, convertValueToZig(value.*), duration, easing, notify));
+}
+
 export fn dunstblick_Clear(con: *app.Connection, oid: protocol.ObjectID, name: protocol.PropertyName) callconv(.C) NativeErrorCode {
     return mapDunstblickErrorVoid(con.clear(oid, name));
 }
@@ -302,6 +311,11 @@ export fn dunstblick_SetObjectProperty(obj: *app.Object, name: protocol.Property
     return mapDunstblickErrorVoid(obj.setProperty(name, convertValueToZig(value.*)));
 }
 
+export fn dunstblick_SetEncodedObjectProperty(obj: *app.Object, name: protocol.PropertyName, value_type: u8, data: [*]const u8, length: usize) callconv(.C) NativeErrorCode {
+    const value_type_enum = std.meta.intToEnum(protocol.Type, value_type) catch return .invalid_type;
+    return mapDunstblickErrorVoid(obj.setEncodedProperty(name, value_type_enum, data[0..length]));
+}
+
 export fn dunstblick_CommitObject(obj: *app.Object) callconv(.C) NativeErrorCode {
     return mapDunstblickErrorVoid(obj.commit());
 }
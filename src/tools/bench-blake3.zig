@@ -0,0 +1,115 @@
+//! Compares the streaming BLAKE3 hash that dfs-daemon uses for small files with
+//! the multi-threaded tree hash it uses for large files.
+//!
+//! Usage: bench-blake3 [threads]
+//! Without arguments, all CPUs are used for the parallel hash.
+
+const std = @import("std");
+const blake3 = @import("dunstfs-blake3");
+
+const iterations = 5;
+
+/// Same buffer size as the streaming path of the daemon.
+const stream_buffer_size = 1 << 20;
+
+const sizes = [_]usize{
+    64 << 10,
+    1 << 20,
+    16 << 20,
+    256 << 20,
+    1 << 30,
+};
+
+pub fn main() !u8 {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+
+    const allocator = gpa.allocator();
+
+    var arg_iter = try std.process.argsWithAllocator(allocator);
+    defer arg_iter.deinit();
+
+    _ = arg_iter.skip(); // executable name
+
+    const thread_count = if (arg_iter.next()) |arg|
+        try std.fmt.parseInt(usize, arg, 10)
+    else
+        std.Thread.getCpuCount() catch 1;
+
+    const data = try allocator.alloc(u8, sizes[sizes.len - 1]);
+    defer allocator.free(data);
+
+    var rng = std.rand.DefaultPrng.init(0xB1_A4_E3);
+    rng.random().bytes(data);
+
+    var stdout = std.io.getStdOut().writer();
+
+    try stdout.print("hashing with {} threads\n", .{thread_count});
+    try stdout.print("{s: >10} {s: >14} {s: >14} {s: >8}\n", .{
+        "size",
+        "streaming",
+        "parallel",
+        "speedup",
+    });
+
+    for (sizes) |size| {
+        const input = data[0..size];
+
+        var expected: [32]u8 = undefined;
+        std.crypto.hash.Blake3.hash(input, &expected, .{});
+        if (!std.mem.eql(u8, &expected, &(try blake3.hash(allocator, input, thread_count)))) {
+            try stdout.print("{d: >7} MiB hash mismatch!\n", .{size >> 20});
+            return 1;
+        }
+
+        const streaming = try measure(allocator, input, thread_count, hashStreaming);
+        const parallel = try measure(allocator, input, thread_count, hashParallel);
+
+        try stdout.print("{d: >7} KiB {d: >9.1} MB/s {d: >9.1} MB/s {d: >7.2}x\n", .{
+            size >> 10,
+            toThroughput(size, streaming),
+            toThroughput(size, parallel),
+            @intToFloat(f64, streaming) / @intToFloat(f64, parallel),
+        });
+    }
+
+    return 0;
+}
+
+fn toThroughput(size: usize, ns: u64) f64 {
+    return (@intToFloat(f64, size) / 1_000_000.0) / (@intToFloat(f64, ns) / std.time.ns_per_s);
+}
+
+const HashFn = fn (std.mem.Allocator, []const u8, usize) anyerror!void;
+
+/// Returns the best time of all iterations in nanoseconds.
+fn measure(allocator: std.mem.Allocator, data: []const u8, thread_count: usize, hashFn: HashFn) !u64 {
+    var best: u64 = std.math.maxInt(u64);
+    var i: usize = 0;
+    while (i < iterations) : (i += 1) {
+        var timer = try std.time.Timer.start();
+        try hashFn(allocator, data, thread_count);
+        best = std.math.min(best, timer.read());
+    }
+    return best;
+}
+
+fn hashStreaming(allocator: std.mem.Allocator, data: []const u8, thread_count: usize) anyerror!void {
+    _ = allocator;
+    _ = thread_count;
+
+    var hasher = std.crypto.hash.Blake3.init(.{});
+    var offset: usize = 0;
+    while (offset < data.len) : (offset += stream_buffer_size) {
+        hasher.update(data[offset..std.math.min(offset + stream_buffer_size, data.len)]);
+    }
+
+    var out: [32]u8 = undefined;
+    hasher.final(&out);
+    std.mem.doNotOptimizeAway(&out);
+}
+
+fn hashParallel(allocator: std.mem.Allocator, data: []const u8, thread_count: usize) anyerror!void {
+    const out = try blake3.hash(allocator, data, thread_count);
+    std.mem.doNotOptimizeAway(&out);
+}
@@ -0,0 +1,178 @@
+//! Compares the bitmap decoder of the display client against the vendored QOI decoder.
+//!
+//! Usage: bench-qoi [file.qoi…]
+//! Without arguments, a set of synthetic images in typical display resolutions is benchmarked.
+//! Files are re-encoded with restart points, so the parallel path can be measured as well.
+
+const std = @import("std");
+const protocol = @import("dunstblick-protocol");
+const qoi = @import("qoi");
+
+const bitmap = protocol.bitmap;
+
+const iterations = 10;
+
+const Sample = struct {
+    name: []const u8,
+    width: u32,
+    height: u32,
+    pixels: []bitmap.Color,
+};
+
+const Pattern = enum {
+    /// Large flat areas with soft gradients, like most UI backgrounds.
+    background,
+    /// Noisy, photo-like content with few runs.
+    photo,
+};
+
+pub fn main() !u8 {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+
+    const allocator = gpa.allocator();
+
+    var samples = std.ArrayList(Sample).init(allocator);
+    defer {
+        for (samples.items) |sample| {
+            allocator.free(sample.pixels);
+        }
+        samples.deinit();
+    }
+
+    var arg_iter = try std.process.argsWithAllocator(allocator);
+    defer arg_iter.deinit();
+
+    _ = arg_iter.skip(); // executable name
+
+    var has_files = false;
+    while (arg_iter.next()) |path| {
+        has_files = true;
+
+        const data = try std.fs.cwd().readFileAlloc(allocator, path, 1 << 30);
+        defer allocator.free(data);
+
+        var image = try bitmap.decode(allocator, data, .{});
+        errdefer image.deinit(allocator);
+
+        try samples.append(Sample{
+            .name = std.fs.path.basename(path),
+            .width = image.width,
+            .height = image.height,
+            .pixels = image.pixels,
+        });
+    }
+
+    if (!has_files) {
+        try samples.append(try generate(allocator, "background-1080p", 1920, 1080, .background));
+        try samples.append(try generate(allocator, "background-4k", 3840, 2160, .background));
+        try samples.append(try generate(allocator, "photo-1080p", 1920, 1080, .photo));
+        try samples.append(try generate(allocator, "photo-4k", 3840, 2160, .photo));
+    }
+
+    var stdout = std.io.getStdOut().writer();
+
+    try stdout.print("{s: <20} {s: >10} {s: >12} {s: >12} {s: >12} {s: >8}\n", .{
+        "image",
+        "size",
+        "vendored",
+        "sequential",
+        "parallel",
+        "speedup",
+    });
+
+    for (samples.items) |sample| {
+        const encoded = try bitmap.encode(allocator, bitmap.ConstImage{
+            .width = sample.width,
+            .height = sample.height,
+            .pixels = sample.pixels,
+        }, .{});
+        defer allocator.free(encoded);
+
+        const vendored = try measure(allocator, encoded, decodeVendored);
+        const sequential = try measure(allocator, encoded, decodeSequential);
+        const parallel = try measure(allocator, encoded, decodeParallel);
+
+        try stdout.print("{s: <20} {d: >4}x{d: <5} {d: >9.2} ms {d: >9.2} ms {d: >9.2} ms {d: >7.2}x\n", .{
+            sample.name,
+            sample.width,
+            sample.height,
+            toMilliseconds(vendored),
+            toMilliseconds(sequential),
+            toMilliseconds(parallel),
+            @intToFloat(f64, vendored) / @intToFloat(f64, parallel),
+        });
+    }
+
+    return 0;
+}
+
+fn toMilliseconds(ns: u64) f64 {
+    return @intToFloat(f64, ns) / std.time.ns_per_ms;
+}
+
+const DecodeFn = fn (std.mem.Allocator, []const u8) anyerror!void;
+
+/// Returns the best time of all iterations in nanoseconds.
+fn measure(allocator: std.mem.Allocator, data: []const u8, decodeFn: DecodeFn) !u64 {
+    var best: u64 = std.math.maxInt(u64);
+    var i: usize = 0;
+    while (i < iterations) : (i += 1) {
+        var timer = try std.time.Timer.start();
+        try decodeFn(allocator, data);
+        best = std.math.min(best, timer.read());
+    }
+    return best;
+}
+
+fn decodeVendored(allocator: std.mem.Allocator, data: []const u8) anyerror!void {
+    var image = try qoi.decodeBuffer(allocator, data);
+    image.deinit(allocator);
+}
+
+fn decodeSequential(allocator: std.mem.Allocator, data: []const u8) anyerror!void {
+    var image = try bitmap.decodeSequential(allocator, data);
+    image.deinit(allocator);
+}
+
+fn decodeParallel(allocator: std.mem.Allocator, data: []const u8) anyerror!void {
+    var image = try bitmap.decode(allocator, data, .{});
+    image.deinit(allocator);
+}
+
+fn generate(allocator: std.mem.Allocator, name: []const u8, width: u32, height: u32, pattern: Pattern) !Sample {
+    const pixels = try allocator.alloc(bitmap.Color, @as(usize, width) * height);
+    errdefer allocator.free(pixels);
+
+    var rng = std.rand.DefaultPrng.init(0xD0_57_B1_1C);
+    const random = rng.random();
+
+    for (pixels) |*pixel, i| {
+        const x = @intCast(u32, i % width);
+        const y = @intCast(u32, i / width);
+        pixel.* = switch (pattern) {
+            .background => if ((x / 256 + y / 256) % 3 == 0)
+                bitmap.Color{ .r = 0x20, .g = 0x24, .b = 0x30, .a = 0xFF }
+            else
+                bitmap.Color{
+                    .r = @truncate(u8, x * 255 / width),
+                    .g = @truncate(u8, y * 255 / height),
+                    .b = 0x80,
+                    .a = 0xFF,
+                },
+            .photo => bitmap.Color{
+                .r = @truncate(u8, x * 255 / width) +% random.intRangeAtMost(u8, 0, 6),
+                .g = @truncate(u8, y * 255 / height) +% random.intRangeAtMost(u8, 0, 6),
+                .b = @truncate(u8, (x + y) * 255 / (width + height)) +% random.intRangeAtMost(u8, 0, 40),
+                .a = 0xFF,
+            },
+        };
+    }
+
+    return Sample{
+        .name = name,
+        .width = width,
+        .height = height,
+        .pixels = pixels,
+    };
+}